@@ -0,0 +1,249 @@
+/*
+  Copyright 2013-2025 Michael William Simmons
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#ifndef ADAMSCOEFFICIENTS_HPP
+#define ADAMSCOEFFICIENTS_HPP
+
+#include <utility>
+
+/**
+ * @brief Adams-Bashforth and Adams-Moulton coefficients, computed by the compiler with exact rational arithmetic
+ *
+ * The coefficient of node j of an order k method is the integral over the step of the Lagrange basis polynomial through
+ * the nodes newestNode, newestNode - 1 ... newestNode - k + 1, in units of the step. newestNode 0 gives the Adams-Bashforth
+ * predictor and newestNode 1 the Adams-Moulton corrector. The basis polynomial numerator has integer coefficients and the
+ * integral of u^n is 1/(n + 1), so over the common denominator lcm(1..k) * (k - 1)! everything is an integer.
+ * At order 20 the numerators stay below 1e34, which 128 bit integers hold, and each coefficient is rounded to double once.
+ *
+ * These replace the tables that used to be generated by the AdamsBashforthMoultonConstants tool and pasted into the kernels.
+ */
+namespace AdamsCoefficients
+{
+  const int minOrder = 2;  /**< Lowest order in the tables */
+  const int maxOrder = 20; /**< Highest order in the tables */
+
+  typedef __int128 Integer;
+
+  /**
+   * @brief An exact fraction, kept in lowest terms with a positive denominator
+   */
+  struct Rational
+  {
+    Integer numerator;
+    Integer denominator;
+  };
+
+  constexpr Integer Abs(Integer value)
+  {
+    return value < 0 ? -value : value;
+  }
+
+  constexpr Integer Gcd(Integer a, Integer b)
+  {
+    a = Abs(a);
+    b = Abs(b);
+    while (b != 0)
+    {
+      Integer remainder = a % b;
+      a = b;
+      b = remainder;
+    }
+    return a;
+  }
+
+  constexpr Integer Lcm(int n)
+  {
+    Integer lcm = 1;
+    for (int i = 1; i <= n; i++)
+    {
+      lcm = lcm / Gcd(lcm, i) * i;
+    }
+    return lcm;
+  }
+
+  constexpr Rational Reduce(Integer numerator, Integer denominator)
+  {
+    Integer divisor = Gcd(numerator, denominator);
+    divisor = denominator < 0 ? -divisor : divisor;
+    return Rational{numerator / divisor, denominator / divisor};
+  }
+
+  /**
+   * @brief Weights of every node of one Adams method, over a denominator shared by every node
+   */
+  struct Weights
+  {
+    Integer numerator[maxOrder]; /**< [node] with node 0 the newest */
+    Integer denominator;         /**< lcm(1..order) * (order - 1)! */
+  };
+
+  /**
+   * @brief Weights of an Adams method
+   * The product over every node is expanded once and each node's basis polynomial numerator divided out of it,
+   * so the whole method costs order^2 operations and stays well inside the compiler's constant evaluation limits
+   * @param order Number of nodes
+   * @param newestNode 0 for Adams-Bashforth, 1 for Adams-Moulton
+   */
+  constexpr Weights MethodWeights(int order, int newestNode)
+  {
+    Weights weights = {};
+    const Integer lcm = Lcm(order);
+
+    // lcm / (i + 1) integrates u^i over the step, and factorials[n] is n!
+    Integer integrals[maxOrder] = {};
+    Integer factorials[maxOrder] = {};
+    integrals[0] = lcm;
+    factorials[0] = 1;
+    for (int i = 1; i < order; i++)
+    {
+      integrals[i] = lcm / (i + 1);
+      factorials[i] = factorials[i - 1] * i;
+    }
+    const Integer factorial = factorials[order - 1];
+    weights.denominator = lcm * factorial;
+
+    // Expand the product of (u - (newestNode - m)) over every node into powers of u
+    Integer product[maxOrder + 1] = {};
+    product[0] = 1;
+    for (int m = 0; m < order; m++)
+    {
+      Integer offset = m - newestNode;
+      for (int i = m + 1; i > 0; i--)
+      {
+        product[i] = product[i - 1] + offset * product[i];
+      }
+      product[0] = offset * product[0];
+    }
+
+    for (int node = 0; node < order; node++)
+    {
+      // Divide out (u - (newestNode - node)), leaving the product over the other nodes
+      Integer root = newestNode - node;
+      Integer polynomial[maxOrder] = {};
+      polynomial[order - 1] = product[order];
+      for (int i = order - 1; i > 0; i--)
+      {
+        polynomial[i - 1] = product[i] + root * polynomial[i];
+      }
+
+      // Integrate from 0 to 1, the integral of u^i being 1/(i + 1)
+      Integer numerator = 0;
+      for (int i = 0; i < order; i++)
+      {
+        numerator += polynomial[i] * integrals[i];
+      }
+
+      // The product of (m - node) over the other nodes is +-node! * (order - 1 - node)!, which divides (order - 1)!
+      Integer denominator = factorials[node] * factorials[order - 1 - node];
+      denominator = (node % 2) ? -denominator : denominator;
+      weights.numerator[node] = numerator * (factorial / denominator);
+    }
+    return weights;
+  }
+
+  /**
+   * @brief Weight of one node of an Adams method
+   * @param order Number of nodes
+   * @param newestNode 0 for Adams-Bashforth, 1 for Adams-Moulton
+   * @param node Node index, 0 is the newest
+   */
+  constexpr Rational Weight(int order, int newestNode, int node)
+  {
+    Weights weights = MethodWeights(order, newestNode);
+    return Reduce(weights.numerator[node], weights.denominator);
+  }
+
+  constexpr double ToDouble(Rational value)
+  {
+    return (double)((long double)value.numerator / (long double)value.denominator);
+  }
+
+  /**
+   * @brief Coefficients of one order, indexed [node] with node 0 the newest
+   */
+  struct Row
+  {
+    double bashforth[maxOrder];
+    double moulton[maxOrder];
+  };
+
+  constexpr Row MakeRow(int order)
+  {
+    Row row = {};
+    if (order < minOrder)
+    {
+      return row;
+    }
+
+    Weights bashforth = MethodWeights(order, 0);
+    Weights moulton = MethodWeights(order, 1);
+    for (int node = 0; node < order; node++)
+    {
+      row.bashforth[node] = ToDouble(Reduce(bashforth.numerator[node], bashforth.denominator));
+      row.moulton[node] = ToDouble(Reduce(moulton.numerator[node], moulton.denominator));
+    }
+    return row;
+  }
+
+  // Each order is its own constant expression, so no single evaluation comes near the compiler's limits
+  template <int order>
+  constexpr Row row = MakeRow(order);
+
+  /**
+   * @brief Coefficients of every order, indexed [order][node] with node 0 the newest
+   */
+  struct Table
+  {
+    double bashforth[maxOrder + 1][maxOrder];
+    double moulton[maxOrder + 1][maxOrder];
+  };
+
+  constexpr void CopyRow(Table &table, int order, const Row &source)
+  {
+    for (int node = 0; node < maxOrder; node++)
+    {
+      table.bashforth[order][node] = source.bashforth[node];
+      table.moulton[order][node] = source.moulton[node];
+    }
+  }
+
+  template <int... orders>
+  constexpr Table MakeTable(std::integer_sequence<int, orders...>)
+  {
+    Table table = {};
+    (CopyRow(table, orders, row<orders>), ...);
+    return table;
+  }
+
+  // The weights of a consistent method sum to exactly one
+  constexpr bool WeightsSumToOne(int order, int newestNode)
+  {
+    Weights weights = MethodWeights(order, newestNode);
+    Integer sum = 0;
+    for (int node = 0; node < order; node++)
+    {
+      sum += weights.numerator[node];
+    }
+    return sum == weights.denominator;
+  }
+
+  constexpr Table table = MakeTable(std::make_integer_sequence<int, maxOrder + 1>{});
+
+  static_assert(Weight(2, 0, 0).numerator == 3 && Weight(2, 0, 0).denominator == 2, "Adams-Bashforth 2 is 3/2, -1/2");
+  static_assert(Weight(4, 1, 0).numerator == 3 && Weight(4, 1, 0).denominator == 8, "Adams-Moulton 4 starts 3/8");
+  static_assert(WeightsSumToOne(maxOrder, 0) && WeightsSumToOne(maxOrder, 1), "Adams weights must sum to one");
+}
+
+#endif // ADAMSCOEFFICIENTS_HPP
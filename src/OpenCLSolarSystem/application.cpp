@@ -23,6 +23,9 @@ bool Application::Args(int argc, wxChar **argv)
   this->numGrav = 16;
   this->useLastDevice = true;
   this->tryForCPUFirst = false;
+  this->retuneKernels = false;
+  this->deterministic = false;
+  this->digestSteps = 0;
   this->desiredPlatform = NULL;
 
   for (int i = 1; i < argc; i++)
@@ -59,6 +62,25 @@ bool Application::Args(int argc, wxChar **argv)
       this->desiredPlatform = (char *)"Intel(R) Corporation";
       this->useLastDevice = false;
     }
+    else if (wxStrcmp(argv[i], wxT("-retune")) == 0)
+    {
+      this->retuneKernels = true;
+    }
+    else if (wxStrcmp(argv[i], wxT("-deterministic")) == 0)
+    {
+      this->deterministic = true;
+    }
+    else if (wxStrcmp(argv[i], wxT("-digest")) == 0 && i + 1 < argc)
+    {
+      long steps;
+      i++;
+      if (!wxString(argv[i]).ToLong(&steps) || steps <= 0)
+      {
+        wxLogError(wxT("Bad number of steps for -digest: %s"), argv[i]);
+        return false;
+      }
+      this->digestSteps = (int)steps;
+    }
     else
     {
       wxLogError(wxT("Bad option: %s"), argv[i]);
@@ -82,6 +104,9 @@ Application::Application()
   this->numGrav = 16;
   this->useLastDevice = true;
   this->tryForCPUFirst = false;
+  this->retuneKernels = false;
+  this->deterministic = false;
+  this->digestSteps = 0;
   this->desiredPlatform = NULL;
 
 #ifdef _WIN32
@@ -116,7 +141,7 @@ bool Application::OnInit()
 
     // Process the command line arguments
     this->Args(argc, argv);
-    this->frame->InitFrame(this->doubleBuffer, this->smooth, this->lighting, this->stereo, this->numParticles, this->numGrav, this->useLastDevice, this->desiredPlatform, this->tryForCPUFirst);
+    this->frame->InitFrame(this->doubleBuffer, this->smooth, this->lighting, this->stereo, this->numParticles, this->numGrav, this->useLastDevice, this->desiredPlatform, this->tryForCPUFirst, this->retuneKernels, this->deterministic, this->digestSteps);
     success = true;
     wxLogDebug(wxT("Application::OnInit Done"));
   }
@@ -44,6 +44,9 @@ private:
   char *desiredPlatform; /**< Target OpenCL platform name (NVIDIA/AMD/Intel) */
   bool useLastDevice;    /**< Use previously selected OpenCL device */
   bool tryForCPUFirst;   /**< Prefer CPU over GPU for computations */
+  bool retuneKernels;    /**< Benchmark the kernel configurations again even if the device has been tuned */
+  bool deterministic;    /**< Build and run only what gives the same state on every device */
+  int digestSteps;       /**< Print the state digest at this step and exit, 0 runs normally */
 
   // Simulation parameters
   int numParticles; /**< Number of particles in the simulation (default: 2560) */
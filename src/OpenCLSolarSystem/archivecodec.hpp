@@ -0,0 +1,128 @@
+/*
+  Copyright 2013-2025 Michael William Simmons
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#ifndef ARCHIVECODEC_HPP
+#define ARCHIVECODEC_HPP
+
+#include <cstdint>
+
+/**
+ * @brief Host decoder for the blocks the archiveEncode kernel packs
+ *
+ * The first word of a block holds the bit widths of the x, y and z residuals, one per byte.
+ * The zigzag encoded residuals of each body follow, packed least significant bit first.
+ * Kept apart from TrajectoryArchive, which needs the device, so the format can be checked on the host alone.
+ * Malformed blocks throw -1, as the rest of the archive reader does.
+ */
+namespace ArchiveCodec
+{
+  /**
+   * @brief Reads the next width bits, least significant first. Mirrors the packing in the archiveEncode kernel
+   */
+  inline std::uint64_t UnpackBits(const std::uint64_t *words, std::uint32_t numWords, std::uint32_t *word, int *used, int width)
+  {
+    if (width == 0)
+    {
+      return 0;
+    }
+
+    if (*word >= numWords)
+    {
+      throw -1;
+    }
+
+    std::uint64_t value = words[*word] >> *used;
+    if (*used + width > 64)
+    {
+      if (*word + 1 >= numWords)
+      {
+        throw -1;
+      }
+      value |= words[*word + 1] << (64 - *used);
+    }
+
+    *used += width;
+    if (*used >= 64)
+    {
+      (*word)++;
+      *used -= 64;
+    }
+
+    if (width < 64)
+    {
+      value &= (((std::uint64_t)1) << width) - 1;
+    }
+    return value;
+  }
+
+  /**
+   * @brief Extrapolates a quantised coordinate from up to three earlier frames, as archivePredict does
+   * @param q [3] the coordinate in the last three frames, newest first
+   */
+  inline std::int64_t Predict(const std::int64_t *q, int predictionOrder)
+  {
+    switch (predictionOrder)
+    {
+    case 0:
+      return 0;
+    case 1:
+      return q[0];
+    case 2:
+      return 2 * q[0] - q[1];
+    default:
+      return 3 * (q[0] - q[1]) + q[2];
+    }
+  }
+
+  /**
+   * @brief Decodes one block and moves its bodies on a frame
+   * @param blockData The block's words, starting with the widths
+   * @param blockSize Number of words in the block
+   * @param numBodies Bodies in the block, fewer than the block size in the last block
+   * @param predictionOrder Earlier frames the block was predicted from, 0 for a keyframe
+   * @param history [numBodies][3 frames][3 axes] quantised positions, newest frame first, updated to include this frame
+   */
+  inline void DecodeBlock(const std::uint64_t *blockData, std::uint32_t blockSize, int numBodies, int predictionOrder, std::int64_t *history)
+  {
+    if (blockSize == 0)
+    {
+      throw -1;
+    }
+
+    int widths[3] = {(int)(blockData[0] & 0xFF), (int)((blockData[0] >> 8) & 0xFF), (int)((blockData[0] >> 16) & 0xFF)};
+    if (widths[0] > 64 || widths[1] > 64 || widths[2] > 64)
+    {
+      throw -1;
+    }
+
+    std::uint32_t word = 1;
+    int used = 0;
+    for (int body = 0; body < numBodies; body++)
+    {
+      std::int64_t *q = history + (size_t)body * 9;
+      for (int axis = 0; axis < 3; axis++)
+      {
+        std::uint64_t zigzag = ArchiveCodec::UnpackBits(blockData, blockSize, &word, &used, widths[axis]);
+        std::int64_t residual = (std::int64_t)(zigzag >> 1) ^ -(std::int64_t)(zigzag & 1);
+        std::int64_t frames[3] = {q[axis], q[3 + axis], q[6 + axis]};
+        q[6 + axis] = q[3 + axis];
+        q[3 + axis] = q[axis];
+        q[axis] = ArchiveCodec::Predict(frames, predictionOrder) + residual;
+      }
+    }
+  }
+} // namespace ArchiveCodec
+
+#endif // ARCHIVECODEC_HPP
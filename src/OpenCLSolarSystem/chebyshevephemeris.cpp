@@ -0,0 +1,628 @@
+/*
+  Copyright 2013-2025 Michael William Simmons
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#include "global.hpp"
+#include "chebyshevephemeris.hpp"
+
+ChebyshevEphemeris::ChebyshevEphemeris()
+{
+  this->file = NULL;
+  this->writing = false;
+  this->header.numBodies = 0;
+  this->header.degree = 0;
+  this->header.intervalDays = 0.0;
+  this->hostCoefficients = NULL;
+  this->row = NULL;
+  this->gramInverse = NULL;
+  this->numSamples = 0;
+  this->sampleIndex = 0;
+  this->sampleDelT = 0.0;
+  this->startJulianDate = 0.0;
+  this->numRecords = 0;
+  this->recordOffsets = NULL;
+  this->recordStarts = NULL;
+  this->recordEnds = NULL;
+  this->lastRecord = 0;
+  this->polynomials = NULL;
+  this->cache = NULL;
+  this->scratch = NULL;
+  this->cacheRecord = -1;
+  this->cacheFirstBody = 0;
+  this->cacheNumBodies = 0;
+  this->cacheCapacity = 0;
+  this->verifyTolerance = 0.0;
+}
+
+ChebyshevEphemeris::~ChebyshevEphemeris()
+{
+  this->Close();
+}
+
+void ChebyshevEphemeris::DeAllocate()
+{
+  delete[] this->hostCoefficients;
+  this->hostCoefficients = NULL;
+  delete[] this->row;
+  this->row = NULL;
+  delete[] this->gramInverse;
+  this->gramInverse = NULL;
+  delete[] this->recordOffsets;
+  this->recordOffsets = NULL;
+  delete[] this->recordStarts;
+  this->recordStarts = NULL;
+  delete[] this->recordEnds;
+  this->recordEnds = NULL;
+  delete[] this->polynomials;
+  this->polynomials = NULL;
+  delete[] this->cache;
+  this->cache = NULL;
+  delete[] this->scratch;
+  this->scratch = NULL;
+  this->numRecords = 0;
+  this->numSamples = 0;
+  this->sampleIndex = 0;
+  this->cacheRecord = -1;
+  this->cacheCapacity = 0;
+}
+
+bool ChebyshevEphemeris::Create(wxString fileName, int numBodies, int degree, double intervalDays)
+{
+  this->Close();
+  if (degree < 1 || intervalDays <= 0.0)
+  {
+    wxLogError(wxT("Ephemeris degree must be at least 1 and the interval positive"));
+    return false;
+  }
+
+  this->file = new wxFile();
+  if (!this->file->Create(fileName, true))
+  {
+    wxLogError(wxT("Unable to create ephemeris %s"), fileName);
+    delete this->file;
+    this->file = NULL;
+    return false;
+  }
+
+  this->writing = true;
+  this->fileName = fileName;
+  this->header.numBodies = numBodies;
+  this->header.degree = degree;
+  this->header.intervalDays = intervalDays;
+  this->file->Write(&this->header, sizeof(this->header));
+  this->numRecords = 0;
+  this->numSamples = 0;
+  this->sampleIndex = 0;
+
+  this->hostCoefficients = new cl_double4[(size_t)(degree + 1) * numBodies];
+  this->row = new double[numBodies];
+  this->gramInverse = new double[(degree + 1) * (degree + 1)];
+  return true;
+}
+
+// Inverts the normal matrix G[k][l] = sum over samples of T_k(x) T_l(x)
+// for numSamples equally spaced samples from -1 to 1, by Gauss-Jordan elimination with partial pivoting
+bool ChebyshevEphemeris::InvertGramMatrix(int degree, int numSamples, double *inverse)
+{
+  int size = degree + 1;
+  double *gram = new double[size * size];
+  double *polynomials = new double[size];
+  memset(gram, 0, size * size * sizeof(double));
+
+  for (int sample = 0; sample < numSamples; sample++)
+  {
+    double x = 2.0 * sample / (numSamples - 1) - 1.0;
+    polynomials[0] = 1.0;
+    polynomials[1] = x;
+    for (int k = 2; k < size; k++)
+    {
+      polynomials[k] = 2.0 * x * polynomials[k - 1] - polynomials[k - 2];
+    }
+
+    for (int k = 0; k < size; k++)
+    {
+      for (int l = 0; l < size; l++)
+      {
+        gram[k * size + l] += polynomials[k] * polynomials[l];
+      }
+    }
+  }
+
+  for (int k = 0; k < size; k++)
+  {
+    for (int l = 0; l < size; l++)
+    {
+      inverse[k * size + l] = k == l ? 1.0 : 0.0;
+    }
+  }
+
+  bool success = true;
+  for (int column = 0; column < size && success; column++)
+  {
+    int pivot = column;
+    for (int k = column + 1; k < size; k++)
+    {
+      if (fabs(gram[k * size + column]) > fabs(gram[pivot * size + column]))
+      {
+        pivot = k;
+      }
+    }
+
+    if (fabs(gram[pivot * size + column]) < 1e-300)
+    {
+      success = false;
+      break;
+    }
+
+    if (pivot != column)
+    {
+      for (int l = 0; l < size; l++)
+      {
+        double swap = gram[pivot * size + l];
+        gram[pivot * size + l] = gram[column * size + l];
+        gram[column * size + l] = swap;
+        swap = inverse[pivot * size + l];
+        inverse[pivot * size + l] = inverse[column * size + l];
+        inverse[column * size + l] = swap;
+      }
+    }
+
+    double scale = 1.0 / gram[column * size + column];
+    for (int l = 0; l < size; l++)
+    {
+      gram[column * size + l] *= scale;
+      inverse[column * size + l] *= scale;
+    }
+
+    for (int k = 0; k < size; k++)
+    {
+      double factor = gram[k * size + column];
+      if (k == column || factor == 0.0)
+      {
+        continue;
+      }
+
+      for (int l = 0; l < size; l++)
+      {
+        gram[k * size + l] -= factor * gram[column * size + l];
+        inverse[k * size + l] -= factor * inverse[column * size + l];
+      }
+    }
+  }
+
+  delete[] polynomials;
+  delete[] gram;
+  return success;
+}
+
+// Starts a new interval with the current positions as its first sample
+void ChebyshevEphemeris::StartInterval(CLModel *clModel, double julianDate)
+{
+  if (clModel->delT == 0.0)
+  {
+    wxLogError(wxT("ChebyshevEphemeris needs a non zero time step"));
+    throw -1;
+  }
+
+  if (clModel->delT != this->sampleDelT || this->numSamples == 0)
+  {
+    int steps = (int)floor(this->header.intervalDays * 60 * 60 * 24 / fabs(clModel->delT) + 0.5);
+    if (steps < this->header.degree)
+    {
+      steps = this->header.degree;
+    }
+
+    this->numSamples = steps + 1;
+    this->sampleDelT = clModel->delT;
+    if (!ChebyshevEphemeris::InvertGramMatrix(this->header.degree, this->numSamples, this->gramInverse))
+    {
+      wxLogError(wxT("ChebyshevEphemeris unable to invert the normal matrix"));
+      this->numSamples = 0;
+      throw -1;
+    }
+  }
+
+  this->startJulianDate = julianDate;
+  clModel->ChebyshevAccumulate(this->header.degree, -1.0, true);
+  this->sampleIndex = 1;
+}
+
+// Fits the completed interval and appends it as a record
+bool ChebyshevEphemeris::WriteRecord(CLModel *clModel, double endJulianDate)
+{
+  int numBodies = this->header.numBodies;
+  int degree = this->header.degree;
+  clModel->ChebyshevSolve(degree, this->gramInverse, this->hostCoefficients);
+
+  // Running backwards the interval is reversed, T_k(-x) = (-1)^k T_k(x)
+  bool backwards = this->sampleDelT < 0;
+  EphemerisRecordHeader recordHeader;
+  recordHeader.startJulianDate = backwards ? endJulianDate : this->startJulianDate;
+  recordHeader.endJulianDate = backwards ? this->startJulianDate : endJulianDate;
+  if (this->file->Write(&recordHeader, sizeof(recordHeader)) != sizeof(recordHeader))
+  {
+    return false;
+  }
+
+  size_t rowSize = numBodies * sizeof(double);
+  for (int component = 0; component < 3; component++)
+  {
+    for (int k = 0; k <= degree; k++)
+    {
+      double sign = backwards && (k & 1) ? -1.0 : 1.0;
+      const cl_double4 *coefficients = this->hostCoefficients + (size_t)k * numBodies;
+      for (int body = 0; body < numBodies; body++)
+      {
+        this->row[body] = sign * coefficients[body].s[component];
+      }
+
+      if (this->file->Write(this->row, rowSize) != rowSize)
+      {
+        return false;
+      }
+    }
+  }
+
+  this->numRecords++;
+  wxLogDebug(wxT("Ephemeris record %d %f to %f"), this->numRecords, recordHeader.startJulianDate, recordHeader.endJulianDate);
+  return true;
+}
+
+bool ChebyshevEphemeris::Sample(CLModel *clModel)
+{
+  if (this->file == NULL || !this->writing)
+  {
+    return false;
+  }
+
+  if (clModel->GetNumParticles() != this->header.numBodies)
+  {
+    wxLogError(wxT("Ephemeris has %d bodies but the simulation has %d"), this->header.numBodies, clModel->GetNumParticles());
+    return false;
+  }
+
+  bool success = false;
+  try
+  {
+    double julianDate = clModel->julianDate + clModel->time / (60 * 60 * 24);
+
+    // A new time step, or a reset or restore that moved the date, breaks the interval
+    if (this->sampleIndex > 0)
+    {
+      double expected = this->startJulianDate + this->sampleIndex * this->sampleDelT / (60 * 60 * 24);
+      if (clModel->delT != this->sampleDelT || fabs(julianDate - expected) > fabs(this->sampleDelT) / (4 * 60 * 60 * 24))
+      {
+        this->sampleIndex = 0;
+      }
+    }
+
+    if (this->sampleIndex == 0)
+    {
+      this->StartInterval(clModel, julianDate);
+    }
+    else
+    {
+      double x = 2.0 * this->sampleIndex / (this->numSamples - 1) - 1.0;
+      if (!clModel->ChebyshevAccumulate(this->header.degree, x, false))
+      {
+        this->StartInterval(clModel, julianDate);
+      }
+      else if (++this->sampleIndex == this->numSamples)
+      {
+        if (!this->WriteRecord(clModel, julianDate))
+        {
+          wxLogError(wxT("ChebyshevEphemeris::Sample write failed"));
+          throw -1;
+        }
+
+        if (this->verifyTolerance > 0.0 && !this->VerifyRecord(clModel, julianDate))
+        {
+          throw -1;
+        }
+
+        // The last sample of this interval is the first of the next
+        this->StartInterval(clModel, julianDate);
+      }
+    }
+    success = true;
+  }
+  catch (int ex)
+  {
+    wxLogError(wxT("ChebyshevEphemeris::Sample failed %d"), ex);
+    success = false;
+  }
+
+  return success;
+}
+
+// Reads the record just written back with a reader of its own and evaluates it where it closes, a date no other record covers,
+// comparing the fit with the positions sampled there
+bool ChebyshevEphemeris::VerifyRecord(CLModel *clModel, double endJulianDate)
+{
+  int numBodies = this->header.numBodies;
+  cl_double4 *sampled = new cl_double4[numBodies];
+  cl_double4 *velocities = new cl_double4[numBodies];
+  cl_double4 *fitted = new cl_double4[numBodies];
+  double worstError = 0.0;
+  int worstBody = 0;
+
+  clModel->ReadToInitialState(sampled, velocities);
+  this->file->Flush();
+  ChebyshevEphemeris reader;
+  bool success = reader.Open(this->fileName) && reader.NumRecords() == this->numRecords && reader.Evaluate(endJulianDate, 0, numBodies, fitted, NULL);
+  if (success)
+  {
+    for (int body = 0; body < numBodies; body++)
+    {
+      double dx = fitted[body].s[0] - sampled[body].s[0];
+      double dy = fitted[body].s[1] - sampled[body].s[1];
+      double dz = fitted[body].s[2] - sampled[body].s[2];
+      double error = sqrt(dx * dx + dy * dy + dz * dz);
+      if (!(error <= worstError))
+      {
+        worstError = error;
+        worstBody = body;
+      }
+    }
+    success = worstError <= this->verifyTolerance;
+  }
+
+  if (success)
+  {
+    wxLogDebug(wxT("Ephemeris record %d fits to %g Gm where it closes"), this->numRecords, worstError);
+  }
+  else
+  {
+    wxLogError(wxT("Ephemeris record %d is %g Gm from the integrated position of body %d where it closes, more than %g Gm"), this->numRecords, worstError, worstBody,
+               this->verifyTolerance);
+  }
+
+  delete[] sampled;
+  delete[] velocities;
+  delete[] fitted;
+  return success;
+}
+
+bool ChebyshevEphemeris::Open(wxString fileName)
+{
+  this->Close();
+  this->file = new wxFile();
+  if (!this->file->Open(fileName) || this->file->Read(&this->header, sizeof(this->header)) != sizeof(this->header) || this->header.degree < 1 || this->header.numBodies <= 0)
+  {
+    wxLogError(wxT("Unable to open ephemeris %s"), fileName);
+    delete this->file;
+    this->file = NULL;
+    return false;
+  }
+  this->writing = false;
+
+  // Index the records, the first pass counts them
+  wxFileOffset length = this->file->Length();
+  wxFileOffset recordSize = sizeof(EphemerisRecordHeader) + (wxFileOffset)3 * (this->header.degree + 1) * this->header.numBodies * sizeof(double);
+  EphemerisRecordHeader recordHeader;
+  for (int pass = 0; pass < 2; pass++)
+  {
+    wxFileOffset position = sizeof(this->header);
+    int record = 0;
+    while (position + recordSize <= length)
+    {
+      if (pass == 1)
+      {
+        this->file->Seek(position);
+        if (this->file->Read(&recordHeader, sizeof(recordHeader)) != sizeof(recordHeader))
+        {
+          break;
+        }
+        this->recordOffsets[record] = position;
+        this->recordStarts[record] = recordHeader.startJulianDate;
+        this->recordEnds[record] = recordHeader.endJulianDate;
+      }
+      record++;
+      position += recordSize;
+    }
+
+    if (pass == 0)
+    {
+      this->numRecords = record;
+      this->recordOffsets = new wxFileOffset[record > 0 ? record : 1];
+      this->recordStarts = new double[record > 0 ? record : 1];
+      this->recordEnds = new double[record > 0 ? record : 1];
+    }
+  }
+
+  this->polynomials = new double[2 * (this->header.degree + 1)];
+  this->lastRecord = 0;
+  this->cacheRecord = -1;
+  return true;
+}
+
+void ChebyshevEphemeris::Close()
+{
+  if (this->file != NULL)
+  {
+    if (this->writing && this->numRecords > 0)
+    {
+      wxLogMessage(wxT("Wrote %d ephemeris records"), this->numRecords);
+    }
+    this->file->Close();
+    delete this->file;
+    this->file = NULL;
+  }
+  this->writing = false;
+  this->DeAllocate();
+}
+
+bool ChebyshevEphemeris::IsOpen()
+{
+  return this->file != NULL;
+}
+
+int ChebyshevEphemeris::NumRecords()
+{
+  return this->numRecords;
+}
+
+int ChebyshevEphemeris::NumBodies()
+{
+  return this->header.numBodies;
+}
+
+int ChebyshevEphemeris::Degree()
+{
+  return this->header.degree;
+}
+
+// Record covering julianDate, -1 if none.
+// Queries tend to move slowly through time so the last record found is tried first
+int ChebyshevEphemeris::FindRecord(double julianDate)
+{
+  if (this->numRecords == 0)
+  {
+    return -1;
+  }
+
+  if (julianDate >= this->recordStarts[this->lastRecord] && julianDate <= this->recordEnds[this->lastRecord])
+  {
+    return this->lastRecord;
+  }
+
+  for (int record = 0; record < this->numRecords; record++)
+  {
+    if (julianDate >= this->recordStarts[record] && julianDate <= this->recordEnds[record])
+    {
+      this->lastRecord = record;
+      return record;
+    }
+  }
+  return -1;
+}
+
+// Reads the coefficients of a range of bodies, keeping them body innermost
+bool ChebyshevEphemeris::LoadCache(int record, int firstBody, int numBodies)
+{
+  if (record == this->cacheRecord && firstBody == this->cacheFirstBody && numBodies == this->cacheNumBodies)
+  {
+    return true;
+  }
+
+  int numRows = 3 * (this->header.degree + 1);
+  if (numBodies > this->cacheCapacity)
+  {
+    delete[] this->cache;
+    delete[] this->scratch;
+    this->cache = new double[(size_t)numRows * numBodies];
+    this->scratch = new double[(size_t)6 * numBodies];
+    this->cacheCapacity = numBodies;
+  }
+
+  this->cacheRecord = -1;
+  size_t rowSize = numBodies * sizeof(double);
+  for (int rowIndex = 0; rowIndex < numRows; rowIndex++)
+  {
+    wxFileOffset position = this->recordOffsets[record] + sizeof(EphemerisRecordHeader) + ((wxFileOffset)rowIndex * this->header.numBodies + firstBody) * sizeof(double);
+    this->file->Seek(position);
+    if (this->file->Read(this->cache + (size_t)rowIndex * numBodies, rowSize) != (ssize_t)rowSize)
+    {
+      return false;
+    }
+  }
+
+  this->cacheRecord = record;
+  this->cacheFirstBody = firstBody;
+  this->cacheNumBodies = numBodies;
+  return true;
+}
+
+bool ChebyshevEphemeris::Evaluate(double julianDate, int firstBody, int numBodies, cl_double4 *positions, cl_double4 *velocities)
+{
+  if (this->file == NULL || this->writing || firstBody < 0 || numBodies <= 0 || firstBody + numBodies > this->header.numBodies)
+  {
+    return false;
+  }
+
+  int record = this->FindRecord(julianDate);
+  if (record < 0)
+  {
+    wxLogError(wxT("Ephemeris does not cover %f"), julianDate);
+    return false;
+  }
+
+  if (!this->LoadCache(record, firstBody, numBodies))
+  {
+    wxLogError(wxT("ChebyshevEphemeris::Evaluate read failed"));
+    return false;
+  }
+
+  // Chebyshev polynomials and their derivatives, shared by every body
+  int degree = this->header.degree;
+  double span = this->recordEnds[record] - this->recordStarts[record];
+  double x = 2.0 * (julianDate - this->recordStarts[record]) / span - 1.0;
+  double *t = this->polynomials;
+  double *dt = this->polynomials + degree + 1;
+  t[0] = 1.0;
+  t[1] = x;
+  dt[0] = 0.0;
+  dt[1] = 1.0;
+  for (int k = 2; k <= degree; k++)
+  {
+    t[k] = 2.0 * x * t[k - 1] - t[k - 2];
+    dt[k] = 2.0 * t[k - 1] + 2.0 * x * dt[k - 1] - dt[k - 2];
+  }
+
+  for (int component = 0; component < 3; component++)
+  {
+    const double *coefficients = this->cache + (size_t)component * (degree + 1) * numBodies;
+    double *position = this->scratch + (size_t)component * numBodies;
+    double *velocity = this->scratch + (size_t)(3 + component) * numBodies;
+    for (int body = 0; body < numBodies; body++)
+    {
+      position[body] = coefficients[body];
+      velocity[body] = 0.0;
+    }
+
+    for (int k = 1; k <= degree; k++)
+    {
+      const double *row = coefficients + (size_t)k * numBodies;
+      double tk = t[k];
+      double dtk = dt[k];
+      for (int body = 0; body < numBodies; body++)
+      {
+        position[body] += row[body] * tk;
+        velocity[body] += row[body] * dtk;
+      }
+    }
+  }
+
+  // dx/dt in per second, and Gm/s to km/s
+  double velocityScale = 2.0 / (span * 60 * 60 * 24) * 1e6;
+  for (int body = 0; body < numBodies; body++)
+  {
+    positions[body].s[0] = this->scratch[body];
+    positions[body].s[1] = this->scratch[numBodies + body];
+    positions[body].s[2] = this->scratch[2 * numBodies + body];
+    positions[body].s[3] = 0.0;
+  }
+
+  if (velocities != NULL)
+  {
+    for (int body = 0; body < numBodies; body++)
+    {
+      velocities[body].s[0] = this->scratch[3 * numBodies + body] * velocityScale;
+      velocities[body].s[1] = this->scratch[4 * numBodies + body] * velocityScale;
+      velocities[body].s[2] = this->scratch[5 * numBodies + body] * velocityScale;
+      velocities[body].s[3] = 0.0;
+    }
+  }
+  return true;
+}
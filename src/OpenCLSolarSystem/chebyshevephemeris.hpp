@@ -0,0 +1,145 @@
+/*
+  Copyright 2013-2025 Michael William Simmons
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#ifndef CHEBYSHEVEPHEMERIS_HPP
+#define CHEBYSHEVEPHEMERIS_HPP
+
+#ifndef CLMODEL_H
+#include "clmodel.hpp"
+#endif // #ifndef CLMODEL_H
+
+/**
+ * @brief Header at the start of an ephemeris file
+ */
+struct EphemerisFileHeader
+{
+  cl_int numBodies;       /**< Number of bodies in every record */
+  cl_int degree;          /**< Degree of the Chebyshev polynomials */
+  cl_double intervalDays; /**< Requested length of each record in days */
+};
+
+/**
+ * @brief Header in front of every record
+ * It is followed by [3][degree+1][numBodies] cl_double coefficients, x y z
+ */
+struct EphemerisRecordHeader
+{
+  cl_double startJulianDate; /**< Julian date mapped to -1 */
+  cl_double endJulianDate;   /**< Julian date mapped to +1, always after startJulianDate */
+};
+
+/**
+ * @brief Chebyshev polynomial ephemeris of every body
+ *
+ * While writing, the positions at every step of an interval are accumulated on the device
+ * and at the end of the interval a least squares fit gives each body's coefficients, so only
+ * the coefficients are read back. Consecutive intervals share their end sample.
+ *
+ * Evaluate returns positions and velocities for a range of bodies at any date covered by the file.
+ * The Chebyshev polynomials are computed once per call and the coefficients are stored body innermost,
+ * so the loops over bodies are simple multiply adds the compiler vectorises.
+ */
+class ChebyshevEphemeris
+{
+public:
+  ChebyshevEphemeris();
+  ~ChebyshevEphemeris();
+
+  /**
+   * @brief Creates a new ephemeris for writing
+   * @param fileName File to create, it is overwritten if it exists
+   * @param numBodies Number of bodies in the simulation
+   * @param degree Degree of the fitted polynomials
+   * @param intervalDays Length of each record, it is lengthened if the time step gives fewer than degree + 1 samples
+   * @return true on success
+   */
+  bool Create(wxString fileName, int numBodies, int degree, double intervalDays);
+
+  /**
+   * @brief Adds the current positions to the interval being fitted, writing a record when it is complete
+   * Called after every step. Changing the time step, or jumping in time, starts a new interval
+   * @param clModel Model to sample, must have the same number of bodies as the ephemeris
+   * @return true on success
+   */
+  bool Sample(CLModel *clModel);
+
+  /**
+   * @brief Opens an existing ephemeris and builds the record index
+   * @param fileName Ephemeris to read
+   * @return true on success
+   */
+  bool Open(wxString fileName);
+
+  void Close();  /**< Closes the ephemeris */
+  bool IsOpen(); /**< true if an ephemeris is open */
+
+  int NumRecords(); /**< Number of records in an ephemeris opened for reading */
+  int NumBodies();  /**< Number of bodies in each record */
+  int Degree();     /**< Degree of the polynomials */
+
+  /**
+   * @brief Evaluates positions and velocities of a range of bodies
+   * @param julianDate Date to evaluate at, must lie within a record
+   * @param firstBody First body to return
+   * @param numBodies Number of bodies to return
+   * @param positions Receives numBodies positions in Gm, w is set to 0
+   * @param velocities Receives numBodies velocities in km/s, w is set to 0. May be NULL
+   * @return true on success
+   */
+  bool Evaluate(double julianDate, int firstBody, int numBodies, cl_double4 *positions, cl_double4 *velocities);
+
+  double verifyTolerance; /**< Largest error in Gm of a record's fit where it closes, checked as each is written, 0 skips the check */
+
+private:
+  wxFile *file;               /**< Open ephemeris or NULL */
+  wxString fileName;          /**< Name of the open ephemeris */
+  bool writing;               /**< Open for writing rather than reading */
+  EphemerisFileHeader header; /**< Header of the open ephemeris */
+
+  // Writing state
+  cl_double4 *hostCoefficients; /**< [degree+1][numBodies] coefficients read back from the device */
+  double *row;                  /**< [numBodies] one component of one coefficient */
+  double *gramInverse;          /**< [degree+1][degree+1] inverse normal matrix for numSamples samples */
+  int numSamples;               /**< Samples in the current interval, numSamples - 1 steps */
+  int sampleIndex;              /**< Index of the next sample, 0 if no interval is in progress */
+  double sampleDelT;            /**< Time step of the current interval */
+  double startJulianDate;       /**< Date of the first sample of the current interval */
+  int numRecords;               /**< Records written or indexed */
+
+  // Record index for reading
+  wxFileOffset *recordOffsets; /**< [numRecords] file offset of each record header */
+  double *recordStarts;        /**< [numRecords] start date of each record */
+  double *recordEnds;          /**< [numRecords] end date of each record */
+  int lastRecord;              /**< Record found by the last lookup */
+
+  // Coefficients of the last record and body range evaluated
+  double *polynomials; /**< [2][degree+1] T_k and dT_k/dx at the date being evaluated */
+  double *cache;       /**< [3][degree+1][cacheNumBodies] coefficients */
+  double *scratch;     /**< [6][cacheNumBodies] position and velocity components */
+  int cacheRecord;     /**< Record in the cache, -1 if none */
+  int cacheFirstBody;  /**< First body in the cache */
+  int cacheNumBodies;  /**< Number of bodies in the cache */
+  int cacheCapacity;   /**< Bodies the cache is allocated for */
+
+  void DeAllocate();
+  void StartInterval(CLModel *clModel, double julianDate);
+  bool WriteRecord(CLModel *clModel, double endJulianDate);
+  bool VerifyRecord(CLModel *clModel, double endJulianDate);
+  int FindRecord(double julianDate);
+  bool LoadCache(int record, int firstBody, int numBodies);
+  static bool InvertGramMatrix(int degree, int numSamples, double *inverse);
+};
+
+#endif // CHEBYSHEVEPHEMERIS_HPP
@@ -0,0 +1,386 @@
+/*
+  Copyright 2013-2025 Michael William Simmons
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#include "global.hpp"
+#include "checkpoint.hpp"
+#include "checkpointcodec.hpp"
+
+Checkpoint::Checkpoint()
+{
+  this->file = NULL;
+  this->deltasSinceBase = 0;
+  this->baseInterval = 16;
+  this->hostState = NULL;
+  this->encoded = NULL;
+  this->hostStateSize = 0;
+}
+
+Checkpoint::~Checkpoint()
+{
+  this->Close();
+  this->DeAllocateBuffers();
+}
+
+void Checkpoint::AllocateBuffers(size_t sectionSize)
+{
+  if (this->hostStateSize >= sectionSize)
+  {
+    return;
+  }
+
+  this->DeAllocateBuffers();
+  this->hostState = new cl_double4[sectionSize];
+  this->encoded = new unsigned char[CheckpointCodec::EncodedSizeBound(sectionSize * 4)];
+  this->hostStateSize = sectionSize;
+}
+
+void Checkpoint::DeAllocateBuffers()
+{
+  if (this->hostState != NULL)
+  {
+    delete[] this->hostState;
+    this->hostState = NULL;
+  }
+
+  if (this->encoded != NULL)
+  {
+    delete[] this->encoded;
+    this->encoded = NULL;
+  }
+
+  this->hostStateSize = 0;
+}
+
+bool Checkpoint::Open(wxString fileName)
+{
+  this->Close();
+  this->file = new wxFile();
+  if (!this->file->Create(fileName, true))
+  {
+    wxLogError(wxT("Unable to create checkpoint file %s"), fileName);
+    delete this->file;
+    this->file = NULL;
+    return false;
+  }
+
+  // force a base as the first record
+  this->deltasSinceBase = this->baseInterval;
+  return true;
+}
+
+void Checkpoint::Close()
+{
+  if (this->file != NULL)
+  {
+    this->file->Close();
+    delete this->file;
+    this->file = NULL;
+  }
+}
+
+bool Checkpoint::IsOpen()
+{
+  return this->file != NULL;
+}
+
+bool Checkpoint::Write(CLModel *clModel)
+{
+  if (this->file == NULL)
+  {
+    return false;
+  }
+
+  bool success = false;
+  wxStopWatch stopWatch;
+  wxFileOffset headerPosition = this->file->Tell();
+  try
+  {
+    CheckpointRecordHeader header;
+    bool base = !clModel->HasCheckpointReference() || this->deltasSinceBase >= this->baseInterval;
+    header.type = base ? CHECKPOINT_BASE : CHECKPOINT_DELTA;
+    header.numParticles = (cl_int)clModel->CheckpointSectionSize(0);
+    header.numGrav = clModel->numGrav;
+    header.step = clModel->step;
+    header.heliocentric = clModel->IsHeliocentric() ? 1 : 0;
+    header.fixedPointBits = clModel->fixedPointBits;
+    header.julianDate = clModel->julianDate;
+    header.time = clModel->time;
+    header.delT = clModel->delT;
+
+    // Until the header is filled in its size runs past the end of the file, so a record cut short is never taken as complete
+    header.encodedSize = ~(cl_ulong)0;
+    if (headerPosition == wxInvalidOffset || this->file->Write(&header, sizeof(header)) != sizeof(header))
+    {
+      wxLogError(wxT("Checkpoint::Write failed to write header"));
+      throw -1;
+    }
+
+    header.encodedSize = 0;
+    size_t rawSize = 0;
+    for (int section = 0; section < CLModel::numCheckpointSections; section++)
+    {
+      size_t count = clModel->CheckpointSectionSize(section);
+      this->AllocateBuffers(count);
+      clModel->ReadCheckpointSection(section, base, this->hostState);
+      size_t encodedSize = CheckpointCodec::EncodeWords((const std::uint64_t *)this->hostState, count * 4, this->encoded);
+      if (this->file->Write(this->encoded, encodedSize) != encodedSize)
+      {
+        wxLogError(wxT("Checkpoint::Write failed to write state"));
+        throw -1;
+      }
+      header.encodedSize += encodedSize;
+      rawSize += count * sizeof(cl_double4);
+    }
+
+    // Now the size is known go back and fill in the header
+    wxFileOffset endPosition = this->file->Tell();
+    if (endPosition == wxInvalidOffset || this->file->Seek(headerPosition) == wxInvalidOffset || this->file->Write(&header, sizeof(header)) != sizeof(header) ||
+        this->file->Seek(endPosition) == wxInvalidOffset || !this->file->Flush())
+    {
+      wxLogError(wxT("Checkpoint::Write failed to complete the header"));
+      throw -1;
+    }
+
+    // Only now the record is on disk can the next delta be taken against this state
+    clModel->CommitCheckpointReference();
+    this->deltasSinceBase = base ? 0 : this->deltasSinceBase + 1;
+    wxLogMessage(wxT("Checkpoint %s step %d: %llu bytes (%.1f%% of full state) in %ld ms"), base ? wxT("base") : wxT("delta"), header.step,
+                 (unsigned long long)(header.encodedSize + sizeof(header)), 100.0 * header.encodedSize / rawSize, stopWatch.Time());
+    success = true;
+  }
+  catch (int ex)
+  {
+    wxLogError(wxT("Checkpoint::Write failed %d"), ex);
+    success = false;
+  }
+
+  // The next record overwrites the failed one, and the device reference still matches the last one written
+  if (!success && headerPosition != wxInvalidOffset && this->file->Seek(headerPosition) == wxInvalidOffset)
+  {
+    wxLogError(wxT("Checkpoint::Write failed to return to the end of the last record, closing the checkpoint file"));
+    this->Close();
+  }
+
+  return success;
+}
+
+// A header read from disk is only trusted if it could describe a record of this file.
+// The encoded state can be no bigger than every word of the whole state at full length, and must fit in the file.
+bool Checkpoint::PlausibleRecord(const CheckpointRecordHeader &record, wxFileOffset position, wxFileOffset length)
+{
+  if (record.type != CHECKPOINT_BASE && record.type != CHECKPOINT_DELTA)
+  {
+    return false;
+  }
+
+  if (record.numParticles <= 0 || record.numGrav < 0 || record.numGrav > record.numParticles || (record.heliocentric != 0 && record.heliocentric != 1) ||
+      record.fixedPointBits < 0 || record.fixedPointBits > 64)
+  {
+    return false;
+  }
+
+  // 36 cl_double4 per body over all the sections, as in checkpointReference
+  cl_ulong maxEncodedSize = CheckpointCodec::EncodedSizeBound((size_t)record.numParticles * 36 * 4);
+  cl_ulong remaining = (cl_ulong)(length - position) - sizeof(record);
+  return record.encodedSize <= maxEncodedSize && record.encodedSize <= remaining;
+}
+
+// Walks the record headers and finds the start of the last complete base record, and where the records end.
+// A partially written record at the end of the file, e.g. from a crash, and anything after it, is ignored.
+bool Checkpoint::FindLastBase(wxFile &checkpointFile, CheckpointRecordHeader *header, wxFileOffset *position, wxFileOffset *end)
+{
+  bool found = false;
+  wxFileOffset length = checkpointFile.Length();
+  wxFileOffset recordPosition = 0;
+  CheckpointRecordHeader record;
+
+  checkpointFile.Seek(0);
+  while (checkpointFile.Read(&record, sizeof(record)) == sizeof(record))
+  {
+    if (!Checkpoint::PlausibleRecord(record, recordPosition, length))
+    {
+      break;
+    }
+
+    // Every record after a base must be a delta of the same bodies
+    if (found && record.type == CHECKPOINT_DELTA && (record.numParticles != header->numParticles || record.numGrav != header->numGrav))
+    {
+      break;
+    }
+
+    if (record.type == CHECKPOINT_BASE)
+    {
+      *header = record;
+      *position = recordPosition;
+      found = true;
+    }
+
+    recordPosition += sizeof(record) + record.encodedSize;
+    checkpointFile.Seek(recordPosition);
+  }
+  *end = recordPosition;
+  return found;
+}
+
+bool Checkpoint::ReadLastBaseHeader(wxString fileName, CheckpointRecordHeader *header)
+{
+  wxFile checkpointFile;
+  if (!checkpointFile.Open(fileName))
+  {
+    return false;
+  }
+
+  wxFileOffset position;
+  wxFileOffset end;
+  bool found = Checkpoint::FindLastBase(checkpointFile, header, &position, &end);
+  checkpointFile.Close();
+  if (!found)
+  {
+    wxLogError(wxT("No base checkpoint found in %s"), fileName);
+  }
+  return found;
+}
+
+bool Checkpoint::Restore(wxString fileName, CLModel *clModel, CheckpointRecordHeader *header)
+{
+  wxStopWatch stopWatch;
+  wxFile checkpointFile;
+  if (!checkpointFile.Open(fileName))
+  {
+    return false;
+  }
+
+  wxFileOffset position;
+  wxFileOffset end;
+  if (!Checkpoint::FindLastBase(checkpointFile, header, &position, &end))
+  {
+    wxLogError(wxT("No base checkpoint found in %s"), fileName);
+    return false;
+  }
+
+  if (header->numParticles != (cl_int)clModel->CheckpointSectionSize(0) || header->numGrav != clModel->numGrav)
+  {
+    wxLogError(wxT("Checkpoint has %d bodies %d with mass but the simulation has %d and %d"), header->numParticles, header->numGrav, (int)clModel->CheckpointSectionSize(0), clModel->numGrav);
+    return false;
+  }
+
+  // The state and the Adams history are in the frame and on the grid they were integrated with
+  cl_int heliocentric = clModel->IsHeliocentric() ? 1 : 0;
+  if (header->heliocentric != heliocentric || header->fixedPointBits != clModel->fixedPointBits)
+  {
+    wxLogError(wxT("Checkpoint was integrated %s with %d fixed point bits but the simulation is %s with %d"), header->heliocentric ? wxT("heliocentric") : wxT("barycentric"),
+               header->fixedPointBits, heliocentric ? wxT("heliocentric") : wxT("barycentric"), clModel->fixedPointBits);
+    return false;
+  }
+
+  size_t sectionSizes[CLModel::numCheckpointSections];
+  size_t totalSize = 0;
+  for (int section = 0; section < CLModel::numCheckpointSections; section++)
+  {
+    sectionSizes[section] = clModel->CheckpointSectionSize(section);
+    totalSize += sectionSizes[section];
+  }
+
+  bool success = true;
+  int numRecords = 0;
+  cl_ulong bytesRead = 0;
+  cl_double4 *state = new cl_double4[totalSize];
+  unsigned char *encoded = NULL;
+  cl_ulong encodedCapacity = 0;
+  CheckpointRecordHeader record;
+
+  // The base is XORed into zeros, each delta is then XORed on top
+  checkpointFile.Seek(position);
+  while (success && checkpointFile.Tell() < end && checkpointFile.Read(&record, sizeof(record)) == sizeof(record))
+  {
+    if (record.numParticles != header->numParticles || record.numGrav != header->numGrav || record.heliocentric != header->heliocentric || record.fixedPointBits != header->fixedPointBits)
+    {
+      wxLogError(wxT("Checkpoint record at step %d does not match the base"), record.step);
+      success = false;
+      break;
+    }
+
+    if (record.encodedSize > encodedCapacity)
+    {
+      delete[] encoded;
+      encodedCapacity = record.encodedSize;
+      encoded = new unsigned char[encodedCapacity];
+    }
+
+    if (checkpointFile.Read(encoded, record.encodedSize) != (ssize_t)record.encodedSize)
+    {
+      wxLogWarning(wxT("Ignoring incomplete checkpoint record at step %d"), record.step);
+      break;
+    }
+
+    if (record.type == CHECKPOINT_BASE)
+    {
+      memset(state, 0, totalSize * sizeof(cl_double4));
+    }
+
+    size_t inIndex = 0;
+    size_t stateIndex = 0;
+    for (int section = 0; section < CLModel::numCheckpointSections; section++)
+    {
+      size_t used;
+      if (!CheckpointCodec::XorDecodedWords(encoded + inIndex, record.encodedSize - inIndex, (std::uint64_t *)(state + stateIndex), sectionSizes[section] * 4, &used))
+      {
+        wxLogError(wxT("Checkpoint record at step %d is corrupt"), record.step);
+        success = false;
+        break;
+      }
+      inIndex += used;
+      stateIndex += sectionSizes[section];
+    }
+
+    if (success)
+    {
+      *header = record;
+      bytesRead += sizeof(record) + record.encodedSize;
+      numRecords++;
+    }
+  }
+  checkpointFile.Close();
+
+  try
+  {
+    if (success && numRecords > 0)
+    {
+      size_t stateIndex = 0;
+      for (int section = 0; section < CLModel::numCheckpointSections; section++)
+      {
+        clModel->WriteCheckpointSection(section, state + stateIndex);
+        stateIndex += sectionSizes[section];
+      }
+      clModel->delT = header->delT;
+      clModel->julianDate = header->julianDate;
+      clModel->RestoreCheckpoint(header->step, header->time);
+      wxLogMessage(wxT("Restored step %d from a base and %d deltas, %llu bytes in %ld ms"), header->step, numRecords - 1, (unsigned long long)bytesRead, stopWatch.Time());
+    }
+    else
+    {
+      success = false;
+    }
+  }
+  catch (int ex)
+  {
+    wxLogError(wxT("Checkpoint::Restore failed %d"), ex);
+    success = false;
+  }
+
+  delete[] encoded;
+  delete[] state;
+  return success;
+}
@@ -0,0 +1,111 @@
+/*
+  Copyright 2013-2025 Michael William Simmons
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+
+#ifndef CLMODEL_H
+#include "clmodel.hpp"
+#endif // #ifndef CLMODEL_H
+
+/**
+ * @brief Header written in front of every checkpoint record
+ */
+struct CheckpointRecordHeader
+{
+  cl_int type;           /**< CHECKPOINT_BASE or CHECKPOINT_DELTA */
+  cl_int numParticles;   /**< Number of bodies in the integrator state */
+  cl_int numGrav;        /**< Number of bodies with mass */
+  cl_int step;           /**< Integration step the state was taken at */
+  cl_int heliocentric;   /**< 1 if the state is relative to the Sun, 0 if barycentric */
+  cl_int fixedPointBits; /**< Fixed point bits the positions are held to, 0 for floating point */
+  cl_double julianDate;  /**< Julian date the simulation started from */
+  cl_double time;        /**< Seconds simulated since julianDate */
+  cl_double delT;        /**< Time step the history buffers were built with */
+  cl_ulong encodedSize;  /**< Number of bytes of encoded state following the header */
+};
+
+#define CHECKPOINT_BASE 0
+#define CHECKPOINT_DELTA 1
+
+/**
+ * @brief Incremental checkpoints of the full integrator state
+ *
+ * A checkpoint file is a sequence of records. A base record holds the whole
+ * integrator state, positions, velocities and the Adams history buffers.
+ * The records that follow it hold only the XOR of the state against the previous record,
+ * computed on the device, so only the bits that actually changed get read back.
+ * Every 64 bit word is stored as just its non zero low order bytes, see CheckpointCodec.
+ *
+ * Restoring replays the last base in the file and every delta after it.
+ */
+class Checkpoint
+{
+public:
+  Checkpoint();
+  ~Checkpoint();
+
+  /**
+   * @brief Starts a new checkpoint file, the first record written will be a base
+   * @param fileName File to create, it is overwritten if it exists
+   * @return true on success
+   */
+  bool Open(wxString fileName);
+
+  void Close();  /**< Closes the checkpoint file */
+  bool IsOpen(); /**< true if checkpoints are being written */
+
+  /**
+   * @brief Appends a checkpoint of the current integrator state
+   * A base is written if the device has no reference copy or baseInterval deltas have been written since the last base
+   * @param clModel Model to read the state from
+   * @return true on success
+   */
+  bool Write(CLModel *clModel);
+
+  /**
+   * @brief Reads the header of the last base record in a checkpoint file
+   * Used to size the model before calling Restore
+   * @param fileName Checkpoint file
+   * @param header Receives the base record header
+   * @return true if a base record was found
+   */
+  static bool ReadLastBaseHeader(wxString fileName, CheckpointRecordHeader *header);
+
+  /**
+   * @brief Replays the last base and all following deltas into the model
+   * @param fileName Checkpoint file
+   * @param clModel Model to restore, must have the same number of bodies as the base
+   * @param header Receives the header of the last record replayed
+   * @return true on success
+   */
+  static bool Restore(wxString fileName, CLModel *clModel, CheckpointRecordHeader *header);
+
+  int baseInterval; /**< Number of deltas written between full bases */
+
+private:
+  wxFile *file;           /**< Open checkpoint file or NULL */
+  int deltasSinceBase;    /**< Deltas written since the last base */
+  cl_double4 *hostState;  /**< Read back buffer big enough for the largest state section */
+  unsigned char *encoded; /**< Encoding buffer for the largest state section */
+  size_t hostStateSize;   /**< Size of hostState in cl_double4 elements */
+
+  void AllocateBuffers(size_t sectionSize);
+  void DeAllocateBuffers();
+  static bool PlausibleRecord(const CheckpointRecordHeader &record, wxFileOffset position, wxFileOffset length);
+  static bool FindLastBase(wxFile &checkpointFile, CheckpointRecordHeader *header, wxFileOffset *position, wxFileOffset *end);
+};
+
+#endif // CHECKPOINT_HPP
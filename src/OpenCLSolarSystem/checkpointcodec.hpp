@@ -0,0 +1,107 @@
+/*
+  Copyright 2013-2025 Michael William Simmons
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#ifndef CHECKPOINTCODEC_HPP
+#define CHECKPOINTCODEC_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief Byte packing of the 64 bit words of a checkpoint record
+ *
+ * Words are encoded in pairs. A byte holding the two byte counts, one per nibble,
+ * is followed by the low order bytes of each word, so a word that XORed to zero takes no bytes.
+ * Kept apart from Checkpoint, which needs the device, so the format can be checked on the host alone.
+ */
+namespace CheckpointCodec
+{
+  /**
+   * @brief Largest encoding of numWords words, every word at full length
+   */
+  inline size_t EncodedSizeBound(size_t numWords)
+  {
+    return numWords * sizeof(std::uint64_t) + (numWords + 1) / 2;
+  }
+
+  /**
+   * @brief Packs numWords words into out, which must hold EncodedSizeBound(numWords) bytes
+   * @return Number of bytes written
+   */
+  inline size_t EncodeWords(const std::uint64_t *words, size_t numWords, unsigned char *out)
+  {
+    size_t outSize = 0;
+    for (size_t i = 0; i < numWords; i += 2)
+    {
+      size_t lengthsIndex = outSize++;
+      unsigned char lengths = 0;
+      for (size_t j = 0; j < 2 && i + j < numWords; j++)
+      {
+        std::uint64_t word = words[i + j];
+        int length = 8;
+        while (length > 0 && ((word >> (8 * (length - 1))) & 0xFF) == 0)
+        {
+          length--;
+        }
+
+        lengths |= (unsigned char)(length << (4 * j));
+        for (int b = 0; b < length; b++)
+        {
+          out[outSize++] = (unsigned char)(word >> (8 * b));
+        }
+      }
+      out[lengthsIndex] = lengths;
+    }
+    return outSize;
+  }
+
+  /**
+   * @brief Decodes numWords words and XORs them into words
+   * @param used Set to the number of bytes consumed
+   * @return false if the encoded data is malformed or runs past inSize
+   */
+  inline bool XorDecodedWords(const unsigned char *in, size_t inSize, std::uint64_t *words, size_t numWords, size_t *used)
+  {
+    size_t inIndex = 0;
+    for (size_t i = 0; i < numWords; i += 2)
+    {
+      if (inIndex >= inSize)
+      {
+        return false;
+      }
+
+      unsigned char lengths = in[inIndex++];
+      for (size_t j = 0; j < 2 && i + j < numWords; j++)
+      {
+        int length = (lengths >> (4 * j)) & 0xF;
+        if (length > 8 || inIndex + length > inSize)
+        {
+          return false;
+        }
+
+        std::uint64_t word = 0;
+        for (int b = 0; b < length; b++)
+        {
+          word |= ((std::uint64_t)in[inIndex++]) << (8 * b);
+        }
+        words[i + j] ^= word;
+      }
+    }
+    *used = inIndex;
+    return true;
+  }
+} // namespace CheckpointCodec
+
+#endif // CHECKPOINTCODEC_HPP
@@ -24,8 +24,11 @@
  * - Execution of integration kernels for position/velocity updates
  * - Synchronization with OpenGL for visualization
  */
+#include <climits>
+#include <cstring>
 #include "global.hpp"
 #include "clmodel.hpp"
+#include "adamscoefficients.hpp"
 #include "kernels.hpp"
 
 CLModel::CLModel()
@@ -35,14 +38,42 @@ CLModel::CLModel()
   this->context = NULL;
   this->devices = NULL;
   this->commandQueue = NULL;
+  this->streamQueue = NULL;
   this->program = NULL;
   this->accKernel = NULL;
   this->adamsBashforthKernel = NULL;
   this->adamsMoultonKernel = NULL;
   this->startupKernel = NULL;
   this->copyToDisplayKernel = NULL;
+  this->checkpointDeltaKernel = NULL;
+  this->archiveEncodeKernel = NULL;
+  this->chebyshevAccumulateKernel = NULL;
+  this->chebyshevSolveKernel = NULL;
+  this->denseOutputKernel = NULL;
+  this->keplerFastForwardKernel = NULL;
+  this->orbitalToStateVectorsKernel = NULL;
+  this->copyChunkToDisplayKernel = NULL;
+  this->twoPhaseTestParticlesKernel = NULL;
+  this->treeBoundsKernel = NULL;
+  this->treeMortonKeysKernel = NULL;
+  this->treeSortStepKernel = NULL;
+  this->treeBuildKernel = NULL;
+  this->treeSummariseKernel = NULL;
+  this->referenceKernel = NULL;
+  this->gravPairsKernel = NULL;
+  this->perturberMaskKernel = NULL;
+  this->heliocentricIndirectKernel = NULL;
+  this->addIndirectKernel = NULL;
+  this->frameOffsetKernel = NULL;
+  this->frameShiftKernel = NULL;
+  this->fixedPointKernel = NULL;
+  this->stepErrorKernel = NULL;
+  this->rescaleHistoryKernel = NULL;
 
   // Initialize numeric values to safe defaults
+  this->programCacheHits = 0;
+  this->programCacheMisses = 0;
+  this->specializeKernels = false;
   this->maxWorkGroupSize = 0;
   this->maxDimensions = 0;
   this->maxWorkItemSizes = NULL;
@@ -52,8 +83,44 @@ CLModel::CLModel()
   this->adamsMoultonKernelWorkGroupSize = 0;
   this->startupKernelWorkGroupSize = 0;
   this->groupSize = 64;
+  this->requestedGroupSize = 64;
+  this->buildOptions = wxT("-cl-mad-enable"); // -cl-fast-relaxed-math";// "-cl-mad-enable -cl-fast-relaxed-math -cl-nv-verbose ";
   this->maxMemoryAlloc = 0;
   this->globalMemorySize = 0;
+  this->gravTileSize = 256;
+  this->particlesPerWorkItem = 1;
+  this->tiledAcceleration = false;
+  this->accelerationBlock = 1;
+  this->accTargetsArg = 0;
+  this->treeOpeningAngle = 0.5;
+  this->treeAcceleration = false;
+  this->treeNumKeys = 0;
+  this->pairwiseMassive = true;
+  this->pairAcceleration = false;
+  this->pairGroupSize = 0;
+  this->summation = CLModel::summationDefault;
+  this->compensatedBodies = 10;
+  this->perturberTolerance = 0.0;
+  this->perturberRefreshSteps = 16;
+  this->maskedAcceleration = false;
+  this->subgroupAcceleration = false;
+  this->heliocentric = false;
+  this->heliocentricFrame = false;
+  this->fixedPointBits = 0;
+  this->deterministic = false;
+  this->stepTolerance = 0.0;
+  this->minDeltaTime = 60.0;
+  this->maxDeltaTime = 24 * 60 * 60.0;
+  this->stepControl = false;
+  this->stepErrorReady = false;
+  this->calmSteps = 0;
+  this->rescaleStep = 0;
+  this->rescaleRatio = 1.0;
+  this->historyGrown = false;
+  this->targetDeltaTime = 0.0;
+  this->maskWords = 0;
+  this->maskStep = -1;
+  this->maskParticles = 0;
 
   this->dispPos = NULL;
   this->currPos = NULL;
@@ -66,6 +133,47 @@ CLModel::CLModel()
   this->accHistory = NULL;
   this->posLast = NULL;
   this->velLast = NULL;
+  this->checkpointReference = NULL;
+  this->checkpointDelta = NULL;
+  this->archiveQuantised[0] = NULL;
+  this->archiveQuantised[1] = NULL;
+  this->archiveQuantised[2] = NULL;
+  this->archiveBlocks = NULL;
+  this->archiveBlockSizes = NULL;
+  this->chebyshevSums = NULL;
+  this->chebyshevCoefficients = NULL;
+  this->chebyshevGramInverse = NULL;
+  this->densePos = NULL;
+  this->denseVel = NULL;
+  this->denseGravPos = NULL;
+  this->denseWeights = NULL;
+  this->twoPhaseEphemeris = NULL;
+  this->twoPhaseCoefficients = NULL;
+  this->treeBox = NULL;
+  this->treeKeys = NULL;
+  this->treeChildren = NULL;
+  this->treeParents = NULL;
+  this->treeFlags = NULL;
+  this->treeCom = NULL;
+  this->treeMin = NULL;
+  this->treeMax = NULL;
+  this->checkAcc[0] = NULL;
+  this->checkAcc[1] = NULL;
+  this->pairCompensation = NULL;
+  this->perturberMask = NULL;
+  this->perturberStats = NULL;
+  this->indirectAcc = NULL;
+  this->frameOffsets = NULL;
+  this->framePos = NULL;
+  this->frameVel = NULL;
+  this->stepErrors = NULL;
+  this->keplerStartPos = NULL;
+  this->keplerStartVel = NULL;
+  for (int buffer = 0; buffer < 9; buffer++)
+  {
+    this->streamSlot[buffer] = NULL;
+  }
+  this->streamState = NULL;
 
   // Set simulation parameters to initial values
   this->updateDisplay = false;
@@ -74,6 +182,19 @@ CLModel::CLModel()
   this->gotAmdFp64 = false;
   this->gotKhrGlSharing = false;
   this->gotAppleGlSharing = false;
+  this->gotKhrSubgroups = false;
+  this->gotIntelSubgroups = false;
+  this->checkpointReferenceValid = false;
+  this->archiveHistoryValid = false;
+  this->chebyshevDegree = -1;
+  this->displayingDenseOutput = false;
+  this->denseOutputTime = 0.0;
+  this->keplerStartTime = 0.0;
+  this->activeParticles = 0;
+  this->streaming = false;
+  this->streamChunkSize = 0;
+  this->chunkSize = 0;
+  this->numChunks = 0;
   this->delT = 4 * 60 * 60.0f; // 4 hour timestep
   this->espSqr = 0.000001f;    // Smoothing length squared
   this->time = 0.0f;
@@ -123,6 +244,7 @@ bool CLModel::FindDeviceAndCreateContext(cl_uint desiredDeviceVendorId, cl_devic
   char *deviceName = NULL;
   char *deviceCLVersion = NULL;
   cl_device_id *contextDeviceIds = NULL;
+  this->groupSize = this->requestedGroupSize;
 
   try
   {
@@ -347,6 +469,8 @@ bool CLModel::FindDeviceAndCreateContext(cl_uint desiredDeviceVendorId, cl_devic
     this->gotAmdFp64 = false;
     this->gotKhrGlSharing = false;
     this->gotAppleGlSharing = false;
+    this->gotKhrSubgroups = false;
+    this->gotIntelSubgroups = false;
 
     size_t extensionsSize;
     status = clGetDeviceInfo(this->deviceId, CL_DEVICE_EXTENSIONS, 0, NULL, &extensionsSize);
@@ -386,6 +510,17 @@ bool CLModel::FindDeviceAndCreateContext(cl_uint desiredDeviceVendorId, cl_devic
       this->gotAmdFp64 = true;
     }
 
+    // cl_khr_subgroups is an OpenCL C 2.0 extension
+    if (deviceExtensions.Contains(wxT("cl_khr_subgroups")) && this->deviceCLVersionNumber >= 2.0)
+    {
+      this->gotKhrSubgroups = true;
+    }
+
+    if (deviceExtensions.Contains(wxT("cl_intel_subgroups")))
+    {
+      this->gotIntelSubgroups = true;
+    }
+
     delete[] extensions;
     extensions = NULL;
 
@@ -534,12 +669,9 @@ bool CLModel::FindDeviceAndCreateContext(cl_uint desiredDeviceVendorId, cl_devic
       throw status;
     }
 
-    this->maxNumGrav = this->maxConstantBufferSize / sizeof(cl_double4);
-    wxLogDebug(wxT("max grav particles %d"), this->maxNumGrav);
-    if (this->numGrav > this->maxNumGrav)
-    {
-      this->numGrav = this->maxNumGrav;
-    }
+    // More bodies with mass than fit in constant memory are staged through local memory by the Local acceleration kernels
+    this->maxConstantNumGrav = this->maxConstantBufferSize / sizeof(cl_double4);
+    wxLogDebug(wxT("max grav particles in constant memory %d"), this->maxConstantNumGrav);
 
     status = clGetDeviceInfo(this->deviceId, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(cl_ulong), (void *)&this->globalMemorySize, NULL);
     if (status != CL_SUCCESS)
@@ -558,9 +690,34 @@ bool CLModel::FindDeviceAndCreateContext(cl_uint desiredDeviceVendorId, cl_devic
     int maxHistory = this->maxMemoryAlloc / (16 * sizeof(cl_double4));
     int maxGlobal = this->globalMemorySize / ((2 * 16 * sizeof(cl_double4)) + (4 * sizeof(cl_double4)));
     this->maxNumParticles = maxGlobal < maxHistory ? maxGlobal : maxHistory;
+    if (this->streamChunkSize > 0)
+    {
+      // When streaming only the display buffer holds every particle
+      cl_ulong maxDisplay = this->maxMemoryAlloc / sizeof(cl_float4);
+      this->maxNumParticles = maxDisplay < (cl_ulong)INT_MAX ? (int)maxDisplay : INT_MAX;
+    }
     wxLogDebug(wxT("max history particles %d"), maxHistory);
     wxLogDebug(wxT("max global particles %d"), maxGlobal);
 
+    cl_ulong maxGravAlloc = this->maxMemoryAlloc / sizeof(cl_double4);
+    this->maxNumGrav = maxGravAlloc < (cl_ulong)this->maxNumParticles ? (int)maxGravAlloc : this->maxNumParticles;
+    wxLogDebug(wxT("max grav particles %d"), this->maxNumGrav);
+    if (this->numGrav > this->maxNumGrav)
+    {
+      this->numGrav = this->maxNumGrav;
+    }
+
+    // A tile of bodies with mass has to fit in local memory
+    int maxGravTileSize = this->totalLocalMemory / sizeof(cl_double4);
+    if (this->gravTileSize > maxGravTileSize)
+    {
+      this->gravTileSize = maxGravTileSize;
+    }
+    if (this->gravTileSize < 1)
+    {
+      this->gravTileSize = 1;
+    }
+
     success = true;
   }
   catch (int ex)
@@ -666,7 +823,21 @@ void CLModel::CreateBufferObjects(GLuint *vbo, int numParticles, int numGrav)
   this->step = 0;
   this->numGrav = numGrav;
   this->numParticles = (cl_int)((numParticles / this->groupSize) * this->groupSize);
-  ;
+  this->activeParticles = this->numParticles;
+
+  // When streaming the device buffers below hold one chunk, in whole work groups and with all the bodies with mass
+  cl_int deviceParticles = this->numParticles;
+  this->chunkSize = (cl_int)((this->streamChunkSize / this->groupSize) * this->groupSize);
+  if (this->chunkSize < this->numGrav)
+  {
+    this->chunkSize = (cl_int)(((this->numGrav + this->groupSize - 1) / this->groupSize) * this->groupSize);
+  }
+  this->streaming = this->streamChunkSize > 0 && this->chunkSize < this->numParticles;
+  if (this->streaming)
+  {
+    this->numChunks = (this->numParticles + this->chunkSize - 1) / this->chunkSize;
+    deviceParticles = this->chunkSize;
+  }
 
   // Create cl_mem objects
   // Get an openCL buffer to the openGL Vertex Array of points.
@@ -679,7 +850,7 @@ void CLModel::CreateBufferObjects(GLuint *vbo, int numParticles, int numGrav)
   }
 
   // The current positions of the solar system bodies.
-  this->currPos = clCreateBuffer(this->context, CL_MEM_READ_ONLY, this->numParticles * sizeof(cl_double4), 0, &status);
+  this->currPos = clCreateBuffer(this->context, CL_MEM_READ_ONLY, deviceParticles * sizeof(cl_double4), 0, &status);
   if (status != CL_SUCCESS)
   {
     wxLogError(wxT("clCreateBuffer failed to create cl_mem object for currPos %s"), this->ErrorMessage(status));
@@ -687,7 +858,7 @@ void CLModel::CreateBufferObjects(GLuint *vbo, int numParticles, int numGrav)
   }
 
   // Contains the new positions computed by the integration from current positions.
-  this->newPos = clCreateBuffer(this->context, CL_MEM_WRITE_ONLY, this->numParticles * sizeof(cl_double4), 0, &status);
+  this->newPos = clCreateBuffer(this->context, CL_MEM_WRITE_ONLY, deviceParticles * sizeof(cl_double4), 0, &status);
   if (status != CL_SUCCESS)
   {
     wxLogError(wxT("clCreateBuffer failed to create cl_mem object for newPos %s"), this->ErrorMessage(status));
@@ -706,7 +877,7 @@ void CLModel::CreateBufferObjects(GLuint *vbo, int numParticles, int numGrav)
   }
 
   // The current velocities of the solar system bodies.
-  this->currVel = clCreateBuffer(this->context, CL_MEM_READ_ONLY, this->numParticles * sizeof(cl_double4), 0, &status);
+  this->currVel = clCreateBuffer(this->context, CL_MEM_READ_ONLY, deviceParticles * sizeof(cl_double4), 0, &status);
   if (status != CL_SUCCESS)
   {
     wxLogError(wxT("clCreateBuffer failed to create cl_mem object for currVel %s"), this->ErrorMessage(status));
@@ -714,7 +885,7 @@ void CLModel::CreateBufferObjects(GLuint *vbo, int numParticles, int numGrav)
   }
 
   // Contains the new velocities computed by the integration from current velocities.
-  this->newVel = clCreateBuffer(this->context, CL_MEM_WRITE_ONLY, this->numParticles * sizeof(cl_double4), 0, &status);
+  this->newVel = clCreateBuffer(this->context, CL_MEM_WRITE_ONLY, deviceParticles * sizeof(cl_double4), 0, &status);
   if (status != CL_SUCCESS)
   {
     wxLogError(wxT("clCreateBuffer failed to create cl_mem object for newVel %s"), this->ErrorMessage(status));
@@ -722,7 +893,7 @@ void CLModel::CreateBufferObjects(GLuint *vbo, int numParticles, int numGrav)
   }
 
   // contains the gravitational accerations computed from the current positions by the acceleration kernel
-  this->acc = clCreateBuffer(this->context, CL_MEM_READ_WRITE, this->numParticles * sizeof(cl_double4), 0, &status);
+  this->acc = clCreateBuffer(this->context, CL_MEM_READ_WRITE, deviceParticles * sizeof(cl_double4), 0, &status);
   if (status != CL_SUCCESS)
   {
     wxLogError(wxT("clCreateBuffer failed to create cl_mem object for acc %s"), this->ErrorMessage(status));
@@ -731,7 +902,7 @@ void CLModel::CreateBufferObjects(GLuint *vbo, int numParticles, int numGrav)
 
   // This is used to hold the current position at the start of the Adams Bashforth Intgration for use by the Adams Moulton Inegrator.
   // i.e. between the AB and AM integrations the current position holds the estimated position. But the AM still needs the position from the start
-  this->posLast = clCreateBuffer(this->context, CL_MEM_READ_WRITE, this->numParticles * 1 * sizeof(cl_double4), 0, &status);
+  this->posLast = clCreateBuffer(this->context, CL_MEM_READ_WRITE, deviceParticles * 1 * sizeof(cl_double4), 0, &status);
   if (status != CL_SUCCESS)
   {
     wxLogError(wxT("clCreateBuffer failed to create cl_mem object for posLast %s"), this->ErrorMessage(status));
@@ -739,7 +910,7 @@ void CLModel::CreateBufferObjects(GLuint *vbo, int numParticles, int numGrav)
   }
 
   // This is used to hold the current velocities at the start of the Adams Bashforth Intgration for use by the Adams Moulton Integrator.
-  this->velLast = clCreateBuffer(this->context, CL_MEM_READ_WRITE, this->numParticles * 1 * sizeof(cl_double4), 0, &status);
+  this->velLast = clCreateBuffer(this->context, CL_MEM_READ_WRITE, deviceParticles * 1 * sizeof(cl_double4), 0, &status);
   if (status != CL_SUCCESS)
   {
     wxLogError(wxT("clCreateBuffer failed to create cl_mem object for velLast %s"), this->ErrorMessage(status));
@@ -748,7 +919,7 @@ void CLModel::CreateBufferObjects(GLuint *vbo, int numParticles, int numGrav)
 
   // 16 element ring buffer used to store the previous steps velocities.
   // e.g the velocity for the previous step is stored at index (step-1)&0xf
-  this->velHistory = clCreateBuffer(this->context, CL_MEM_READ_WRITE, this->numParticles * 16 * sizeof(cl_double4), 0, &status);
+  this->velHistory = clCreateBuffer(this->context, CL_MEM_READ_WRITE, deviceParticles * 16 * sizeof(cl_double4), 0, &status);
   if (status != CL_SUCCESS)
   {
     wxLogError(wxT("clCreateBuffer failed to create cl_mem object for velHistory %s"), this->ErrorMessage(status));
@@ -757,13 +928,18 @@ void CLModel::CreateBufferObjects(GLuint *vbo, int numParticles, int numGrav)
 
   // 16 element ring buffer used to store the previous steps accerlerations.
   // e.g the accerleration for the previous step is stored at index (step-1)&0xf
-  this->accHistory = clCreateBuffer(this->context, CL_MEM_READ_WRITE, this->numParticles * 16 * sizeof(cl_double4), 0, &status);
+  this->accHistory = clCreateBuffer(this->context, CL_MEM_READ_WRITE, deviceParticles * 16 * sizeof(cl_double4), 0, &status);
   if (status != CL_SUCCESS)
   {
     wxLogError(wxT("clCreateBuffer failed to create cl_mem object for accHistory %s"), this->ErrorMessage(status));
     throw status;
   }
 
+  if (this->streaming)
+  {
+    this->CreateStreamBuffers();
+  }
+
   wxLogDebug(wxT("Finished CLModel::CreateBufferObjects"));
 }
 
@@ -798,40 +974,199 @@ void CLModel::CompileProgramAndCreateKernels()
     programSource.Append(wxT("#pragma OPENCL EXTENSION cl_amd_fp64 : enable \r\n"));
   }
 
+  // Baking the body counts into the kernels lets the compiler unroll the loops over the bodies with mass and fold the history indexing.
+  // The program cache key covers the whole source, so each combination gets its own binary
+  if (this->specializeKernels)
+  {
+    programSource.Append(wxString::Format(wxT("#define SPECIALIZED_NUM_GRAV %d\r\n"), this->numGrav));
+    programSource.Append(wxString::Format(wxT("#define SPECIALIZED_HISTORY_STRIDE %d\r\n"), this->streaming ? this->chunkSize : this->numParticles));
+  }
+
+  // The acceleration kernel to build. The deterministic choice stays local to the build, so it is never shown, tuned or saved
+  // as the device's kernel
+  wxString accelerationKernel = *this->accelerationKernelName;
+
+  // A deterministic build uses the Local kernels on every device, as they take any number of bodies with mass and add them
+  // one at a time in order whatever the tile and work-group sizes. The tree, pruned, sub-group and blocked kernels are left out
+  if (this->deterministic)
+  {
+    programSource.Append(wxT("#define DETERMINISTIC\r\n"));
+    accelerationKernel = (accelerationKernel.StartsWith(wxT("newtonian")) ? wxT("newtonian") : wxT("relativistic")) + wxString(wxT("Local"));
+  }
+
+  // The tree needs a body with mass besides the Sun
+  this->treeAcceleration = accelerationKernel.EndsWith(wxT("Tree"));
+  if (this->treeAcceleration && this->numGrav < 2)
+  {
+    wxLogMessage(wxT("The Barnes-Hut tree needs at least two bodies with mass, summing them directly"));
+    accelerationKernel.RemoveLast(4);
+    this->treeAcceleration = false;
+  }
+
+  // The Subgroup kernels fall back to the constant memory ones on devices without sub-groups
+  this->subgroupAcceleration = accelerationKernel.EndsWith(wxT("Subgroup"));
+  if (this->subgroupAcceleration && !this->HasSubgroups())
+  {
+    wxLogMessage(wxT("%s has no sub-group broadcasts, using the constant memory acceleration kernel"), *this->deviceName);
+    accelerationKernel.RemoveLast(8);
+    this->subgroupAcceleration = false;
+  }
+
+  // Perturber pruning takes the place of the direct sum kernels. The masks are kept for every particle on the device,
+  // so it isn't available while streaming
+  this->maskedAcceleration = this->perturberTolerance > 0.0 && !this->treeAcceleration && !this->streaming && !this->deterministic && this->numGrav > 1;
+  if (this->maskedAcceleration)
+  {
+    this->maskWords = (this->numGrav + 31) / 32;
+    if ((cl_ulong)this->maskWords * this->numParticles * sizeof(cl_uint) > this->maxMemoryAlloc)
+    {
+      wxLogMessage(wxT("Perturber masks for %d bodies and %d with mass don't fit in one allocation, summing every body with mass"), this->numParticles, this->numGrav);
+      this->maskedAcceleration = false;
+    }
+  }
+  this->subgroupAcceleration = this->subgroupAcceleration && !this->maskedAcceleration;
+
+  // The streamed chunks would each need the frame offset of the whole state, so streaming stays barycentric
+  this->heliocentricFrame = this->heliocentric && this->numGrav > 1;
+  if (this->heliocentricFrame && this->streaming)
+  {
+    wxLogMessage(wxT("Heliocentric integration isn't available while streaming, integrating in the barycentric frame"));
+    this->heliocentricFrame = false;
+  }
+
+  // The streamed chunks are each corrected before the next is predicted, so a step's difference is only known once it can't be redone
+  this->stepControl = this->stepTolerance > 0.0;
+  if (this->stepControl && this->streaming)
+  {
+    wxLogMessage(wxT("The step size can't follow the predictor corrector difference while streaming, keeping it fixed"));
+    this->stepControl = false;
+  }
+
+  // The constant memory acceleration kernels can't hold more bodies with mass than the constant buffer,
+  // so switch to the variant that tiles them through local memory. The tree, Pruned and Subgroup kernels
+  // read them from global memory
+  if (!this->treeAcceleration && !this->maskedAcceleration && !this->subgroupAcceleration && !accelerationKernel.EndsWith(wxT("Local")) && this->numGrav > this->maxConstantNumGrav)
+  {
+    wxLogMessage(wxT("%d bodies with mass exceed the %d that fit in constant memory, using %sLocal"), this->numGrav, this->maxConstantNumGrav,
+                 accelerationKernel);
+    accelerationKernel += wxT("Local");
+  }
+  this->tiledAcceleration = !this->maskedAcceleration && accelerationKernel.EndsWith(wxT("Local"));
+  if (!this->deterministic)
+  {
+    *this->accelerationKernelName = accelerationKernel;
+  }
+
+  // Several particles per work-item only applies to the constant memory kernels
+  this->accelerationBlock = 1;
+  if (!this->tiledAcceleration && !this->treeAcceleration && !this->maskedAcceleration && !this->subgroupAcceleration && (this->particlesPerWorkItem == 2 || this->particlesPerWorkItem == 4 || this->particlesPerWorkItem == 8))
+  {
+    this->accelerationBlock = this->particlesPerWorkItem;
+    programSource.Append(wxString::Format(wxT("#define ACCELERATION_BLOCK %d\r\n"), this->accelerationBlock));
+  }
+
+  // The summation the acceleration kernels are built with, by default what each physics has always used
+  int summation = this->summation;
+  if (summation <= CLModel::summationDefault || summation >= CLModel::numSummations)
+  {
+    summation = accelerationKernel.StartsWith(wxT("newtonian")) ? CLModel::summationPlain : CLModel::summationKahan;
+  }
+  const wxChar *summationDefines[] = {wxT(""), wxT("ACCELERATION_SUM_PLAIN"), wxT("ACCELERATION_SUM_KAHAN"), wxT("ACCELERATION_SUM_BLOCKED"), wxT("ACCELERATION_SUM_MAJOR")};
+  programSource.Append(wxString::Format(wxT("#define %s\r\n"), summationDefines[summation]));
+  if (summation == CLModel::summationMajor)
+  {
+    programSource.Append(wxString::Format(wxT("#define COMPENSATED_BODIES %d\r\n"), this->compensatedBodies));
+  }
+
+  // Fixed point positions need some of the 53 bits a double holds exactly left for the whole Gm
+  if (this->fixedPointBits < 0 || this->fixedPointBits > 52)
+  {
+    wxLogMessage(wxT("%d fixed point bits is out of range, positions are floating point"), this->fixedPointBits);
+    this->fixedPointBits = 0;
+  }
+  if (this->fixedPointBits > 0)
+  {
+    programSource.Append(wxString::Format(wxT("#define FIXED_POINT_BITS %d\r\n"), this->fixedPointBits));
+  }
+
+  // The Intel shuffle is preferred, the KHR broadcast needs the program built as OpenCL C 2.0
+  // -cl-mad-enable and -cl-fast-relaxed-math let each compiler round differently
+  wxString programOptions = this->deterministic ? wxString(wxT("")) : this->buildOptions;
+  if (this->subgroupAcceleration)
+  {
+    if (this->gotIntelSubgroups)
+    {
+      programSource.Append(wxT("#define SUBGROUP_BROADCAST(x, lane) intel_sub_group_shuffle(x, lane)\r\n"));
+    }
+    else
+    {
+      programSource.Append(wxT("#pragma OPENCL EXTENSION cl_khr_subgroups : enable \r\n"));
+      programSource.Append(wxT("#define SUBGROUP_BROADCAST(x, lane) sub_group_broadcast(x, lane)\r\n"));
+      programOptions += wxT(" -cl-std=CL2.0");
+    }
+  }
+
+  programSource.Append(this->AdamsProgramSource());
+
   programSource.Append(nbodySource);
 
   const char *source = programSource.c_str();
   size_t sourceSize[] = {strlen(source)};
+  wxCharBuffer optionsBytes = programOptions.utf8_str();
+  const char *options = optionsBytes.data();
 
-  // setup a openCL program to hold the program
-  this->program = clCreateProgramWithSource(this->context, 1, &source, sourceSize, &status);
-  if (status != CL_SUCCESS)
+  // Reuse the binary built last time for this device, driver, options and source, building from source if there is none
+  wxString cacheFileName;
+  bool cached = false;
+  if (!this->programCacheDirectory.IsEmpty())
   {
-    wxLogError(wxT("clCreateProgramWithSource failed %s"), this->ErrorMessage(status));
-    throw status;
+    cacheFileName = this->ProgramCacheFileName(source, options);
+    cached = this->LoadProgramBinary(cacheFileName, options);
   }
 
-  // compile the program (kernels)
-  const char *options = "-cl-mad-enable"; // -cl-fast-relaxed-math";// "-cl-mad-enable -cl-fast-relaxed-math -cl-nv-verbose ";
-  status = clBuildProgram(this->program, 1, &this->deviceId, options, NULL, NULL);
-  if (status != CL_SUCCESS)
+  if (cached)
   {
-    // if it failed to compile then obtain the compile log and display it in an error dialog
-    wxLogError(wxT("clBuildProgram failed %s"), this->ErrorMessage(status));
-    if (status == CL_BUILD_PROGRAM_FAILURE)
+    this->programCacheHits++;
+    wxLogDebug(wxT("Loaded program binary %s"), cacheFileName);
+  }
+  else
+  {
+    this->programCacheMisses++;
+
+    // setup a openCL program to hold the program
+    this->program = clCreateProgramWithSource(this->context, 1, &source, sourceSize, &status);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clCreateProgramWithSource failed %s"), this->ErrorMessage(status));
+      throw status;
+    }
+
+    // compile the program (kernels)
+    status = clBuildProgram(this->program, 1, &this->deviceId, options, NULL, NULL);
+    if (status != CL_SUCCESS)
     {
-      // Determine the size of the log
-      size_t log_size;
-      clGetProgramBuildInfo(this->program, this->deviceId, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
+      // if it failed to compile then obtain the compile log and display it in an error dialog
+      wxLogError(wxT("clBuildProgram failed %s"), this->ErrorMessage(status));
+      if (status == CL_BUILD_PROGRAM_FAILURE)
+      {
+        // Determine the size of the log
+        size_t log_size;
+        clGetProgramBuildInfo(this->program, this->deviceId, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
 
-      // Allocate memory for the log
-      char *log = (char *)malloc(log_size);
+        // Allocate memory for the log
+        char *log = (char *)malloc(log_size);
 
-      // Get the log
-      clGetProgramBuildInfo(this->program, this->deviceId, CL_PROGRAM_BUILD_LOG, log_size, log, NULL);
-      wxLogError(log);
+        // Get the log
+        clGetProgramBuildInfo(this->program, this->deviceId, CL_PROGRAM_BUILD_LOG, log_size, log, NULL);
+        wxLogError(log);
+      }
+      throw status;
+    }
+
+    if (!cacheFileName.IsEmpty())
+    {
+      this->SaveProgramBinary(cacheFileName);
     }
-    throw status;
   }
 
   // if we are debugging then include the compile log
@@ -857,7 +1192,17 @@ void CLModel::CompileProgramAndCreateKernels()
 #endif
 
   // setup kernels (pointers?) to required compiled kernels
-  this->accKernel = clCreateKernel(this->program, this->accelerationKernelName->c_str(), &status);
+  wxString physics = accelerationKernel.StartsWith(wxT("newtonian")) ? wxT("newtonian") : wxT("relativistic");
+  wxString accKernelName = accelerationKernel;
+  if (this->accelerationBlock > 1)
+  {
+    accKernelName += wxT("Blocked");
+  }
+  else if (this->maskedAcceleration)
+  {
+    accKernelName = physics + wxT("Pruned");
+  }
+  this->accKernel = clCreateKernel(this->program, accKernelName.c_str(), &status);
   if (status != CL_SUCCESS)
   {
     wxLogError(wxT("clCreateKernel failed %s"), this->ErrorMessage(status));
@@ -894,327 +1239,3721 @@ void CLModel::CompileProgramAndCreateKernels()
     throw status;
   }
 
-  this->initialisedOk = true;
-  wxLogDebug(wxT("Finished CLModel:CompileProgramAndCreateKernels"));
-}
-
-// Excutes the kernels to advance the simulation to the next time step
-void CLModel::ExecuteKernels()
-{
+  this->copyChunkToDisplayKernel = clCreateKernel(this->program, "copyChunkToDisplay", &status);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clCreateKernel copyChunkToDisplay failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
 
-#ifdef __WXDEBUG__
-  wxLogDebug(wxT("CLModel::ExecuteKernel threadId: %ld"), wxThread::GetCurrentId());
-#endif
+  this->checkpointDeltaKernel = clCreateKernel(this->program, "checkpointDelta", &status);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clCreateKernel checkpointDelta failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
 
-  cl_int status = CL_SUCCESS;
+  this->archiveEncodeKernel = clCreateKernel(this->program, "archiveEncode", &status);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clCreateKernel archiveEncode failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
 
-  if (!this->initialisedOk)
+  this->chebyshevAccumulateKernel = clCreateKernel(this->program, "chebyshevAccumulate", &status);
+  if (status != CL_SUCCESS)
   {
-    wxLogDebug(wxT("Aborted CLModel failed to Initialise"));
-    throw -1;
+    wxLogError(wxT("clCreateKernel chebyshevAccumulate failed %s"), this->ErrorMessage(status));
+    throw status;
   }
 
-  // TODO this should be per kernel. Not the lowest that works for all of them
-  size_t globalThreads[] = {(size_t)this->numParticles};
-  size_t localThreads[] = {this->groupSize};
+  this->chebyshevSolveKernel = clCreateKernel(this->program, "chebyshevSolve", &status);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clCreateKernel chebyshevSolve failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
 
-  if (localThreads[0] > this->maxWorkItemSizes[0] || localThreads[0] > this->maxWorkGroupSize)
+  this->denseOutputKernel = clCreateKernel(this->program, "denseOutput", &status);
+  if (status != CL_SUCCESS)
   {
-    wxLogError(wxT("groupSize %llu is greater than maxWorkItemSizes %llu or maxWorkGroupSize %llu"), (unsigned long long)this->groupSize, (unsigned long long)this->maxWorkItemSizes[0], (unsigned long long)this->maxWorkGroupSize);
-    throw -1;
+    wxLogError(wxT("clCreateKernel denseOutput failed %s"), this->ErrorMessage(status));
+    throw status;
   }
 
-  status = clFinish(this->commandQueue);
+  this->keplerFastForwardKernel = clCreateKernel(this->program, "keplerFastForward", &status);
   if (status != CL_SUCCESS)
   {
-    wxLogError(wxT("clFinish failed %s"), this->ErrorMessage(status));
+    wxLogError(wxT("clCreateKernel keplerFastForward failed %s"), this->ErrorMessage(status));
     throw status;
   }
 
-  // Execute acceleration kernel on given device
-  // cl_event  eventND[1];
-  status = clEnqueueNDRangeKernel(this->commandQueue, this->accKernel, 1, NULL, globalThreads, localThreads, 0, 0, NULL);
+  this->orbitalToStateVectorsKernel = clCreateKernel(this->program, "orbitalToStateVectors", &status);
   if (status != CL_SUCCESS)
   {
-    wxLogError(wxT("clEnqueueNDRangeKernel failed %s"), this->ErrorMessage(status));
+    wxLogError(wxT("clCreateKernel orbitalToStateVectors failed %s"), this->ErrorMessage(status));
     throw status;
   }
 
-  status = clFlush(this->commandQueue);
+  this->twoPhaseTestParticlesKernel = clCreateKernel(this->program, "twoPhaseTestParticles", &status);
   if (status != CL_SUCCESS)
   {
-    wxLogError(wxT("clFlush failed %s"), this->ErrorMessage(status));
+    wxLogError(wxT("clCreateKernel twoPhaseTestParticles failed %s"), this->ErrorMessage(status));
     throw status;
   }
 
-  if (this->deviceCLVersionNumber >= 1.2)
+  // The tree is there to avoid summing every pair of bodies with mass
+  this->pairAcceleration = this->pairwiseMassive && !this->treeAcceleration && this->numGrav > 1;
+  if (this->pairAcceleration)
   {
-    status = clEnqueueBarrierWithWaitList(this->commandQueue, 0, NULL, NULL);
+    this->gravPairsKernel = clCreateKernel(this->program, "gravPairs", &status);
     if (status != CL_SUCCESS)
     {
-      wxLogError(wxT("clEnqueueBarrierWithWaitList failed %s"), this->ErrorMessage(status));
+      wxLogError(wxT("clCreateKernel gravPairs failed %s"), this->ErrorMessage(status));
       throw status;
     }
-    wxLogDebug(wxT("CLModel::ExecuteKernels clEnqueueBarrierWithWaitList()"));
   }
-  else
+
+  if (this->treeAcceleration)
   {
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
-    status = clEnqueueBarrier(this->commandQueue);
-#pragma GCC diagnostic pop
+    const char *treeKernelNames[] = {"treeBounds", "treeMortonKeys", "treeSortStep", "treeBuild", "treeSummarise"};
+    cl_kernel *treeKernels[] = {&this->treeBoundsKernel, &this->treeMortonKeysKernel, &this->treeSortStepKernel, &this->treeBuildKernel, &this->treeSummariseKernel};
+    for (int kernel = 0; kernel < 5; kernel++)
+    {
+      *treeKernels[kernel] = clCreateKernel(this->program, treeKernelNames[kernel], &status);
+      if (status != CL_SUCCESS)
+      {
+        wxLogError(wxT("clCreateKernel %s failed %s"), treeKernelNames[kernel], this->ErrorMessage(status));
+        throw status;
+      }
+    }
+  }
+
+  if (this->maskedAcceleration)
+  {
+    this->perturberMaskKernel = clCreateKernel(this->program, "perturberMask", &status);
     if (status != CL_SUCCESS)
     {
-      wxLogError(wxT("clEnqueueBarrier failed %s"), this->ErrorMessage(status));
+      wxLogError(wxT("clCreateKernel perturberMask failed %s"), this->ErrorMessage(status));
       throw status;
     }
-    wxLogDebug(wxT("CLModel::ExecuteKernels clEnqueueBarrier()"));
   }
 
-  // for the first 16 steps we call the startupKernel. This populates the 16 element ring buffer
-  // It is current very inaccurate and uses a 1st order Adams Bashford Moulton followed by a 2nd order
-  // follows by several 4th orders steps until all 16 elements in the history ring buffer have been set.
-  // It needs to be replaced with a Runge Kutta 7th order with a smaller step size (1/10th?)
-  if (this->step < 16)
+  // The direct sum over local memory tiles works for any number of bodies with mass
+  if (this->treeAcceleration || this->maskedAcceleration)
   {
-    wxLogDebug(wxT("CLModel:Using startupKernel"));
-
-    status = clSetKernelArg(this->startupKernel, 6, sizeof(cl_int), (void *)&this->stage);
+    wxString referenceName = physics + wxT("Local");
+    this->referenceKernel = clCreateKernel(this->program, referenceName.c_str(), &status);
     if (status != CL_SUCCESS)
     {
-      wxLogError(wxT("clSetKernelArg 6 startupKernel failed for stage %s"), this->ErrorMessage(status));
+      wxLogError(wxT("clCreateKernel %s failed %s"), referenceName, this->ErrorMessage(status));
       throw status;
     }
+  }
 
-    status = clSetKernelArg(this->startupKernel, 7, sizeof(cl_int), (void *)&this->step);
+  // Streamed positions are rounded on the host as they are loaded
+  if (this->fixedPointBits > 0 && !this->streaming)
+  {
+    this->fixedPointKernel = clCreateKernel(this->program, "fixedPointPositions", &status);
     if (status != CL_SUCCESS)
     {
-      wxLogError(wxT("clSetKernelArg 7 startupKernel failed for step %s"), this->ErrorMessage(status));
+      wxLogError(wxT("clCreateKernel fixedPointPositions failed %s"), this->ErrorMessage(status));
       throw status;
     }
+  }
 
-    // use reuse event?
-    status = clEnqueueNDRangeKernel(this->commandQueue, this->startupKernel, 1, NULL, globalThreads, localThreads, 0, 0, NULL);
+  // The history of streamed chunks is on the host, so changing the step there restarts it
+  if (!this->streaming)
+  {
+    this->rescaleHistoryKernel = clCreateKernel(this->program, "rescaleHistory", &status);
     if (status != CL_SUCCESS)
     {
-      wxLogError(wxT("clEnqueueNDRangeKernel startupKernel failed %s"), this->ErrorMessage(status));
+      wxLogError(wxT("clCreateKernel rescaleHistory failed %s"), this->ErrorMessage(status));
       throw status;
     }
   }
-  else
+
+  if (this->stepControl)
   {
-    // The Integration has two stages
-    // The first, Adams Bashford Integration, computes an initial estimate of the next position and velocity
-    // The second,Adams Moulton Integration, takes the estimates, combined with the acceration at estimate position
-    // and compute a more exact position and velocity
-    // The first stage is also called the Predictor stage, the second stage the corrector stage.
-    // Note that it is possible to iterate the corrector stage to increase the accurarcy.
-    if (stage == 1)
+    this->stepErrorKernel = clCreateKernel(this->program, "stepError", &status);
+    if (status != CL_SUCCESS)
     {
-      // Update arguments for the AdamsBashfordKernel then Execute it
-      status = clSetKernelArg(this->adamsBashforthKernel, 6, sizeof(cl_int), (void *)&this->stage);
-      if (status != CL_SUCCESS)
-      {
-        wxLogError(wxT("clSetKernelArg 6 adamsBashforthKernel failed for stage %s"), this->ErrorMessage(status));
-        throw status;
-      }
-
-      status = clSetKernelArg(this->adamsBashforthKernel, 7, sizeof(cl_int), (void *)&this->step);
-      if (status != CL_SUCCESS)
-      {
-        wxLogError(wxT("clSetKernelArg 7 adamsBashforthKernel failed for step %s"), this->ErrorMessage(status));
-        throw status;
-      }
-
-      // use reuse event?
-      status = clEnqueueNDRangeKernel(this->commandQueue, this->adamsBashforthKernel, 1, NULL, globalThreads, localThreads, 0, 0, NULL);
-      if (status != CL_SUCCESS)
-      {
-        wxLogError(wxT("clEnqueueNDRangeKernel adamsBashforthKernel failed %s"), this->ErrorMessage(status));
-        throw status;
-      }
+      wxLogError(wxT("clCreateKernel stepError failed %s"), this->ErrorMessage(status));
+      throw status;
     }
-    else
-    {
-      // Update arguments for the adamsMoultonKernel then Execute it
-      status = clSetKernelArg(this->adamsMoultonKernel, 6, sizeof(cl_int), (void *)&this->stage);
-      if (status != CL_SUCCESS)
-      {
-        wxLogError(wxT("clSetKernelArg 6 adamsMoultonKernel failed for stage %s"), this->ErrorMessage(status));
-        throw status;
-      }
-
-      status = clSetKernelArg(this->adamsMoultonKernel, 7, sizeof(cl_int), (void *)&this->step);
-      if (status != CL_SUCCESS)
-      {
-        wxLogError(wxT("clSetKernelArg 7 adamsMoultonKernel failed for step %s"), this->ErrorMessage(status));
-        throw status;
-      }
+  }
 
-      // use reuse event?
-      status = clEnqueueNDRangeKernel(this->commandQueue, this->adamsMoultonKernel, 1, NULL, globalThreads, localThreads, 0, 0, NULL);
+  if (this->heliocentricFrame)
+  {
+    cl_kernel *frameKernels[] = {&this->heliocentricIndirectKernel, &this->addIndirectKernel, &this->frameOffsetKernel, &this->frameShiftKernel};
+    const char *frameKernelNames[] = {"heliocentricIndirect", "addIndirect", "frameOffset", "frameShift"};
+    for (int kernel = 0; kernel < 4; kernel++)
+    {
+      *frameKernels[kernel] = clCreateKernel(this->program, frameKernelNames[kernel], &status);
       if (status != CL_SUCCESS)
       {
-        wxLogError(wxT("clEnqueueNDRangeKernel failed %s"), this->ErrorMessage(status));
+        wxLogError(wxT("clCreateKernel %s failed %s"), frameKernelNames[kernel], this->ErrorMessage(status));
         throw status;
       }
     }
   }
 
-  status = clFlush(this->commandQueue);
-  if (status != CL_SUCCESS)
-  {
-    wxLogError(wxT("clFlush failed %s"), this->ErrorMessage(status));
-    throw status;
-  }
-
+  this->initialisedOk = true;
+  wxLogDebug(wxT("Finished CLModel:CompileProgramAndCreateKernels"));
+}
+
+// Selects the Adams-Bashforth predictor of order and the Adams-Moulton corrector with the same number of nodes.
+// Takes effect when the program is next built
+void CLModel::SetAdamsOrder(int order)
+{
+  *this->adamsBashforthKernelName = wxString::Format(wxT("adamsBashforth%d"), order);
+  *this->adamsMoultonKernelName = wxString::Format(wxT("adamsMoulton%d"), order - 1);
+}
+
+// Order of the selected Adams-Bashforth kernel
+int CLModel::AdamsOrder()
+{
+  long order = 0;
+  if (!this->adamsBashforthKernelName->Mid(wxStrlen(wxT("adamsBashforth"))).ToLong(&order) || order < CLModel::minAdamsOrder || order > CLModel::maxAdamsOrder)
+  {
+    wxLogError(wxT("%s is not an Adams-Bashforth kernel of order %d to %d"), *this->adamsBashforthKernelName, CLModel::minAdamsOrder, CLModel::maxAdamsOrder);
+    throw -1;
+  }
+  return (int)order;
+}
+
+// Defines that instantiate the Adams kernel template in the kernels for the selected order, with its coefficients
+wxString CLModel::AdamsProgramSource()
+{
+  int order = this->AdamsOrder();
+  wxString source;
+  source.Append(wxString::Format(wxT("#define ADAMS_ORDER %d\r\n"), order));
+  source.Append(wxString::Format(wxT("#define ADAMS_MOULTON_ORDER %d\r\n"), order - 1));
+
+  const double *tables[2] = {AdamsCoefficients::table.bashforth[order], AdamsCoefficients::table.moulton[order]};
+  const wxChar *names[2] = {wxT("adamsBashforthCoefficients"), wxT("adamsMoultonCoefficients")};
+  for (int table = 0; table < 2; table++)
+  {
+    source.Append(wxString::Format(wxT("__constant double %s[%d] = {"), names[table], order));
+    for (int node = 0; node < order; node++)
+    {
+      source.Append(wxString::Format(wxT("%s%.17e"), node > 0 ? wxT(", ") : wxT(""), tables[table][node]));
+    }
+    source.Append(wxT("};\r\n"));
+  }
+  return source;
+}
+
+// Excutes the kernels to advance the simulation to the next time step
+void CLModel::ExecuteKernels()
+{
+
+#ifdef __WXDEBUG__
+  wxLogDebug(wxT("CLModel::ExecuteKernel threadId: %ld"), wxThread::GetCurrentId());
+#endif
+
+  if (!this->initialisedOk)
+  {
+    wxLogDebug(wxT("Aborted CLModel failed to Initialise"));
+    throw -1;
+  }
+
+  // TODO this should be per kernel. Not the lowest that works for all of them
+  // Particles past activeParticles are frozen by a Kepler fast forward and skipped
+  size_t globalThreads[] = {(size_t)this->activeParticles};
+  size_t localThreads[] = {this->groupSize};
+
+  if (localThreads[0] > this->maxWorkItemSizes[0] || localThreads[0] > this->maxWorkGroupSize)
+  {
+    wxLogError(wxT("groupSize %llu is greater than maxWorkItemSizes %llu or maxWorkGroupSize %llu"), (unsigned long long)this->groupSize, (unsigned long long)this->maxWorkItemSizes[0], (unsigned long long)this->maxWorkGroupSize);
+    throw -1;
+  }
+
+  if (this->streaming)
+  {
+    this->ExecuteStreamingStage();
+    this->EndStage();
+    return;
+  }
+
+  this->EnqueueStage(globalThreads[0], this->stepControl);
+  this->EndStage();
+  wxLogDebug(wxT("CLModel:ExecuteKernel Done"));
+}
+
+// Global size of the acceleration kernel for numThreads particles. A Blocked kernel is told how many particles to write
+// and needs a work-item per accelerationBlock of them, rounded up to whole work-groups
+size_t CLModel::AccelerationThreads(size_t numThreads)
+{
+  if (this->accelerationBlock <= 1)
+  {
+    return numThreads;
+  }
+
+  cl_int numTargets = (cl_int)numThreads;
+  cl_int status = clSetKernelArg(this->accKernel, this->accTargetsArg, sizeof(cl_int), (void *)&numTargets);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg failed for numTargets %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  size_t workItems = (numThreads + this->accelerationBlock - 1) / this->accelerationBlock;
+  return ((workItems + this->groupSize - 1) / this->groupSize) * this->groupSize;
+}
+
+// Enqueues the acceleration kernel over the first numThreads particles of the buffers it is pointed at.
+// With pairwise accelerations for the bodies with mass it starts at the work-group holding the last of them,
+// then gravPairs overwrites the bodies with mass, if the buffers hold them
+void CLModel::EnqueueAcceleration(cl_command_queue queue, size_t numThreads, bool withMassive)
+{
+  cl_int status = CL_SUCCESS;
+  size_t localThreads[] = {this->groupSize};
+  size_t offset[] = {0};
+  size_t accThreads[] = {this->AccelerationThreads(numThreads)};
+
+  // A Blocked kernel spreads its particles over the whole launch, so it can't start part way
+  if (this->pairAcceleration && withMassive && this->accelerationBlock == 1)
+  {
+    offset[0] = (this->numGrav / this->groupSize) * this->groupSize;
+    offset[0] = offset[0] < numThreads ? offset[0] : numThreads;
+    accThreads[0] = numThreads - offset[0];
+  }
+
+  if (accThreads[0] > 0)
+  {
+    status = clEnqueueNDRangeKernel(queue, this->accKernel, 1, offset, accThreads, localThreads, 0, NULL, NULL);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clEnqueueNDRangeKernel accKernel failed %s"), this->ErrorMessage(status));
+      throw status;
+    }
+  }
+
+  if (this->pairAcceleration && withMassive)
+  {
+    size_t pairThreads[] = {this->pairGroupSize};
+    status = clEnqueueNDRangeKernel(queue, this->gravPairsKernel, 1, NULL, pairThreads, pairThreads, 0, NULL, NULL);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clEnqueueNDRangeKernel gravPairs failed %s"), this->ErrorMessage(status));
+      throw status;
+    }
+  }
+}
+
+// Enqueues everything that finds acc at currPos for the first numThreads particles, with the indirect term in the heliocentric frame
+void CLModel::EnqueueAccelerations(size_t numThreads)
+{
+  cl_int status = CL_SUCCESS;
+  size_t globalThreads[] = {numThreads};
+  size_t localThreads[] = {this->groupSize};
+
+  if (this->treeAcceleration)
+  {
+    this->EnqueueTreeBuild(this->commandQueue);
+  }
+
+  // The masks hold for perturberRefreshSteps steps from when they were built, going back in time needs new ones too
+  if (this->maskedAcceleration && (this->maskStep < 0 || this->step < this->maskStep || this->step - this->maskStep >= this->perturberRefreshSteps ||
+                                   (cl_int)numThreads > this->maskParticles))
+  {
+    this->EnqueuePerturberMask(numThreads);
+  }
+
+  // Execute acceleration kernel on given device
+  // cl_event  eventND[1];
+  this->EnqueueAcceleration(this->commandQueue, numThreads, true);
+
+  if (this->heliocentricFrame)
+  {
+    size_t indirectThreads[] = {1};
+    status = clEnqueueNDRangeKernel(this->commandQueue, this->heliocentricIndirectKernel, 1, NULL, indirectThreads, indirectThreads, 0, NULL, NULL);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clEnqueueNDRangeKernel heliocentricIndirect failed %s"), this->ErrorMessage(status));
+      throw status;
+    }
+
+    status = clEnqueueNDRangeKernel(this->commandQueue, this->addIndirectKernel, 1, NULL, globalThreads, localThreads, 0, NULL, NULL);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clEnqueueNDRangeKernel addIndirect failed %s"), this->ErrorMessage(status));
+      throw status;
+    }
+  }
+}
+
+// Runs the kernels of the current stage over the first numThreads particles and makes the results current.
+// The caller advances the stage
+void CLModel::EnqueueStage(size_t numThreads, bool measureError)
+{
+  cl_int status = CL_SUCCESS;
+  size_t globalThreads[] = {numThreads};
+  size_t localThreads[] = {this->groupSize};
+
+  status = clFinish(this->commandQueue);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clFinish failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  this->EnqueueAccelerations(numThreads);
+
+  status = clFlush(this->commandQueue);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clFlush failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  if (this->deviceCLVersionNumber >= 1.2)
+  {
+    status = clEnqueueBarrierWithWaitList(this->commandQueue, 0, NULL, NULL);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clEnqueueBarrierWithWaitList failed %s"), this->ErrorMessage(status));
+      throw status;
+    }
+    wxLogDebug(wxT("CLModel::ExecuteKernels clEnqueueBarrierWithWaitList()"));
+  }
+  else
+  {
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+    status = clEnqueueBarrier(this->commandQueue);
+#pragma GCC diagnostic pop
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clEnqueueBarrier failed %s"), this->ErrorMessage(status));
+      throw status;
+    }
+    wxLogDebug(wxT("CLModel::ExecuteKernels clEnqueueBarrier()"));
+  }
+
+  // A change of step size decided at the end of the last step, now the current acceleration is known.
+  // One left over from before the step was reset is dropped
+  if (this->rescaleRatio != 1.0 && this->stage == this->numStages)
+  {
+    if (this->step == this->rescaleStep)
+    {
+      this->EnqueueRescaleHistory();
+    }
+    this->rescaleRatio = 1.0;
+  }
+
+  // for the first 16 steps we call the startupKernel. This populates the 16 element ring buffer
+  // It is current very inaccurate and uses a 1st order Adams Bashford Moulton followed by a 2nd order
+  // follows by several 4th orders steps until all 16 elements in the history ring buffer have been set.
+  // It needs to be replaced with a Runge Kutta 7th order with a smaller step size (1/10th?)
+  if (this->step < 16)
+  {
+    wxLogDebug(wxT("CLModel:Using startupKernel"));
+
+    status = clSetKernelArg(this->startupKernel, 6, sizeof(cl_int), (void *)&this->stage);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clSetKernelArg 6 startupKernel failed for stage %s"), this->ErrorMessage(status));
+      throw status;
+    }
+
+    status = clSetKernelArg(this->startupKernel, 7, sizeof(cl_int), (void *)&this->step);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clSetKernelArg 7 startupKernel failed for step %s"), this->ErrorMessage(status));
+      throw status;
+    }
+
+    // use reuse event?
+    status = clEnqueueNDRangeKernel(this->commandQueue, this->startupKernel, 1, NULL, globalThreads, localThreads, 0, 0, NULL);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clEnqueueNDRangeKernel startupKernel failed %s"), this->ErrorMessage(status));
+      throw status;
+    }
+  }
+  else
+  {
+    // The Integration has two stages
+    // The first, Adams Bashford Integration, computes an initial estimate of the next position and velocity
+    // The second,Adams Moulton Integration, takes the estimates, combined with the acceration at estimate position
+    // and compute a more exact position and velocity
+    // The first stage is also called the Predictor stage, the second stage the corrector stage.
+    // Note that it is possible to iterate the corrector stage to increase the accurarcy.
+    if (stage == 1)
+    {
+      // Update arguments for the AdamsBashfordKernel then Execute it
+      status = clSetKernelArg(this->adamsBashforthKernel, 6, sizeof(cl_int), (void *)&this->stage);
+      if (status != CL_SUCCESS)
+      {
+        wxLogError(wxT("clSetKernelArg 6 adamsBashforthKernel failed for stage %s"), this->ErrorMessage(status));
+        throw status;
+      }
+
+      status = clSetKernelArg(this->adamsBashforthKernel, 7, sizeof(cl_int), (void *)&this->step);
+      if (status != CL_SUCCESS)
+      {
+        wxLogError(wxT("clSetKernelArg 7 adamsBashforthKernel failed for step %s"), this->ErrorMessage(status));
+        throw status;
+      }
+
+      // use reuse event?
+      status = clEnqueueNDRangeKernel(this->commandQueue, this->adamsBashforthKernel, 1, NULL, globalThreads, localThreads, 0, 0, NULL);
+      if (status != CL_SUCCESS)
+      {
+        wxLogError(wxT("clEnqueueNDRangeKernel adamsBashforthKernel failed %s"), this->ErrorMessage(status));
+        throw status;
+      }
+    }
+    else
+    {
+      // Update arguments for the adamsMoultonKernel then Execute it
+      status = clSetKernelArg(this->adamsMoultonKernel, 6, sizeof(cl_int), (void *)&this->stage);
+      if (status != CL_SUCCESS)
+      {
+        wxLogError(wxT("clSetKernelArg 6 adamsMoultonKernel failed for stage %s"), this->ErrorMessage(status));
+        throw status;
+      }
+
+      status = clSetKernelArg(this->adamsMoultonKernel, 7, sizeof(cl_int), (void *)&this->step);
+      if (status != CL_SUCCESS)
+      {
+        wxLogError(wxT("clSetKernelArg 7 adamsMoultonKernel failed for step %s"), this->ErrorMessage(status));
+        throw status;
+      }
+
+      // use reuse event?
+      status = clEnqueueNDRangeKernel(this->commandQueue, this->adamsMoultonKernel, 1, NULL, globalThreads, localThreads, 0, 0, NULL);
+      if (status != CL_SUCCESS)
+      {
+        wxLogError(wxT("clEnqueueNDRangeKernel failed %s"), this->ErrorMessage(status));
+        throw status;
+      }
+    }
+  }
+
+  status = clFlush(this->commandQueue);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clFlush failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
   if (this->deviceCLVersionNumber >= 1.2)
   {
-    status = clEnqueueBarrierWithWaitList(this->commandQueue, 0, NULL, NULL);
+    status = clEnqueueBarrierWithWaitList(this->commandQueue, 0, NULL, NULL);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clEnqueueBarrierWithWaitList failed %s"), this->ErrorMessage(status));
+      throw status;
+    }
+    wxLogDebug(wxT("CLModel::ExecuteKernels clEnqueueBarrierWithWaitList()"));
+  }
+  else
+  {
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+    status = clEnqueueBarrier(this->commandQueue);
+#pragma GCC diagnostic pop
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clEnqueueBarrier failed %s"), this->ErrorMessage(status));
+      throw status;
+    }
+    wxLogDebug(wxT("CLModel::ExecuteKernels clEnqueueBarrier()"));
+  }
+
+  // currPos still holds the predicted positions the corrector started from
+  if (measureError && this->step >= 16 && this->stage == 0)
+  {
+    this->EnqueueStepError(numThreads);
+  }
+
+  // Copy new positions to current position
+  status = clEnqueueCopyBuffer(commandQueue, this->newPos, this->currPos, 0, 0, sizeof(cl_double4) * numThreads, 0, 0, 0);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clEnqueueCopyBuffer newPos to currPos failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  // Copy new positions of the bodies with mass to gravPos
+  status = clEnqueueCopyBuffer(commandQueue, this->newPos, this->gravPos, 0, 0, sizeof(cl_double4) * this->numGrav, 0, 0, 0);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clEnqueueCopyBuffer newPos to gravPos failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+  // Copy new velocities to current velocities
+  status = clEnqueueCopyBuffer(commandQueue, this->newVel, this->currVel, 0, 0, sizeof(cl_double4) * numThreads, 0, 0, 0);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clEnqueueCopyBuffer newVel to currVel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  if (this->deviceCLVersionNumber >= 1.2)
+  {
+    status = clEnqueueBarrierWithWaitList(this->commandQueue, 0, NULL, NULL);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clEnqueueBarrierWithWaitList failed %s"), this->ErrorMessage(status));
+      throw status;
+    }
+    wxLogDebug(wxT("CLModel::ExecuteKernels clEnqueueBarrierWithWaitList()"));
+  }
+  else
+  {
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+    status = clEnqueueBarrier(this->commandQueue);
+#pragma GCC diagnostic pop
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clEnqueueBarrier failed %s"), this->ErrorMessage(status));
+      throw status;
+    }
+    wxLogDebug(wxT("CLModel::ExecuteKernels clEnqueueBarrier()"));
+  }
+}
+
+// Aquire the GL points buffer and then copy the positions to it
+void CLModel::UpdateDisplay()
+{
+
+#ifdef __WXDEBUG__
+  wxLogDebug(wxT("CLModel::UpdateDisplay threadId: %ld"), wxThread::GetCurrentId());
+#endif
+
+  cl_int status = CL_SUCCESS;
+
+  if (!this->initialisedOk)
+  {
+    wxLogDebug(wxT("Aborted CLModel failed to Initialise"));
+    throw -1;
+  }
+
+  // TODO this should be per kernel. Not the lowest that works for all of them
+  size_t globalThreads[] = {(size_t)this->numParticles};
+  size_t localThreads[] = {this->groupSize};
+
+  if (localThreads[0] > this->maxWorkItemSizes[0] || localThreads[0] > this->maxWorkGroupSize)
+  {
+    wxLogError(wxT("groupSize %llu is greater than maxWorkItemSizes %llu or maxWorkGroupSize %llu"), (unsigned long long)this->groupSize, (unsigned long long)this->maxWorkItemSizes[0], (unsigned long long)this->maxWorkGroupSize);
+    throw -1;
+  }
+
+  if (this->streaming)
+  {
+    this->UpdateStreamingDisplay();
+    return;
+  }
+
+  // Execute acceleration kernel on given device
+  // glFinish();
+
+  wxLogDebug(wxT("CLModel::UpdateDisplay clEnqueueAcquireGLObjects()"));
+
+  // cl_event  eventND[1];
+  //  Acquire GL buffer
+  status = clEnqueueAcquireGLObjects(this->commandQueue, 1, &this->dispPos, 0, 0, NULL);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clEnqueueAcquireGLObjects failed to acquire dispPos %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  // Copy new positions, or the dense output positions, to the display vertex buffer
+  status = clSetKernelArg(this->copyToDisplayKernel, 0, sizeof(cl_mem), (void *)(this->displayingDenseOutput ? &this->denseGravPos : &this->gravPos));
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 0 failed for gravPos %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->copyToDisplayKernel, 1, sizeof(cl_mem), (void *)(this->displayingDenseOutput ? &this->densePos : &this->currPos));
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 1 failed for currPos %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  // update the copyToDisplayKernel's centerBody argument so it knows which body to offset the posistions against
+  status = clSetKernelArg(this->copyToDisplayKernel, 3, sizeof(cl_int), (void *)&this->centerBody);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 3 failed for centerBody %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  // use reuse event?
+  status = clEnqueueNDRangeKernel(this->commandQueue, this->copyToDisplayKernel, 1, NULL, globalThreads, localThreads, 0, 0, NULL);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clEnqueueNDRangeKernel copyToDisplayKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  // Release GL buffer
+  status = clEnqueueReleaseGLObjects(this->commandQueue, 1, &this->dispPos, 0, 0, NULL);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clEnqueueReleaseGLObjects failed to release dispPos %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clFinish(this->commandQueue);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clFinish failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  wxLogDebug(wxT("CLModel::UpdateDisplay clFinish()"));
+  wxLogDebug(wxT("CLModel:UpdateDisplay Done"));
+}
+
+// initialise the kernels so they are ready to be called.
+void CLModel::SetKernelArgumentsAndGroupSize()
+{
+
+#ifdef __WXDEBUG__
+  wxLogDebug(wxT("CLModel::SetKernelArgumentsAndGroupSize threadId: %ld"), wxThread::GetCurrentId());
+#endif
+
+  if (!this->initialisedOk)
+  {
+    wxLogDebug(wxT("Aborted CLModel failed to Initialise"));
+    throw -1;
+  }
+
+  cl_int status;
+  int paramNumber = 0;
+
+  /*
+    __kernel
+    void copyToDisplay(
+      __constant double4* pos,
+      __global double4* dispPos,
+      int centerBodyIndex
+    )
+  */
+  status = clSetKernelArg(this->copyToDisplayKernel, paramNumber++, sizeof(cl_mem), (void *)&this->gravPos);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg failed for gravPos %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->copyToDisplayKernel, paramNumber++, sizeof(cl_mem), (void *)&this->currPos);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg failed for currPos %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->copyToDisplayKernel, paramNumber++, sizeof(cl_mem), (void *)&this->dispPos);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg failed for dispPos %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->copyToDisplayKernel, paramNumber++, sizeof(cl_int), (void *)&this->centerBody);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg failed for centerBody %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  /* Set appropriate arguments to the kernel
+  __kernel void computeAcc(
+     __constant double4* gravPos,
+     __global double4* pos,
+     int numGrav,
+     double epsSqr,
+     __global double4* acc)
+     the Local kernels take __global gravPos and add
+     __local double4* gravTile,
+     int tileSize
+     and the Blocked kernels add
+     int numTargets
+     and the Pruned kernels take __global gravPos and add
+     __global const uint* mask,
+     int maskStride
+  */
+  paramNumber = 0;
+  status = clSetKernelArg(this->accKernel, paramNumber++, sizeof(cl_mem), (void *)&this->gravPos);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg failed for gravPos %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->accKernel, paramNumber++, sizeof(cl_mem), (void *)&this->currPos);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg failed for currPos %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  // the acceleration kernel that includes relativistic corrections need the relativistic parameter stored
+  // in .w. We pass the whole velocity vector in case it can be used in a more complicated relativistic on MOND type kernel
+  if (!this->accelerationKernelName->StartsWith(wxT("newtonian")))
+  {
+    status = clSetKernelArg(this->accKernel, paramNumber++, sizeof(cl_mem), (void *)&this->currVel);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clSetKernelArg failed for currVel %s"), this->ErrorMessage(status));
+      throw status;
+    }
+  }
+
+  status = clSetKernelArg(this->accKernel, paramNumber++, sizeof(cl_int), (void *)&this->numGrav);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg failed for numGrav %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->accKernel, paramNumber++, sizeof(cl_double), (void *)&this->espSqr);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg failed for espSqr %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->accKernel, paramNumber++, sizeof(cl_mem), (void *)&this->acc);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg failed for acc %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  if (this->accelerationBlock > 1)
+  {
+    this->accTargetsArg = paramNumber++;
+    this->AccelerationThreads(this->numParticles);
+  }
+
+  if (this->maskedAcceleration)
+  {
+    if (this->perturberMask == NULL)
+    {
+      this->perturberMask = clCreateBuffer(this->context, CL_MEM_READ_WRITE, (size_t)this->maskWords * this->numParticles * sizeof(cl_uint), 0, &status);
+      if (status != CL_SUCCESS)
+      {
+        wxLogError(wxT("clCreateBuffer failed to create cl_mem object for perturberMask %s"), this->ErrorMessage(status));
+        throw status;
+      }
+    }
+
+    status = clSetKernelArg(this->accKernel, paramNumber++, sizeof(cl_mem), (void *)&this->perturberMask);
+    status |= clSetKernelArg(this->accKernel, paramNumber++, sizeof(cl_int), (void *)&this->numParticles);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clSetKernelArg failed for perturberMask %s"), this->ErrorMessage(status));
+      throw status;
+    }
+  }
+
+  if (this->treeAcceleration)
+  {
+    this->CreateTreeBuffers();
+
+    cl_double thetaSqr = this->treeOpeningAngle * this->treeOpeningAngle;
+    size_t argSizes[5] = {sizeof(cl_mem), sizeof(cl_mem), sizeof(cl_mem), sizeof(cl_mem), sizeof(cl_double)};
+    void *argValues[5] = {(void *)&this->treeChildren, (void *)&this->treeCom, (void *)&this->treeMin, (void *)&this->treeMax, (void *)&thetaSqr};
+    for (int arg = 0; arg < 5; arg++)
+    {
+      status = clSetKernelArg(this->accKernel, paramNumber++, argSizes[arg], argValues[arg]);
+      if (status != CL_SUCCESS)
+      {
+        wxLogError(wxT("clSetKernelArg %d failed for the tree %s"), paramNumber - 1, this->ErrorMessage(status));
+        throw status;
+      }
+    }
+  }
+
+  if (this->tiledAcceleration)
+  {
+    status = clSetKernelArg(this->accKernel, paramNumber++, sizeof(cl_double4) * this->gravTileSize, NULL);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clSetKernelArg failed for gravTile %s"), this->ErrorMessage(status));
+      throw status;
+    }
+
+    status = clSetKernelArg(this->accKernel, paramNumber++, sizeof(cl_int), (void *)&this->gravTileSize);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clSetKernelArg failed for tileSize %s"), this->ErrorMessage(status));
+      throw status;
+    }
+  }
+
+  // set integration kernel args
+  SetAdamsKernelArgs(this->startupKernel);
+  SetAdamsKernelArgs(this->adamsBashforthKernel);
+  SetAdamsKernelArgs(this->adamsMoultonKernel);
+
+  // I'm a bit paranoid here. I set the group size to the smallest that will work for all the kernels
+  // perhap each kernel should use the largest group size possible for it. But I don't do that.
+  /* Check group size against group size returned by kernel */
+  status = clGetKernelWorkGroupInfo(this->accKernel, this->deviceId, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &this->accKernelWorkGroupSize, 0);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("getting accKernel kernel CL_KERNEL_WORK_GROUP_SIZE failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  wxLogDebug(wxT("accKernel Work Group Size %llu"), (unsigned long long)this->accKernelWorkGroupSize);
+
+  if (this->groupSize > this->accKernelWorkGroupSize)
+  {
+    wxLogDebug(wxT("Group size larger than max acc kernel group size"));
+    this->groupSize = this->accKernelWorkGroupSize;
+  }
+
+  status = clGetKernelWorkGroupInfo(this->startupKernel, this->deviceId, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &this->startupKernelWorkGroupSize, 0);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("getting startupKernel kernel CL_KERNEL_WORK_GROUP_SIZE failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  wxLogDebug(wxT("startupKernel Work Group Size %llu"), (unsigned long long)this->startupKernelWorkGroupSize);
+
+  if (this->groupSize > this->startupKernelWorkGroupSize)
+  {
+    wxLogDebug(wxT("Group size larger than max startup kernel group size"));
+    this->groupSize = this->startupKernelWorkGroupSize;
+  }
+
+  status = clGetKernelWorkGroupInfo(this->adamsBashforthKernel, this->deviceId, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &this->adamsBashforthKernelWorkGroupSize, 0);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("getting adamsBashforth kernel CL_KERNEL_WORK_GROUP_SIZE failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  wxLogDebug(wxT("adamsBashford Work Group Size %llu"), (unsigned long long)this->adamsBashforthKernelWorkGroupSize);
+
+  if (this->groupSize > this->adamsBashforthKernelWorkGroupSize)
+  {
+    wxLogDebug(wxT("Group size larger than max adamsBashforth group size"));
+    this->groupSize = this->adamsBashforthKernelWorkGroupSize;
+  }
+
+  status = clGetKernelWorkGroupInfo(this->adamsMoultonKernel, this->deviceId, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &this->adamsMoultonKernelWorkGroupSize, 0);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("getting adamsMoulton kernel CL_KERNEL_WORK_GROUP_SIZE failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  wxLogDebug(wxT("adamsKernel Work Group Size %llu"), (unsigned long long)this->adamsMoultonKernelWorkGroupSize);
+
+  if (this->groupSize > this->adamsMoultonKernelWorkGroupSize)
+  {
+    wxLogDebug(wxT("Group size larger than max adams Moulton group size"));
+    this->groupSize = this->adamsMoultonKernelWorkGroupSize;
+  }
+
+  status = clGetKernelWorkGroupInfo(this->copyToDisplayKernel, this->deviceId, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &this->copyToDisplayKernelWorkGroupSize, 0);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("getting copyToDisplay kernel CL_KERNEL_WORK_GROUP_SIZE failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  wxLogDebug(wxT("copyToDisplayKernel Work Group Size %llu"), (unsigned long long)this->copyToDisplayKernelWorkGroupSize);
+
+  if (this->groupSize > this->copyToDisplayKernelWorkGroupSize)
+  {
+    wxLogDebug(wxT("Group size larger than max group size"));
+    this->groupSize = this->copyToDisplayKernelWorkGroupSize;
+  }
+
+  // treeBounds runs as one work-group of the final size
+  if (this->treeAcceleration)
+  {
+    this->SetTreeKernelArgs();
+  }
+
+  if (this->pairAcceleration)
+  {
+    this->SetPairKernelArgs();
+  }
+
+  if (this->maskedAcceleration)
+  {
+    this->SetPerturberKernelArgs();
+  }
+
+  if (this->heliocentricFrame)
+  {
+    this->SetHeliocentricKernelArgs();
+  }
+
+  if (this->rescaleHistoryKernel != NULL)
+  {
+    this->SetStepControlKernelArgs();
+  }
+
+  wxLogDebug(wxT("Finished CLModel:SetKernelArgumentsAndGroupSize"));
+}
+
+// the Adams Bashforth and Adams Moulton integration kernels all have the same signature
+/*
+__kernel
+void adamsMoulton11(
+__global double4* pos,
+__global double4* vel,
+__global double4* acc,
+double deltaTime,
+__global double4* newPos,
+__global double4* newVel,
+int stage,
+int step,
+int numParticles,
+__global double4* posLast,
+__global double4* velLast,
+__global double4* velHistory,
+__global double4* accHistory)
+*/
+void CLModel::SetAdamsKernelArgs(cl_kernel adamsKernel)
+{
+  cl_int status;
+
+  // adamskernel
+  status = clSetKernelArg(adamsKernel, 0, sizeof(cl_mem), (void *)&this->currPos);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 0 failed for currPos %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(adamsKernel, 1, sizeof(cl_mem), (void *)&this->currVel);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 1 failed for currVel %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(adamsKernel, 2, sizeof(cl_mem), (void *)&this->acc);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 2 failed for acc %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(adamsKernel, 3, sizeof(cl_double), (void *)&this->delT);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 3 failed for delT %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(adamsKernel, 4, sizeof(cl_mem), (void *)&this->newPos);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 4 failed for newPos %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(adamsKernel, 5, sizeof(cl_mem), (void *)&this->newVel);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 5 failed for newVel %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(adamsKernel, 6, sizeof(cl_int), (void *)&this->stage);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 6 failed for stage %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(adamsKernel, 7, sizeof(cl_int), (void *)&this->step);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 7 failed for step %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(adamsKernel, 8, sizeof(cl_int), (void *)&this->numParticles);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 8 failed for step %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(adamsKernel, 9, sizeof(cl_mem), (void *)&this->posLast);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 9 failed for posLast %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(adamsKernel, 10, sizeof(cl_mem), (void *)&this->velLast);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 10 failed for velLast %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(adamsKernel, 11, sizeof(cl_mem), (void *)&this->velHistory);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 11 failed for velHistory %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(adamsKernel, 12, sizeof(cl_mem), (void *)&this->accHistory);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 12 failed for accHistory %s"), this->ErrorMessage(status));
+    throw status;
+  }
+}
+
+// Release and/or de-allocates all opencl resources.
+// A cleanup and initialise sequence is done every time something major changes.
+// e.g. number of bodies or the kernels changes.
+int CLModel::CleanUpCL()
+{
+
+#ifdef __WXDEBUG__
+  wxLogDebug(wxT("CLModel::CleanUpCL threadId: %ld"), wxThread::GetCurrentId());
+#endif
+
+  cl_int status;
+  int success = CL_SUCCESS;
+
+  if (this->commandQueue != NULL)
+  {
+    status = clFinish(this->commandQueue);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clFinish failed %s"), this->ErrorMessage(status));
+      success = status;
+    }
+  }
+
+  if (this->currPos != NULL)
+  {
+    status = clReleaseMemObject(this->currPos);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clReleaseMemObject currPos failed %s"), this->ErrorMessage(status));
+      success = status;
+    }
+    else
+    {
+      this->currPos = NULL;
+    }
+  }
+
+  if (this->newPos != NULL)
+  {
+    status = clReleaseMemObject(this->newPos);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clReleaseMemObject newPos failed %s"), this->ErrorMessage(status));
+      success = status;
+    }
+    else
+    {
+      this->newPos = NULL;
+    }
+  }
+
+  if (this->currVel != NULL)
+  {
+    status = clReleaseMemObject(this->currVel);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clReleaseMemObject currVel failed %s"), this->ErrorMessage(status));
+      success = status;
+    }
+    else
+    {
+      this->currVel = NULL;
+    }
+  }
+
+  if (this->newVel != NULL)
+  {
+    status = clReleaseMemObject(this->newVel);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clReleaseMemObject newVel failed %s"), this->ErrorMessage(status));
+      success = status;
+    }
+    else
+    {
+      this->newVel = NULL;
+    }
+  }
+
+  if (this->gravPos != NULL)
+  {
+    status = clReleaseMemObject(this->gravPos);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clReleaseMemObject gravPos failed %s"), this->ErrorMessage(status));
+      success = status;
+    }
+    else
+    {
+      this->gravPos = NULL;
+    }
+  }
+
+  if (this->acc != NULL)
+  {
+    status = clReleaseMemObject(this->acc);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clReleaseMemObject acc failed %s"), this->ErrorMessage(status));
+      success = status;
+    }
+    else
+    {
+      this->acc = NULL;
+    }
+  }
+
+  if (this->posLast != NULL)
+  {
+    status = clReleaseMemObject(this->posLast);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clReleaseMemObject posLast failed %s"), this->ErrorMessage(status));
+      success = status;
+    }
+    else
+    {
+      this->posLast = NULL;
+    }
+  }
+
+  if (this->velLast != NULL)
+  {
+    status = clReleaseMemObject(this->velLast);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clReleaseMemObject velLast failed %s"), this->ErrorMessage(status));
+      success = status;
+    }
+    else
+    {
+      this->velLast = NULL;
+    }
+  }
+
+  if (this->velHistory != NULL)
+  {
+    status = clReleaseMemObject(this->velHistory);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clReleaseMemObject velHistory failed %s"), this->ErrorMessage(status));
+      success = status;
+    }
+    else
+    {
+      this->velHistory = NULL;
+    }
+  }
+
+  if (this->accHistory != NULL)
+  {
+    status = clReleaseMemObject(this->accHistory);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clReleaseMemObject accHistory failed %s"), this->ErrorMessage(status));
+      success = status;
+    }
+    else
+    {
+      this->accHistory = NULL;
+    }
+  }
+
+  if (this->checkpointReference != NULL)
+  {
+    status = clReleaseMemObject(this->checkpointReference);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clReleaseMemObject checkpointReference failed %s"), this->ErrorMessage(status));
+      success = status;
+    }
+    else
+    {
+      this->checkpointReference = NULL;
+    }
+  }
+  this->checkpointReferenceValid = false;
+
+  if (this->checkpointDelta != NULL)
+  {
+    status = clReleaseMemObject(this->checkpointDelta);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clReleaseMemObject checkpointDelta failed %s"), this->ErrorMessage(status));
+      success = status;
+    }
+    else
+    {
+      this->checkpointDelta = NULL;
+    }
+  }
+
+  for (int index = 0; index < 3; index++)
+  {
+    if (this->archiveQuantised[index] != NULL)
+    {
+      status = clReleaseMemObject(this->archiveQuantised[index]);
+      if (status != CL_SUCCESS)
+      {
+        wxLogError(wxT("clReleaseMemObject archiveQuantised failed %s"), this->ErrorMessage(status));
+        success = status;
+      }
+      else
+      {
+        this->archiveQuantised[index] = NULL;
+      }
+    }
+  }
+  this->archiveHistoryValid = false;
+
+  if (this->archiveBlocks != NULL)
+  {
+    status = clReleaseMemObject(this->archiveBlocks);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clReleaseMemObject archiveBlocks failed %s"), this->ErrorMessage(status));
+      success = status;
+    }
+    else
+    {
+      this->archiveBlocks = NULL;
+    }
+  }
+
+  if (this->archiveBlockSizes != NULL)
+  {
+    status = clReleaseMemObject(this->archiveBlockSizes);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clReleaseMemObject archiveBlockSizes failed %s"), this->ErrorMessage(status));
+      success = status;
+    }
+    else
+    {
+      this->archiveBlockSizes = NULL;
+    }
+  }
+
+  this->ReleaseChebyshevBuffers();
+
+  if (this->densePos != NULL)
+  {
+    status = clReleaseMemObject(this->densePos);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clReleaseMemObject densePos failed %s"), this->ErrorMessage(status));
+      success = status;
+    }
+    else
+    {
+      this->densePos = NULL;
+    }
+  }
+
+  if (this->denseVel != NULL)
+  {
+    status = clReleaseMemObject(this->denseVel);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clReleaseMemObject denseVel failed %s"), this->ErrorMessage(status));
+      success = status;
+    }
+    else
+    {
+      this->denseVel = NULL;
+    }
+  }
+
+  if (this->denseGravPos != NULL)
+  {
+    status = clReleaseMemObject(this->denseGravPos);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clReleaseMemObject denseGravPos failed %s"), this->ErrorMessage(status));
+      success = status;
+    }
+    else
+    {
+      this->denseGravPos = NULL;
+    }
+  }
+
+  if (this->denseWeights != NULL)
+  {
+    status = clReleaseMemObject(this->denseWeights);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clReleaseMemObject denseWeights failed %s"), this->ErrorMessage(status));
+      success = status;
+    }
+    else
+    {
+      this->denseWeights = NULL;
+    }
+  }
+
+  if (this->twoPhaseEphemeris != NULL)
+  {
+    status = clReleaseMemObject(this->twoPhaseEphemeris);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clReleaseMemObject twoPhaseEphemeris failed %s"), this->ErrorMessage(status));
+      success = status;
+    }
+    else
+    {
+      this->twoPhaseEphemeris = NULL;
+    }
+  }
+
+  if (this->twoPhaseCoefficients != NULL)
+  {
+    status = clReleaseMemObject(this->twoPhaseCoefficients);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clReleaseMemObject twoPhaseCoefficients failed %s"), this->ErrorMessage(status));
+      success = status;
+    }
+    else
+    {
+      this->twoPhaseCoefficients = NULL;
+    }
+  }
+  this->displayingDenseOutput = false;
+  this->ReleaseKeplerBuffers();
+  this->ReleaseStreamBuffers();
+  this->ReleaseTreeBuffers();
+
+  if (this->pairCompensation != NULL)
+  {
+    status = clReleaseMemObject(this->pairCompensation);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clReleaseMemObject pairCompensation failed %s"), this->ErrorMessage(status));
+      success = status;
+    }
+    else
+    {
+      this->pairCompensation = NULL;
+    }
+  }
+
+  cl_mem *approximationBuffers[] = {&this->checkAcc[0], &this->checkAcc[1], &this->perturberMask, &this->perturberStats};
+  for (int buffer = 0; buffer < 4; buffer++)
+  {
+    if (*approximationBuffers[buffer] != NULL)
+    {
+      status = clReleaseMemObject(*approximationBuffers[buffer]);
+      if (status != CL_SUCCESS)
+      {
+        wxLogError(wxT("clReleaseMemObject approximation buffer %d failed %s"), buffer, this->ErrorMessage(status));
+        success = status;
+      }
+      else
+      {
+        *approximationBuffers[buffer] = NULL;
+      }
+    }
+  }
+
+  cl_mem *frameBuffers[] = {&this->indirectAcc, &this->frameOffsets, &this->framePos, &this->frameVel, &this->stepErrors};
+  for (int buffer = 0; buffer < 5; buffer++)
+  {
+    if (*frameBuffers[buffer] != NULL)
+    {
+      status = clReleaseMemObject(*frameBuffers[buffer]);
+      if (status != CL_SUCCESS)
+      {
+        wxLogError(wxT("clReleaseMemObject frame buffer %d failed %s"), buffer, this->ErrorMessage(status));
+        success = status;
+      }
+      else
+      {
+        *frameBuffers[buffer] = NULL;
+      }
+    }
+  }
+
+  if (this->dispPos != NULL)
+  {
+    status = clReleaseMemObject(this->dispPos);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clReleaseMemObject dispPos failed %s"), this->ErrorMessage(status));
+      success = status;
+    }
+    else
+    {
+      this->dispPos = NULL;
+    }
+  }
+
+  if (this->accKernel != NULL)
+  {
+    status = clReleaseKernel(this->accKernel);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clReleaseKernel accKernel failed %s"), this->ErrorMessage(status));
+      success = status;
+    }
+    else
+    {
+      this->accKernel = NULL;
+    }
+  }
+
+  if (this->startupKernel != NULL)
+  {
+    status = clReleaseKernel(this->startupKernel);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clReleaseKernel startupKernel failed %s"), this->ErrorMessage(status));
+      success = status;
+    }
+    else
+    {
+      this->startupKernel = NULL;
+    }
+  }
+
+  if (this->adamsBashforthKernel != NULL)
+  {
+    status = clReleaseKernel(this->adamsBashforthKernel);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clReleaseKernel adamsBashforthKernel failed %s"), this->ErrorMessage(status));
+      success = status;
+    }
+    else
+    {
+      this->adamsBashforthKernel = NULL;
+    }
+  }
+
+  if (this->adamsMoultonKernel != NULL)
+  {
+    status = clReleaseKernel(this->adamsMoultonKernel);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clReleaseKernel adamsMoultonKernel failed %s"), this->ErrorMessage(status));
+      success = status;
+    }
+    else
+    {
+      this->adamsMoultonKernel = NULL;
+    }
+  }
+
+  if (this->copyToDisplayKernel != NULL)
+  {
+    status = clReleaseKernel(this->copyToDisplayKernel);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clReleaseKernel copyToDisplayKernel failed %s"), this->ErrorMessage(status));
+      success = status;
+    }
+    else
+    {
+      this->copyToDisplayKernel = NULL;
+    }
+  }
+
+  if (this->checkpointDeltaKernel != NULL)
+  {
+    status = clReleaseKernel(this->checkpointDeltaKernel);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clReleaseKernel checkpointDeltaKernel failed %s"), this->ErrorMessage(status));
+      success = status;
+    }
+    else
+    {
+      this->checkpointDeltaKernel = NULL;
+    }
+  }
+
+  if (this->archiveEncodeKernel != NULL)
+  {
+    status = clReleaseKernel(this->archiveEncodeKernel);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clReleaseKernel archiveEncodeKernel failed %s"), this->ErrorMessage(status));
+      success = status;
+    }
+    else
+    {
+      this->archiveEncodeKernel = NULL;
+    }
+  }
+
+  if (this->chebyshevAccumulateKernel != NULL)
+  {
+    status = clReleaseKernel(this->chebyshevAccumulateKernel);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clReleaseKernel chebyshevAccumulateKernel failed %s"), this->ErrorMessage(status));
+      success = status;
+    }
+    else
+    {
+      this->chebyshevAccumulateKernel = NULL;
+    }
+  }
+
+  if (this->chebyshevSolveKernel != NULL)
+  {
+    status = clReleaseKernel(this->chebyshevSolveKernel);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clReleaseKernel chebyshevSolveKernel failed %s"), this->ErrorMessage(status));
+      success = status;
+    }
+    else
+    {
+      this->chebyshevSolveKernel = NULL;
+    }
+  }
+
+  if (this->denseOutputKernel != NULL)
+  {
+    status = clReleaseKernel(this->denseOutputKernel);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clReleaseKernel denseOutputKernel failed %s"), this->ErrorMessage(status));
+      success = status;
+    }
+    else
+    {
+      this->denseOutputKernel = NULL;
+    }
+  }
+
+  if (this->keplerFastForwardKernel != NULL)
+  {
+    status = clReleaseKernel(this->keplerFastForwardKernel);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clReleaseKernel keplerFastForwardKernel failed %s"), this->ErrorMessage(status));
+      success = status;
+    }
+    else
+    {
+      this->keplerFastForwardKernel = NULL;
+    }
+  }
+
+  if (this->orbitalToStateVectorsKernel != NULL)
+  {
+    status = clReleaseKernel(this->orbitalToStateVectorsKernel);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clReleaseKernel orbitalToStateVectorsKernel failed %s"), this->ErrorMessage(status));
+      success = status;
+    }
+    else
+    {
+      this->orbitalToStateVectorsKernel = NULL;
+    }
+  }
+
+  if (this->copyChunkToDisplayKernel != NULL)
+  {
+    status = clReleaseKernel(this->copyChunkToDisplayKernel);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clReleaseKernel copyChunkToDisplayKernel failed %s"), this->ErrorMessage(status));
+      success = status;
+    }
+    else
+    {
+      this->copyChunkToDisplayKernel = NULL;
+    }
+  }
+
+  if (this->twoPhaseTestParticlesKernel != NULL)
+  {
+    status = clReleaseKernel(this->twoPhaseTestParticlesKernel);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clReleaseKernel twoPhaseTestParticlesKernel failed %s"), this->ErrorMessage(status));
+      success = status;
+    }
+    else
+    {
+      this->twoPhaseTestParticlesKernel = NULL;
+    }
+  }
+
+  if (this->gravPairsKernel != NULL)
+  {
+    status = clReleaseKernel(this->gravPairsKernel);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clReleaseKernel gravPairsKernel failed %s"), this->ErrorMessage(status));
+      success = status;
+    }
+    else
+    {
+      this->gravPairsKernel = NULL;
+    }
+  }
+
+  cl_kernel *approximationKernels[] = {&this->treeBoundsKernel, &this->treeMortonKeysKernel, &this->treeSortStepKernel, &this->treeBuildKernel, &this->treeSummariseKernel,
+                                       &this->referenceKernel, &this->perturberMaskKernel};
+  for (int kernel = 0; kernel < 7; kernel++)
+  {
+    if (*approximationKernels[kernel] != NULL)
+    {
+      status = clReleaseKernel(*approximationKernels[kernel]);
+      if (status != CL_SUCCESS)
+      {
+        wxLogError(wxT("clReleaseKernel approximation kernel %d failed %s"), kernel, this->ErrorMessage(status));
+        success = status;
+      }
+      else
+      {
+        *approximationKernels[kernel] = NULL;
+      }
+    }
+  }
+
+  cl_kernel *frameKernels[] = {&this->heliocentricIndirectKernel, &this->addIndirectKernel, &this->frameOffsetKernel, &this->frameShiftKernel, &this->fixedPointKernel,
+                               &this->stepErrorKernel, &this->rescaleHistoryKernel};
+  for (int kernel = 0; kernel < 7; kernel++)
+  {
+    if (*frameKernels[kernel] != NULL)
+    {
+      status = clReleaseKernel(*frameKernels[kernel]);
+      if (status != CL_SUCCESS)
+      {
+        wxLogError(wxT("clReleaseKernel frame kernel %d failed %s"), kernel, this->ErrorMessage(status));
+        success = status;
+      }
+      else
+      {
+        *frameKernels[kernel] = NULL;
+      }
+    }
+  }
+
+  if (this->program != NULL)
+  {
+    status = clReleaseProgram(this->program);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clReleaseProgram failed %s"), this->ErrorMessage(status));
+      success = status;
+    }
+    else
+    {
+      this->program = NULL;
+    }
+  }
+
+  if (this->commandQueue != NULL)
+  {
+    status = clReleaseCommandQueue(this->commandQueue);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clReleaseCommandQueue failed %s"), this->ErrorMessage(status));
+      success = status;
+    }
+    else
+    {
+      this->commandQueue = NULL;
+    }
+  }
+
+  if (this->context != NULL)
+  {
+    status = clReleaseContext(this->context);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clReleaseContext failed %s"), this->ErrorMessage(status));
+      success = status;
+    }
+    else
+    {
+      this->context = NULL;
+    }
+  }
+
+  wxLogDebug(wxT("CLModel:CleanUpCL Done"));
+  return success;
+}
+
+void CLModel::RequestUpdate()
+{
+  this->updateDisplay = true;
+}
+
+// numParticles rounded down to a whole number of work groups
+int CLModel::GetNumParticles()
+{
+  return this->numParticles;
+}
+
+// Particles each work-item of the acceleration kernel in use computes, particlesPerWorkItem or 1 if it can't be used
+int CLModel::AccelerationBlock()
+{
+  return this->accelerationBlock;
+}
+
+// Copies the initial positions and velocities into the opencl buffers
+void CLModel::SetInitalState(cl_double4 *initalPositions, cl_double4 *initalVelocities)
+{
+
+#ifdef __WXDEBUG__
+  wxLogDebug(wxT("CLModel::SetInitalState threadId: %ld"), wxThread::GetCurrentId());
+#endif
+
+  cl_int status = CL_SUCCESS;
+
+  // Past 2^53 units a double no longer holds every whole number, so the position updates stop being exact
+  if (this->fixedPointBits > 0)
+  {
+    double exactRange = ldexp(1.0, 53 - this->fixedPointBits);
+    double furthest = 0.0;
+    for (int particle = 0; particle < this->numParticles; particle++)
+    {
+      for (int component = 0; component < 3; component++)
+      {
+        furthest = fabs(initalPositions[particle].s[component]) > furthest ? fabs(initalPositions[particle].s[component]) : furthest;
+      }
+    }
+    if (furthest >= exactRange)
+    {
+      wxLogMessage(wxT("Positions out to %g Gm are past the %g Gm that %d fixed point bits hold exactly"), furthest, exactRange, this->fixedPointBits);
+    }
+  }
+
+  if (this->streaming)
+  {
+    // Only the positions and velocities are set, the history is filled in by the startup steps
+    memset(this->streamState, 0, (size_t)this->numChunks * numStreamRows * this->chunkSize * sizeof(cl_double4));
+    for (int chunk = 0; chunk < this->numChunks; chunk++)
+    {
+      size_t first = (size_t)chunk * this->chunkSize;
+      size_t count = this->numParticles - first;
+      count = count < (size_t)this->chunkSize ? count : (size_t)this->chunkSize;
+      memcpy(this->StreamRow(chunk, 0), initalPositions + first, count * sizeof(cl_double4));
+      memcpy(this->StreamRow(chunk, 1), initalVelocities + first, count * sizeof(cl_double4));
+      if (this->fixedPointBits > 0)
+      {
+        this->ToFixedPoint(this->StreamRow(chunk, 0), count);
+      }
+    }
+  }
+  else
+  {
+    status = clEnqueueWriteBuffer(this->commandQueue, this->currPos, CL_FALSE, 0, this->numParticles * sizeof(cl_double4), initalPositions, 0, 0, 0);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clEnqueueWriteBuffer write inital Positions to currPos %s"), this->ErrorMessage(status));
+      throw status;
+    }
+
+    status = clEnqueueWriteBuffer(this->commandQueue, this->currVel, CL_FALSE, 0, this->numParticles * sizeof(cl_double4), initalVelocities, 0, 0, 0);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clEnqueueWriteBuffer write inital Velocity to currVel %s"), this->ErrorMessage(status));
+      throw status;
+    }
+  }
+
+  // The bodies with mass are in the first streamed chunk
+  cl_double4 *gravPositions = this->streaming ? this->StreamRow(0, 0) : initalPositions;
+  status = clEnqueueWriteBuffer(this->commandQueue, this->gravPos, CL_FALSE, 0, this->numGrav * sizeof(cl_double4), gravPositions, 0, 0, 0);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clEnqueueWriteBuffer write inital Positions to gravPos %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  // The initial state is barycentric and floating point. Move it to the Sun's frame and onto the fixed point grid
+  // on the device and take the bodies with mass from there
+  if (this->heliocentricFrame)
+  {
+    this->EnqueueFrameShift(true, this->currPos, this->currVel);
+  }
+
+  if (this->fixedPointKernel != NULL)
+  {
+    size_t fixedPointThreads[] = {(size_t)this->numParticles};
+    status |= clSetKernelArg(this->fixedPointKernel, 0, sizeof(cl_mem), (void *)&this->currPos);
+    status |= clSetKernelArg(this->fixedPointKernel, 1, sizeof(cl_int), (void *)&this->numParticles);
+    status |= clEnqueueNDRangeKernel(this->commandQueue, this->fixedPointKernel, 1, NULL, fixedPointThreads, NULL, 0, NULL, NULL);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clEnqueueNDRangeKernel fixedPointPositions failed %s"), this->ErrorMessage(status));
+      throw status;
+    }
+  }
+
+  if (this->heliocentricFrame || this->fixedPointKernel != NULL)
+  {
+    status = clEnqueueCopyBuffer(this->commandQueue, this->currPos, this->gravPos, 0, 0, this->numGrav * sizeof(cl_double4), 0, NULL, NULL);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clEnqueueCopyBuffer currPos to gravPos failed %s"), this->ErrorMessage(status));
+      throw status;
+    }
+  }
+
+  status = clFinish(this->commandQueue);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clFinish failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  this->displayingDenseOutput = false;
+  this->ReleaseKeplerBuffers();
+  this->step = 0;
+}
+
+// snapshots the current positions and velocities and makes them the initial start conditions.
+// From there they can be saved to disk as either binary or slf format for later
+void CLModel::ReadToInitialState(cl_double4 *initalPositions, cl_double4 *initalVelocities)
+{
+
+#ifdef __WXDEBUG__
+  wxLogDebug(wxT("CLModel::ReadToInitialState threadId: %ld"), wxThread::GetCurrentId());
+#endif
+
+  cl_int status = CL_SUCCESS;
+  status = clFinish(this->commandQueue);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clFinish failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  if (this->streaming)
+  {
+    for (int chunk = 0; chunk < this->numChunks; chunk++)
+    {
+      size_t first = (size_t)chunk * this->chunkSize;
+      size_t count = this->numParticles - first;
+      count = count < (size_t)this->chunkSize ? count : (size_t)this->chunkSize;
+      memcpy(initalPositions + first, this->StreamRow(chunk, 0), count * sizeof(cl_double4));
+      memcpy(initalVelocities + first, this->StreamRow(chunk, 1), count * sizeof(cl_double4));
+    }
+    return;
+  }
+
+  cl_mem readPos;
+  cl_mem readVel;
+  this->BarycentricState(&readPos, &readVel);
+
+  status = clEnqueueReadBuffer(this->commandQueue, readPos, CL_TRUE, 0, this->numParticles * sizeof(cl_double4), initalPositions, 0, 0, 0);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clEnqueueWriteBuffer write inital Positions to currPos %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clEnqueueReadBuffer(this->commandQueue, readVel, CL_TRUE, 0, this->numParticles * sizeof(cl_double4), initalVelocities, 0, 0, 0);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clEnqueueWriteBuffer write inital Velocity to currVel %s"), this->ErrorMessage(status));
+    throw status;
+  }
+}
+
+// Returns the device buffer holding one section of the integrator state,
+// its length in cl_double4 elements and where it sits within checkpointReference.
+// Everything needed to carry on integrating exactly where we left off is covered,
+// including the Adams history ring buffers. acc and gravPos are recomputed from these.
+cl_mem CLModel::CheckpointSection(int section, size_t *count, size_t *offset)
+{
+  if (this->streaming)
+  {
+    wxLogError(wxT("Checkpoints are not supported while streaming"));
+    throw -1;
+  }
+
+  size_t n = (size_t)this->numParticles;
+  switch (section)
+  {
+  case 0:
+    *count = n;
+    *offset = 0;
+    return this->currPos;
+  case 1:
+    *count = n;
+    *offset = n;
+    return this->currVel;
+  case 2:
+    *count = n;
+    *offset = 2 * n;
+    return this->posLast;
+  case 3:
+    *count = n;
+    *offset = 3 * n;
+    return this->velLast;
+  case 4:
+    *count = 16 * n;
+    *offset = 4 * n;
+    return this->velHistory;
+  case 5:
+    *count = 16 * n;
+    *offset = 20 * n;
+    return this->accHistory;
+  default:
+    wxLogError(wxT("CLModel::CheckpointSection invalid section %d"), section);
+    throw -1;
+  }
+}
+
+size_t CLModel::CheckpointSectionSize(int section)
+{
+  size_t count;
+  size_t offset;
+  this->CheckpointSection(section, &count, &offset);
+  return count;
+}
+
+// true once a base checkpoint has been taken since the buffers were created.
+// Until then only a full base can be written.
+bool CLModel::HasCheckpointReference()
+{
+  return this->checkpointReferenceValid;
+}
+
+// The reference copy is as big as the whole integrator state so only allocate it if checkpoints are used
+void CLModel::CreateCheckpointBuffers()
+{
+  cl_int status = CL_SUCCESS;
+  if (this->checkpointReference == NULL)
+  {
+    this->checkpointReference = clCreateBuffer(this->context, CL_MEM_READ_WRITE, this->numParticles * 36 * sizeof(cl_double4), 0, &status);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clCreateBuffer failed to create cl_mem object for checkpointReference %s"), this->ErrorMessage(status));
+      throw status;
+    }
+    this->checkpointReferenceValid = false;
+  }
+
+  if (this->checkpointDelta == NULL)
+  {
+    this->checkpointDelta = clCreateBuffer(this->context, CL_MEM_WRITE_ONLY, this->numParticles * 16 * sizeof(cl_double4), 0, &status);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clCreateBuffer failed to create cl_mem object for checkpointDelta %s"), this->ErrorMessage(status));
+      throw status;
+    }
+  }
+}
+
+// Reads one section of the integrator state back for a checkpoint.
+// For a base the raw state is returned.
+// Otherwise the XOR of the state against the reference is computed on the device and only that is read back.
+// The reference is left alone until CommitCheckpointReference, so a record that fails to reach the disk isn't chained on from.
+void CLModel::ReadCheckpointSection(int section, bool base, cl_double4 *hostState)
+{
+
+#ifdef __WXDEBUG__
+  wxLogDebug(wxT("CLModel::ReadCheckpointSection threadId: %ld"), wxThread::GetCurrentId());
+#endif
+
+  cl_int status = CL_SUCCESS;
+  size_t count;
+  size_t offset;
+  cl_mem source = this->CheckpointSection(section, &count, &offset);
+  this->CreateCheckpointBuffers();
+
+  if (base)
+  {
+    status = clEnqueueReadBuffer(this->commandQueue, source, CL_TRUE, 0, count * sizeof(cl_double4), hostState, 0, 0, 0);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clEnqueueReadBuffer checkpoint base %s"), this->ErrorMessage(status));
+      throw status;
+    }
+  }
+  else
+  {
+    if (!this->checkpointReferenceValid)
+    {
+      wxLogError(wxT("CLModel::ReadCheckpointSection delta requested without a base"));
+      throw -1;
+    }
+
+    // The kernel works on 64 bit words so there are four per cl_double4
+    cl_ulong referenceOffset = offset * 4;
+    size_t globalThreads[] = {count * 4};
+
+    status = clSetKernelArg(this->checkpointDeltaKernel, 0, sizeof(cl_mem), (void *)&source);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clSetKernelArg 0 checkpointDeltaKernel failed %s"), this->ErrorMessage(status));
+      throw status;
+    }
+
+    status = clSetKernelArg(this->checkpointDeltaKernel, 1, sizeof(cl_mem), (void *)&this->checkpointReference);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clSetKernelArg 1 checkpointDeltaKernel failed %s"), this->ErrorMessage(status));
+      throw status;
+    }
+
+    status = clSetKernelArg(this->checkpointDeltaKernel, 2, sizeof(cl_ulong), (void *)&referenceOffset);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clSetKernelArg 2 checkpointDeltaKernel failed %s"), this->ErrorMessage(status));
+      throw status;
+    }
+
+    status = clSetKernelArg(this->checkpointDeltaKernel, 3, sizeof(cl_mem), (void *)&this->checkpointDelta);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clSetKernelArg 3 checkpointDeltaKernel failed %s"), this->ErrorMessage(status));
+      throw status;
+    }
+
+    status = clEnqueueNDRangeKernel(this->commandQueue, this->checkpointDeltaKernel, 1, NULL, globalThreads, NULL, 0, 0, NULL);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clEnqueueNDRangeKernel checkpointDeltaKernel failed %s"), this->ErrorMessage(status));
+      throw status;
+    }
+
+    status = clEnqueueReadBuffer(this->commandQueue, this->checkpointDelta, CL_TRUE, 0, count * sizeof(cl_double4), hostState, 0, 0, 0);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clEnqueueReadBuffer checkpointDelta %s"), this->ErrorMessage(status));
+      throw status;
+    }
+  }
+}
+
+// Called once a checkpoint record is on disk. Copies the state it was taken from into the reference
+// so the next delta is against it. Nothing may step the model between reading the sections and this.
+void CLModel::CommitCheckpointReference()
+{
+  cl_int status = CL_SUCCESS;
+  this->CreateCheckpointBuffers();
+  for (int section = 0; section < CLModel::numCheckpointSections; section++)
+  {
+    size_t count;
+    size_t offset;
+    cl_mem source = this->CheckpointSection(section, &count, &offset);
+    status = clEnqueueCopyBuffer(this->commandQueue, source, this->checkpointReference, 0, offset * sizeof(cl_double4), count * sizeof(cl_double4), 0, 0, 0);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clEnqueueCopyBuffer state to checkpointReference %s"), this->ErrorMessage(status));
+      this->checkpointReferenceValid = false;
+      throw status;
+    }
+  }
+  this->checkpointReferenceValid = true;
+}
+
+// Writes one section of a restored checkpoint back into the integrator state
+void CLModel::WriteCheckpointSection(int section, cl_double4 *hostState)
+{
+  cl_int status = CL_SUCCESS;
+  size_t count;
+  size_t offset;
+  cl_mem destination = this->CheckpointSection(section, &count, &offset);
+
+  status = clEnqueueWriteBuffer(this->commandQueue, destination, CL_TRUE, 0, count * sizeof(cl_double4), hostState, 0, 0, 0);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clEnqueueWriteBuffer checkpoint section %d %s"), section, this->ErrorMessage(status));
+    throw status;
+  }
+}
+
+// Called once all the sections of a checkpoint have been written.
+// Refreshes gravPos from the restored positions and picks up at the restored step.
+// The step count matters as it selects the history ring buffer slots and whether the startup integrator is still running.
+void CLModel::RestoreCheckpoint(cl_int restoredStep, cl_double restoredTime)
+{
+  cl_int status = CL_SUCCESS;
+  status = clEnqueueCopyBuffer(this->commandQueue, this->currPos, this->gravPos, 0, 0, this->numGrav * sizeof(cl_double4), 0, 0, 0);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clEnqueueCopyBuffer currPos to gravPos %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clFinish(this->commandQueue);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clFinish failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  this->displayingDenseOutput = false;
+  this->ReleaseKeplerBuffers();
+  this->step = restoredStep;
+  this->stage = this->numStages;
+  this->time = restoredTime;
+
+  // The checkpoint's delT can differ from the one the kernels were given when the model was reset
+  this->SetDeltaTimeArgs();
+  this->stepErrorReady = false;
+  this->calmSteps = 0;
+  this->rescaleStep = 0;
+  this->rescaleRatio = 1.0;
+  this->historyGrown = false;
+  this->targetDeltaTime = 0.0;
+}
+
+int CLModel::ArchiveNumBlocks()
+{
+  return (this->numParticles + CLModel::archiveBlockSize - 1) / CLModel::archiveBlockSize;
+}
+
+// true if the quantised positions of previously archived frames are still on the device.
+// They are lost when the buffers are recreated, in which case the next frame must be a keyframe.
+bool CLModel::HasArchiveHistory()
+{
+  return this->archiveHistoryValid;
+}
+
+void CLModel::CreateArchiveBuffers()
+{
+  cl_int status = CL_SUCCESS;
+  for (int index = 0; index < 3; index++)
+  {
+    if (this->archiveQuantised[index] == NULL)
+    {
+      this->archiveQuantised[index] = clCreateBuffer(this->context, CL_MEM_READ_WRITE, this->numParticles * sizeof(cl_long4), 0, &status);
+      if (status != CL_SUCCESS)
+      {
+        wxLogError(wxT("clCreateBuffer failed to create cl_mem object for archiveQuantised %s"), this->ErrorMessage(status));
+        throw status;
+      }
+      this->archiveHistoryValid = false;
+    }
+  }
+
+  if (this->archiveBlocks == NULL)
+  {
+    this->archiveBlocks = clCreateBuffer(this->context, CL_MEM_WRITE_ONLY, this->ArchiveNumBlocks() * CLModel::archiveBlockWords * sizeof(cl_ulong), 0, &status);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clCreateBuffer failed to create cl_mem object for archiveBlocks %s"), this->ErrorMessage(status));
+      throw status;
+    }
+  }
+
+  if (this->archiveBlockSizes == NULL)
+  {
+    this->archiveBlockSizes = clCreateBuffer(this->context, CL_MEM_WRITE_ONLY, this->ArchiveNumBlocks() * sizeof(cl_uint), 0, &status);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clCreateBuffer failed to create cl_mem object for archiveBlockSizes %s"), this->ErrorMessage(status));
+      throw status;
+    }
+  }
+}
+
+// Encodes the current positions as one archive frame.
+// predictionOrder is the number of previous frames to extrapolate from, 0 for a keyframe.
+// hostBlocks receives ArchiveNumBlocks() * archiveBlockWords words of which hostBlockWords[block] are used for each block.
+// Returns the prediction order actually used, which is 0 if the previous frames have been lost.
+cl_int CLModel::ArchiveEncode(cl_double quantum, cl_int predictionOrder, cl_ulong *hostBlocks, cl_uint *hostBlockWords)
+{
+
+#ifdef __WXDEBUG__
+  wxLogDebug(wxT("CLModel::ArchiveEncode threadId: %ld"), wxThread::GetCurrentId());
+#endif
+
+  cl_int status = CL_SUCCESS;
+  if (this->streaming)
+  {
+    wxLogError(wxT("Trajectory archives are not supported while streaming"));
+    throw -1;
+  }
+
+  this->CreateArchiveBuffers();
+  if (!this->archiveHistoryValid)
+  {
+    predictionOrder = 0;
+  }
+
+  cl_int numBlocks = this->ArchiveNumBlocks();
+  size_t globalThreads[] = {(size_t)numBlocks};
+
+  // Archives hold barycentric positions whatever frame is integrated in
+  cl_mem pos;
+  cl_mem vel;
+  this->BarycentricState(&pos, &vel);
+
+  // The oldest frame is read then overwritten by the newest
+  status = clSetKernelArg(this->archiveEncodeKernel, 0, sizeof(cl_mem), (void *)&pos);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 0 archiveEncodeKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->archiveEncodeKernel, 1, sizeof(cl_mem), (void *)&this->archiveQuantised[0]);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 1 archiveEncodeKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->archiveEncodeKernel, 2, sizeof(cl_mem), (void *)&this->archiveQuantised[1]);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 2 archiveEncodeKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->archiveEncodeKernel, 3, sizeof(cl_mem), (void *)&this->archiveQuantised[2]);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 3 archiveEncodeKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->archiveEncodeKernel, 4, sizeof(cl_double), (void *)&quantum);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 4 archiveEncodeKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->archiveEncodeKernel, 5, sizeof(cl_int), (void *)&predictionOrder);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 5 archiveEncodeKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->archiveEncodeKernel, 6, sizeof(cl_int), (void *)&this->numParticles);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 6 archiveEncodeKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->archiveEncodeKernel, 7, sizeof(cl_mem), (void *)&this->archiveBlocks);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 7 archiveEncodeKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->archiveEncodeKernel, 8, sizeof(cl_mem), (void *)&this->archiveBlockSizes);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 8 archiveEncodeKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clEnqueueNDRangeKernel(this->commandQueue, this->archiveEncodeKernel, 1, NULL, globalThreads, NULL, 0, 0, NULL);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clEnqueueNDRangeKernel archiveEncodeKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clEnqueueReadBuffer(this->commandQueue, this->archiveBlockSizes, CL_TRUE, 0, numBlocks * sizeof(cl_uint), hostBlockWords, 0, 0, 0);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clEnqueueReadBuffer archiveBlockSizes %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clEnqueueReadBuffer(this->commandQueue, this->archiveBlocks, CL_TRUE, 0, numBlocks * CLModel::archiveBlockWords * sizeof(cl_ulong), hostBlocks, 0, 0, 0);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clEnqueueReadBuffer archiveBlocks %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  // rotate so archiveQuantised[0] is the frame just encoded
+  cl_mem newest = this->archiveQuantised[2];
+  this->archiveQuantised[2] = this->archiveQuantised[1];
+  this->archiveQuantised[1] = this->archiveQuantised[0];
+  this->archiveQuantised[0] = newest;
+  this->archiveHistoryValid = true;
+  return predictionOrder;
+}
+
+void CLModel::ReleaseChebyshevBuffers()
+{
+  cl_int status = CL_SUCCESS;
+  if (this->chebyshevSums != NULL)
+  {
+    status = clReleaseMemObject(this->chebyshevSums);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clReleaseMemObject chebyshevSums failed %s"), this->ErrorMessage(status));
+    }
+    this->chebyshevSums = NULL;
+  }
+
+  if (this->chebyshevCoefficients != NULL)
+  {
+    status = clReleaseMemObject(this->chebyshevCoefficients);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clReleaseMemObject chebyshevCoefficients failed %s"), this->ErrorMessage(status));
+    }
+    this->chebyshevCoefficients = NULL;
+  }
+
+  if (this->chebyshevGramInverse != NULL)
+  {
+    status = clReleaseMemObject(this->chebyshevGramInverse);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clReleaseMemObject chebyshevGramInverse failed %s"), this->ErrorMessage(status));
+    }
+    this->chebyshevGramInverse = NULL;
+  }
+  this->chebyshevDegree = -1;
+}
+
+void CLModel::CreateChebyshevBuffers(cl_int degree)
+{
+  cl_int status = CL_SUCCESS;
+  if (this->chebyshevDegree == degree)
+  {
+    return;
+  }
+
+  this->ReleaseChebyshevBuffers();
+  this->chebyshevSums = clCreateBuffer(this->context, CL_MEM_READ_WRITE, (size_t)(degree + 1) * this->numParticles * sizeof(cl_double4), 0, &status);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clCreateBuffer failed to create cl_mem object for chebyshevSums %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  this->chebyshevCoefficients = clCreateBuffer(this->context, CL_MEM_WRITE_ONLY, (size_t)(degree + 1) * this->numParticles * sizeof(cl_double4), 0, &status);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clCreateBuffer failed to create cl_mem object for chebyshevCoefficients %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  this->chebyshevGramInverse = clCreateBuffer(this->context, CL_MEM_READ_ONLY, (size_t)(degree + 1) * (degree + 1) * sizeof(cl_double), 0, &status);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clCreateBuffer failed to create cl_mem object for chebyshevGramInverse %s"), this->ErrorMessage(status));
+    throw status;
+  }
+  this->chebyshevDegree = degree;
+}
+
+// Adds the current positions as a sample of the interval being fitted.
+// x is the sample time mapped onto [-1,1].
+// Returns false if the sums from earlier samples have been lost, e.g. by a reset,
+// in which case this sample has been taken as the first of a new interval.
+bool CLModel::ChebyshevAccumulate(cl_int degree, cl_double x, bool firstSample)
+{
+  cl_int status = CL_SUCCESS;
+  if (this->streaming)
+  {
+    wxLogError(wxT("Chebyshev ephemerides are not supported while streaming"));
+    throw -1;
+  }
+
+  bool continued = true;
+  if (this->chebyshevDegree != degree)
+  {
+    this->CreateChebyshevBuffers(degree);
+    continued = firstSample;
+    firstSample = true;
+  }
+
+  cl_int first = firstSample ? 1 : 0;
+  size_t globalThreads[] = {(size_t)this->numParticles};
+
+  // Ephemerides are fitted to barycentric positions whatever frame is integrated in
+  cl_mem pos;
+  cl_mem vel;
+  this->BarycentricState(&pos, &vel);
+
+  status = clSetKernelArg(this->chebyshevAccumulateKernel, 0, sizeof(cl_mem), (void *)&pos);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 0 chebyshevAccumulateKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->chebyshevAccumulateKernel, 1, sizeof(cl_mem), (void *)&this->chebyshevSums);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 1 chebyshevAccumulateKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->chebyshevAccumulateKernel, 2, sizeof(cl_int), (void *)&this->numParticles);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 2 chebyshevAccumulateKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->chebyshevAccumulateKernel, 3, sizeof(cl_int), (void *)&degree);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 3 chebyshevAccumulateKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->chebyshevAccumulateKernel, 4, sizeof(cl_double), (void *)&x);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 4 chebyshevAccumulateKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->chebyshevAccumulateKernel, 5, sizeof(cl_int), (void *)&first);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 5 chebyshevAccumulateKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clEnqueueNDRangeKernel(this->commandQueue, this->chebyshevAccumulateKernel, 1, NULL, globalThreads, NULL, 0, 0, NULL);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clEnqueueNDRangeKernel chebyshevAccumulateKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+  return continued;
+}
+
+// Fits the coefficients from the accumulated samples and reads them back.
+// hostCoefficients receives [degree+1][numParticles] cl_double4, w is unused.
+void CLModel::ChebyshevSolve(cl_int degree, cl_double *gramInverse, cl_double4 *hostCoefficients)
+{
+  cl_int status = CL_SUCCESS;
+  if (this->chebyshevDegree != degree)
+  {
+    wxLogError(wxT("CLModel::ChebyshevSolve called without samples"));
+    throw -1;
+  }
+
+  size_t globalThreads[] = {(size_t)this->numParticles};
+  status = clEnqueueWriteBuffer(this->commandQueue, this->chebyshevGramInverse, CL_FALSE, 0, (size_t)(degree + 1) * (degree + 1) * sizeof(cl_double), gramInverse, 0, 0, 0);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clEnqueueWriteBuffer chebyshevGramInverse %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->chebyshevSolveKernel, 0, sizeof(cl_mem), (void *)&this->chebyshevSums);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 0 chebyshevSolveKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->chebyshevSolveKernel, 1, sizeof(cl_mem), (void *)&this->chebyshevGramInverse);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 1 chebyshevSolveKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->chebyshevSolveKernel, 2, sizeof(cl_int), (void *)&this->numParticles);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 2 chebyshevSolveKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->chebyshevSolveKernel, 3, sizeof(cl_int), (void *)&degree);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 3 chebyshevSolveKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->chebyshevSolveKernel, 4, sizeof(cl_mem), (void *)&this->chebyshevCoefficients);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 4 chebyshevSolveKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clEnqueueNDRangeKernel(this->commandQueue, this->chebyshevSolveKernel, 1, NULL, globalThreads, NULL, 0, 0, NULL);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clEnqueueNDRangeKernel chebyshevSolveKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clEnqueueReadBuffer(this->commandQueue, this->chebyshevCoefficients, CL_TRUE, 0, (size_t)(degree + 1) * this->numParticles * sizeof(cl_double4), hostCoefficients, 0, 0, 0);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clEnqueueReadBuffer chebyshevCoefficients %s"), this->ErrorMessage(status));
+    throw status;
+  }
+}
+
+void CLModel::CreateDenseOutputBuffers()
+{
+  cl_int status = CL_SUCCESS;
+  if (this->densePos == NULL)
+  {
+    this->densePos = clCreateBuffer(this->context, CL_MEM_READ_WRITE, this->numParticles * sizeof(cl_double4), 0, &status);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clCreateBuffer failed to create cl_mem object for densePos %s"), this->ErrorMessage(status));
+      throw status;
+    }
+  }
+
+  if (this->denseVel == NULL)
+  {
+    this->denseVel = clCreateBuffer(this->context, CL_MEM_WRITE_ONLY, this->numParticles * sizeof(cl_double4), 0, &status);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clCreateBuffer failed to create cl_mem object for denseVel %s"), this->ErrorMessage(status));
+      throw status;
+    }
+  }
+
+  if (this->denseGravPos == NULL)
+  {
+    this->denseGravPos = clCreateBuffer(this->context, CL_MEM_READ_ONLY, this->numGrav * sizeof(cl_double4), 0, &status);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clCreateBuffer failed to create cl_mem object for denseGravPos %s"), this->ErrorMessage(status));
+      throw status;
+    }
+  }
+
+  if (this->denseWeights == NULL)
+  {
+    this->denseWeights = clCreateBuffer(this->context, CL_MEM_READ_ONLY, CLModel::denseOutputOrder * sizeof(cl_double), 0, &status);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clCreateBuffer failed to create cl_mem object for denseWeights %s"), this->ErrorMessage(status));
+      throw status;
+    }
+  }
+}
+
+// Integrals from 0 to fraction of the Lagrange basis polynomials through the nodes 1, 0, -1 ... -10,
+// in units of the step. At fraction 1 these are the Adams-Moulton M12 coefficients.
+void CLModel::DenseOutputWeights(cl_double fraction, cl_double *weights)
+{
+  CLModel::AdamsWeights(CLModel::denseOutputOrder, 1, fraction, weights);
+}
+
+// Integrals from 0 to fraction of the order Lagrange basis polynomials through the nodes newestNode, newestNode - 1 ...
+// in units of the step. At fraction 1, newestNode 0 gives the Adams-Bashforth coefficients and newestNode 1 the Adams-Moulton ones.
+void CLModel::AdamsWeights(int order, int newestNode, cl_double fraction, cl_double *weights)
+{
+  for (int j = 0; j < order; j++)
+  {
+    // Expand the product of (u - node) over the other nodes into powers of u
+    double coefficients[16];
+    double denominator = 1.0;
+    int degree = 0;
+    coefficients[0] = 1.0;
+    for (int m = 0; m < order; m++)
+    {
+      if (m == j)
+      {
+        continue;
+      }
+
+      double node = newestNode - m;
+      coefficients[degree + 1] = 0.0;
+      for (int i = degree + 1; i > 0; i--)
+      {
+        coefficients[i] = coefficients[i - 1] - node * coefficients[i];
+      }
+      coefficients[0] = -node * coefficients[0];
+      degree++;
+      denominator *= (newestNode - j) - node;
+    }
+
+    double integral = 0.0;
+    double power = fraction;
+    for (int i = 0; i <= degree; i++)
+    {
+      integral += coefficients[i] * power / (i + 1);
+      power *= fraction;
+    }
+    weights[j] = integral / denominator;
+  }
+}
+
+// Evaluates the state fraction of the way through the step just completed, 0 being the start of the step and 1 the current state.
+// The integrator state is left untouched. hostPositions and hostVelocities receive numParticles values and may be NULL.
+// Returns false if there is not yet enough Adams history to interpolate.
+bool CLModel::DenseOutput(cl_double fraction, cl_double4 *hostPositions, cl_double4 *hostVelocities)
+{
+
+#ifdef __WXDEBUG__
+  wxLogDebug(wxT("CLModel::DenseOutput threadId: %ld"), wxThread::GetCurrentId());
+#endif
+
+  cl_int status = CL_SUCCESS;
+  if (!this->initialisedOk)
+  {
+    wxLogDebug(wxT("Aborted CLModel failed to Initialise"));
+    throw -1;
+  }
+
+  // The history is only complete once the startup steps are done and between steps, and is interpolated for a while after
+  // the step size changes. When streaming the history is on the host
+  if (this->step <= 16 || this->stage != this->numStages || this->streaming || (this->step >= this->rescaleStep && this->step - this->rescaleStep < 16))
+  {
+    return false;
+  }
+
+  this->CreateDenseOutputBuffers();
+  cl_double weights[CLModel::denseOutputOrder];
+  CLModel::DenseOutputWeights(fraction, weights);
+  status = clEnqueueWriteBuffer(this->commandQueue, this->denseWeights, CL_TRUE, 0, CLModel::denseOutputOrder * sizeof(cl_double), weights, 0, 0, 0);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clEnqueueWriteBuffer denseWeights %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  size_t globalThreads[] = {(size_t)this->numParticles};
+  size_t localThreads[] = {this->groupSize};
+  cl_int completedStep = this->step - 1;
+
+  status = clSetKernelArg(this->denseOutputKernel, 0, sizeof(cl_mem), (void *)&this->currPos);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 0 denseOutputKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->denseOutputKernel, 1, sizeof(cl_mem), (void *)&this->currVel);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 1 denseOutputKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->denseOutputKernel, 2, sizeof(cl_mem), (void *)&this->acc);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 2 denseOutputKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->denseOutputKernel, 3, sizeof(cl_mem), (void *)&this->posLast);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 3 denseOutputKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->denseOutputKernel, 4, sizeof(cl_mem), (void *)&this->velLast);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 4 denseOutputKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->denseOutputKernel, 5, sizeof(cl_mem), (void *)&this->velHistory);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 5 denseOutputKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->denseOutputKernel, 6, sizeof(cl_mem), (void *)&this->accHistory);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 6 denseOutputKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->denseOutputKernel, 7, sizeof(cl_mem), (void *)&this->denseWeights);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 7 denseOutputKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->denseOutputKernel, 8, sizeof(cl_double), (void *)&this->delT);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 8 denseOutputKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->denseOutputKernel, 9, sizeof(cl_int), (void *)&completedStep);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 9 denseOutputKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->denseOutputKernel, 10, sizeof(cl_int), (void *)&this->numParticles);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 10 denseOutputKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->denseOutputKernel, 11, sizeof(cl_mem), (void *)&this->densePos);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 11 denseOutputKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->denseOutputKernel, 12, sizeof(cl_mem), (void *)&this->denseVel);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 12 denseOutputKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clEnqueueNDRangeKernel(this->commandQueue, this->denseOutputKernel, 1, NULL, globalThreads, localThreads, 0, 0, NULL);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clEnqueueNDRangeKernel denseOutputKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  if (hostPositions != NULL)
+  {
+    status = clEnqueueReadBuffer(this->commandQueue, this->densePos, CL_TRUE, 0, this->numParticles * sizeof(cl_double4), hostPositions, 0, 0, 0);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clEnqueueReadBuffer densePos %s"), this->ErrorMessage(status));
+      throw status;
+    }
+  }
+
+  if (hostVelocities != NULL)
+  {
+    status = clEnqueueReadBuffer(this->commandQueue, this->denseVel, CL_TRUE, 0, this->numParticles * sizeof(cl_double4), hostVelocities, 0, 0, 0);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clEnqueueReadBuffer denseVel %s"), this->ErrorMessage(status));
+      throw status;
+    }
+  }
+
+  this->denseOutputTime = this->time - (1.0 - fraction) * this->delT;
+  return true;
+}
+
+// Shows the dense output state in place of the current state until the next step
+bool CLModel::DisplayDenseOutput(cl_double fraction)
+{
+  cl_int status = CL_SUCCESS;
+  if (!this->DenseOutput(fraction, NULL, NULL))
+  {
+    return false;
+  }
+
+  status = clEnqueueCopyBuffer(this->commandQueue, this->densePos, this->denseGravPos, 0, 0, this->numGrav * sizeof(cl_double4), 0, 0, 0);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clEnqueueCopyBuffer densePos to denseGravPos failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  this->displayingDenseOutput = true;
+  this->UpdateDisplay();
+  return true;
+}
+
+// Seconds since julianDate of the state being displayed
+cl_double CLModel::DisplayedTime()
+{
+  return this->displayingDenseOutput ? this->denseOutputTime : this->time;
+}
+
+// Mass weighted centre of the bodies with mass, total GM in .w. Mirrors gravCentre in the kernels
+cl_double4 CLModel::GravCentre(cl_double4 *state, cl_double4 *positions)
+{
+  cl_double4 centre;
+  double total = 0.0;
+  centre.s[0] = centre.s[1] = centre.s[2] = centre.s[3] = 0.0;
+  for (int gravBody = 0; gravBody < this->numGrav; gravBody++)
+  {
+    double gm = positions[gravBody].s[3];
+    for (int component = 0; component < 3; component++)
+    {
+      centre.s[component] += gm * state[gravBody].s[component];
+    }
+    total += gm;
+  }
+
+  for (int component = 0; component < 3; component++)
+  {
+    centre.s[component] /= total;
+  }
+  centre.s[3] = total;
+  return centre;
+}
+
+// Stops integrating the test particles at the end of the arrays that are further than minDistance Gm from the
+// centre of mass and on bound orbits. They are left where they are until EndKeplerFastForward moves them analytically.
+// Only a run of such particles at the end can be frozen, as the kernels are launched over the first activeParticles.
+// Returns the number of particles frozen.
+cl_int CLModel::BeginKeplerFastForward(cl_double minDistance)
+{
+  cl_int status = CL_SUCCESS;
+  if (this->activeParticles != this->numParticles)
+  {
+    return this->numParticles - this->activeParticles;
+  }
+
+  // The history of the bodies with mass is needed to fill in the history of the frozen particles afterwards,
+  // and the orbits are about the barycentre so the device state has to be barycentric.
+  // The Kepler solver's sin and cos aren't correctly rounded, so deterministic runs integrate every particle
+  if (this->step < 16 || this->stage != this->numStages || this->streaming || this->heliocentricFrame || this->deterministic)
+  {
+    return 0;
+  }
+
+  cl_double4 *positions = new cl_double4[this->numParticles];
+  cl_double4 *velocities = new cl_double4[this->numParticles];
+  cl_int firstFrozen = this->numParticles;
+  try
+  {
+    this->ReadToInitialState(positions, velocities);
+    cl_double4 centrePos = this->GravCentre(positions, positions);
+    cl_double4 centreVel = this->GravCentre(velocities, positions);
+    // GM in w gives accelerations in km/s^2 from distances in Gm, work in Gm and Gm/s
+    double mu = centrePos.s[3] * 1e-6;
+    while (firstFrozen > this->numGrav)
+    {
+      double radiusSquared = 0.0;
+      double speedSquared = 0.0;
+      for (int component = 0; component < 3; component++)
+      {
+        double r = positions[firstFrozen - 1].s[component] - centrePos.s[component];
+        double v = (velocities[firstFrozen - 1].s[component] - centreVel.s[component]) * 1e-6;
+        radiusSquared += r * r;
+        speedSquared += v * v;
+      }
+
+      double radius = sqrt(radiusSquared);
+      if (radius < minDistance || speedSquared / 2 - mu / radius >= 0.0)
+      {
+        break;
+      }
+      firstFrozen--;
+    }
+
+    // The kernels need whole work groups
+    firstFrozen = (cl_int)(((firstFrozen + this->groupSize - 1) / this->groupSize) * this->groupSize);
+    if (firstFrozen < this->numParticles)
+    {
+      size_t numFrozen = this->numParticles - firstFrozen;
+      this->keplerStartPos = clCreateBuffer(this->context, CL_MEM_READ_ONLY, numFrozen * sizeof(cl_double4), 0, &status);
+      if (status != CL_SUCCESS)
+      {
+        wxLogError(wxT("clCreateBuffer failed to create cl_mem object for keplerStartPos %s"), this->ErrorMessage(status));
+        throw status;
+      }
+
+      this->keplerStartVel = clCreateBuffer(this->context, CL_MEM_READ_ONLY, numFrozen * sizeof(cl_double4), 0, &status);
+      if (status != CL_SUCCESS)
+      {
+        wxLogError(wxT("clCreateBuffer failed to create cl_mem object for keplerStartVel %s"), this->ErrorMessage(status));
+        throw status;
+      }
+
+      status = clEnqueueWriteBuffer(this->commandQueue, this->keplerStartPos, CL_TRUE, 0, numFrozen * sizeof(cl_double4), positions + firstFrozen, 0, 0, 0);
+      if (status != CL_SUCCESS)
+      {
+        wxLogError(wxT("clEnqueueWriteBuffer keplerStartPos %s"), this->ErrorMessage(status));
+        throw status;
+      }
+
+      status = clEnqueueWriteBuffer(this->commandQueue, this->keplerStartVel, CL_TRUE, 0, numFrozen * sizeof(cl_double4), velocities + firstFrozen, 0, 0, 0);
+      if (status != CL_SUCCESS)
+      {
+        wxLogError(wxT("clEnqueueWriteBuffer keplerStartVel %s"), this->ErrorMessage(status));
+        throw status;
+      }
+
+      this->keplerStartCentrePos = centrePos;
+      this->keplerStartCentreVel = centreVel;
+      this->keplerStartTime = this->time;
+      this->activeParticles = firstFrozen;
+    }
+  }
+  catch (int ex)
+  {
+    delete[] positions;
+    delete[] velocities;
+    this->ReleaseKeplerBuffers();
+    throw ex;
+  }
+
+  delete[] positions;
+  delete[] velocities;
+  return this->numParticles - this->activeParticles;
+}
+
+bool CLModel::IsKeplerFastForwarding()
+{
+  return this->activeParticles != this->numParticles;
+}
+
+// Moves the frozen particles along their Kepler orbits to the current time, fills in their Adams history,
+// and goes back to integrating every particle
+void CLModel::EndKeplerFastForward()
+{
+  cl_int status = CL_SUCCESS;
+  if (!this->IsKeplerFastForwarding())
+  {
+    return;
+  }
+
+  size_t globalThreads[] = {(size_t)(this->numParticles - this->activeParticles)};
+  cl_double elapsed = this->time - this->keplerStartTime;
+
+  status = clSetKernelArg(this->keplerFastForwardKernel, 0, sizeof(cl_mem), (void *)&this->currPos);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 0 keplerFastForwardKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->keplerFastForwardKernel, 1, sizeof(cl_mem), (void *)&this->currVel);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 1 keplerFastForwardKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->keplerFastForwardKernel, 2, sizeof(cl_mem), (void *)&this->acc);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 2 keplerFastForwardKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->keplerFastForwardKernel, 3, sizeof(cl_mem), (void *)&this->posLast);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 3 keplerFastForwardKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->keplerFastForwardKernel, 4, sizeof(cl_mem), (void *)&this->velLast);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 4 keplerFastForwardKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->keplerFastForwardKernel, 5, sizeof(cl_mem), (void *)&this->velHistory);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 5 keplerFastForwardKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->keplerFastForwardKernel, 6, sizeof(cl_mem), (void *)&this->accHistory);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 6 keplerFastForwardKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->keplerFastForwardKernel, 7, sizeof(cl_mem), (void *)&this->keplerStartPos);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 7 keplerFastForwardKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->keplerFastForwardKernel, 8, sizeof(cl_mem), (void *)&this->keplerStartVel);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 8 keplerFastForwardKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->keplerFastForwardKernel, 9, sizeof(cl_double4), (void *)&this->keplerStartCentrePos);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 9 keplerFastForwardKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->keplerFastForwardKernel, 10, sizeof(cl_double4), (void *)&this->keplerStartCentreVel);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 10 keplerFastForwardKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->keplerFastForwardKernel, 11, sizeof(cl_double), (void *)&elapsed);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 11 keplerFastForwardKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->keplerFastForwardKernel, 12, sizeof(cl_double), (void *)&this->delT);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 12 keplerFastForwardKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->keplerFastForwardKernel, 13, sizeof(cl_int), (void *)&this->step);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 13 keplerFastForwardKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->keplerFastForwardKernel, 14, sizeof(cl_int), (void *)&this->numGrav);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 14 keplerFastForwardKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->keplerFastForwardKernel, 15, sizeof(cl_int), (void *)&this->numParticles);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 15 keplerFastForwardKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(this->keplerFastForwardKernel, 16, sizeof(cl_int), (void *)&this->activeParticles);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 16 keplerFastForwardKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clEnqueueNDRangeKernel(this->commandQueue, this->keplerFastForwardKernel, 1, NULL, globalThreads, NULL, 0, 0, NULL);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clEnqueueNDRangeKernel keplerFastForwardKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clFinish(this->commandQueue);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clFinish failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  this->ReleaseKeplerBuffers();
+}
+
+// Drops the fast forward state, any frozen particles are integrated again from where they were frozen
+void CLModel::ReleaseKeplerBuffers()
+{
+  cl_int status = CL_SUCCESS;
+  if (this->keplerStartPos != NULL)
+  {
+    status = clReleaseMemObject(this->keplerStartPos);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clReleaseMemObject keplerStartPos failed %s"), this->ErrorMessage(status));
+    }
+    this->keplerStartPos = NULL;
+  }
+
+  if (this->keplerStartVel != NULL)
+  {
+    status = clReleaseMemObject(this->keplerStartVel);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clReleaseMemObject keplerStartVel failed %s"), this->ErrorMessage(status));
+    }
+    this->keplerStartVel = NULL;
+  }
+  this->activeParticles = this->numParticles;
+}
+
+// Converts orbital elements to state vectors relative to the centre body on the device.
+// See orbitalToStateVectors in the kernels for the layout of the elements.
+// Only needs the program, so it can be used before the buffers for a new initial state exist
+void CLModel::OrbitalToStateVectors(cl_double4 *elementsA, cl_double4 *elementsB, cl_int numElements, cl_double centreMass, cl_double4 *positions, cl_double4 *velocities)
+{
+  cl_int status = CL_SUCCESS;
+  if (!this->initialisedOk || this->orbitalToStateVectorsKernel == NULL)
+  {
+    wxLogError(wxT("OrbitalToStateVectors called before the kernels were created"));
+    throw -1;
+  }
+
+  if (numElements <= 0)
+  {
+    return;
+  }
+
+  size_t size = numElements * sizeof(cl_double4);
+  cl_mem buffers[4] = {NULL, NULL, NULL, NULL};
+  try
+  {
+    buffers[0] = clCreateBuffer(this->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, size, elementsA, &status);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clCreateBuffer failed to create cl_mem object for elementsA %s"), this->ErrorMessage(status));
+      throw status;
+    }
+
+    buffers[1] = clCreateBuffer(this->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, size, elementsB, &status);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clCreateBuffer failed to create cl_mem object for elementsB %s"), this->ErrorMessage(status));
+      throw status;
+    }
+
+    buffers[2] = clCreateBuffer(this->context, CL_MEM_WRITE_ONLY, size, 0, &status);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clCreateBuffer failed to create cl_mem object for element positions %s"), this->ErrorMessage(status));
+      throw status;
+    }
+
+    buffers[3] = clCreateBuffer(this->context, CL_MEM_WRITE_ONLY, size, 0, &status);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clCreateBuffer failed to create cl_mem object for element velocities %s"), this->ErrorMessage(status));
+      throw status;
+    }
+
+    status = clSetKernelArg(this->orbitalToStateVectorsKernel, 0, sizeof(cl_mem), (void *)&buffers[0]);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clSetKernelArg 0 orbitalToStateVectorsKernel failed %s"), this->ErrorMessage(status));
+      throw status;
+    }
+
+    status = clSetKernelArg(this->orbitalToStateVectorsKernel, 1, sizeof(cl_mem), (void *)&buffers[1]);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clSetKernelArg 1 orbitalToStateVectorsKernel failed %s"), this->ErrorMessage(status));
+      throw status;
+    }
+
+    status = clSetKernelArg(this->orbitalToStateVectorsKernel, 2, sizeof(cl_double), (void *)&centreMass);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clSetKernelArg 2 orbitalToStateVectorsKernel failed %s"), this->ErrorMessage(status));
+      throw status;
+    }
+
+    status = clSetKernelArg(this->orbitalToStateVectorsKernel, 3, sizeof(cl_mem), (void *)&buffers[2]);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clSetKernelArg 3 orbitalToStateVectorsKernel failed %s"), this->ErrorMessage(status));
+      throw status;
+    }
+
+    status = clSetKernelArg(this->orbitalToStateVectorsKernel, 4, sizeof(cl_mem), (void *)&buffers[3]);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clSetKernelArg 4 orbitalToStateVectorsKernel failed %s"), this->ErrorMessage(status));
+      throw status;
+    }
+
+    status = clSetKernelArg(this->orbitalToStateVectorsKernel, 5, sizeof(cl_int), (void *)&numElements);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clSetKernelArg 5 orbitalToStateVectorsKernel failed %s"), this->ErrorMessage(status));
+      throw status;
+    }
+
+    size_t globalThreads[] = {(size_t)numElements};
+    status = clEnqueueNDRangeKernel(this->commandQueue, this->orbitalToStateVectorsKernel, 1, NULL, globalThreads, NULL, 0, 0, NULL);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clEnqueueNDRangeKernel orbitalToStateVectorsKernel failed %s"), this->ErrorMessage(status));
+      throw status;
+    }
+
+    status = clEnqueueReadBuffer(this->commandQueue, buffers[2], CL_TRUE, 0, size, positions, 0, NULL, NULL);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clEnqueueReadBuffer element positions failed %s"), this->ErrorMessage(status));
+      throw status;
+    }
+
+    status = clEnqueueReadBuffer(this->commandQueue, buffers[3], CL_TRUE, 0, size, velocities, 0, NULL, NULL);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clEnqueueReadBuffer element velocities failed %s"), this->ErrorMessage(status));
+      throw status;
+    }
+  }
+  catch (int ex)
+  {
+    for (int buffer = 0; buffer < 4; buffer++)
+    {
+      if (buffers[buffer] != NULL)
+      {
+        clReleaseMemObject(buffers[buffer]);
+      }
+    }
+    throw ex;
+  }
+
+  for (int buffer = 0; buffer < 4; buffer++)
+  {
+    status = clReleaseMemObject(buffers[buffer]);
     if (status != CL_SUCCESS)
     {
-      wxLogError(wxT("clEnqueueBarrierWithWaitList failed %s"), this->ErrorMessage(status));
+      wxLogError(wxT("clReleaseMemObject orbital element buffer failed %s"), this->ErrorMessage(status));
+    }
+  }
+}
+
+bool CLModel::IsStreaming()
+{
+  return this->streaming;
+}
+
+// Advances the stage, and after the corrector the step, once the kernels for a stage have been run
+void CLModel::EndStage()
+{
+  this->stage = this->stage - 1;
+  if (this->stage < 0)
+  {
+    // if we just finished the corrector stage then advance to the next step (time)
+    this->displayingDenseOutput = false;
+    this->stage = this->numStages;
+    this->time += this->delT;
+    this->step++;
+
+    if (this->stepErrorReady)
+    {
+      this->stepErrorReady = false;
+      this->ControlStepSize();
+    }
+
+    if (this->targetDeltaTime != 0.0 && this->rescaleRatio == 1.0)
+    {
+      this->GrowToTargetStep();
+    }
+
+    if (this->updateDisplay)
+    {
+      this->updateDisplay = !this->updateDisplay;
+      this->UpdateDisplay();
+    }
+  }
+}
+
+// The host copy of one row of a chunk, see numStreamRows.
+// Each chunk is laid out like the device buffers for a simulation of chunkSize particles, so the history rows go across in one transfer
+cl_double4 *CLModel::StreamRow(int chunk, int row)
+{
+  return this->streamState + ((size_t)chunk * numStreamRows + row) * this->chunkSize;
+}
+
+// The usual device buffers hold the first chunk, this creates the second set, its queue and the host state
+void CLModel::CreateStreamBuffers()
+{
+  cl_int status = CL_SUCCESS;
+  size_t historyRows[9] = {1, 1, 1, 1, 16, 16, 1, 1, 1};
+  for (int buffer = 0; buffer < 9; buffer++)
+  {
+    this->streamSlot[buffer] = clCreateBuffer(this->context, CL_MEM_READ_WRITE, this->chunkSize * historyRows[buffer] * sizeof(cl_double4), 0, &status);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clCreateBuffer failed to create cl_mem object for streamSlot %d %s"), buffer, this->ErrorMessage(status));
       throw status;
     }
-    wxLogDebug(wxT("CLModel::ExecuteKernels clEnqueueBarrierWithWaitList()"));
+  }
+
+  if (this->deviceCLVersionNumber >= 2.0)
+  {
+    cl_queue_properties properties[] = {
+        CL_QUEUE_PROPERTIES, 0, // No special properties
+        0                       // Terminating zero
+    };
+    this->streamQueue = clCreateCommandQueueWithProperties(this->context, this->deviceId, properties, &status);
   }
   else
   {
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wdeprecated-declarations"
-    status = clEnqueueBarrier(this->commandQueue);
+    this->streamQueue = clCreateCommandQueue(this->context, this->deviceId, 0, &status);
 #pragma GCC diagnostic pop
+  }
+
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("Stream command queue creation failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  size_t streamStateSize = (size_t)this->numChunks * numStreamRows * this->chunkSize;
+  this->streamState = new cl_double4[streamStateSize];
+  if (this->streamState == NULL)
+  {
+    wxLogError(wxT("Failed to Allocate streamState"));
+    throw -1;
+  }
+  memset(this->streamState, 0, streamStateSize * sizeof(cl_double4));
+  wxLogDebug(wxT("Streaming %d particles in %d chunks of %d"), this->numParticles, this->numChunks, this->chunkSize);
+}
+
+void CLModel::ReleaseStreamBuffers()
+{
+  cl_int status = CL_SUCCESS;
+  for (int buffer = 0; buffer < 9; buffer++)
+  {
+    if (this->streamSlot[buffer] != NULL)
+    {
+      status = clReleaseMemObject(this->streamSlot[buffer]);
+      if (status != CL_SUCCESS)
+      {
+        wxLogError(wxT("clReleaseMemObject streamSlot %d failed %s"), buffer, this->ErrorMessage(status));
+      }
+      this->streamSlot[buffer] = NULL;
+    }
+  }
+
+  if (this->streamQueue != NULL)
+  {
+    status = clReleaseCommandQueue(this->streamQueue);
     if (status != CL_SUCCESS)
     {
-      wxLogError(wxT("clEnqueueBarrier failed %s"), this->ErrorMessage(status));
-      throw status;
+      wxLogError(wxT("clReleaseCommandQueue streamQueue failed %s"), this->ErrorMessage(status));
     }
-    wxLogDebug(wxT("CLModel::ExecuteKernels clEnqueueBarrier()"));
+    this->streamQueue = NULL;
   }
 
-  // Copy new positions to current position
-  status = clEnqueueCopyBuffer(commandQueue, this->newPos, this->currPos, 0, 0, sizeof(cl_double4) * this->numParticles, 0, 0, 0);
-  if (status != CL_SUCCESS)
+  if (this->streamState != NULL)
   {
-    wxLogError(wxT("clEnqueueCopyBuffer newPos to currPos failed %s"), this->ErrorMessage(status));
-    throw status;
+    delete[] this->streamState;
+    this->streamState = NULL;
   }
+  this->streaming = false;
+}
 
-  // Copy new positions of the bodies with mass to gravPos
-  status = clEnqueueCopyBuffer(commandQueue, this->newPos, this->gravPos, 0, 0, sizeof(cl_double4) * this->numGrav, 0, 0, 0);
+// Points the acceleration kernel and an integration kernel at one set of chunk buffers.
+// Kernel arguments are captured when a kernel is enqueued, so the same kernels serve both sets
+void CLModel::SetStreamKernelArgs(cl_kernel integrationKernel, cl_mem *buffers)
+{
+  cl_int status;
+  bool newtonian = this->accelerationKernelName->StartsWith(wxT("newtonian"));
+
+  status = clSetKernelArg(this->accKernel, 1, sizeof(cl_mem), (void *)&buffers[0]);
   if (status != CL_SUCCESS)
   {
-    wxLogError(wxT("clEnqueueCopyBuffer newPos to gravPos failed %s"), this->ErrorMessage(status));
+    wxLogError(wxT("clSetKernelArg 1 accKernel failed for chunk positions %s"), this->ErrorMessage(status));
     throw status;
   }
-  // Copy new velocities to current velocities
-  status = clEnqueueCopyBuffer(commandQueue, this->newVel, this->currVel, 0, 0, sizeof(cl_double4) * this->numParticles, 0, 0, 0);
+
+  if (!newtonian)
+  {
+    status = clSetKernelArg(this->accKernel, 2, sizeof(cl_mem), (void *)&buffers[1]);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clSetKernelArg 2 accKernel failed for chunk velocities %s"), this->ErrorMessage(status));
+      throw status;
+    }
+  }
+
+  status = clSetKernelArg(this->accKernel, newtonian ? 4 : 5, sizeof(cl_mem), (void *)&buffers[6]);
   if (status != CL_SUCCESS)
   {
-    wxLogError(wxT("clEnqueueCopyBuffer newVel to currVel failed %s"), this->ErrorMessage(status));
+    wxLogError(wxT("clSetKernelArg accKernel failed for chunk accelerations %s"), this->ErrorMessage(status));
     throw status;
   }
 
-  if (this->deviceCLVersionNumber >= 1.2)
+  // argument number of each chunk buffer in the integration kernels, see SetAdamsKernelArgs
+  const cl_uint integrationArgs[9] = {0, 1, 9, 10, 11, 12, 2, 4, 5};
+  for (int buffer = 0; buffer < 9; buffer++)
   {
-    status = clEnqueueBarrierWithWaitList(this->commandQueue, 0, NULL, NULL);
+    status = clSetKernelArg(integrationKernel, integrationArgs[buffer], sizeof(cl_mem), (void *)&buffers[buffer]);
     if (status != CL_SUCCESS)
     {
-      wxLogError(wxT("clEnqueueBarrierWithWaitList failed %s"), this->ErrorMessage(status));
+      wxLogError(wxT("clSetKernelArg %u integration kernel failed for chunk buffer %s"), integrationArgs[buffer], this->ErrorMessage(status));
       throw status;
     }
-    wxLogDebug(wxT("CLModel::ExecuteKernels clEnqueueBarrierWithWaitList()"));
+  }
+
+  status = clSetKernelArg(integrationKernel, 6, sizeof(cl_int), (void *)&this->stage);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 6 integration kernel failed for stage %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  status = clSetKernelArg(integrationKernel, 7, sizeof(cl_int), (void *)&this->step);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 7 integration kernel failed for step %s"), this->ErrorMessage(status));
+    throw status;
+  }
+
+  // the history ring buffers of a chunk are strided by the chunk size
+  status = clSetKernelArg(integrationKernel, 8, sizeof(cl_int), (void *)&this->chunkSize);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 8 integration kernel failed for chunkSize %s"), this->ErrorMessage(status));
+    throw status;
+  }
+}
+
+// Runs one stage over every chunk. Chunks alternate between the two sets of device buffers, each with its own queue,
+// so while one chunk is being integrated the next is being uploaded and the previous one read back.
+// The bodies with mass are all in the first chunk. gravPos is only refreshed once every chunk has used it,
+// exactly as when everything is on the device.
+void CLModel::ExecuteStreamingStage()
+{
+  cl_int status = CL_SUCCESS;
+  cl_kernel integrationKernel;
+  if (this->step < 16)
+  {
+    integrationKernel = this->startupKernel;
   }
   else
   {
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
-    status = clEnqueueBarrier(this->commandQueue);
-#pragma GCC diagnostic pop
+    integrationKernel = this->stage == 1 ? this->adamsBashforthKernel : this->adamsMoultonKernel;
+  }
+
+  // The predictor writes posLast, velLast and one history slot, the corrector only the new position and velocity
+  bool predictor = this->stage == 1;
+  int historyRow = this->step & 0xF;
+
+  cl_command_queue queues[2] = {this->commandQueue, this->streamQueue};
+  cl_mem buffers[2][9] = {
+      {this->currPos, this->currVel, this->posLast, this->velLast, this->velHistory, this->accHistory, this->acc, this->newPos, this->newVel},
+      {this->streamSlot[0], this->streamSlot[1], this->streamSlot[2], this->streamSlot[3], this->streamSlot[4], this->streamSlot[5], this->streamSlot[6], this->streamSlot[7], this->streamSlot[8]}};
+  size_t rowSize = this->chunkSize * sizeof(cl_double4);
+  size_t localThreads[] = {this->groupSize};
+
+  // Every chunk uses the tree of the bodies with mass, so it is built before any of them
+  if (this->treeAcceleration)
+  {
+    this->EnqueueTreeBuild(this->commandQueue);
+    status = clFinish(this->commandQueue);
     if (status != CL_SUCCESS)
     {
-      wxLogError(wxT("clEnqueueBarrier failed %s"), this->ErrorMessage(status));
+      wxLogError(wxT("clFinish after the tree build failed %s"), this->ErrorMessage(status));
       throw status;
     }
-    wxLogDebug(wxT("CLModel::ExecuteKernels clEnqueueBarrier()"));
   }
 
-  this->stage = this->stage - 1;
-  if (this->stage < 0)
+  for (int chunk = 0; chunk < this->numChunks; chunk++)
   {
-    // if we just finished the corrector stage then advance to the next step (time)
-    this->stage = this->numStages;
-    this->time += this->delT;
-    this->step++;
+    int slot = chunk & 1;
+    cl_command_queue queue = queues[slot];
+    cl_mem *slotBuffers = buffers[slot];
+    size_t count = this->numParticles - chunk * this->chunkSize;
+    count = count < (size_t)this->chunkSize ? count : (size_t)this->chunkSize;
+    size_t countSize = count * sizeof(cl_double4);
+    size_t globalThreads[] = {count};
+
+    // upload currPos, currVel, posLast and velLast, then both ring buffers whole
+    for (int row = 0; row < 4; row++)
+    {
+      status = clEnqueueWriteBuffer(queue, slotBuffers[row], CL_FALSE, 0, countSize, this->StreamRow(chunk, row), 0, NULL, NULL);
+      if (status != CL_SUCCESS)
+      {
+        wxLogError(wxT("clEnqueueWriteBuffer chunk %d row %d failed %s"), chunk, row, this->ErrorMessage(status));
+        throw status;
+      }
+    }
 
-    if (this->updateDisplay)
+    status = clEnqueueWriteBuffer(queue, slotBuffers[4], CL_FALSE, 0, 16 * rowSize, this->StreamRow(chunk, 4), 0, NULL, NULL);
+    if (status != CL_SUCCESS)
     {
-      this->updateDisplay = !this->updateDisplay;
-      this->UpdateDisplay();
+      wxLogError(wxT("clEnqueueWriteBuffer chunk %d velHistory failed %s"), chunk, this->ErrorMessage(status));
+      throw status;
     }
-  }
 
-  wxLogDebug(wxT("CLModel:ExecuteKernel Done"));
-}
+    status = clEnqueueWriteBuffer(queue, slotBuffers[5], CL_FALSE, 0, 16 * rowSize, this->StreamRow(chunk, 20), 0, NULL, NULL);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clEnqueueWriteBuffer chunk %d accHistory failed %s"), chunk, this->ErrorMessage(status));
+      throw status;
+    }
 
-// Aquire the GL points buffer and then copy the positions to it
-void CLModel::UpdateDisplay()
-{
+    this->SetStreamKernelArgs(integrationKernel, slotBuffers);
 
-#ifdef __WXDEBUG__
-  wxLogDebug(wxT("CLModel::UpdateDisplay threadId: %ld"), wxThread::GetCurrentId());
-#endif
+    // The bodies with mass are all in the first chunk, which uses the usual buffers
+    this->EnqueueAcceleration(queue, count, chunk == 0);
 
-  cl_int status = CL_SUCCESS;
+    status = clEnqueueNDRangeKernel(queue, integrationKernel, 1, NULL, globalThreads, localThreads, 0, NULL, NULL);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clEnqueueNDRangeKernel integration kernel chunk %d failed %s"), chunk, this->ErrorMessage(status));
+      throw status;
+    }
 
-  if (!this->initialisedOk)
+    // read back only what the kernel changed, the new state going straight into currPos and currVel
+    status = clEnqueueReadBuffer(queue, slotBuffers[7], CL_FALSE, 0, countSize, this->StreamRow(chunk, 0), 0, NULL, NULL);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clEnqueueReadBuffer chunk %d newPos failed %s"), chunk, this->ErrorMessage(status));
+      throw status;
+    }
+
+    status = clEnqueueReadBuffer(queue, slotBuffers[8], CL_FALSE, 0, countSize, this->StreamRow(chunk, 1), 0, NULL, NULL);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clEnqueueReadBuffer chunk %d newVel failed %s"), chunk, this->ErrorMessage(status));
+      throw status;
+    }
+
+    if (predictor)
+    {
+      for (int row = 2; row < 4; row++)
+      {
+        status = clEnqueueReadBuffer(queue, slotBuffers[row], CL_FALSE, 0, countSize, this->StreamRow(chunk, row), 0, NULL, NULL);
+        if (status != CL_SUCCESS)
+        {
+          wxLogError(wxT("clEnqueueReadBuffer chunk %d row %d failed %s"), chunk, row, this->ErrorMessage(status));
+          throw status;
+        }
+      }
+
+      status = clEnqueueReadBuffer(queue, slotBuffers[4], CL_FALSE, historyRow * rowSize, countSize, this->StreamRow(chunk, 4 + historyRow), 0, NULL, NULL);
+      if (status != CL_SUCCESS)
+      {
+        wxLogError(wxT("clEnqueueReadBuffer chunk %d velHistory failed %s"), chunk, this->ErrorMessage(status));
+        throw status;
+      }
+
+      status = clEnqueueReadBuffer(queue, slotBuffers[5], CL_FALSE, historyRow * rowSize, countSize, this->StreamRow(chunk, 20 + historyRow), 0, NULL, NULL);
+      if (status != CL_SUCCESS)
+      {
+        wxLogError(wxT("clEnqueueReadBuffer chunk %d accHistory failed %s"), chunk, this->ErrorMessage(status));
+        throw status;
+      }
+    }
+
+    status = clFlush(queue);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clFlush failed %s"), this->ErrorMessage(status));
+      throw status;
+    }
+  }
+
+  for (int slot = 0; slot < 2; slot++)
   {
-    wxLogDebug(wxT("Aborted CLModel failed to Initialise"));
-    throw -1;
+    status = clFinish(queues[slot]);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clFinish failed %s"), this->ErrorMessage(status));
+      throw status;
+    }
   }
 
-  // TODO this should be per kernel. Not the lowest that works for all of them
-  size_t globalThreads[] = {(size_t)this->numParticles};
+  status = clEnqueueWriteBuffer(this->commandQueue, this->gravPos, CL_TRUE, 0, this->numGrav * sizeof(cl_double4), this->StreamRow(0, 0), 0, NULL, NULL);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clEnqueueWriteBuffer gravPos failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
+}
+
+// UpdateDisplay when streaming, each chunk's positions are uploaded and copied to their place in the display buffer
+void CLModel::UpdateStreamingDisplay()
+{
+  cl_int status = CL_SUCCESS;
   size_t localThreads[] = {this->groupSize};
 
-  if (localThreads[0] > this->maxWorkItemSizes[0] || localThreads[0] > this->maxWorkGroupSize)
+  status = clEnqueueAcquireGLObjects(this->commandQueue, 1, &this->dispPos, 0, 0, NULL);
+  if (status != CL_SUCCESS)
   {
-    wxLogError(wxT("groupSize %llu is greater than maxWorkItemSizes %llu or maxWorkGroupSize %llu"), (unsigned long long)this->groupSize, (unsigned long long)this->maxWorkItemSizes[0], (unsigned long long)this->maxWorkGroupSize);
-    throw -1;
+    wxLogError(wxT("clEnqueueAcquireGLObjects failed to acquire dispPos %s"), this->ErrorMessage(status));
+    throw status;
   }
 
-  // Execute acceleration kernel on given device
-  // glFinish();
+  status = clSetKernelArg(this->copyChunkToDisplayKernel, 0, sizeof(cl_mem), (void *)&this->gravPos);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 0 copyChunkToDisplayKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
 
-  wxLogDebug(wxT("CLModel::UpdateDisplay clEnqueueAcquireGLObjects()"));
+  status = clSetKernelArg(this->copyChunkToDisplayKernel, 1, sizeof(cl_mem), (void *)&this->currPos);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg 1 copyChunkToDisplayKernel failed %s"), this->ErrorMessage(status));
+    throw status;
+  }
 
-  // cl_event  eventND[1];
-  //  Acquire GL buffer
-  status = clEnqueueAcquireGLObjects(this->commandQueue, 1, &this->dispPos, 0, 0, NULL);
+  status = clSetKernelArg(this->copyChunkToDisplayKernel, 2, sizeof(cl_mem), (void *)&this->dispPos);
   if (status != CL_SUCCESS)
   {
-    wxLogError(wxT("clEnqueueAcquireGLObjects failed to acquire dispPos %s"), this->ErrorMessage(status));
+    wxLogError(wxT("clSetKernelArg 2 copyChunkToDisplayKernel failed %s"), this->ErrorMessage(status));
     throw status;
   }
 
-  // Copy new positions to the display vertex buffer
-  // update the copyToDisplayKernel's centerBody argument so it knows which body to offset the posistions against
-  status = clSetKernelArg(this->copyToDisplayKernel, 3, sizeof(cl_int), (void *)&this->centerBody);
+  status = clSetKernelArg(this->copyChunkToDisplayKernel, 3, sizeof(cl_int), (void *)&this->centerBody);
   if (status != CL_SUCCESS)
   {
-    wxLogError(wxT("clSetKernelArg 3 failed for centerBody %s"), this->ErrorMessage(status));
+    wxLogError(wxT("clSetKernelArg 3 copyChunkToDisplayKernel failed %s"), this->ErrorMessage(status));
     throw status;
   }
 
-  // use reuse event?
-  status = clEnqueueNDRangeKernel(this->commandQueue, this->copyToDisplayKernel, 1, NULL, globalThreads, localThreads, 0, 0, NULL);
-  if (status != CL_SUCCESS)
-  {
-    wxLogError(wxT("clEnqueueNDRangeKernel copyToDisplayKernel failed %s"), this->ErrorMessage(status));
-    throw status;
+  for (int chunk = 0; chunk < this->numChunks; chunk++)
+  {
+    cl_int firstParticle = chunk * this->chunkSize;
+    size_t count = this->numParticles - firstParticle;
+    count = count < (size_t)this->chunkSize ? count : (size_t)this->chunkSize;
+    size_t globalThreads[] = {count};
+
+    status = clEnqueueWriteBuffer(this->commandQueue, this->currPos, CL_FALSE, 0, count * sizeof(cl_double4), this->StreamRow(chunk, 0), 0, NULL, NULL);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clEnqueueWriteBuffer chunk %d positions for display failed %s"), chunk, this->ErrorMessage(status));
+      throw status;
+    }
+
+    status = clSetKernelArg(this->copyChunkToDisplayKernel, 4, sizeof(cl_int), (void *)&firstParticle);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clSetKernelArg 4 copyChunkToDisplayKernel failed %s"), this->ErrorMessage(status));
+      throw status;
+    }
+
+    status = clEnqueueNDRangeKernel(this->commandQueue, this->copyChunkToDisplayKernel, 1, NULL, globalThreads, localThreads, 0, NULL, NULL);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clEnqueueNDRangeKernel copyChunkToDisplayKernel failed %s"), this->ErrorMessage(status));
+      throw status;
+    }
   }
 
-  // Release GL buffer
   status = clEnqueueReleaseGLObjects(this->commandQueue, 1, &this->dispPos, 0, 0, NULL);
   if (status != CL_SUCCESS)
   {
@@ -1228,699 +4967,1220 @@ void CLModel::UpdateDisplay()
     wxLogError(wxT("clFinish failed %s"), this->ErrorMessage(status));
     throw status;
   }
+}
 
-  wxLogDebug(wxT("CLModel::UpdateDisplay clFinish()"));
-  wxLogDebug(wxT("CLModel:UpdateDisplay Done"));
+// Two-phase integration needs the Adams history, whole steps and every particle on the device.
+// Its test particle kernel has no indirect term, so it only runs in the barycentric frame, and it runs at a fixed step.
+// It sums every body with mass directly, so it isn't used with the tree or the perturber masks
+bool CLModel::CanRunTwoPhase()
+{
+  return this->initialisedOk && !this->streaming && !this->heliocentricFrame && !this->stepControl && !this->treeAcceleration && !this->maskedAcceleration && this->step >= 16 && this->stage == this->numStages;
 }
 
-// initialise the kernels so they are ready to be called.
-void CLModel::SetKernelArgumentsAndGroupSize()
+void CLModel::CreateTwoPhaseBuffers()
 {
+  cl_int status = CL_SUCCESS;
+  if (this->twoPhaseEphemeris == NULL)
+  {
+    this->twoPhaseEphemeris = clCreateBuffer(this->context, CL_MEM_READ_WRITE, 2 * CLModel::maxTwoPhaseSteps * this->numGrav * sizeof(cl_double4), 0, &status);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clCreateBuffer failed to create cl_mem object for twoPhaseEphemeris %s"), this->ErrorMessage(status));
+      throw status;
+    }
+  }
 
-#ifdef __WXDEBUG__
-  wxLogDebug(wxT("CLModel::SetKernelArgumentsAndGroupSize threadId: %ld"), wxThread::GetCurrentId());
-#endif
+  if (this->twoPhaseCoefficients == NULL)
+  {
+    this->twoPhaseCoefficients = clCreateBuffer(this->context, CL_MEM_READ_ONLY, 32 * sizeof(cl_double), 0, &status);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clCreateBuffer failed to create cl_mem object for twoPhaseCoefficients %s"), this->ErrorMessage(status));
+      throw status;
+    }
+  }
+}
 
-  if (!this->initialisedOk)
+// Advances numSteps whole steps in two phases.
+// First the bodies with mass, with the test particles that share their work groups, are integrated by the usual stage kernels
+// while gravPos is recorded before every stage. Then a single launch of twoPhaseTestParticles advances every other active
+// test particle all numSteps steps against that record, so their state and history cross global memory once rather than every stage.
+void CLModel::ExecuteTwoPhase(int numSteps)
+{
+  cl_int status = CL_SUCCESS;
+  if (!this->CanRunTwoPhase())
   {
-    wxLogDebug(wxT("Aborted CLModel failed to Initialise"));
+    wxLogError(wxT("Two-phase integration needs the Adams history and every particle on the device"));
     throw -1;
   }
 
-  cl_int status;
-  int paramNumber = 0;
+  numSteps = numSteps < CLModel::maxTwoPhaseSteps ? numSteps : CLModel::maxTwoPhaseSteps;
+  this->CreateTwoPhaseBuffers();
 
-  /*
-    __kernel
-    void copyToDisplay(
-      __constant double4* pos,
-      __global double4* dispPos,
-      int centerBodyIndex
-    )
-  */
-  status = clSetKernelArg(this->copyToDisplayKernel, paramNumber++, sizeof(cl_mem), (void *)&this->gravPos);
+  // The same order of Adams-Bashforth predictor and Adams-Moulton corrector as the stage kernels
+  int order = this->AdamsOrder();
+  cl_double coefficients[32] = {0.0};
+  for (int node = 0; node < order; node++)
+  {
+    coefficients[node] = AdamsCoefficients::table.bashforth[order][node];
+    coefficients[16 + node] = AdamsCoefficients::table.moulton[order][node];
+  }
+  status = clEnqueueWriteBuffer(this->commandQueue, this->twoPhaseCoefficients, CL_TRUE, 0, 32 * sizeof(cl_double), coefficients, 0, 0, 0);
   if (status != CL_SUCCESS)
   {
-    wxLogError(wxT("clSetKernelArg failed for gravPos %s"), this->ErrorMessage(status));
+    wxLogError(wxT("clEnqueueWriteBuffer twoPhaseCoefficients %s"), this->ErrorMessage(status));
     throw status;
   }
 
-  status = clSetKernelArg(this->copyToDisplayKernel, paramNumber++, sizeof(cl_mem), (void *)&this->currPos);
-  if (status != CL_SUCCESS)
+  // Phase one, the work groups holding the bodies with mass
+  size_t gravThreads = ((this->numGrav + this->groupSize - 1) / this->groupSize) * this->groupSize;
+  gravThreads = gravThreads < (size_t)this->activeParticles ? gravThreads : (size_t)this->activeParticles;
+  cl_int firstStep = this->step;
+  bool update = this->updateDisplay;
+  this->updateDisplay = false;
+  for (int record = 0; record < 2 * numSteps; record++)
   {
-    wxLogError(wxT("clSetKernelArg failed for currPos %s"), this->ErrorMessage(status));
-    throw status;
+    status = clEnqueueCopyBuffer(this->commandQueue, this->gravPos, this->twoPhaseEphemeris, 0, record * this->numGrav * sizeof(cl_double4), this->numGrav * sizeof(cl_double4), 0, 0, 0);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clEnqueueCopyBuffer gravPos to twoPhaseEphemeris failed %s"), this->ErrorMessage(status));
+      throw status;
+    }
+
+    this->EnqueueStage(gravThreads, false);
+    this->EndStage();
   }
 
-  status = clSetKernelArg(this->copyToDisplayKernel, paramNumber++, sizeof(cl_mem), (void *)&this->dispPos);
-  if (status != CL_SUCCESS)
+  // Phase two, the rest of the active test particles
+  if (gravThreads < (size_t)this->activeParticles)
   {
-    wxLogError(wxT("clSetKernelArg failed for dispPos %s"), this->ErrorMessage(status));
-    throw status;
+    size_t globalThreads[] = {this->activeParticles - gravThreads};
+    size_t localThreads[] = {this->groupSize};
+    cl_int firstParticle = (cl_int)gravThreads;
+    cl_int relativistic = this->accelerationKernelName->StartsWith(wxT("newtonian")) ? 0 : 1;
+    cl_int kernelOrder = (cl_int)order;
+
+    // in the order of the kernel's arguments
+    size_t argSizes[18] = {sizeof(cl_mem), sizeof(cl_int), sizeof(cl_double), sizeof(cl_int), sizeof(cl_mem), sizeof(cl_int), sizeof(cl_double), sizeof(cl_int), sizeof(cl_int), sizeof(cl_int), sizeof(cl_int), sizeof(cl_mem), sizeof(cl_mem), sizeof(cl_mem), sizeof(cl_mem), sizeof(cl_mem), sizeof(cl_mem), sizeof(cl_mem)};
+    void *argValues[18] = {
+        (void *)&this->twoPhaseEphemeris,
+        (void *)&this->numGrav,
+        (void *)&this->espSqr,
+        (void *)&relativistic,
+        (void *)&this->twoPhaseCoefficients,
+        (void *)&kernelOrder,
+        (void *)&this->delT,
+        (void *)&firstStep,
+        (void *)&numSteps,
+        (void *)&this->numParticles,
+        (void *)&firstParticle,
+        (void *)&this->currPos,
+        (void *)&this->currVel,
+        (void *)&this->acc,
+        (void *)&this->posLast,
+        (void *)&this->velLast,
+        (void *)&this->velHistory,
+        (void *)&this->accHistory};
+    for (cl_uint arg = 0; arg < 18; arg++)
+    {
+      status = clSetKernelArg(this->twoPhaseTestParticlesKernel, arg, argSizes[arg], argValues[arg]);
+      if (status != CL_SUCCESS)
+      {
+        wxLogError(wxT("clSetKernelArg %u twoPhaseTestParticlesKernel failed %s"), arg, this->ErrorMessage(status));
+        throw status;
+      }
+    }
+
+    status = clEnqueueNDRangeKernel(this->commandQueue, this->twoPhaseTestParticlesKernel, 1, NULL, globalThreads, localThreads, 0, 0, NULL);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clEnqueueNDRangeKernel twoPhaseTestParticlesKernel failed %s"), this->ErrorMessage(status));
+      throw status;
+    }
   }
 
-  status = clSetKernelArg(this->copyToDisplayKernel, paramNumber++, sizeof(cl_int), (void *)&this->centerBody);
+  status = clFinish(this->commandQueue);
   if (status != CL_SUCCESS)
   {
-    wxLogError(wxT("clSetKernelArg failed for centerBody %s"), this->ErrorMessage(status));
+    wxLogError(wxT("clFinish failed %s"), this->ErrorMessage(status));
     throw status;
   }
 
-  /* Set appropriate arguments to the kernel
-  __kernel void computeAcc(
-     __constant double4* gravPos,
-     __global double4* pos,
-     int numGrav,
-     double epsSqr,
-     __global double4* acc)
-  */
-  paramNumber = 0;
-  status = clSetKernelArg(this->accKernel, paramNumber++, sizeof(cl_mem), (void *)&this->gravPos);
-  if (status != CL_SUCCESS)
+  if (update)
   {
-    wxLogError(wxT("clSetKernelArg failed for gravPos %s"), this->ErrorMessage(status));
-    throw status;
+    this->UpdateDisplay();
   }
+}
 
-  status = clSetKernelArg(this->accKernel, paramNumber++, sizeof(cl_mem), (void *)&this->currPos);
-  if (status != CL_SUCCESS)
+// The tree holds numGrav - 1 leaves, the Sun being summed directly, and numGrav - 2 internal nodes
+void CLModel::CreateTreeBuffers()
+{
+  cl_int status = CL_SUCCESS;
+  int numLeaves = this->numGrav - 1;
+  int numNodes = 2 * numLeaves - 1;
+  int numInternal = numLeaves > 1 ? numLeaves - 1 : 1;
+  this->treeNumKeys = 1;
+  while (this->treeNumKeys < numLeaves)
   {
-    wxLogError(wxT("clSetKernelArg failed for currPos %s"), this->ErrorMessage(status));
-    throw status;
+    this->treeNumKeys *= 2;
   }
 
-  // the acceleration kernel that includes relativistic corrections need the relativistic parameter stored
-  // in .w. We pass the whole velocity vector in case it can be used in a more complicated relativistic on MOND type kernel
-  if (!this->accelerationKernelName->IsSameAs(wxT("newtonian"), false))
+  cl_mem *buffers[] = {&this->treeBox, &this->treeKeys, &this->treeChildren, &this->treeParents, &this->treeFlags, &this->treeCom, &this->treeMin, &this->treeMax};
+  const wxChar *names[] = {wxT("treeBox"), wxT("treeKeys"), wxT("treeChildren"), wxT("treeParents"), wxT("treeFlags"), wxT("treeCom"), wxT("treeMin"), wxT("treeMax")};
+  size_t sizes[] = {2 * sizeof(cl_double4), this->treeNumKeys * sizeof(cl_ulong), numInternal * sizeof(cl_int2), numNodes * sizeof(cl_int), numInternal * sizeof(cl_int),
+                    numNodes * sizeof(cl_double4), numNodes * sizeof(cl_double4), numNodes * sizeof(cl_double4)};
+  for (int buffer = 0; buffer < 8; buffer++)
   {
-    status = clSetKernelArg(this->accKernel, paramNumber++, sizeof(cl_mem), (void *)&this->currVel);
+    if (*buffers[buffer] == NULL)
+    {
+      *buffers[buffer] = clCreateBuffer(this->context, CL_MEM_READ_WRITE, sizes[buffer], 0, &status);
+      if (status != CL_SUCCESS)
+      {
+        wxLogError(wxT("clCreateBuffer failed to create cl_mem object for %s %s"), names[buffer], this->ErrorMessage(status));
+        throw status;
+      }
+    }
+  }
+}
+
+void CLModel::ReleaseTreeBuffers()
+{
+  cl_int status = CL_SUCCESS;
+  cl_mem *buffers[] = {&this->treeBox, &this->treeKeys, &this->treeChildren, &this->treeParents, &this->treeFlags, &this->treeCom, &this->treeMin, &this->treeMax};
+  for (int buffer = 0; buffer < 8; buffer++)
+  {
+    if (*buffers[buffer] != NULL)
+    {
+      status = clReleaseMemObject(*buffers[buffer]);
+      if (status != CL_SUCCESS)
+      {
+        wxLogError(wxT("clReleaseMemObject tree buffer %d failed %s"), buffer, this->ErrorMessage(status));
+      }
+      *buffers[buffer] = NULL;
+    }
+  }
+}
+
+// Everything but the sort pass, which changes every launch
+void CLModel::SetTreeKernelArgs()
+{
+  cl_int status = CL_SUCCESS;
+  struct TreeKernelArg
+  {
+    cl_kernel kernel;
+    size_t size;
+    const void *value;
+  };
+  TreeKernelArg args[] = {
+      {this->treeBoundsKernel, sizeof(cl_mem), &this->gravPos},
+      {this->treeBoundsKernel, sizeof(cl_int), &this->numGrav},
+      {this->treeBoundsKernel, sizeof(cl_mem), &this->treeBox},
+      {this->treeBoundsKernel, sizeof(cl_double4) * this->groupSize, NULL},
+      {this->treeBoundsKernel, sizeof(cl_double4) * this->groupSize, NULL},
+      {this->treeMortonKeysKernel, sizeof(cl_mem), &this->gravPos},
+      {this->treeMortonKeysKernel, sizeof(cl_int), &this->numGrav},
+      {this->treeMortonKeysKernel, sizeof(cl_mem), &this->treeBox},
+      {this->treeMortonKeysKernel, sizeof(cl_mem), &this->treeKeys},
+      {this->treeMortonKeysKernel, sizeof(cl_int), &this->treeNumKeys},
+      {this->treeSortStepKernel, sizeof(cl_mem), &this->treeKeys},
+      {this->treeBuildKernel, sizeof(cl_mem), &this->treeKeys},
+      {this->treeBuildKernel, sizeof(cl_int), &this->numGrav},
+      {this->treeBuildKernel, sizeof(cl_mem), &this->treeChildren},
+      {this->treeBuildKernel, sizeof(cl_mem), &this->treeParents},
+      {this->treeBuildKernel, sizeof(cl_mem), &this->treeFlags},
+      {this->treeSummariseKernel, sizeof(cl_mem), &this->gravPos},
+      {this->treeSummariseKernel, sizeof(cl_int), &this->numGrav},
+      {this->treeSummariseKernel, sizeof(cl_mem), &this->treeKeys},
+      {this->treeSummariseKernel, sizeof(cl_mem), &this->treeChildren},
+      {this->treeSummariseKernel, sizeof(cl_mem), &this->treeParents},
+      {this->treeSummariseKernel, sizeof(cl_mem), &this->treeFlags},
+      {this->treeSummariseKernel, sizeof(cl_mem), &this->treeCom},
+      {this->treeSummariseKernel, sizeof(cl_mem), &this->treeMin},
+      {this->treeSummariseKernel, sizeof(cl_mem), &this->treeMax}};
+
+  cl_uint argIndex = 0;
+  for (size_t arg = 0; arg < sizeof(args) / sizeof(args[0]); arg++)
+  {
+    if (arg > 0 && args[arg].kernel != args[arg - 1].kernel)
+    {
+      argIndex = 0;
+    }
+    status = clSetKernelArg(args[arg].kernel, argIndex, args[arg].size, args[arg].value);
     if (status != CL_SUCCESS)
     {
-      wxLogError(wxT("clSetKernelArg failed for currVel %s"), this->ErrorMessage(status));
+      wxLogError(wxT("clSetKernelArg %u failed for a tree kernel %s"), argIndex, this->ErrorMessage(status));
       throw status;
     }
+    argIndex++;
   }
+}
 
-  status = clSetKernelArg(this->accKernel, paramNumber++, sizeof(cl_int), (void *)&this->numGrav);
+// Builds the tree of the current gravPos: the bounding box, the keys, a bitonic sort of the keys,
+// the internal nodes and then every node's mass and box from the leaves up
+void CLModel::EnqueueTreeBuild(cl_command_queue queue)
+{
+  cl_int status = CL_SUCCESS;
+  int numLeaves = this->numGrav - 1;
+
+  size_t boundsThreads[] = {this->groupSize};
+  status = clEnqueueNDRangeKernel(queue, this->treeBoundsKernel, 1, NULL, boundsThreads, boundsThreads, 0, NULL, NULL);
   if (status != CL_SUCCESS)
   {
-    wxLogError(wxT("clSetKernelArg failed for numGrav %s"), this->ErrorMessage(status));
+    wxLogError(wxT("clEnqueueNDRangeKernel treeBounds failed %s"), this->ErrorMessage(status));
     throw status;
   }
 
-  status = clSetKernelArg(this->accKernel, paramNumber++, sizeof(cl_double), (void *)&this->espSqr);
+  size_t keyThreads[] = {(size_t)this->treeNumKeys};
+  status = clEnqueueNDRangeKernel(queue, this->treeMortonKeysKernel, 1, NULL, keyThreads, NULL, 0, NULL, NULL);
   if (status != CL_SUCCESS)
   {
-    wxLogError(wxT("clSetKernelArg failed for espSqr %s"), this->ErrorMessage(status));
+    wxLogError(wxT("clEnqueueNDRangeKernel treeMortonKeys failed %s"), this->ErrorMessage(status));
     throw status;
   }
 
-  status = clSetKernelArg(this->accKernel, paramNumber++, sizeof(cl_mem), (void *)&this->acc);
-  if (status != CL_SUCCESS)
+  for (cl_int stage = 2; stage <= this->treeNumKeys; stage *= 2)
   {
-    wxLogError(wxT("clSetKernelArg failed for acc %s"), this->ErrorMessage(status));
-    throw status;
+    for (cl_int pass = stage / 2; pass > 0; pass /= 2)
+    {
+      status = clSetKernelArg(this->treeSortStepKernel, 1, sizeof(cl_int), (void *)&stage);
+      status |= clSetKernelArg(this->treeSortStepKernel, 2, sizeof(cl_int), (void *)&pass);
+      if (status != CL_SUCCESS)
+      {
+        wxLogError(wxT("clSetKernelArg treeSortStep failed %s"), this->ErrorMessage(status));
+        throw status;
+      }
+
+      status = clEnqueueNDRangeKernel(queue, this->treeSortStepKernel, 1, NULL, keyThreads, NULL, 0, NULL, NULL);
+      if (status != CL_SUCCESS)
+      {
+        wxLogError(wxT("clEnqueueNDRangeKernel treeSortStep failed %s"), this->ErrorMessage(status));
+        throw status;
+      }
+    }
   }
 
-  if (this->accelerationKernelName->IsSameAs(wxT("relativisticLocal"), false))
+  if (numLeaves > 1)
   {
-    status = clSetKernelArg(this->accKernel, paramNumber++, sizeof(cl_double4) * this->groupSize, NULL);
+    size_t buildThreads[] = {(size_t)(numLeaves - 1)};
+    status = clEnqueueNDRangeKernel(queue, this->treeBuildKernel, 1, NULL, buildThreads, NULL, 0, NULL, NULL);
     if (status != CL_SUCCESS)
     {
-      wxLogError(wxT("clSetKernelArg failed for currVel %s"), this->ErrorMessage(status));
+      wxLogError(wxT("clEnqueueNDRangeKernel treeBuild failed %s"), this->ErrorMessage(status));
       throw status;
     }
   }
 
-  // set integration kernel args
-  SetAdamsKernelArgs(this->startupKernel);
-  SetAdamsKernelArgs(this->adamsBashforthKernel);
-  SetAdamsKernelArgs(this->adamsMoultonKernel);
-
-  // I'm a bit paranoid here. I set the group size to the smallest that will work for all the kernels
-  // perhap each kernel should use the largest group size possible for it. But I don't do that.
-  /* Check group size against group size returned by kernel */
-  status = clGetKernelWorkGroupInfo(this->accKernel, this->deviceId, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &this->accKernelWorkGroupSize, 0);
+  size_t leafThreads[] = {(size_t)numLeaves};
+  status = clEnqueueNDRangeKernel(queue, this->treeSummariseKernel, 1, NULL, leafThreads, NULL, 0, NULL, NULL);
   if (status != CL_SUCCESS)
   {
-    wxLogError(wxT("getting accKernel kernel CL_KERNEL_WORK_GROUP_SIZE failed %s"), this->ErrorMessage(status));
+    wxLogError(wxT("clEnqueueNDRangeKernel treeSummarise failed %s"), this->ErrorMessage(status));
     throw status;
   }
+}
 
-  wxLogDebug(wxT("accKernel Work Group Size %llu"), (unsigned long long)this->accKernelWorkGroupSize);
+// gravPairs reads the positions from gravPos and the relativistic parameter from currVel, and runs as one work-group
+void CLModel::SetPairKernelArgs()
+{
+  cl_int status = CL_SUCCESS;
+  if (this->pairCompensation == NULL)
+  {
+    this->pairCompensation = clCreateBuffer(this->context, CL_MEM_READ_WRITE, this->numGrav * sizeof(cl_double4), 0, &status);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clCreateBuffer failed to create cl_mem object for pairCompensation %s"), this->ErrorMessage(status));
+      throw status;
+    }
+  }
 
-  if (this->groupSize > this->accKernelWorkGroupSize)
+  cl_int relativistic = this->accelerationKernelName->StartsWith(wxT("newtonian")) ? 0 : 1;
+  size_t argSizes[6] = {sizeof(cl_mem), sizeof(cl_mem), sizeof(cl_int), sizeof(cl_int), sizeof(cl_mem), sizeof(cl_mem)};
+  void *argValues[6] = {(void *)&this->gravPos, (void *)&this->currVel, (void *)&this->numGrav, (void *)&relativistic, (void *)&this->acc, (void *)&this->pairCompensation};
+  for (cl_uint arg = 0; arg < 6; arg++)
   {
-    wxLogDebug(wxT("Group size larger than max acc kernel group size"));
-    this->groupSize = this->accKernelWorkGroupSize;
+    status = clSetKernelArg(this->gravPairsKernel, arg, argSizes[arg], argValues[arg]);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clSetKernelArg %u gravPairsKernel failed %s"), arg, this->ErrorMessage(status));
+      throw status;
+    }
   }
 
-  status = clGetKernelWorkGroupInfo(this->startupKernel, this->deviceId, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &this->startupKernelWorkGroupSize, 0);
+  size_t kernelWorkGroupSize;
+  status = clGetKernelWorkGroupInfo(this->gravPairsKernel, this->deviceId, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &kernelWorkGroupSize, 0);
   if (status != CL_SUCCESS)
   {
-    wxLogError(wxT("getting startupKernel kernel CL_KERNEL_WORK_GROUP_SIZE failed %s"), this->ErrorMessage(status));
+    wxLogError(wxT("getting gravPairs kernel CL_KERNEL_WORK_GROUP_SIZE failed %s"), this->ErrorMessage(status));
     throw status;
   }
+  this->pairGroupSize = this->groupSize < kernelWorkGroupSize ? this->groupSize : kernelWorkGroupSize;
+}
 
-  wxLogDebug(wxT("startupKernel Work Group Size %llu"), (unsigned long long)this->startupKernelWorkGroupSize);
-
-  if (this->groupSize > this->startupKernelWorkGroupSize)
+// Runs the tree or the pruned sum and the direct sum on the current positions into scratch buffers and compares them.
+// The relative error of each particle is |approximate - direct| / |direct|. Not available while streaming
+bool CLModel::AccelerationErrorStatistics(double *maxRelativeError, double *rmsRelativeError)
+{
+  if (!this->initialisedOk || !(this->treeAcceleration || this->maskedAcceleration) || this->streaming)
   {
-    wxLogDebug(wxT("Group size larger than max startup kernel group size"));
-    this->groupSize = this->startupKernelWorkGroupSize;
+    return false;
   }
 
-  status = clGetKernelWorkGroupInfo(this->adamsBashforthKernel, this->deviceId, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &this->adamsBashforthKernelWorkGroupSize, 0);
-  if (status != CL_SUCCESS)
+  bool success = false;
+  cl_double4 *accelerations = NULL;
+  bool newtonian = this->accelerationKernelName->StartsWith(wxT("newtonian"));
+  cl_uint accArg = newtonian ? 4 : 5;
+  try
   {
-    wxLogError(wxT("getting adamsBashforth kernel CL_KERNEL_WORK_GROUP_SIZE failed %s"), this->ErrorMessage(status));
-    throw status;
+    cl_int status = CL_SUCCESS;
+    for (int buffer = 0; buffer < 2; buffer++)
+    {
+      if (this->checkAcc[buffer] == NULL)
+      {
+        this->checkAcc[buffer] = clCreateBuffer(this->context, CL_MEM_READ_WRITE, this->numParticles * sizeof(cl_double4), 0, &status);
+        if (status != CL_SUCCESS)
+        {
+          wxLogError(wxT("clCreateBuffer failed to create cl_mem object for checkAcc %s"), this->ErrorMessage(status));
+          throw status;
+        }
+      }
+    }
+
+    // in the order of the reference kernel's arguments
+    cl_mem *referenceBuffers[] = {&this->gravPos, &this->currPos, &this->currVel};
+    cl_uint paramNumber = 0;
+    for (int buffer = 0; buffer < 3; buffer++)
+    {
+      if (buffer == 2 && newtonian)
+      {
+        continue;
+      }
+      status |= clSetKernelArg(this->referenceKernel, paramNumber++, sizeof(cl_mem), (void *)referenceBuffers[buffer]);
+    }
+    status |= clSetKernelArg(this->referenceKernel, paramNumber++, sizeof(cl_int), (void *)&this->numGrav);
+    status |= clSetKernelArg(this->referenceKernel, paramNumber++, sizeof(cl_double), (void *)&this->espSqr);
+    status |= clSetKernelArg(this->referenceKernel, paramNumber++, sizeof(cl_mem), (void *)&this->checkAcc[1]);
+    status |= clSetKernelArg(this->referenceKernel, paramNumber++, sizeof(cl_double4) * this->gravTileSize, NULL);
+    status |= clSetKernelArg(this->referenceKernel, paramNumber++, sizeof(cl_int), (void *)&this->gravTileSize);
+    status |= clSetKernelArg(this->accKernel, accArg, sizeof(cl_mem), (void *)&this->checkAcc[0]);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clSetKernelArg failed for the acceleration check %s"), this->ErrorMessage(status));
+      throw status;
+    }
+
+    size_t globalThreads[] = {(size_t)this->numParticles};
+    size_t localThreads[] = {this->groupSize};
+    if (this->treeAcceleration)
+    {
+      this->EnqueueTreeBuild(this->commandQueue);
+    }
+    else if (this->maskParticles < this->numParticles)
+    {
+      this->EnqueuePerturberMask(this->numParticles);
+    }
+    status = clEnqueueNDRangeKernel(this->commandQueue, this->accKernel, 1, NULL, globalThreads, localThreads, 0, NULL, NULL);
+    status |= clEnqueueNDRangeKernel(this->commandQueue, this->referenceKernel, 1, NULL, globalThreads, localThreads, 0, NULL, NULL);
+    status |= clSetKernelArg(this->accKernel, accArg, sizeof(cl_mem), (void *)&this->acc);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clEnqueueNDRangeKernel failed for the acceleration check %s"), this->ErrorMessage(status));
+      throw status;
+    }
+
+    accelerations = new cl_double4[2 * this->numParticles];
+    for (int buffer = 0; buffer < 2; buffer++)
+    {
+      status = clEnqueueReadBuffer(this->commandQueue, this->checkAcc[buffer], CL_TRUE, 0, this->numParticles * sizeof(cl_double4), accelerations + buffer * this->numParticles, 0, NULL, NULL);
+      if (status != CL_SUCCESS)
+      {
+        wxLogError(wxT("clEnqueueReadBuffer checkAcc failed %s"), this->ErrorMessage(status));
+        throw status;
+      }
+    }
+
+    double maxError = 0.0;
+    double sumSqrError = 0.0;
+    for (int particle = 0; particle < this->numParticles; particle++)
+    {
+      cl_double4 approximate = accelerations[particle];
+      cl_double4 direct = accelerations[this->numParticles + particle];
+      double errorSqr = 0.0;
+      double directSqr = 0.0;
+      for (int axis = 0; axis < 3; axis++)
+      {
+        errorSqr += (approximate.s[axis] - direct.s[axis]) * (approximate.s[axis] - direct.s[axis]);
+        directSqr += direct.s[axis] * direct.s[axis];
+      }
+      double error = directSqr > 0.0 ? sqrt(errorSqr / directSqr) : 0.0;
+      maxError = error > maxError ? error : maxError;
+      sumSqrError += error * error;
+    }
+
+    *maxRelativeError = maxError;
+    *rmsRelativeError = sqrt(sumSqrError / this->numParticles);
+    success = true;
+  }
+  catch (int ex)
+  {
+    clSetKernelArg(this->accKernel, accArg, sizeof(cl_mem), (void *)&this->acc);
   }
 
-  wxLogDebug(wxT("adamsBashford Work Group Size %llu"), (unsigned long long)this->adamsBashforthKernelWorkGroupSize);
+  delete[] accelerations;
+  return success;
+}
 
-  if (this->groupSize > this->adamsBashforthKernelWorkGroupSize)
+// perturberMask reads the whole state, and its horizon and the stats are set before each launch
+void CLModel::SetPerturberKernelArgs()
+{
+  cl_int status = CL_SUCCESS;
+  if (this->perturberStats == NULL)
   {
-    wxLogDebug(wxT("Group size larger than max adamsBashforth group size"));
-    this->groupSize = this->adamsBashforthKernelWorkGroupSize;
+    this->perturberStats = clCreateBuffer(this->context, CL_MEM_READ_WRITE, 2 * sizeof(cl_uint), 0, &status);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clCreateBuffer failed to create cl_mem object for perturberStats %s"), this->ErrorMessage(status));
+      throw status;
+    }
+  }
+
+  cl_double horizon = 0.0;
+  size_t argSizes[8] = {sizeof(cl_mem), sizeof(cl_mem), sizeof(cl_int), sizeof(cl_double), sizeof(cl_double), sizeof(cl_mem), sizeof(cl_int), sizeof(cl_mem)};
+  void *argValues[8] = {(void *)&this->currPos, (void *)&this->currVel, (void *)&this->numGrav, (void *)&horizon, (void *)&this->perturberTolerance,
+                        (void *)&this->perturberMask, (void *)&this->numParticles, (void *)&this->perturberStats};
+  for (cl_uint arg = 0; arg < 8; arg++)
+  {
+    status = clSetKernelArg(this->perturberMaskKernel, arg, argSizes[arg], argValues[arg]);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clSetKernelArg %u perturberMaskKernel failed %s"), arg, this->ErrorMessage(status));
+      throw status;
+    }
   }
+  this->maskStep = -1;
+  this->maskParticles = 0;
+}
 
-  status = clGetKernelWorkGroupInfo(this->adamsMoultonKernel, this->deviceId, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &this->adamsMoultonKernelWorkGroupSize, 0);
+// Rebuilds the perturber masks of the first numThreads particles from the current state, to hold for the next
+// perturberRefreshSteps steps and the one the refresh happens in
+void CLModel::EnqueuePerturberMask(size_t numThreads)
+{
+  static const cl_uint zeroStats[2] = {0, 0};
+  cl_double horizon = fabs(this->delT) * (this->perturberRefreshSteps + 1);
+  cl_int status = clSetKernelArg(this->perturberMaskKernel, 3, sizeof(cl_double), (void *)&horizon);
   if (status != CL_SUCCESS)
   {
-    wxLogError(wxT("getting adamsMoulton kernel CL_KERNEL_WORK_GROUP_SIZE failed %s"), this->ErrorMessage(status));
+    wxLogError(wxT("clSetKernelArg 3 perturberMaskKernel failed for horizon %s"), this->ErrorMessage(status));
     throw status;
   }
 
-  wxLogDebug(wxT("adamsKernel Work Group Size %llu"), (unsigned long long)this->adamsMoultonKernelWorkGroupSize);
-
-  if (this->groupSize > this->adamsMoultonKernelWorkGroupSize)
-  {
-    wxLogDebug(wxT("Group size larger than max adams Moulton group size"));
-    this->groupSize = this->adamsMoultonKernelWorkGroupSize;
-  }
-
-  status = clGetKernelWorkGroupInfo(this->copyToDisplayKernel, this->deviceId, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &this->copyToDisplayKernelWorkGroupSize, 0);
+  status = clEnqueueWriteBuffer(this->commandQueue, this->perturberStats, CL_FALSE, 0, sizeof(zeroStats), zeroStats, 0, NULL, NULL);
   if (status != CL_SUCCESS)
   {
-    wxLogError(wxT("getting copyToDisplay kernel CL_KERNEL_WORK_GROUP_SIZE failed %s"), this->ErrorMessage(status));
+    wxLogError(wxT("clEnqueueWriteBuffer perturberStats failed %s"), this->ErrorMessage(status));
     throw status;
   }
 
-  wxLogDebug(wxT("copyToDisplayKernel Work Group Size %llu"), (unsigned long long)this->copyToDisplayKernelWorkGroupSize);
-
-  if (this->groupSize > this->copyToDisplayKernelWorkGroupSize)
+  size_t globalThreads[] = {numThreads};
+  size_t localThreads[] = {this->groupSize};
+  status = clEnqueueNDRangeKernel(this->commandQueue, this->perturberMaskKernel, 1, NULL, globalThreads, localThreads, 0, NULL, NULL);
+  if (status != CL_SUCCESS)
   {
-    wxLogDebug(wxT("Group size larger than max group size"));
-    this->groupSize = this->copyToDisplayKernelWorkGroupSize;
+    wxLogError(wxT("clEnqueueNDRangeKernel perturberMask failed %s"), this->ErrorMessage(status));
+    throw status;
   }
 
-  wxLogDebug(wxT("Finished CLModel:SetKernelArgumentsAndGroupSize"));
+  this->maskStep = this->step;
+  this->maskParticles = (cl_int)numThreads;
 }
 
-// the Adams Bashforth and Adams Moulton integration kernels all have the same signature
-/*
-__kernel
-void adamsMoulton11(
-__global double4* pos,
-__global double4* vel,
-__global double4* acc,
-double deltaTime,
-__global double4* newPos,
-__global double4* newVel,
-int stage,
-int step,
-int numParticles,
-__global double4* posLast,
-__global double4* velLast,
-__global double4* velHistory,
-__global double4* accHistory)
-*/
-void CLModel::SetAdamsKernelArgs(cl_kernel adamsKernel)
+// heliocentricIndirect sums the bodies with mass as they are in gravPos, addIndirect works on acc like the acceleration kernel
+void CLModel::SetHeliocentricKernelArgs()
 {
-  cl_int status;
-
-  // adamskernel
-  status = clSetKernelArg(adamsKernel, 0, sizeof(cl_mem), (void *)&this->currPos);
-  if (status != CL_SUCCESS)
+  cl_int status = CL_SUCCESS;
+  if (this->indirectAcc == NULL)
   {
-    wxLogError(wxT("clSetKernelArg 0 failed for currPos %s"), this->ErrorMessage(status));
-    throw status;
+    this->indirectAcc = clCreateBuffer(this->context, CL_MEM_READ_WRITE, sizeof(cl_double4), 0, &status);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clCreateBuffer failed to create cl_mem object for indirectAcc %s"), this->ErrorMessage(status));
+      throw status;
+    }
   }
 
-  status = clSetKernelArg(adamsKernel, 1, sizeof(cl_mem), (void *)&this->currVel);
+  status |= clSetKernelArg(this->heliocentricIndirectKernel, 0, sizeof(cl_mem), (void *)&this->gravPos);
+  status |= clSetKernelArg(this->heliocentricIndirectKernel, 1, sizeof(cl_int), (void *)&this->numGrav);
+  status |= clSetKernelArg(this->heliocentricIndirectKernel, 2, sizeof(cl_mem), (void *)&this->indirectAcc);
+  status |= clSetKernelArg(this->addIndirectKernel, 0, sizeof(cl_mem), (void *)&this->acc);
+  status |= clSetKernelArg(this->addIndirectKernel, 1, sizeof(cl_mem), (void *)&this->indirectAcc);
   if (status != CL_SUCCESS)
   {
-    wxLogError(wxT("clSetKernelArg 1 failed for currVel %s"), this->ErrorMessage(status));
+    wxLogError(wxT("clSetKernelArg failed for the heliocentric kernels %s"), this->ErrorMessage(status));
     throw status;
   }
+}
 
-  status = clSetKernelArg(adamsKernel, 2, sizeof(cl_mem), (void *)&this->acc);
-  if (status != CL_SUCCESS)
+// Moves currPos and currVel into the heliocentric frame, or back to the barycentric one, writing the result to dstPos and dstVel.
+// The arguments are set here as it runs before SetKernelArgumentsAndGroupSize when the initial state is set
+void CLModel::EnqueueFrameShift(bool toHeliocentric, cl_mem dstPos, cl_mem dstVel)
+{
+  cl_int status = CL_SUCCESS;
+  if (this->frameOffsets == NULL)
   {
-    wxLogError(wxT("clSetKernelArg 2 failed for acc %s"), this->ErrorMessage(status));
-    throw status;
+    this->frameOffsets = clCreateBuffer(this->context, CL_MEM_READ_WRITE, 2 * sizeof(cl_double4), 0, &status);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clCreateBuffer failed to create cl_mem object for frameOffsets %s"), this->ErrorMessage(status));
+      throw status;
+    }
   }
 
-  status = clSetKernelArg(adamsKernel, 3, sizeof(cl_double), (void *)&this->delT);
+  cl_int direction = toHeliocentric ? 1 : 0;
+  status |= clSetKernelArg(this->frameOffsetKernel, 0, sizeof(cl_mem), (void *)&this->currPos);
+  status |= clSetKernelArg(this->frameOffsetKernel, 1, sizeof(cl_mem), (void *)&this->currVel);
+  status |= clSetKernelArg(this->frameOffsetKernel, 2, sizeof(cl_int), (void *)&this->numGrav);
+  status |= clSetKernelArg(this->frameOffsetKernel, 3, sizeof(cl_int), (void *)&direction);
+  status |= clSetKernelArg(this->frameOffsetKernel, 4, sizeof(cl_mem), (void *)&this->frameOffsets);
+  status |= clSetKernelArg(this->frameShiftKernel, 0, sizeof(cl_mem), (void *)&this->currPos);
+  status |= clSetKernelArg(this->frameShiftKernel, 1, sizeof(cl_mem), (void *)&this->currVel);
+  status |= clSetKernelArg(this->frameShiftKernel, 2, sizeof(cl_mem), (void *)&this->frameOffsets);
+  status |= clSetKernelArg(this->frameShiftKernel, 3, sizeof(cl_mem), (void *)&dstPos);
+  status |= clSetKernelArg(this->frameShiftKernel, 4, sizeof(cl_mem), (void *)&dstVel);
+  status |= clSetKernelArg(this->frameShiftKernel, 5, sizeof(cl_int), (void *)&this->numParticles);
   if (status != CL_SUCCESS)
   {
-    wxLogError(wxT("clSetKernelArg 3 failed for delT %s"), this->ErrorMessage(status));
+    wxLogError(wxT("clSetKernelArg failed for the frame kernels %s"), this->ErrorMessage(status));
     throw status;
   }
 
-  status = clSetKernelArg(adamsKernel, 4, sizeof(cl_mem), (void *)&this->newPos);
+  size_t offsetThreads[] = {1};
+  status = clEnqueueNDRangeKernel(this->commandQueue, this->frameOffsetKernel, 1, NULL, offsetThreads, offsetThreads, 0, NULL, NULL);
   if (status != CL_SUCCESS)
   {
-    wxLogError(wxT("clSetKernelArg 4 failed for newPos %s"), this->ErrorMessage(status));
+    wxLogError(wxT("clEnqueueNDRangeKernel frameOffset failed %s"), this->ErrorMessage(status));
     throw status;
   }
 
-  status = clSetKernelArg(adamsKernel, 5, sizeof(cl_mem), (void *)&this->newVel);
+  size_t shiftThreads[] = {(size_t)this->numParticles};
+  status = clEnqueueNDRangeKernel(this->commandQueue, this->frameShiftKernel, 1, NULL, shiftThreads, NULL, 0, NULL, NULL);
   if (status != CL_SUCCESS)
   {
-    wxLogError(wxT("clSetKernelArg 5 failed for newVel %s"), this->ErrorMessage(status));
+    wxLogError(wxT("clEnqueueNDRangeKernel frameShift failed %s"), this->ErrorMessage(status));
     throw status;
   }
+}
 
-  status = clSetKernelArg(adamsKernel, 6, sizeof(cl_int), (void *)&this->stage);
-  if (status != CL_SUCCESS)
+// Sets pos and vel to buffers holding the current state in the barycentric frame.
+// Heliocentric states are moved back into the framePos and frameVel scratch buffers, leaving the integration alone
+void CLModel::BarycentricState(cl_mem *pos, cl_mem *vel)
+{
+  cl_int status = CL_SUCCESS;
+  *pos = this->currPos;
+  *vel = this->currVel;
+  if (!this->heliocentricFrame)
   {
-    wxLogError(wxT("clSetKernelArg 6 failed for stage %s"), this->ErrorMessage(status));
-    throw status;
+    return;
   }
 
-  status = clSetKernelArg(adamsKernel, 7, sizeof(cl_int), (void *)&this->step);
-  if (status != CL_SUCCESS)
+  cl_mem *frameBuffers[] = {&this->framePos, &this->frameVel};
+  for (int buffer = 0; buffer < 2; buffer++)
   {
-    wxLogError(wxT("clSetKernelArg 7 failed for step %s"), this->ErrorMessage(status));
-    throw status;
+    if (*frameBuffers[buffer] == NULL)
+    {
+      *frameBuffers[buffer] = clCreateBuffer(this->context, CL_MEM_READ_WRITE, this->numParticles * sizeof(cl_double4), 0, &status);
+      if (status != CL_SUCCESS)
+      {
+        wxLogError(wxT("clCreateBuffer failed to create cl_mem object for frame buffer %d %s"), buffer, this->ErrorMessage(status));
+        throw status;
+      }
+    }
   }
+  this->EnqueueFrameShift(false, this->framePos, this->frameVel);
+  *pos = this->framePos;
+  *vel = this->frameVel;
+}
 
-  status = clSetKernelArg(adamsKernel, 8, sizeof(cl_int), (void *)&this->numParticles);
-  if (status != CL_SUCCESS)
+// Rounds host positions onto the fixed point grid as the fixedPointPositions kernel does, keeping the GM in w.
+// rint rounds half to even in the default rounding mode on both sides
+void CLModel::ToFixedPoint(cl_double4 *positions, size_t count)
+{
+  double scale = ldexp(1.0, this->fixedPointBits);
+  for (size_t particle = 0; particle < count; particle++)
   {
-    wxLogError(wxT("clSetKernelArg 8 failed for step %s"), this->ErrorMessage(status));
-    throw status;
+    for (int component = 0; component < 3; component++)
+    {
+      positions[particle].s[component] = rint(positions[particle].s[component] * scale) / scale;
+    }
   }
+}
 
-  status = clSetKernelArg(adamsKernel, 9, sizeof(cl_mem), (void *)&this->posLast);
-  if (status != CL_SUCCESS)
+// FNV-1a over the positions and velocities as read back, so the same state gives the same digest on any device
+bool CLModel::StateDigest(cl_ulong *digest)
+{
+  if (!this->initialisedOk)
   {
-    wxLogError(wxT("clSetKernelArg 9 failed for posLast %s"), this->ErrorMessage(status));
-    throw status;
+    return false;
   }
 
-  status = clSetKernelArg(adamsKernel, 10, sizeof(cl_mem), (void *)&this->velLast);
-  if (status != CL_SUCCESS)
+  cl_double4 *positions = new cl_double4[this->numParticles];
+  cl_double4 *velocities = new cl_double4[this->numParticles];
+  bool success = true;
+  try
   {
-    wxLogError(wxT("clSetKernelArg 10 failed for velLast %s"), this->ErrorMessage(status));
-    throw status;
+    this->ReadToInitialState(positions, velocities);
+    cl_ulong hash = 14695981039346656037ULL;
+    cl_double4 *buffers[] = {positions, velocities};
+    for (int buffer = 0; buffer < 2; buffer++)
+    {
+      const unsigned char *bytes = (const unsigned char *)buffers[buffer];
+      for (size_t byte = 0; byte < this->numParticles * sizeof(cl_double4); byte++)
+      {
+        hash = (hash ^ bytes[byte]) * 1099511628211ULL;
+      }
+    }
+    *digest = hash;
+  }
+  catch (int)
+  {
+    success = false;
   }
 
-  status = clSetKernelArg(adamsKernel, 11, sizeof(cl_mem), (void *)&this->velHistory);
-  if (status != CL_SUCCESS)
+  delete[] positions;
+  delete[] velocities;
+  return success;
+}
+
+bool CLModel::IsHeliocentric()
+{
+  return this->initialisedOk && this->heliocentricFrame;
+}
+
+bool CLModel::IsControllingStep()
+{
+  return this->initialisedOk && this->stepControl;
+}
+
+bool CLModel::StepErrorStatistics(double *maxError, double *rmsError)
+{
+  if (!this->IsControllingStep() || this->stepErrors == NULL)
   {
-    wxLogError(wxT("clSetKernelArg 11 failed for velHistory %s"), this->ErrorMessage(status));
-    throw status;
+    return false;
   }
 
-  status = clSetKernelArg(adamsKernel, 12, sizeof(cl_mem), (void *)&this->accHistory);
+  cl_double errors[2];
+  cl_int status = clEnqueueReadBuffer(this->commandQueue, this->stepErrors, CL_TRUE, 0, sizeof(errors), errors, 0, NULL, NULL);
   if (status != CL_SUCCESS)
   {
-    wxLogError(wxT("clSetKernelArg 12 failed for accHistory %s"), this->ErrorMessage(status));
-    throw status;
+    wxLogError(wxT("clEnqueueReadBuffer stepErrors failed %s"), this->ErrorMessage(status));
+    return false;
   }
+
+  *maxError = errors[0];
+  *rmsError = errors[1];
+  return true;
 }
 
-// Release and/or de-allocates all opencl resources.
-// A cleanup and initialise sequence is done every time something major changes.
-// e.g. number of bodies or the kernels changes.
-int CLModel::CleanUpCL()
+// stepError compares the corrector's output with the predicted positions it started from, rescaleHistory
+// respaces the history rings behind the current state
+void CLModel::SetStepControlKernelArgs()
 {
+  cl_int status = CL_SUCCESS;
+  status |= clSetKernelArg(this->rescaleHistoryKernel, 0, sizeof(cl_mem), (void *)&this->currPos);
+  status |= clSetKernelArg(this->rescaleHistoryKernel, 1, sizeof(cl_mem), (void *)&this->currVel);
+  status |= clSetKernelArg(this->rescaleHistoryKernel, 2, sizeof(cl_mem), (void *)&this->acc);
+  status |= clSetKernelArg(this->rescaleHistoryKernel, 3, sizeof(cl_mem), (void *)&this->velHistory);
+  status |= clSetKernelArg(this->rescaleHistoryKernel, 4, sizeof(cl_mem), (void *)&this->accHistory);
+  status |= clSetKernelArg(this->rescaleHistoryKernel, 5, sizeof(cl_int), (void *)&this->numParticles);
+  if (status != CL_SUCCESS)
+  {
+    wxLogError(wxT("clSetKernelArg failed for rescaleHistory %s"), this->ErrorMessage(status));
+    throw status;
+  }
 
-#ifdef __WXDEBUG__
-  wxLogDebug(wxT("CLModel::CleanUpCL threadId: %ld"), wxThread::GetCurrentId());
-#endif
-
-  cl_int status;
-  int success = CL_SUCCESS;
+  if (!this->stepControl)
+  {
+    return;
+  }
 
-  if (this->commandQueue != NULL)
+  if (this->stepErrors == NULL)
   {
-    status = clFinish(this->commandQueue);
+    cl_double noErrors[2] = {0.0, 0.0};
+    this->stepErrors = clCreateBuffer(this->context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeof(noErrors), noErrors, &status);
     if (status != CL_SUCCESS)
     {
-      wxLogError(wxT("clFinish failed %s"), this->ErrorMessage(status));
-      success = status;
+      wxLogError(wxT("clCreateBuffer failed to create cl_mem object for stepErrors %s"), this->ErrorMessage(status));
+      throw status;
     }
   }
 
-  if (this->currPos != NULL)
+  status |= clSetKernelArg(this->stepErrorKernel, 0, sizeof(cl_mem), (void *)&this->currPos);
+  status |= clSetKernelArg(this->stepErrorKernel, 1, sizeof(cl_mem), (void *)&this->newPos);
+  status |= clSetKernelArg(this->stepErrorKernel, 5, sizeof(cl_mem), (void *)&this->stepErrors);
+  if (status != CL_SUCCESS)
   {
-    status = clReleaseMemObject(this->currPos);
-    if (status != CL_SUCCESS)
-    {
-      wxLogError(wxT("clReleaseMemObject currPos failed %s"), this->ErrorMessage(status));
-      success = status;
-    }
-    else
-    {
-      this->currPos = NULL;
-    }
+    wxLogError(wxT("clSetKernelArg failed for stepError %s"), this->ErrorMessage(status));
+    throw status;
   }
+}
 
-  if (this->newPos != NULL)
+// One work-group reduces the difference over the first numThreads particles
+void CLModel::EnqueueStepError(size_t numThreads)
+{
+  cl_int status = CL_SUCCESS;
+  cl_int numTargets = (cl_int)numThreads;
+  size_t errorThreads[] = {this->groupSize};
+  status |= clSetKernelArg(this->stepErrorKernel, 2, sizeof(cl_int), (void *)&numTargets);
+  status |= clSetKernelArg(this->stepErrorKernel, 3, this->groupSize * sizeof(cl_double), NULL);
+  status |= clSetKernelArg(this->stepErrorKernel, 4, this->groupSize * sizeof(cl_double), NULL);
+  if (status != CL_SUCCESS)
   {
-    status = clReleaseMemObject(this->newPos);
-    if (status != CL_SUCCESS)
-    {
-      wxLogError(wxT("clReleaseMemObject newPos failed %s"), this->ErrorMessage(status));
-      success = status;
-    }
-    else
-    {
-      this->newPos = NULL;
-    }
+    wxLogError(wxT("clSetKernelArg failed for stepError %s"), this->ErrorMessage(status));
+    throw status;
   }
 
-  if (this->currVel != NULL)
+  status = clEnqueueNDRangeKernel(this->commandQueue, this->stepErrorKernel, 1, NULL, errorThreads, errorThreads, 0, NULL, NULL);
+  if (status != CL_SUCCESS)
   {
-    status = clReleaseMemObject(this->currVel);
-    if (status != CL_SUCCESS)
-    {
-      wxLogError(wxT("clReleaseMemObject currVel failed %s"), this->ErrorMessage(status));
-      success = status;
-    }
-    else
-    {
-      this->currVel = NULL;
-    }
+    wxLogError(wxT("clEnqueueNDRangeKernel stepError failed %s"), this->ErrorMessage(status));
+    throw status;
   }
+  this->stepErrorReady = true;
+}
 
-  if (this->newVel != NULL)
+// Respaces the history of the particles being integrated by rescaleRatio and moves delT to the new step.
+// Frozen particles get a new history when their Kepler fast forward ends
+void CLModel::EnqueueRescaleHistory()
+{
+  cl_int status = CL_SUCCESS;
+  size_t globalThreads[] = {(size_t)this->activeParticles};
+  size_t localThreads[] = {this->groupSize};
+  status |= clSetKernelArg(this->rescaleHistoryKernel, 6, sizeof(cl_int), (void *)&this->step);
+  status |= clSetKernelArg(this->rescaleHistoryKernel, 7, sizeof(cl_double), (void *)&this->delT);
+  status |= clSetKernelArg(this->rescaleHistoryKernel, 8, sizeof(cl_double), (void *)&this->rescaleRatio);
+  if (status != CL_SUCCESS)
   {
-    status = clReleaseMemObject(this->newVel);
-    if (status != CL_SUCCESS)
-    {
-      wxLogError(wxT("clReleaseMemObject newVel failed %s"), this->ErrorMessage(status));
-      success = status;
-    }
-    else
-    {
-      this->newVel = NULL;
-    }
+    wxLogError(wxT("clSetKernelArg failed for rescaleHistory %s"), this->ErrorMessage(status));
+    throw status;
   }
 
-  if (this->gravPos != NULL)
+  status = clEnqueueNDRangeKernel(this->commandQueue, this->rescaleHistoryKernel, 1, NULL, globalThreads, localThreads, 0, NULL, NULL);
+  if (status != CL_SUCCESS)
   {
-    status = clReleaseMemObject(this->gravPos);
-    if (status != CL_SUCCESS)
-    {
-      wxLogError(wxT("clReleaseMemObject gravPos failed %s"), this->ErrorMessage(status));
-      success = status;
-    }
-    else
-    {
-      this->gravPos = NULL;
-    }
+    wxLogError(wxT("clEnqueueNDRangeKernel rescaleHistory failed %s"), this->ErrorMessage(status));
+    throw status;
   }
 
-  if (this->acc != NULL)
+  // Snap onto the step ChangeDeltaTime asked for once it is reached, so it is exact
+  this->historyGrown = fabs(this->rescaleRatio) > 1.0;
+  this->delT *= this->rescaleRatio;
+  if (this->targetDeltaTime != 0.0 && fabs(this->delT - this->targetDeltaTime) <= 1e-9 * fabs(this->targetDeltaTime))
   {
-    status = clReleaseMemObject(this->acc);
-    if (status != CL_SUCCESS)
-    {
-      wxLogError(wxT("clReleaseMemObject acc failed %s"), this->ErrorMessage(status));
-      success = status;
-    }
-    else
-    {
-      this->acc = NULL;
-    }
+    this->delT = this->targetDeltaTime;
+    this->targetDeltaTime = 0.0;
   }
+  this->SetDeltaTimeArgs();
+}
 
-  if (this->posLast != NULL)
+// Called once a step has been corrected. Halves delT when the largest difference is over stepTolerance, and grows it when
+// the difference has stayed small enough for 16 steps that it would still be under half the tolerance at the larger step.
+// The difference of an order k predictor corrector pair goes as delT^(k + 1). The history reaches 15 steps back, so delT
+// only grows as far as keeps the predictor's oldest node inside it. The change is made at the start of the next step
+void CLModel::ControlStepSize()
+{
+  double maxError;
+  double rmsError;
+  if (!this->StepErrorStatistics(&maxError, &rmsError))
   {
-    status = clReleaseMemObject(this->posLast);
-    if (status != CL_SUCCESS)
-    {
-      wxLogError(wxT("clReleaseMemObject posLast failed %s"), this->ErrorMessage(status));
-      success = status;
-    }
-    else
-    {
-      this->posLast = NULL;
-    }
+    return;
   }
 
-  if (this->velLast != NULL)
+  int order = this->AdamsOrder();
+  double stepSize = fabs(this->delT);
+  double ratio = 1.0;
+  if (maxError > this->stepTolerance)
   {
-    status = clReleaseMemObject(this->velLast);
-    if (status != CL_SUCCESS)
-    {
-      wxLogError(wxT("clReleaseMemObject velLast failed %s"), this->ErrorMessage(status));
-      success = status;
-    }
-    else
+    this->calmSteps = 0;
+    this->targetDeltaTime = 0.0;
+    if (stepSize * 0.5 >= this->minDeltaTime)
     {
-      this->velLast = NULL;
+      ratio = 0.5;
     }
   }
-
-  if (this->velHistory != NULL)
+  else
   {
-    status = clReleaseMemObject(this->velHistory);
-    if (status != CL_SUCCESS)
+    double growth = fmin(2.0, 15.0 / (order - 1));
+    growth = fmin(growth, this->maxDeltaTime / stepSize);
+    if (growth > 1.0 && maxError * pow(growth, order + 1) < 0.5 * this->stepTolerance)
     {
-      wxLogError(wxT("clReleaseMemObject velHistory failed %s"), this->ErrorMessage(status));
-      success = status;
+      this->calmSteps++;
+      ratio = this->calmSteps >= 16 ? growth : 1.0;
     }
     else
     {
-      this->velHistory = NULL;
+      this->calmSteps = 0;
     }
   }
 
-  if (this->accHistory != NULL)
+  if (ratio == 1.0)
   {
-    status = clReleaseMemObject(this->accHistory);
-    if (status != CL_SUCCESS)
-    {
-      wxLogError(wxT("clReleaseMemObject accHistory failed %s"), this->ErrorMessage(status));
-      success = status;
-    }
-    else
-    {
-      this->accHistory = NULL;
-    }
+    return;
   }
 
-  if (this->dispPos != NULL)
+  // Halving interpolates over nodes a growth didn't rewrite, so it waits until the stale ones have been stepped out
+  if (this->HistoryStale())
   {
-    status = clReleaseMemObject(this->dispPos);
-    if (status != CL_SUCCESS)
-    {
-      wxLogError(wxT("clReleaseMemObject dispPos failed %s"), this->ErrorMessage(status));
-      success = status;
-    }
-    else
-    {
-      this->dispPos = NULL;
-    }
+    wxLogDebug(wxT("Predictor corrector difference %.3g, waiting for the history to be respaced before changing the time step"), maxError);
+    return;
   }
 
-  if (this->accKernel != NULL)
+  wxLogMessage(wxT("Predictor corrector difference %.3g, %.3g rms, changing the time step from %g to %g seconds"), maxError, rmsError, stepSize,
+               stepSize * ratio);
+  this->rescaleRatio = ratio;
+  this->rescaleStep = this->step;
+  this->calmSteps = 0;
+}
+
+// A growth only respaces the nodes the predictor reaches at the new step, ratio * j <= 15. The rest still hold the old spacing
+// until 16 more steps have replaced them, and another rescale then would interpolate over them
+bool CLModel::HistoryStale()
+{
+  return this->historyGrown && this->step >= this->rescaleStep && this->step - this->rescaleStep < 16;
+}
+
+// Changes delT without rerunning the startup steps. A shorter step respaces the history at once. Reversing time needs the
+// history ahead of the current state, so the state is moved back to the oldest node, 15 steps back, and the history is taken
+// in the other order. A longer step can only reach as far as the history goes, so it grows at the start of later steps
+// until it gets there. Returns false, leaving delT alone, when there is no history to keep: during the startup steps,
+// between stages, while streaming, during a Kepler fast forward, growing the step at order 16, or shortening or reversing
+// it within 16 steps of a growth
+bool CLModel::ChangeDeltaTime(cl_double newDelT)
+{
+  this->targetDeltaTime = 0.0;
+  if (!this->initialisedOk || this->streaming || this->step < 16 || this->stage != this->numStages || this->activeParticles < this->numParticles || newDelT == 0.0)
   {
-    status = clReleaseKernel(this->accKernel);
-    if (status != CL_SUCCESS)
-    {
-      wxLogError(wxT("clReleaseKernel accKernel failed %s"), this->ErrorMessage(status));
-      success = status;
-    }
-    else
-    {
-      this->accKernel = NULL;
-    }
+    return false;
   }
 
-  if (this->startupKernel != NULL)
+  if (fabs(newDelT) > fabs(this->delT) && this->AdamsOrder() - 1 >= 15)
   {
-    status = clReleaseKernel(this->startupKernel);
-    if (status != CL_SUCCESS)
-    {
-      wxLogError(wxT("clReleaseKernel startupKernel failed %s"), this->ErrorMessage(status));
-      success = status;
-    }
-    else
-    {
-      this->startupKernel = NULL;
-    }
+    return false;
   }
 
-  if (this->adamsBashforthKernel != NULL)
+  // A shorter or reversed step respaces the whole history now, which the stale nodes left by a recent growth can't take
+  cl_double ratio = newDelT / this->delT;
+  if ((ratio < 0.0 || fabs(ratio) < 1.0) && this->HistoryStale())
   {
-    status = clReleaseKernel(this->adamsBashforthKernel);
-    if (status != CL_SUCCESS)
-    {
-      wxLogError(wxT("clReleaseKernel adamsBashforthKernel failed %s"), this->ErrorMessage(status));
-      success = status;
-    }
-    else
-    {
-      this->adamsBashforthKernel = NULL;
-    }
+    return false;
   }
 
-  if (this->adamsMoultonKernel != NULL)
+  cl_int status = CL_SUCCESS;
+  cl_double oldDelT = this->delT;
+  this->targetDeltaTime = newDelT;
+  this->rescaleRatio = (ratio < 0.0 ? -1.0 : 1.0) * (fabs(ratio) < 1.0 ? fabs(ratio) : 1.0);
+  if (this->rescaleRatio != 1.0)
   {
-    status = clReleaseKernel(this->adamsMoultonKernel);
-    if (status != CL_SUCCESS)
+    // rescaleHistory needs the current acceleration, which the next step would otherwise find
+    this->EnqueueAccelerations(this->activeParticles);
+    this->rescaleStep = this->step;
+    this->EnqueueRescaleHistory();
+
+    if (ratio < 0.0)
     {
-      wxLogError(wxT("clReleaseKernel adamsMoultonKernel failed %s"), this->ErrorMessage(status));
-      success = status;
+      status = clEnqueueCopyBuffer(this->commandQueue, this->currPos, this->gravPos, 0, 0, sizeof(cl_double4) * this->numGrav, 0, 0, 0);
+      if (status != CL_SUCCESS)
+      {
+        wxLogError(wxT("clEnqueueCopyBuffer currPos to gravPos failed %s"), this->ErrorMessage(status));
+        throw status;
+      }
+      this->time -= 15 * oldDelT;
+      this->maskStep = -1;
     }
-    else
+
+    status = clFinish(this->commandQueue);
+    if (status != CL_SUCCESS)
     {
-      this->adamsMoultonKernel = NULL;
+      wxLogError(wxT("clFinish failed %s"), this->ErrorMessage(status));
+      throw status;
     }
   }
 
-  if (this->copyToDisplayKernel != NULL)
+  this->rescaleRatio = 1.0;
+  this->displayingDenseOutput = false;
+  this->stepErrorReady = false;
+  this->calmSteps = 0;
+  return true;
+}
+
+// Grows delT toward targetDeltaTime by as much as the predictor's nodes stay inside the history, once the whole history
+// is at the current step again
+void CLModel::GrowToTargetStep()
+{
+  if (this->step < this->rescaleStep)
   {
-    status = clReleaseKernel(this->copyToDisplayKernel);
-    if (status != CL_SUCCESS)
-    {
-      wxLogError(wxT("clReleaseKernel copyToDisplayKernel failed %s"), this->ErrorMessage(status));
-      success = status;
-    }
-    else
-    {
-      this->copyToDisplayKernel = NULL;
-    }
+    this->targetDeltaTime = 0.0;
+    return;
   }
 
-  if (this->program != NULL)
+  if (this->step - this->rescaleStep < 16)
   {
-    status = clReleaseProgram(this->program);
-    if (status != CL_SUCCESS)
-    {
-      wxLogError(wxT("clReleaseProgram failed %s"), this->ErrorMessage(status));
-      success = status;
-    }
-    else
-    {
-      this->program = NULL;
-    }
+    return;
   }
 
-  if (this->commandQueue != NULL)
+  double ratio = fmin(15.0 / (this->AdamsOrder() - 1), this->targetDeltaTime / this->delT);
+  if (ratio <= 1.0)
   {
-    status = clReleaseCommandQueue(this->commandQueue);
-    if (status != CL_SUCCESS)
-    {
-      wxLogError(wxT("clReleaseCommandQueue failed %s"), this->ErrorMessage(status));
-      success = status;
-    }
-    else
-    {
-      this->commandQueue = NULL;
-    }
+    this->targetDeltaTime = 0.0;
+    return;
   }
 
-  if (this->context != NULL)
+  this->rescaleRatio = ratio;
+  this->rescaleStep = this->step;
+}
+
+// The startup and Adams kernels take delT as argument 3
+void CLModel::SetDeltaTimeArgs()
+{
+  cl_kernel adamsKernels[] = {this->startupKernel, this->adamsBashforthKernel, this->adamsMoultonKernel};
+  for (int kernel = 0; kernel < 3; kernel++)
   {
-    status = clReleaseContext(this->context);
+    cl_int status = clSetKernelArg(adamsKernels[kernel], 3, sizeof(cl_double), (void *)&this->delT);
     if (status != CL_SUCCESS)
     {
-      wxLogError(wxT("clReleaseContext failed %s"), this->ErrorMessage(status));
-      success = status;
-    }
-    else
-    {
-      this->context = NULL;
+      wxLogError(wxT("clSetKernelArg 3 failed for delT %s"), this->ErrorMessage(status));
+      throw status;
     }
   }
+}
 
-  wxLogDebug(wxT("CLModel:CleanUpCL Done"));
-  return success;
+// Name of a summation for menus and reports
+const wxChar *CLModel::SummationName(int summation)
+{
+  const wxChar *names[] = {wxT("Default"), wxT("Plain"), wxT("Kahan"), wxT("Blocked"), wxT("Compensated Sun and Planets")};
+  return summation >= 0 && summation < CLModel::numSummations ? names[summation] : wxT("Unknown");
 }
 
-void CLModel::RequestUpdate()
+bool CLModel::HasSubgroups()
 {
-  this->updateDisplay = true;
+  return this->gotIntelSubgroups || this->gotKhrSubgroups;
 }
 
-// Copies the initial positions and velocities into the opencl buffers
-void CLModel::SetInitalState(cl_double4 *initalPositions, cl_double4 *initalVelocities)
+bool CLModel::IsPruningPerturbers()
 {
+  return this->initialisedOk && this->maskedAcceleration;
+}
 
-#ifdef __WXDEBUG__
-  wxLogDebug(wxT("CLModel::SetInitalState threadId: %ld"), wxThread::GetCurrentId());
-#endif
+// The fraction of particle and body with mass pairs skipped at the last mask refresh, and the largest over the particles
+// of the summed bounds on what its skipped bodies pull, relative to the least the Sun pulls over the refresh interval
+bool CLModel::PerturberStatistics(double *skippedFraction, double *maxErrorBound)
+{
+  if (!this->IsPruningPerturbers() || this->maskParticles == 0)
+  {
+    return false;
+  }
 
-  cl_int status = CL_SUCCESS;
-  status = clEnqueueWriteBuffer(this->commandQueue, this->currPos, CL_FALSE, 0, this->numParticles * sizeof(cl_double4), initalPositions, 0, 0, 0);
+  cl_uint stats[2];
+  cl_int status = clEnqueueReadBuffer(this->commandQueue, this->perturberStats, CL_TRUE, 0, sizeof(stats), stats, 0, NULL, NULL);
   if (status != CL_SUCCESS)
   {
-    wxLogError(wxT("clEnqueueWriteBuffer write inital Positions to currPos %s"), this->ErrorMessage(status));
-    throw status;
+    wxLogError(wxT("clEnqueueReadBuffer perturberStats failed %s"), this->ErrorMessage(status));
+    return false;
+  }
+
+  cl_float bound;
+  memcpy(&bound, &stats[1], sizeof(bound));
+  *skippedFraction = (double)stats[0] / ((double)this->maskParticles * (this->numGrav - 1));
+  *maxErrorBound = bound;
+  return true;
+}
+
+// Overwrites the state of some of the bodies with mass, used to drive them from an external ephemeris.
+// positions keep the GM in w and velocities the relativistic parameter. Called between stages,
+// so the next acceleration kernel sees these positions and the integrated values are discarded
+void CLModel::SetBodyStates(int numBodies, cl_int *indices, cl_double4 *positions, cl_double4 *velocities)
+{
+  cl_int status = CL_SUCCESS;
+  if (this->streaming)
+  {
+    wxLogError(wxT("Bodies cannot be driven from an ephemeris while streaming"));
+    throw -1;
+  }
+
+  if (this->heliocentricFrame)
+  {
+    wxLogError(wxT("Bodies cannot be driven from an ephemeris in the heliocentric frame"));
+    throw -1;
+  }
+
+  for (int body = 0; body < numBodies; body++)
+  {
+    size_t offset = indices[body] * sizeof(cl_double4);
+    status = clEnqueueWriteBuffer(this->commandQueue, this->gravPos, CL_FALSE, offset, sizeof(cl_double4), positions + body, 0, 0, 0);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clEnqueueWriteBuffer gravPos body %d %s"), indices[body], this->ErrorMessage(status));
+      throw status;
+    }
+
+    status = clEnqueueWriteBuffer(this->commandQueue, this->currPos, CL_FALSE, offset, sizeof(cl_double4), positions + body, 0, 0, 0);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clEnqueueWriteBuffer currPos body %d %s"), indices[body], this->ErrorMessage(status));
+      throw status;
+    }
+
+    status = clEnqueueWriteBuffer(this->commandQueue, this->currVel, CL_FALSE, offset, sizeof(cl_double4), velocities + body, 0, 0, 0);
+    if (status != CL_SUCCESS)
+    {
+      wxLogError(wxT("clEnqueueWriteBuffer currVel body %d %s"), indices[body], this->ErrorMessage(status));
+      throw status;
+    }
   }
 
-  status = clEnqueueWriteBuffer(this->commandQueue, this->gravPos, CL_FALSE, 0, this->numGrav * sizeof(cl_double4), initalPositions, 0, 0, 0);
+  status = clFinish(this->commandQueue);
   if (status != CL_SUCCESS)
   {
-    wxLogError(wxT("clEnqueueWriteBuffer write inital Positions to gravPos %s"), this->ErrorMessage(status));
+    wxLogError(wxT("clFinish failed %s"), this->ErrorMessage(status));
     throw status;
   }
+}
+
+// Runs the startup steps if they have not been done, then times numSteps whole steps and returns the milliseconds per step.
+// The simulation advances, so the caller resets it afterwards
+double CLModel::BenchmarkSteps(int numSteps)
+{
+  cl_int status = CL_SUCCESS;
+  while (this->step < 16)
+  {
+    this->ExecuteKernels();
+  }
 
-  status = clEnqueueWriteBuffer(this->commandQueue, this->currVel, CL_FALSE, 0, this->numParticles * sizeof(cl_double4), initalVelocities, 0, 0, 0);
+  status = clFinish(this->commandQueue);
   if (status != CL_SUCCESS)
   {
-    wxLogError(wxT("clEnqueueWriteBuffer write inital Velocity to currVel %s"), this->ErrorMessage(status));
+    wxLogError(wxT("clFinish failed %s"), this->ErrorMessage(status));
     throw status;
   }
 
+  wxStopWatch stopWatch;
+  int lastStep = this->step + numSteps;
+  while (this->step < lastStep)
+  {
+    this->ExecuteKernels();
+  }
+
   status = clFinish(this->commandQueue);
   if (status != CL_SUCCESS)
   {
     wxLogError(wxT("clFinish failed %s"), this->ErrorMessage(status));
     throw status;
   }
+  return stopWatch.TimeInMicro().ToDouble() / (1000.0 * numSteps);
+}
 
-  this->step = 0;
+// Version of the selected device's driver
+wxString CLModel::DriverVersion()
+{
+  char driverVersion[256] = "";
+  clGetDeviceInfo(this->deviceId, CL_DRIVER_VERSION, sizeof(driverVersion), driverVersion, NULL);
+  driverVersion[sizeof(driverVersion) - 1] = 0;
+  return wxString(driverVersion, wxConvUTF8);
 }
 
-// snapshots the current positions and velocities and makes them the initial start conditions.
-// From there they can be saved to disk as either binary or slf format for later
-void CLModel::ReadToInitialState(cl_double4 *initalPositions, cl_double4 *initalVelocities)
+// Name of the cached binary for this device and driver built from source with options, an FNV-1a hash of all of them
+wxString CLModel::ProgramCacheFileName(const char *source, const char *options)
 {
+  wxString key = *this->platformName + wxT("|") + *this->deviceName + wxT("|") + *this->deviceCLVersion + wxT("|") + this->DriverVersion() + wxT("|") + wxString(options, wxConvUTF8) + wxT("|");
+  wxCharBuffer keyBytes = key.utf8_str();
 
-#ifdef __WXDEBUG__
-  wxLogDebug(wxT("CLModel::ReadToInitialState threadId: %ld"), wxThread::GetCurrentId());
-#endif
+  cl_ulong hash = 14695981039346656037ULL;
+  const char *parts[2] = {keyBytes.data(), source};
+  for (int part = 0; part < 2; part++)
+  {
+    for (const unsigned char *byte = (const unsigned char *)parts[part]; *byte != 0; byte++)
+    {
+      hash = (hash ^ *byte) * 1099511628211ULL;
+    }
+  }
+
+  return wxString::Format(wxT("%s%s%016llx.bin"), this->programCacheDirectory, wxFileName::GetPathSeparator(), (unsigned long long)hash);
+}
 
+// Creates and builds the program from a cached binary. Returns false, leaving no program, if there is no usable binary
+bool CLModel::LoadProgramBinary(wxString fileName, const char *options)
+{
   cl_int status = CL_SUCCESS;
-  status = clFinish(this->commandQueue);
-  if (status != CL_SUCCESS)
+  cl_int binaryStatus = CL_SUCCESS;
+  wxFile file;
+  if (!wxFile::Exists(fileName) || !file.Open(fileName))
   {
-    wxLogError(wxT("clFinish failed %s"), this->ErrorMessage(status));
-    throw status;
+    return false;
   }
 
-  status = clEnqueueReadBuffer(this->commandQueue, this->currPos, CL_TRUE, 0, this->numParticles * sizeof(cl_double4), initalPositions, 0, 0, 0);
-  if (status != CL_SUCCESS)
+  size_t size = (size_t)file.Length();
+  if (size == 0)
   {
-    wxLogError(wxT("clEnqueueWriteBuffer write inital Positions to currPos %s"), this->ErrorMessage(status));
-    throw status;
+    return false;
   }
 
-  status = clEnqueueReadBuffer(this->commandQueue, this->currVel, CL_TRUE, 0, this->numParticles * sizeof(cl_double4), initalVelocities, 0, 0, 0);
-  if (status != CL_SUCCESS)
+  unsigned char *binary = new unsigned char[size];
+  bool read = file.Read(binary, size) == (ssize_t)size;
+  file.Close();
+  if (read)
   {
-    wxLogError(wxT("clEnqueueWriteBuffer write inital Velocity to currVel %s"), this->ErrorMessage(status));
-    throw status;
+    const unsigned char *binaries[1] = {binary};
+    this->program = clCreateProgramWithBinary(this->context, 1, &this->deviceId, &size, binaries, &binaryStatus, &status);
+  }
+  delete[] binary;
+
+  // A binary from an older driver may be refused, or only fail to build
+  if (read && status == CL_SUCCESS && binaryStatus == CL_SUCCESS)
+  {
+    status = clBuildProgram(this->program, 1, &this->deviceId, options, NULL, NULL);
+    if (status == CL_SUCCESS)
+    {
+      return true;
+    }
+  }
+
+  wxLogDebug(wxT("Cached program binary %s not usable %s"), fileName, this->ErrorMessage(status != CL_SUCCESS ? status : binaryStatus));
+  if (this->program != NULL)
+  {
+    clReleaseProgram(this->program);
+    this->program = NULL;
+  }
+  return false;
+}
+
+// Writes the binary of the program just built to the cache. Failing to is not an error, the next start just builds again
+void CLModel::SaveProgramBinary(wxString fileName)
+{
+  size_t size = 0;
+  cl_int status = clGetProgramInfo(this->program, CL_PROGRAM_BINARY_SIZES, sizeof(size_t), &size, NULL);
+  if (status != CL_SUCCESS || size == 0)
+  {
+    wxLogDebug(wxT("clGetProgramInfo CL_PROGRAM_BINARY_SIZES failed %s"), this->ErrorMessage(status));
+    return;
+  }
+
+  unsigned char *binary = new unsigned char[size];
+  unsigned char *binaries[1] = {binary};
+  status = clGetProgramInfo(this->program, CL_PROGRAM_BINARIES, sizeof(binaries), binaries, NULL);
+  if (status == CL_SUCCESS)
+  {
+    wxFile file;
+    if ((wxFileName::DirExists(this->programCacheDirectory) || wxFileName::Mkdir(this->programCacheDirectory, 0777, wxPATH_MKDIR_FULL)) && file.Create(fileName, true))
+    {
+      if (file.Write(binary, size) != size)
+      {
+        wxLogDebug(wxT("Unable to write program binary %s"), fileName);
+      }
+      file.Close();
+    }
+  }
+  else
+  {
+    wxLogDebug(wxT("clGetProgramInfo CL_PROGRAM_BINARIES failed %s"), this->ErrorMessage(status));
   }
+  delete[] binary;
 }
 
 // convert the openCL status code to text
@@ -28,6 +28,8 @@ public:
 
   // Public methods
   void CompileProgramAndCreateKernels();
+  void SetAdamsOrder(int order);
+  int AdamsOrder();
   bool FindDeviceAndCreateContext(cl_uint desiredDeviceVendorId, cl_device_type deviceType, char *desiredPlatformName);
   void CreateBufferObjects(GLuint *vbo, int numParticles, int numGrav);
   void SetInitalState(cl_double4 *initalPositions, cl_double4 *initalVelocities);
@@ -37,8 +39,102 @@ public:
   int CleanUpCL();
   void UpdateDisplay();
   void RequestUpdate();
+  int GetNumParticles();
+  int AccelerationBlock();
+  wxString DriverVersion();
   wxString ErrorMessage(cl_int status);
 
+  // Incremental checkpoint support
+  // The integrator state is split into sections: currPos, currVel, posLast, velLast, velHistory and accHistory
+  size_t CheckpointSectionSize(int section);
+  bool HasCheckpointReference();
+  void ReadCheckpointSection(int section, bool base, cl_double4 *hostState);
+  void CommitCheckpointReference();
+  void WriteCheckpointSection(int section, cl_double4 *hostState);
+  void RestoreCheckpoint(cl_int restoredStep, cl_double restoredTime);
+  static const int numCheckpointSections = 6;
+
+  // Trajectory archive support
+  // These must match ARCHIVE_BLOCK_SIZE and ARCHIVE_BLOCK_WORDS in the kernels
+  static const int archiveBlockSize = 32;
+  static const int archiveBlockWords = 1 + 3 * 32;
+  int ArchiveNumBlocks();
+  bool HasArchiveHistory();
+  cl_int ArchiveEncode(cl_double quantum, cl_int predictionOrder, cl_ulong *hostBlocks, cl_uint *hostBlockWords);
+
+  // Chebyshev ephemeris support
+  bool ChebyshevAccumulate(cl_int degree, cl_double x, bool firstSample);
+  void ChebyshevSolve(cl_int degree, cl_double *gramInverse, cl_double4 *hostCoefficients);
+
+  // The Adams-Bashforth and Adams-Moulton kernels are generated for any order up to the length of the history ring
+  static const int minAdamsOrder = 2;
+  static const int maxAdamsOrder = 16;
+
+  // Dense output, the state part way through the last step from the Adams history
+  static const int denseOutputOrder = 12;
+  bool DenseOutput(cl_double fraction, cl_double4 *hostPositions, cl_double4 *hostVelocities);
+  bool DisplayDenseOutput(cl_double fraction);
+  cl_double DisplayedTime();
+
+  // Kepler fast forward of distant test particles
+  cl_int BeginKeplerFastForward(cl_double minDistance);
+  bool IsKeplerFastForwarding();
+  void EndKeplerFastForward();
+
+  // Bulk conversion of orbital elements, used when importing element catalogs
+  void OrbitalToStateVectors(cl_double4 *elementsA, cl_double4 *elementsB, cl_int numElements, cl_double centreMass, cl_double4 *positions, cl_double4 *velocities);
+
+  // Out-of-core streaming, the particle state lives on the host and is staged through the device in chunks
+  // Rows of each host chunk: currPos, currVel, posLast, velLast, 16 of velHistory then 16 of accHistory
+  static const int numStreamRows = 36;
+  bool IsStreaming();
+
+  // Two-phase integration, the bodies with mass are integrated several steps ahead of the test particles
+  // which then catch up in a single kernel launch
+  static const int maxTwoPhaseSteps = 64;
+  bool CanRunTwoPhase();
+  void ExecuteTwoPhase(int numSteps);
+
+  // Barnes-Hut tree gravity, selected with the newtonianTree or relativisticTree acceleration kernel, and perturber pruning.
+  // Compares the tree or the pruned sum with the direct sum for the current positions, as relative errors of the accelerations
+  bool AccelerationErrorStatistics(double *maxRelativeError, double *rmsRelativeError);
+
+  // Perturber pruning, the bodies with mass each particle skipped at the last mask refresh and the largest bound on what they pull
+  bool IsPruningPerturbers();
+  bool PerturberStatistics(double *skippedFraction, double *maxErrorBound);
+
+  // Heliocentric integration, the state on the device is relative to the Sun and is barycentric again when read back
+  bool IsHeliocentric();
+
+  // Hash of the bits of the current positions and velocities, to compare deterministic runs on different devices
+  bool StateDigest(cl_ulong *digest);
+
+  // Adaptive step size, the largest and root mean square predictor corrector difference of the last step, relative to the distance from the Sun
+  bool IsControllingStep();
+  bool StepErrorStatistics(double *maxError, double *rmsError);
+
+  // Changes delT, or reverses time, keeping the Adams history rather than rerunning the startup steps
+  bool ChangeDeltaTime(cl_double newDelT);
+
+  // Bodies with mass driven from an external ephemeris rather than integrated
+  void SetBodyStates(int numBodies, cl_int *indices, cl_double4 *positions, cl_double4 *velocities);
+
+  // How the acceleration kernels add up the bodies with mass, chosen when the program is built.
+  // The default is plain sums for Newtonian gravity and compensated sums for relativistic
+  static const int summationDefault = 0;
+  static const int summationPlain = 1;
+  static const int summationKahan = 2;
+  static const int summationBlocked = 3;
+  static const int summationMajor = 4; /**< Compensated for the first compensatedBodies, the Sun and planets, plain for the rest */
+  static const int numSummations = 5;
+  static const wxChar *SummationName(int summation);
+
+  // The Subgroup acceleration kernels need cl_intel_subgroups or cl_khr_subgroups, otherwise the constant memory kernels are used
+  bool HasSubgroups();
+
+  // Milliseconds per step of the current kernels, used to compare generic and specialised builds
+  double BenchmarkSteps(int numSteps);
+
   // Device/Platform Information
   wxString *deviceName;               /**< Name of selected OpenCL device */
   wxString *deviceCLVersion;          /**< OpenCL version supported by device */
@@ -55,9 +151,31 @@ public:
   cl_double time;         /**< Current simulation time in seconds */
   cl_int numGrav;         /**< Number of gravitational bodies */
   cl_int maxNumGrav;      /**< Maximum allowed gravitational bodies */
+  cl_int maxConstantNumGrav; /**< Gravitational bodies that fit in constant memory, above this the Local acceleration kernels are used */
   cl_int maxNumParticles; /**< Maximum allowed particles */
   cl_int step;            /**< Current integration step number */
   cl_int centerBody;      /**< Index of central body (usually Sun) */
+  cl_int streamChunkSize; /**< Particles per device chunk when there are more, 0 keeps every particle on the device */
+  wxString programCacheDirectory; /**< Directory of cached program binaries, empty to always build from source */
+  int programCacheHits;           /**< Programs loaded from a cached binary */
+  int programCacheMisses;         /**< Programs built from source */
+  bool specializeKernels;         /**< Builds the program with the body counts as constants rather than kernel arguments */
+  wxString buildOptions;          /**< Options the program is built with */
+  size_t requestedGroupSize;      /**< Work-group size to use, reduced to what the device and every kernel allow */
+  int gravTileSize;               /**< Bodies with mass per local memory tile of the Local acceleration kernels */
+  int particlesPerWorkItem;       /**< Particles each acceleration work-item computes, 1, 2, 4 or 8. Above 1 the Blocked kernels are used */
+  bool pairwiseMassive;           /**< The bodies with mass are summed pairwise by gravPairs rather than by the acceleration kernel */
+  double treeOpeningAngle;        /**< Tree nodes that look smaller than this many radians are summed as a point mass */
+  int summation;                  /**< Summation of the bodies with mass, one of the summation constants */
+  int compensatedBodies;          /**< Bodies with mass, from the Sun, that summationMajor compensates */
+  double perturberTolerance;      /**< Bodies with mass pulling less than this fraction of the Sun are skipped per particle, 0 sums them all */
+  int perturberRefreshSteps;      /**< Steps between rebuilds of the perturber masks */
+  bool heliocentric;              /**< Integrates relative to the Sun with the indirect term rather than in the barycentric frame */
+  int fixedPointBits;             /**< Positions are whole numbers of 2^-fixedPointBits Gm updated exactly, 0 leaves them floating point */
+  bool deterministic;             /**< Builds and runs only what rounds the same on every device, so any device gives the same state */
+  double stepTolerance;           /**< Largest predictor corrector difference, relative to the distance from the Sun, before delT is halved. 0 keeps delT fixed */
+  double minDeltaTime;            /**< Smallest step in seconds the step size control halves delT to */
+  double maxDeltaTime;            /**< Largest step in seconds the step size control grows delT to */
   cl_uint deviceVendorId; /**< OpenCL device vendor ID */
 
 private:
@@ -66,6 +184,7 @@ private:
   cl_context context;            /**< OpenCL context */
   cl_device_id *devices;         /**< List of available OpenCL devices */
   cl_command_queue commandQueue; /**< Command queue for kernel execution */
+  cl_command_queue streamQueue;  /**< Second queue when streaming, so one chunk's transfers overlap the other's kernels */
   cl_program program;            /**< Compiled OpenCL program */
 
   // OpenCL Kernels
@@ -74,6 +193,30 @@ private:
   cl_kernel adamsMoultonKernel;   /**< Adams-Moulton integration kernel */
   cl_kernel startupKernel;        /**< Initialization kernel */
   cl_kernel copyToDisplayKernel;  /**< Display buffer update kernel */
+  cl_kernel checkpointDeltaKernel; /**< XOR delta kernel for incremental checkpoints */
+  cl_kernel archiveEncodeKernel;  /**< Trajectory archive encoding kernel */
+  cl_kernel chebyshevAccumulateKernel; /**< Chebyshev fit sample accumulation kernel */
+  cl_kernel chebyshevSolveKernel;      /**< Chebyshev fit coefficient kernel */
+  cl_kernel denseOutputKernel;         /**< Dense output interpolation kernel */
+  cl_kernel keplerFastForwardKernel;   /**< Kepler orbit propagation kernel */
+  cl_kernel orbitalToStateVectorsKernel; /**< Orbital element conversion kernel */
+  cl_kernel copyChunkToDisplayKernel;    /**< Display buffer update kernel for one streamed chunk */
+  cl_kernel twoPhaseTestParticlesKernel; /**< Multi-step test particle kernel of two-phase integration */
+  cl_kernel treeBoundsKernel;            /**< Bounding box of the bodies with mass for the tree */
+  cl_kernel treeMortonKeysKernel;        /**< Morton code keys of the bodies with mass */
+  cl_kernel treeSortStepKernel;          /**< One pass of the bitonic sort of the keys */
+  cl_kernel treeBuildKernel;             /**< Internal nodes of the radix tree */
+  cl_kernel treeSummariseKernel;         /**< Mass, centre of mass and box of every tree node */
+  cl_kernel referenceKernel;             /**< Direct sum acceleration kernel the tree or pruned sum is checked against */
+  cl_kernel perturberMaskKernel;         /**< Per particle masks of the bodies with mass worth summing */
+  cl_kernel gravPairsKernel;             /**< Pairwise accelerations of the bodies with mass */
+  cl_kernel heliocentricIndirectKernel;  /**< Pull of the other bodies with mass on the Sun */
+  cl_kernel addIndirectKernel;           /**< Takes the indirect term off the heliocentric accelerations */
+  cl_kernel frameOffsetKernel;           /**< Offset between the barycentric and heliocentric frames */
+  cl_kernel frameShiftKernel;            /**< Moves positions and velocities by the frame offset */
+  cl_kernel fixedPointKernel;            /**< Rounds the loaded positions onto the fixed point grid */
+  cl_kernel stepErrorKernel;             /**< Predictor corrector difference of a step */
+  cl_kernel rescaleHistoryKernel;        /**< Respaces the Adams history for a new step size */
 
   // Device Capabilities
   size_t maxWorkGroupSize;        /**< Maximum work-items per work-group */
@@ -83,6 +226,26 @@ private:
   cl_ulong maxConstantBufferSize; /**< Maximum constant buffer size */
   cl_ulong globalMemorySize;      /**< Total available global memory */
   cl_ulong maxMemoryAlloc;        /**< Maximum single allocation size */
+  bool tiledAcceleration;         /**< The acceleration kernel stages gravPos through local memory tiles */
+  int accelerationBlock;          /**< Particles per work-item of the acceleration kernel built, 1 unless it is a Blocked kernel */
+  cl_uint accTargetsArg;          /**< Index of the numTargets argument of a Blocked acceleration kernel */
+  bool treeAcceleration;          /**< The acceleration kernel sums the bodies with mass over a Barnes-Hut tree */
+  cl_int treeNumKeys;             /**< Tree keys sorted, numGrav - 1 rounded up to a power of two */
+  bool pairAcceleration;          /**< gravPairs computes the acceleration of the bodies with mass */
+  size_t pairGroupSize;           /**< Size of the single work-group gravPairs runs as */
+  bool maskedAcceleration;        /**< The acceleration kernel sums only the bodies with mass in each particle's perturber mask */
+  bool subgroupAcceleration;      /**< The acceleration kernel shares the bodies with mass across each sub-group with broadcasts */
+  cl_int maskWords;               /**< Words of each particle's perturber mask, numGrav / 32 rounded up */
+  cl_int maskStep;                /**< Step the perturber masks were built at, -1 when they need building */
+  cl_int maskParticles;           /**< Particles the perturber masks were built for */
+  bool heliocentricFrame;         /**< The device state is heliocentric, heliocentric unless streaming */
+  bool stepControl;               /**< delT follows the predictor corrector difference, stepTolerance unless streaming */
+  bool stepErrorReady;            /**< The last corrector measured its difference for the step size control */
+  cl_int calmSteps;               /**< Steps in a row the difference has been small enough to grow delT */
+  cl_int rescaleStep;             /**< Step the pending step ratio is applied at, or the step the history was last rescaled */
+  cl_double rescaleRatio;         /**< Pending change of delT, 1 when there is none */
+  bool historyGrown;              /**< The last rescale grew delT, leaving the history past the predictor's reach at the old spacing */
+  cl_double targetDeltaTime;      /**< delT that ChangeDeltaTime is growing the step to, 0 when there is none */
 
   // Kernel Work Group Sizes
   size_t accKernelWorkGroupSize;            /**< Optimal work-group size for acc kernel */
@@ -94,8 +257,13 @@ private:
 
   // Simulation State
   cl_int numParticles; /**< Current number of particles */
+  cl_int activeParticles; /**< Particles being integrated, the rest are frozen by a Kepler fast forward */
   cl_int stage;        /**< Current integration stage */
   cl_int numStages;    /**< Total integration stages */
+  bool streaming;      /**< The particles are streamed through the device in chunks */
+  cl_int chunkSize;    /**< Particles per chunk when streaming, the device buffers hold one chunk */
+  cl_int numChunks;    /**< Number of chunks when streaming */
+  cl_double4 *streamState; /**< [numChunks][numStreamRows][chunkSize] host copy of the integrator state when streaming */
 
   // OpenCL memory buffers
   cl_mem dispPos;    // [numParticles][4] - Display positions (GL shared buffer)
@@ -109,6 +277,40 @@ private:
   cl_mem accHistory; // [numParticles][16][4] - Acceleration history ring buffer
   cl_mem posLast;    // [numParticles][4] - Previous positions for Adams-Moulton
   cl_mem velLast;    // [numParticles][4] - Previous velocities for Adams-Moulton
+  cl_mem checkpointReference; // [numParticles][36][4] - State as of the last checkpoint, allocated on first checkpoint
+  cl_mem checkpointDelta;     // [numParticles][16][4] - XOR delta of one state section against checkpointReference
+  cl_mem archiveQuantised[3]; // [3][numParticles][4] - Quantised positions of the last three archived frames, newest first
+  cl_mem archiveBlocks;       // [numBlocks][archiveBlockWords] - Bit packed residuals of one archive frame
+  cl_mem archiveBlockSizes;   // [numBlocks] - Number of words used by each block
+  cl_mem chebyshevSums;         // [degree+1][numParticles][4] - Sums of position times T_k over the samples of an interval
+  cl_mem chebyshevCoefficients; // [degree+1][numParticles][4] - Fitted Chebyshev coefficients
+  cl_mem chebyshevGramInverse;  // [degree+1][degree+1] - Inverse of the least squares normal matrix
+  cl_mem densePos;              // [numParticles][4] - Dense output positions
+  cl_mem denseVel;              // [numParticles][4] - Dense output velocities
+  cl_mem denseGravPos;          // [numGrav][4] - Dense output positions of the bodies with mass, for display
+  cl_mem denseWeights;          // [denseOutputOrder] - Dense output interpolation weights
+  cl_mem keplerStartPos;        // [numParticles - activeParticles][4] - Positions of the frozen particles when frozen
+  cl_mem keplerStartVel;        // [numParticles - activeParticles][4] - Velocities of the frozen particles when frozen
+  cl_mem twoPhaseEphemeris;     // [2 * maxTwoPhaseSteps][numGrav][4] - Positions of the bodies with mass before every stage of a two-phase run
+  cl_mem twoPhaseCoefficients;  // [2][16] - Adams-Bashforth then Adams-Moulton weights for two-phase integration
+  cl_mem treeBox;               // [2][4] - Bounding box of the bodies with mass other than the Sun, min then max
+  cl_mem treeKeys;              // [treeNumKeys] - Morton code above body index of the bodies with mass other than the Sun, sorted
+  cl_mem treeChildren;          // [numGrav - 2][2] - Children of the internal tree nodes
+  cl_mem treeParents;           // [2 * numGrav - 3] - Parent of every tree node
+  cl_mem treeFlags;             // [numGrav - 2] - Children of each internal node summed so far
+  cl_mem treeCom;               // [2 * numGrav - 3][4] - Centre of mass of every tree node, total GM in w
+  cl_mem treeMin;               // [2 * numGrav - 3][4] - Low corner of the box around every tree node
+  cl_mem treeMax;               // [2 * numGrav - 3][4] - High corner of the box around every tree node
+  cl_mem checkAcc[2];           // [2][numParticles][4] - Approximate and direct sum accelerations compared by AccelerationErrorStatistics
+  cl_mem pairCompensation;      // [numGrav][4] - Running compensation of the pairwise sums
+  cl_mem perturberMask;         // [maskWords][numParticles] - Bodies with mass each particle sums, a bit per body
+  cl_mem perturberStats;        // [2] - Bodies skipped at the last mask refresh and the largest relative bound, as float bits
+  cl_mem indirectAcc;           // [1][4] - Indirect term of the heliocentric accelerations
+  cl_mem frameOffsets;          // [2][4] - Position and velocity offset between the barycentric and heliocentric frames
+  cl_mem framePos;              // [numParticles][4] - Barycentric positions read back from the heliocentric frame
+  cl_mem frameVel;              // [numParticles][4] - Barycentric velocities read back from the heliocentric frame
+  cl_mem stepErrors;            // [2] - Largest and root mean square predictor corrector difference of the last step
+  cl_mem streamSlot[9];         // Second set of chunk buffers when streaming, in the order currPos, currVel, posLast, velLast, velHistory, accHistory, acc, newPos, newVel
 
   // Dimensions explanation:
   // [numParticles] - Number of bodies in simulation
@@ -125,10 +327,64 @@ private:
   bool gotAmdFp64;        /**< AMD double precision support */
   bool gotKhrGlSharing;   /**< KHR OpenGL sharing support */
   bool gotAppleGlSharing; /**< Apple OpenGL sharing support */
+  bool gotKhrSubgroups;   /**< KHR sub-group support */
+  bool gotIntelSubgroups; /**< Intel sub-group support */
+  bool checkpointReferenceValid; /**< checkpointReference holds the last written checkpoint */
+  bool archiveHistoryValid;      /**< archiveQuantised holds previously archived frames */
+  cl_int chebyshevDegree;        /**< Degree the Chebyshev buffers were allocated for, -1 if none */
+  bool displayingDenseOutput;    /**< The display shows the dense output rather than the current state */
+  cl_double denseOutputTime;     /**< Time in seconds of the last dense output */
+  cl_double keplerStartTime;     /**< Time in seconds the frozen particles were frozen */
+  cl_double4 keplerStartCentrePos; /**< Centre of mass when the particles were frozen, total GM in w */
+  cl_double4 keplerStartCentreVel; /**< Velocity of the centre of mass when the particles were frozen */
 
   // Private methods
   void SetAdamsKernelArgs(cl_kernel adamsKernel);
   bool IsDeviceSuitable(cl_device_id deviceIdToCheck);
+  cl_mem CheckpointSection(int section, size_t *count, size_t *offset);
+  void CreateCheckpointBuffers();
+  void CreateArchiveBuffers();
+  void CreateChebyshevBuffers(cl_int degree);
+  void ReleaseChebyshevBuffers();
+  void CreateDenseOutputBuffers();
+  static void DenseOutputWeights(cl_double fraction, cl_double *weights);
+  static void AdamsWeights(int order, int newestNode, cl_double fraction, cl_double *weights);
+  cl_double4 GravCentre(cl_double4 *state, cl_double4 *positions);
+  void ReleaseKeplerBuffers();
+  void CreateStreamBuffers();
+  void ReleaseStreamBuffers();
+  cl_double4 *StreamRow(int chunk, int row);
+  void SetStreamKernelArgs(cl_kernel integrationKernel, cl_mem *buffers);
+  void ExecuteStreamingStage();
+  void UpdateStreamingDisplay();
+  void EndStage();
+  void EnqueueStage(size_t numThreads, bool measureError);
+  void EnqueueAccelerations(size_t numThreads);
+  size_t AccelerationThreads(size_t numThreads);
+  void CreateTwoPhaseBuffers();
+  void CreateTreeBuffers();
+  void ReleaseTreeBuffers();
+  void SetTreeKernelArgs();
+  void EnqueueTreeBuild(cl_command_queue queue);
+  void SetPairKernelArgs();
+  void EnqueueAcceleration(cl_command_queue queue, size_t numThreads, bool withMassive);
+  void SetPerturberKernelArgs();
+  void EnqueuePerturberMask(size_t numThreads);
+  void SetHeliocentricKernelArgs();
+  void EnqueueFrameShift(bool toHeliocentric, cl_mem dstPos, cl_mem dstVel);
+  void BarycentricState(cl_mem *pos, cl_mem *vel);
+  void ToFixedPoint(cl_double4 *positions, size_t count);
+  void SetStepControlKernelArgs();
+  void EnqueueStepError(size_t numThreads);
+  void EnqueueRescaleHistory();
+  void ControlStepSize();
+  bool HistoryStale();
+  void GrowToTargetStep();
+  void SetDeltaTimeArgs();
+  wxString AdamsProgramSource();
+  wxString ProgramCacheFileName(const char *source, const char *options);
+  bool LoadProgramBinary(wxString fileName, const char *options);
+  void SaveProgramBinary(wxString fileName);
 };
 
 #endif // CLMODEL_H
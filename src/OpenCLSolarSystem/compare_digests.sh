@@ -0,0 +1,37 @@
+#!/bin/bash
+
+# Runs the same deterministic steps on two or more devices and checks that their state digests match.
+# Each device is picked with one of the program's device options, -cpu, -nvidia, -amd or -intel
+if [ $# -lt 4 ]; then
+    echo "Usage: $0 <executable> <steps> <device option> <device option>..."
+    echo "Example: $0 build/bin/OpenCLSolarSystem 1000 -cpu -nvidia"
+    exit 1
+fi
+
+EXECUTABLE="$1"
+STEPS="$2"
+shift 2
+
+REFERENCE=""
+MISMATCH=0
+for DEVICE in "$@"; do
+    LINE=$("$EXECUTABLE" -deterministic -digest "$STEPS" "$DEVICE" | grep "state digest") || {
+        echo "Error: no state digest from $EXECUTABLE $DEVICE"
+        exit 1
+    }
+
+    # The digest is the last word of the line
+    DIGEST="${LINE##* }"
+    echo "$DEVICE: $LINE"
+    if [ -z "$REFERENCE" ]; then
+        REFERENCE="$DIGEST"
+    elif [ "$DIGEST" != "$REFERENCE" ]; then
+        MISMATCH=1
+    fi
+done
+
+if [ $MISMATCH -ne 0 ]; then
+    echo "State digests differ after $STEPS steps"
+    exit 1
+fi
+echo "State digests match after $STEPS steps"
@@ -25,8 +25,14 @@ enum
   ID_START,
   ID_STOP,
   ID_RESET,
+  ID_GOTODATE,
+  ID_BENCHMARKKERNELS,
+  ID_ACCELERATIONERRORS,
+  ID_SUMMATIONMATRIX,
+  ID_STATEDIGEST,
   ID_RESETCOLOURS,
   ID_IMPORTSLF,
+  ID_IMPORTMPCORB,
   ID_SETDELTAT1,
   ID_SETDELTAT5,
   ID_SETDELTAT15,
@@ -59,21 +65,27 @@ enum
   ID_SETGRAV256,
   ID_SETGRAV384,
   ID_SETGRAV512,
+  ID_SETGRAV1024,
+  ID_SETGRAV2048,
+  ID_SETGRAV4096,
   ID_SETGRAVMAX,
   ID_SAVESTATE,
   ID_LOADSTATE,
   ID_READSTATE,
   ID_EXPORTSLF,
   ID_BLENDING,
-  ID_SETADAMS4,
-  ID_SETADAMS8,
-  ID_SETADAMS10,
-  ID_SETADAMS11,
-  ID_SETADAMS12,
-  ID_SETADAMS16,
+  ID_SETADAMS2, // one id per Adams order from CLModel::minAdamsOrder to CLModel::maxAdamsOrder
+  ID_SETADAMSLAST = ID_SETADAMS2 + CLModel::maxAdamsOrder - CLModel::minAdamsOrder,
+  ID_SETSUMMATION0, // one id per CLModel summation
+  ID_SETSUMMATIONLAST = ID_SETSUMMATION0 + CLModel::numSummations - 1,
   ID_SETNEWTONIAN,
+  ID_SETNEWTONIANL,
   ID_SETRELATIVISTIC,
   ID_SETRELATIVISTICL,
+  ID_SETNEWTONIANTREE,
+  ID_SETRELATIVISTICTREE,
+  ID_SETNEWTONIANSUBGROUP,
+  ID_SETRELATIVISTICSUBGROUP,
   ID_SETCENTER0,
   ID_SETCENTER1,
   ID_SETCENTER2,
@@ -92,6 +104,13 @@ enum
   ID_SETCENTER15,
   ID_SETCENTER16,
   ID_LOGENCOUNTERS,
+  ID_CHECKPOINTS,
+  ID_RESTORECHECKPOINT,
+  ID_ARCHIVE,
+  ID_EPHEMERIS,
+  ID_KEPLERFASTFORWARD,
+  ID_JPLEPHEMERIS,
+  ID_HELIOCENTRIC,
 };
 
 // mapping of UI event ids to functions
@@ -101,14 +120,16 @@ EVT_MENU(wxID_ABOUT, Frame::OnAbout)
 EVT_MENU(ID_START, Frame::OnStart)
 EVT_MENU(ID_STOP, Frame::OnStop)
 EVT_MENU(ID_RESET, Frame::OnReset)
+EVT_MENU(ID_GOTODATE, Frame::OnGoToDate)
+EVT_MENU(ID_BENCHMARKKERNELS, Frame::OnBenchmarkKernels)
+EVT_MENU(ID_ACCELERATIONERRORS, Frame::OnAccelerationErrors)
+EVT_MENU(ID_SUMMATIONMATRIX, Frame::OnSummationMatrix)
+EVT_MENU(ID_STATEDIGEST, Frame::OnStateDigest)
 EVT_MENU(ID_RESETCOLOURS, Frame::OnResetColours)
 EVT_MENU(ID_IMPORTSLF, Frame::OnImportSlf)
-EVT_MENU(ID_SETADAMS4, Frame::OnSetIntegrator)
-EVT_MENU(ID_SETADAMS8, Frame::OnSetIntegrator)
-EVT_MENU(ID_SETADAMS10, Frame::OnSetIntegrator)
-EVT_MENU(ID_SETADAMS11, Frame::OnSetIntegrator)
-EVT_MENU(ID_SETADAMS12, Frame::OnSetIntegrator)
-EVT_MENU(ID_SETADAMS16, Frame::OnSetIntegrator)
+EVT_MENU(ID_IMPORTMPCORB, Frame::OnImportMpcOrb)
+EVT_MENU_RANGE(ID_SETADAMS2, ID_SETADAMSLAST, Frame::OnSetIntegrator)
+EVT_MENU_RANGE(ID_SETSUMMATION0, ID_SETSUMMATIONLAST, Frame::OnSetSummation)
 EVT_MENU(ID_SETDELTATMINUS1, Frame::OnSetDeltaTime)
 EVT_MENU(ID_SETDELTATMINUS5, Frame::OnSetDeltaTime)
 EVT_MENU(ID_SETDELTATMINUS15, Frame::OnSetDeltaTime)
@@ -141,6 +162,9 @@ EVT_MENU(ID_SETGRAV192, Frame::OnSetGrav)
 EVT_MENU(ID_SETGRAV256, Frame::OnSetGrav)
 EVT_MENU(ID_SETGRAV384, Frame::OnSetGrav)
 EVT_MENU(ID_SETGRAV512, Frame::OnSetGrav)
+EVT_MENU(ID_SETGRAV1024, Frame::OnSetGrav)
+EVT_MENU(ID_SETGRAV2048, Frame::OnSetGrav)
+EVT_MENU(ID_SETGRAV4096, Frame::OnSetGrav)
 EVT_MENU(ID_SETGRAVMAX, Frame::OnSetGrav)
 EVT_MENU(ID_SETCENTER0, Frame::OnSetCenter)
 EVT_MENU(ID_SETCENTER1, Frame::OnSetCenter)
@@ -160,14 +184,26 @@ EVT_MENU(ID_SETCENTER14, Frame::OnSetCenter)
 EVT_MENU(ID_SETCENTER15, Frame::OnSetCenter)
 EVT_MENU(ID_SETCENTER16, Frame::OnSetCenter)
 EVT_MENU(ID_SETNEWTONIAN, Frame::OnSetAcceleration)
+EVT_MENU(ID_SETNEWTONIANL, Frame::OnSetAcceleration)
 EVT_MENU(ID_SETRELATIVISTIC, Frame::OnSetAcceleration)
 EVT_MENU(ID_SETRELATIVISTICL, Frame::OnSetAcceleration)
+EVT_MENU(ID_SETNEWTONIANTREE, Frame::OnSetAcceleration)
+EVT_MENU(ID_SETRELATIVISTICTREE, Frame::OnSetAcceleration)
+EVT_MENU(ID_SETNEWTONIANSUBGROUP, Frame::OnSetAcceleration)
+EVT_MENU(ID_SETRELATIVISTICSUBGROUP, Frame::OnSetAcceleration)
 EVT_MENU(ID_SAVESTATE, Frame::OnSaveInitialState)
 EVT_MENU(ID_LOADSTATE, Frame::OnLoadInitialState)
 EVT_MENU(ID_READSTATE, Frame::OnReadToInitialState)
 EVT_MENU(ID_EXPORTSLF, Frame::OnExportSlf)
 EVT_MENU(ID_BLENDING, Frame::OnBlending)
 EVT_MENU(ID_LOGENCOUNTERS, Frame::OnLogEncounters)
+EVT_MENU(ID_CHECKPOINTS, Frame::OnCheckpoints)
+EVT_MENU(ID_RESTORECHECKPOINT, Frame::OnRestoreCheckpoint)
+EVT_MENU(ID_ARCHIVE, Frame::OnArchive)
+EVT_MENU(ID_EPHEMERIS, Frame::OnEphemeris)
+EVT_MENU(ID_KEPLERFASTFORWARD, Frame::OnKeplerFastForward)
+EVT_MENU(ID_JPLEPHEMERIS, Frame::OnJplEphemeris)
+EVT_MENU(ID_HELIOCENTRIC, Frame::OnHeliocentric)
 EVT_TIMER(ID_TIMER, Frame::OnTimer)
 EVT_IDLE(Frame::OnIdle)
 EVT_CLOSE(Frame::OnClose)
@@ -183,6 +219,19 @@ Frame::Frame(wxFrame *frame, const wxString &title, const wxPoint &pos, const wx
   this->clModel = NULL;
   this->timer = new wxTimer(this, ID_TIMER);
   this->initialState = new InitialState();
+  this->checkpoint = new Checkpoint();
+  this->checkpointInterval = 1024;
+  this->archive = new TrajectoryArchive();
+  this->archiveInterval = 64;
+  this->archiveErrorBound = 1e-6;
+  this->ephemeris = new ChebyshevEphemeris();
+  this->ephemerisDegree = 12;
+  this->ephemerisIntervalDays = 8.0;
+  this->keplerFastForward = false;
+  this->keplerFastForwardDistance = 4500.0;
+  this->twoPhaseSteps = 0;
+  this->jplEphemeris = new JplEphemeris();
+  this->numDrivenBodies = 0;
   this->stopDateJdn = 2456430.5;
   this->encounterDistance = 5 * 0.35;
   this->goingToDate = false;
@@ -191,6 +240,9 @@ Frame::Frame(wxFrame *frame, const wxString &title, const wxPoint &pos, const wx
   this->desiredPlatform = NULL;
   this->useLastDevice = false;
   this->tryForCPUFirst = false;
+  this->retuneKernels = false;
+  this->deterministic = false;
+  this->digestSteps = 0;
   this->checkForEncounters = false;
   this->numParticles = 0;
   this->numGrav = 0;
@@ -205,13 +257,17 @@ Frame::~Frame()
   delete this->glCanvas;
   delete this->timer;
   delete this->initialState;
+  delete this->checkpoint;
+  delete this->archive;
+  delete this->ephemeris;
+  delete this->jplEphemeris;
 
 #if defined(__WXDEBUG__)
   delete wxLog::SetActiveTarget(NULL);
 #endif
 }
 
-void Frame::InitFrame(bool doubleBuffer, bool smooth, bool lighting, bool stereo, int numParticles, int numGrav, bool useLastDevice, char *desiredPlatform, bool tryForCPUFirst)
+void Frame::InitFrame(bool doubleBuffer, bool smooth, bool lighting, bool stereo, int numParticles, int numGrav, bool useLastDevice, char *desiredPlatform, bool tryForCPUFirst, bool retuneKernels, bool deterministic, int digestSteps)
 {
   bool die = false;
 
@@ -222,11 +278,38 @@ void Frame::InitFrame(bool doubleBuffer, bool smooth, bool lighting, bool stereo
   this->numGrav = numGrav;
   this->tryForCPUFirst = tryForCPUFirst;
   this->useLastDevice = useLastDevice;
+  this->retuneKernels = retuneKernels;
+  this->deterministic = deterministic;
+  this->digestSteps = digestSteps;
   this->desiredPlatform = desiredPlatform;
 
   try
   {
     this->config = wxConfigBase::Get();
+    this->config->Read(wxT("CheckpointInterval"), &this->checkpointInterval, 1024);
+    this->config->Read(wxT("CheckpointBaseInterval"), &this->checkpoint->baseInterval, 16);
+    this->config->Read(wxT("ArchiveInterval"), &this->archiveInterval, 64);
+    this->config->Read(wxT("ArchiveKeyframeInterval"), &this->archive->keyframeInterval, 64);
+    this->config->Read(wxT("ArchiveErrorBound"), &this->archiveErrorBound, 1e-6);
+    this->config->Read(wxT("ArchiveVerifyFrames"), &this->archive->verifyFrames, false);
+    this->config->Read(wxT("EphemerisDegree"), &this->ephemerisDegree, 12);
+    this->config->Read(wxT("EphemerisIntervalDays"), &this->ephemerisIntervalDays, 8.0);
+    this->config->Read(wxT("EphemerisVerifyTolerance"), &this->ephemeris->verifyTolerance, 0.0);
+    this->config->Read(wxT("KeplerFastForwardDistance"), &this->keplerFastForwardDistance, 4500.0);
+    this->config->Read(wxT("TwoPhaseSteps"), &this->twoPhaseSteps, 0);
+
+    // The intervals divide the step count, so a checkpoint every step is as often as they go
+    if (this->checkpointInterval < 1)
+    {
+      wxLogWarning(wxT("CheckpointInterval %d is less than 1, checkpointing every step"), this->checkpointInterval);
+      this->checkpointInterval = 1;
+    }
+
+    if (this->archiveInterval < 1)
+    {
+      wxLogWarning(wxT("ArchiveInterval %d is less than 1, archiving every step"), this->archiveInterval);
+      this->archiveInterval = 1;
+    }
 
     this->initialState->initialNumGrav = this->numGrav;
     if (!this->initialState->LoadInitialState(wxT("initial.bin")))
@@ -254,7 +337,9 @@ void Frame::InitFrame(bool doubleBuffer, bool smooth, bool lighting, bool stereo
     menuFile->Append(ID_LOADSTATE, wxT("Load Initial"));
     menuFile->Append(ID_READSTATE, wxT("Set Initial"));
     menuFile->Append(ID_IMPORTSLF, wxT("&Import .SLF File"));
+    menuFile->Append(ID_IMPORTMPCORB, wxT("Import &MPCORB Catalog"));
     menuFile->Append(ID_EXPORTSLF, wxT("&Export .SLF File"));
+    menuFile->Append(ID_RESTORECHECKPOINT, wxT("Restore Checkpoint"));
     menuFile->Append(ID_RESETCOLOURS, wxT("Reset Colours"));
     menuFile->Append(wxID_EXIT, wxT("E&xit"));
 
@@ -263,23 +348,36 @@ void Frame::InitFrame(bool doubleBuffer, bool smooth, bool lighting, bool stereo
     menuGo->Append(ID_START, wxT("&Start"));
     menuGo->Append(ID_STOP, wxT("S&top"));
     menuGo->Append(ID_RESET, wxT("&Reset"));
+    menuGo->Append(ID_GOTODATE, wxT("Go To &Date..."));
+    menuGo->Append(ID_BENCHMARKKERNELS, wxT("&Benchmark Specialised Kernels"));
+    menuGo->Append(ID_ACCELERATIONERRORS, wxT("Acceleration &Errors"));
+    menuGo->Append(ID_SUMMATIONMATRIX, wxT("&Summation Accuracy and Speed"));
+    menuGo->Append(ID_STATEDIGEST, wxT("State Di&gest"));
 
     // Create a menu that lets the user choose the menthod used to calculate updated positions and velocities
     // Only one option can be chosen at any time
     wxMenu *menuIntegrator = new wxMenu;
-    menuIntegrator->AppendRadioItem(ID_SETADAMS4, wxT("Adams Bashforth Moulton 4"));
-    menuIntegrator->AppendRadioItem(ID_SETADAMS8, wxT("Adams Bashforth Moulton 8"));
-    menuIntegrator->AppendRadioItem(ID_SETADAMS10, wxT("Adams Bashforth Moulton 10"));
-    menuIntegrator->AppendRadioItem(ID_SETADAMS11, wxT("Adams Bashforth Moulton 11"));
-    menuIntegrator->AppendRadioItem(ID_SETADAMS12, wxT("Adams Bashforth Moulton 12"));
-    menuIntegrator->AppendRadioItem(ID_SETADAMS16, wxT("Adams Bashforth Moulton 16"));
+    for (int order = CLModel::minAdamsOrder; order <= CLModel::maxAdamsOrder; order++)
+    {
+      menuIntegrator->AppendRadioItem(ID_SETADAMS2 + order - CLModel::minAdamsOrder, wxString::Format(wxT("Adams Bashforth Moulton %d"), order));
+    }
 
     // Create a menu that lets the user choose the gravity acceleration calculation method
     // Only one option can be chosen at any time
     wxMenu *menuGravity = new wxMenu;
     menuGravity->AppendRadioItem(ID_SETNEWTONIAN, wxT("Newtonian"));
+    menuGravity->AppendRadioItem(ID_SETNEWTONIANL, wxT("Newtonian using Local Memory"));
     menuGravity->AppendRadioItem(ID_SETRELATIVISTIC, wxT("With Relativistic corrections"));
     menuGravity->AppendRadioItem(ID_SETRELATIVISTICL, wxT("With Relativistic corrections using Local Memory"));
+    menuGravity->AppendRadioItem(ID_SETNEWTONIANTREE, wxT("Newtonian using a Barnes-Hut Tree"));
+    menuGravity->AppendRadioItem(ID_SETRELATIVISTICTREE, wxT("With Relativistic corrections using a Barnes-Hut Tree"));
+    menuGravity->AppendRadioItem(ID_SETNEWTONIANSUBGROUP, wxT("Newtonian using Sub-group Broadcasts"));
+    menuGravity->AppendRadioItem(ID_SETRELATIVISTICSUBGROUP, wxT("With Relativistic corrections using Sub-group Broadcasts"));
+    menuGravity->AppendSeparator();
+    for (int summation = 0; summation < CLModel::numSummations; summation++)
+    {
+      menuGravity->AppendRadioItem(ID_SETSUMMATION0 + summation, wxString(wxT("Summation: ")) + CLModel::SummationName(summation));
+    }
 
     // Create a menu that lets the user choose the time step size.
     // Only one option can be chosen at any time
@@ -324,7 +422,10 @@ void Frame::InitFrame(bool doubleBuffer, bool smooth, bool lighting, bool stereo
     menuGrav->AppendRadioItem(ID_SETGRAV256, wxT("256"));
     menuGrav->AppendRadioItem(ID_SETGRAV384, wxT("384"));
     menuGrav->AppendRadioItem(ID_SETGRAV512, wxT("512"));
-    menuGrav->AppendRadioItem(ID_SETGRAVMAX, wxT("Maximum"));
+    menuGrav->AppendRadioItem(ID_SETGRAV1024, wxT("1024"));
+    menuGrav->AppendRadioItem(ID_SETGRAV2048, wxT("2048"));
+    menuGrav->AppendRadioItem(ID_SETGRAV4096, wxT("4096"));
+    menuGrav->AppendRadioItem(ID_SETGRAVMAX, wxT("Maximum in Constant Memory"));
 
     // Create a menu that lets the user choose a body to center the display on.
     // Only one option can be chosen at any time
@@ -351,6 +452,12 @@ void Frame::InitFrame(bool doubleBuffer, bool smooth, bool lighting, bool stereo
     wxMenu *menuOptions = new wxMenu;
     menuOptions->AppendCheckItem(ID_BLENDING, wxT("Blending"));
     menuOptions->AppendCheckItem(ID_LOGENCOUNTERS, wxT("Detect Close Encounters"));
+    menuOptions->AppendCheckItem(ID_CHECKPOINTS, wxT("Incremental Checkpoints"));
+    menuOptions->AppendCheckItem(ID_ARCHIVE, wxT("Record Trajectory Archive"));
+    menuOptions->AppendCheckItem(ID_EPHEMERIS, wxT("Generate Chebyshev Ephemeris"));
+    menuOptions->AppendCheckItem(ID_KEPLERFASTFORWARD, wxT("Kepler Fast Forward Distant Bodies"));
+    menuOptions->AppendCheckItem(ID_JPLEPHEMERIS, wxT("Drive Planets From JPL Ephemeris"));
+    menuOptions->AppendCheckItem(ID_HELIOCENTRIC, wxT("Integrate Relative to the Sun"));
 
     // Add the menus to the windows menu bar
     wxMenuBar *menuBar = new wxMenuBar;
@@ -432,8 +539,8 @@ void Frame::UpdateStatusBar(wxLongLong timeTaken)
   double frameRate = 1000000.0 / movingAverageTimeTaken;
   double timeRate = frameRate * this->clModel->delT / (60 * 60 * 24);
 
-  // compute the Julian day Number
-  double jdn = this->clModel->julianDate + (this->clModel->time) * 1 / (60 * 60 * 24);
+  // compute the Julian day Number of what is being displayed
+  double jdn = this->clModel->julianDate + (this->clModel->DisplayedTime()) * 1 / (60 * 60 * 24);
   wxDateTime dateTime;
   dateTime.Set(jdn);
 
@@ -544,18 +651,262 @@ void Frame::ChooseDevice(wxConfigBase *config)
   wxLogDebug(wxT("Found Vendor Id 0x%X"), (unsigned int)this->clModel->deviceVendorId);
 }
 
+// Config group of the settings tuned for the selected platform and device
+wxString Frame::TuningGroup()
+{
+  wxString device = *this->clModel->platformName + wxT(" ") + *this->clModel->deviceName;
+  device.Replace(wxT("/"), wxT("_"));
+  device.Replace(wxT("\\"), wxT("_"));
+  return wxT("/KernelTuning/") + device;
+}
+
+// Applies the settings tuned for the selected device. They are only used with the driver they were tuned on
+bool Frame::LoadKernelTuning()
+{
+  wxString group = this->TuningGroup();
+  wxString driverVersion;
+  wxString buildOptions;
+  wxString accelerationKernelName;
+  long groupSize;
+  if (!this->config->Read(group + wxT("/DriverVersion"), &driverVersion) || driverVersion != this->clModel->DriverVersion() ||
+      !this->config->Read(group + wxT("/BuildOptions"), &buildOptions) ||
+      !this->config->Read(group + wxT("/AccelerationKernel"), &accelerationKernelName) ||
+      !this->config->Read(group + wxT("/GroupSize"), &groupSize) || groupSize <= 0)
+  {
+    return false;
+  }
+
+  this->clModel->buildOptions = buildOptions;
+  *this->clModel->accelerationKernelName = accelerationKernelName;
+  this->clModel->requestedGroupSize = (size_t)groupSize;
+  this->clModel->gravTileSize = this->config->ReadLong(group + wxT("/GravTileSize"), this->clModel->gravTileSize);
+  this->clModel->particlesPerWorkItem = this->config->ReadLong(group + wxT("/ParticlesPerWorkItem"), this->clModel->particlesPerWorkItem);
+
+  // A summation chosen in the configuration is kept, the tuned one only replaces the default
+  long summation = this->config->ReadLong(group + wxT("/Summation"), CLModel::summationDefault);
+  if (this->clModel->summation == CLModel::summationDefault && summation > CLModel::summationDefault && summation < CLModel::numSummations)
+  {
+    this->clModel->summation = (int)summation;
+  }
+  wxLogDebug(wxT("Tuned kernels: %s, %s summation, %d particles per work-item, work-group size %ld, build options %s, tile %d"), accelerationKernelName,
+             CLModel::SummationName(this->clModel->summation), this->clModel->particlesPerWorkItem, groupSize, buildOptions, this->clModel->gravTileSize);
+  return true;
+}
+
+// Rebuilds the model with the current kernel settings, runs the startup steps and then numSteps more, and reads back the positions.
+// Candidates that fail to build or run are expected, so their errors are not shown
+double Frame::TimeKernelConfiguration(int numSteps, cl_double4 *positions)
+{
+  wxLogNull noLog;
+  cl_double4 *velocities = new cl_double4[this->numParticles];
+  double time = -1.0;
+  try
+  {
+    this->RebuildModel();
+    double msPerStep = this->clModel->BenchmarkSteps(numSteps);
+    this->clModel->ReadToInitialState(positions, velocities);
+    time = msPerStep * 1000.0 / this->clModel->GetNumParticles();
+  }
+  catch (int)
+  {
+    time = -1.0;
+  }
+
+  delete[] velocities;
+  return time;
+}
+
+// Benchmarks the build options, then the constant memory, local memory and sub-group acceleration kernels, then unless the configuration
+// picks one the summation of the bodies with mass, then for a constant memory kernel the particles per work-item, then the work-group sizes,
+// then for a Local kernel the bodies with mass per tile, on the current bodies.
+// Each setting keeps the fastest candidate whose positions at the end of the run are within KernelTuneTolerance Gm
+// of the untuned configuration, which is the accuracy reference. Settings are tuned in turn rather than in every combination.
+// The result is saved for the device and driver and the model left built with it
+void Frame::TuneKernels()
+{
+  const int tuneSteps = 64;
+  const int numSettings = 6;
+  const wxChar *buildOptionCandidates[] = {wxT("-cl-mad-enable"), wxT("-cl-mad-enable -cl-fast-relaxed-math")};
+  const int summationCandidates[] = {CLModel::summationPlain, CLModel::summationKahan, CLModel::summationBlocked, CLModel::summationMajor};
+  const int particlesPerWorkItemCandidates[] = {1, 2, 4, 8};
+  const size_t groupSizeCandidates[] = {32, 64, 128, 256};
+  const int gravTileSizeCandidates[] = {64, 128, 256, 512};
+  const int numCandidates[numSettings] = {2, this->clModel->HasSubgroups() ? 3 : 2, 4, 4, 4, 4};
+
+  double tolerance;
+  this->config->Read(wxT("KernelTuneTolerance"), &tolerance, 1e-6);
+  this->SetStatusText(wxT("Tuning the kernels for ") + *this->clModel->deviceName);
+
+  wxString bestBuildOptions = this->clModel->buildOptions;
+  wxString bestAcceleration = *this->clModel->accelerationKernelName;
+  size_t bestGroupSize = this->clModel->requestedGroupSize;
+  int bestGravTileSize = this->clModel->gravTileSize;
+  int bestParticlesPerWorkItem = this->clModel->particlesPerWorkItem;
+  int bestSummation = this->clModel->summation;
+  bool tuneSummation = this->clModel->summation == CLModel::summationDefault;
+
+  // The tuner doesn't change the physics, only whether the bodies with mass are read from constant or local memory
+  // or shared across sub-groups, where the device has them
+  wxString accelerationCandidates[] = {bestAcceleration.StartsWith(wxT("newtonian")) ? wxT("newtonian") : wxT("relativistic"), wxT(""), wxT("")};
+  accelerationCandidates[1] = accelerationCandidates[0] + wxT("Local");
+  accelerationCandidates[2] = accelerationCandidates[0] + wxT("Subgroup");
+
+  cl_double4 *reference = new cl_double4[this->numParticles];
+  cl_double4 *positions = new cl_double4[this->numParticles];
+  double bestTime = this->TimeKernelConfiguration(tuneSteps, reference);
+  int numReference = this->clModel->GetNumParticles();
+  if (bestTime < 0.0)
+  {
+    wxLogError(wxT("Unable to run the untuned kernels, keeping them"));
+  }
+
+  for (int setting = 0; setting < numSettings && bestTime >= 0.0; setting++)
+  {
+    // Blocking only applies to the constant memory kernels and tiling to the local memory ones.
+    // The tree is a different approximation, so it is never swapped for a direct sum, and it keeps its own sums
+    // A deterministic build runs the Local kernel whatever accelerationKernelName says
+    bool localAcceleration = bestAcceleration.EndsWith(wxT("Local")) || this->clModel->deterministic;
+    bool treeAcceleration = bestAcceleration.EndsWith(wxT("Tree"));
+    bool subgroupAcceleration = bestAcceleration.EndsWith(wxT("Subgroup"));
+    // A deterministic build fixes the build options, acceleration kernel and summation itself, leaving the sizes to tune
+    if ((setting == 1 && treeAcceleration) || (setting == 2 && (treeAcceleration || !tuneSummation)) ||
+        (setting == 3 && (localAcceleration || treeAcceleration || subgroupAcceleration)) || (setting == 5 && !localAcceleration) ||
+        (this->clModel->deterministic && setting < 4))
+    {
+      continue;
+    }
+
+    for (int candidate = 0; candidate < numCandidates[setting]; candidate++)
+    {
+      switch (setting)
+      {
+      case 0:
+        this->clModel->buildOptions = buildOptionCandidates[candidate];
+        break;
+      case 1:
+        *this->clModel->accelerationKernelName = accelerationCandidates[candidate];
+        break;
+      case 2:
+        this->clModel->summation = summationCandidates[candidate];
+        break;
+      case 3:
+        this->clModel->particlesPerWorkItem = particlesPerWorkItemCandidates[candidate];
+        break;
+      case 4:
+        this->clModel->requestedGroupSize = groupSizeCandidates[candidate];
+        break;
+      default:
+        this->clModel->gravTileSize = gravTileSizeCandidates[candidate];
+        break;
+      }
+
+      double time = this->TimeKernelConfiguration(tuneSteps, positions);
+      if (time < 0.0)
+      {
+        wxLogDebug(wxT("Tuning: %s, %llu, %s %s x%d, tile %d failed"), this->clModel->buildOptions, (unsigned long long)this->clModel->requestedGroupSize,
+                   *this->clModel->accelerationKernelName, CLModel::SummationName(this->clModel->summation), this->clModel->particlesPerWorkItem,
+                   this->clModel->gravTileSize);
+        continue;
+      }
+
+      // Compare the bodies both runs had, the work-group size rounds the number of bodies down
+      int numCompared = this->clModel->GetNumParticles() < numReference ? this->clModel->GetNumParticles() : numReference;
+      double maxError = 0.0;
+      for (int body = 0; body < numCompared; body++)
+      {
+        for (int axis = 0; axis < 3; axis++)
+        {
+          double error = fabs(positions[body].s[axis] - reference[body].s[axis]);
+          maxError = error > maxError ? error : maxError;
+        }
+      }
+
+      wxLogDebug(wxT("Tuning: %s, %llu, %s %s x%d, tile %d %f ms per thousand body steps, error %g Gm"), this->clModel->buildOptions,
+                 (unsigned long long)this->clModel->requestedGroupSize, *this->clModel->accelerationKernelName, CLModel::SummationName(this->clModel->summation),
+                 this->clModel->particlesPerWorkItem, this->clModel->gravTileSize, time, maxError);
+      if (maxError <= tolerance && time < bestTime)
+      {
+        bestTime = time;
+        bestBuildOptions = this->clModel->buildOptions;
+        bestAcceleration = *this->clModel->accelerationKernelName;
+        bestGroupSize = this->clModel->requestedGroupSize;
+        bestGravTileSize = this->clModel->gravTileSize;
+        bestParticlesPerWorkItem = this->clModel->particlesPerWorkItem;
+        bestSummation = this->clModel->summation;
+      }
+    }
+
+    this->clModel->buildOptions = bestBuildOptions;
+    *this->clModel->accelerationKernelName = bestAcceleration;
+    this->clModel->requestedGroupSize = bestGroupSize;
+    this->clModel->gravTileSize = bestGravTileSize;
+    this->clModel->particlesPerWorkItem = bestParticlesPerWorkItem;
+    this->clModel->summation = bestSummation;
+  }
+
+  delete[] reference;
+  delete[] positions;
+
+  this->RebuildModel();
+
+  // Sizes tuned for the deterministic build aren't what the device's usual kernels want, so they are only used for this run
+  if (bestTime >= 0.0 && this->clModel->deterministic)
+  {
+    wxLogMessage(wxT("Tuned kernels for this deterministic run, not saved: work-group size %llu, tile %d, %f ms per thousand body steps"),
+                 (unsigned long long)bestGroupSize, bestGravTileSize, bestTime);
+  }
+  else if (bestTime >= 0.0)
+  {
+    wxString group = this->TuningGroup();
+    this->config->Write(group + wxT("/DriverVersion"), this->clModel->DriverVersion());
+    this->config->Write(group + wxT("/BuildOptions"), bestBuildOptions);
+    this->config->Write(group + wxT("/AccelerationKernel"), bestAcceleration);
+    this->config->Write(group + wxT("/GroupSize"), (long)bestGroupSize);
+    this->config->Write(group + wxT("/GravTileSize"), (long)bestGravTileSize);
+    this->config->Write(group + wxT("/ParticlesPerWorkItem"), (long)bestParticlesPerWorkItem);
+    if (tuneSummation)
+    {
+      this->config->Write(group + wxT("/Summation"), (long)bestSummation);
+    }
+    wxLogMessage(wxT("Tuned kernels: %s, %s summation, %d particles per work-item, work-group size %llu, tile %d, build options %s, %f ms per thousand body steps"),
+                 bestAcceleration, CLModel::SummationName(bestSummation), bestParticlesPerWorkItem, (unsigned long long)bestGroupSize, bestGravTileSize,
+                 bestBuildOptions, bestTime);
+  }
+}
+
 // Advances the simulation one time step
 void Frame::DoStep()
 {
   try
   {
-    // Adams-Bashforth
-    this->clModel->ExecuteKernels();
+    int numSteps = this->TwoPhaseSteps();
+    if (numSteps > 1)
+    {
+      // The bodies with mass run ahead, then the test particles catch up in one launch
+      this->clModel->RequestUpdate();
+      this->clModel->ExecuteTwoPhase(numSteps);
+    }
+    else if (this->jplEphemeris->IsOpen())
+    {
+      // The driven bodies are placed from the ephemeris before each stage, at the start and then the end of the step
+      double currentJdn = this->clModel->julianDate + (this->clModel->time) * 1 / (60 * 60 * 24);
+      this->DriveBodies(currentJdn, true);
+      this->clModel->ExecuteKernels();
+      this->DriveBodies(currentJdn + this->clModel->delT / (60 * 60 * 24), true);
+      this->clModel->ExecuteKernels();
+      this->DriveBodies(currentJdn + this->clModel->delT / (60 * 60 * 24), false);
+      this->clModel->UpdateDisplay();
+    }
+    else
+    {
+      // Adams-Bashforth
+      this->clModel->ExecuteKernels();
 
-    // Request that dispPos vbo be updated after the Adams-Moulton
-    this->clModel->RequestUpdate();
-    // Adams-Moulton
-    this->clModel->ExecuteKernels();
+      // Request that dispPos vbo be updated after the Adams-Moulton
+      this->clModel->RequestUpdate();
+      // Adams-Moulton
+      this->clModel->ExecuteKernels();
+    }
   }
   catch (int e)
   {
@@ -564,10 +915,11 @@ void Frame::DoStep()
 
   this->UpdateStatusBar(this->stopWatch.TimeInMicro());
 
+  // Pausing rather than stopping keeps any Kepler fast forward going
   if (this->checkForEncounters)
   {
     static int moonIndex = -1;
-    this->Stop();
+    this->Pause();
     this->clModel->ReadToInitialState(this->initialState->initialPositions, this->initialState->initialVelocities);
     this->initialState->initialJulianDate = this->clModel->julianDate + (this->clModel->time) * 1 / (60 * 60 * 24);
     this->initialState->initialNumParticles = this->numParticles;
@@ -605,6 +957,43 @@ void Frame::DoStep()
     this->Start();
   }
 
+  // The frozen bodies' state and history are stale, so bring them up to date before anything is saved.
+  // A writer opened during a Go To Date ends the fast forward here
+  if (this->checkpoint->IsOpen() || this->archive->IsOpen() || this->ephemeris->IsOpen())
+  {
+    this->EndFastForward();
+  }
+
+  // write a checkpoint every checkpointInterval steps
+  if (this->checkpoint->IsOpen() && this->clModel->step % this->checkpointInterval == 0)
+  {
+    if (!this->checkpoint->Write(this->clModel))
+    {
+      this->checkpoint->Close();
+      this->UpdateMenuItems();
+    }
+  }
+
+  // add a frame to the trajectory archive every archiveInterval steps
+  if (this->archive->IsOpen() && this->clModel->step % this->archiveInterval == 0)
+  {
+    if (!this->archive->WriteFrame(this->clModel))
+    {
+      this->archive->Close();
+      this->UpdateMenuItems();
+    }
+  }
+
+  // the ephemeris fit samples every step
+  if (this->ephemeris->IsOpen())
+  {
+    if (!this->ephemeris->Sample(this->clModel))
+    {
+      this->ephemeris->Close();
+      this->UpdateMenuItems();
+    }
+  }
+
   this->stopWatch.Start(0);
 
   // check if going a date
@@ -616,6 +1005,7 @@ void Frame::DoStep()
       if (currentJdn >= this->stopDateJdn)
       {
         this->Stop();
+        this->LandOnStopDate();
         this->goingToDate = false;
       }
     }
@@ -624,12 +1014,47 @@ void Frame::DoStep()
       if (currentJdn <= this->stopDateJdn)
       {
         this->Stop();
+        this->LandOnStopDate();
         this->goingToDate = false;
       }
     }
   }
 }
 
+// Two-phase runs stop short of the steps that are checkpointed or archived and of the step that reaches the stop date,
+// and are not used while anything needs to see every step
+int Frame::TwoPhaseSteps()
+{
+  if (this->twoPhaseSteps <= 1 || !this->clModel->CanRunTwoPhase() || this->checkForEncounters || this->ephemeris->IsOpen() || this->jplEphemeris->IsOpen())
+  {
+    return 1;
+  }
+
+  int numSteps = this->twoPhaseSteps < CLModel::maxTwoPhaseSteps ? this->twoPhaseSteps : CLModel::maxTwoPhaseSteps;
+  if (this->checkpoint->IsOpen())
+  {
+    int toCheckpoint = this->checkpointInterval - this->clModel->step % this->checkpointInterval;
+    numSteps = toCheckpoint < numSteps ? toCheckpoint : numSteps;
+  }
+
+  if (this->archive->IsOpen())
+  {
+    int toArchive = this->archiveInterval - this->clModel->step % this->archiveInterval;
+    numSteps = toArchive < numSteps ? toArchive : numSteps;
+  }
+
+  if (this->goingToDate)
+  {
+    double currentJdn = this->clModel->julianDate + (this->clModel->time) * 1 / (60 * 60 * 24);
+    double stepDays = this->clModel->delT / (60 * 60 * 24);
+    int toStopDate = (int)ceil((this->stopDateJdn - currentJdn) / stepDays);
+    toStopDate = toStopDate > 1 ? toStopDate : 1;
+    numSteps = toStopDate < numSteps ? toStopDate : numSteps;
+  }
+
+  return numSteps;
+}
+
 // Run when Idle
 void Frame::OnIdle(wxIdleEvent &event)
 {
@@ -669,11 +1094,56 @@ void Frame::OnTimer(wxTimerEvent &event)
   InOnTimer = false;
 }
 
+// The step that reached the stop date usually overshoots it.
+// Show the state exactly at the stop date, interpolated within that step, without disturbing the integration
+void Frame::LandOnStopDate()
+{
+  double currentJdn = this->clModel->julianDate + (this->clModel->time) * 1 / (60 * 60 * 24);
+  double stepDays = this->clModel->delT / (60 * 60 * 24);
+  double fraction = 1.0 - (currentJdn - this->stopDateJdn) / stepDays;
+  if (fraction < 0.0 || fraction >= 1.0)
+  {
+    return;
+  }
+
+  try
+  {
+    this->clModel->DisplayDenseOutput(fraction);
+  }
+  catch (int e)
+  {
+    wxLogError(wxT("Unable to interpolate to the stop date %d"), e);
+  }
+  this->UpdateStatusBar(0);
+}
+
 void Frame::Stop()
+{
+  this->Pause();
+  this->EndFastForward();
+  this->UpdateStatusBar(0);
+}
+
+void Frame::Pause()
 {
   this->runOnIdle = false;
   this->timer->Stop();
-  this->UpdateStatusBar(0);
+}
+
+void Frame::EndFastForward()
+{
+  if (this->clModelOk && this->clModel->IsKeplerFastForwarding())
+  {
+    try
+    {
+      this->clModel->EndKeplerFastForward();
+      this->clModel->UpdateDisplay();
+    }
+    catch (int e)
+    {
+      wxLogError(wxT("Kepler fast forward failed %d"), e);
+    }
+  }
 }
 
 void Frame::Start()
@@ -699,6 +1169,242 @@ void Frame::OnStop(wxCommandEvent &WXUNUSED(event))
   this->Stop();
 }
 
+// Runs the simulation until a date, entered as YYYY-MM-DD or a Julian day number
+void Frame::OnGoToDate(wxCommandEvent &WXUNUSED(event))
+{
+  wxDateTime dateTime;
+  dateTime.Set(this->stopDateJdn);
+  wxString text = wxGetTextFromUser(wxT("Date to go to, YYYY-MM-DD or a Julian day"), wxT("Go To Date"), dateTime.FormatISODate(), this);
+  if (text.IsEmpty())
+  {
+    return;
+  }
+
+  double jdn;
+  if (dateTime.ParseISODate(text))
+  {
+    jdn = dateTime.GetJulianDayNumber();
+  }
+  else if (!text.ToDouble(&jdn))
+  {
+    wxLogError(wxT("Unable to read the date %s"), text);
+    return;
+  }
+
+  double currentJdn = this->clModel->julianDate + (this->clModel->time) * 1 / (60 * 60 * 24);
+  if ((jdn - currentJdn) * this->clModel->delT <= 0)
+  {
+    wxLogError(wxT("%s is not ahead in the direction time is running"), text);
+    return;
+  }
+
+  this->stopDateJdn = jdn;
+  this->goingToDate = true;
+
+  // Distant bodies can be moved along their orbits in one go at the end rather than integrated.
+  // Not while checkpoints, archives or an ephemeris are being written, as they would need the frozen bodies every step
+  if (this->keplerFastForward && (this->checkpoint->IsOpen() || this->archive->IsOpen() || this->ephemeris->IsOpen()))
+  {
+    wxLogMessage(wxT("Integrating every body, Kepler fast forward isn't used while writing checkpoints, archives or an ephemeris"));
+  }
+  else if (this->keplerFastForward)
+  {
+    try
+    {
+      int numFrozen = this->clModel->BeginKeplerFastForward(this->keplerFastForwardDistance);
+      if (numFrozen > 0)
+      {
+        wxLogMessage(wxT("Fast forwarding %d distant bodies on Kepler orbits"), numFrozen);
+      }
+    }
+    catch (int e)
+    {
+      wxLogError(wxT("Unable to start the Kepler fast forward %d"), e);
+    }
+  }
+  this->Start();
+}
+
+// Times the current integrator with the generic kernels and with kernels specialised for the current body counts,
+// then on devices with sub-groups the generic build with the Subgroup acceleration kernel of the same physics.
+// Every run starts from the current state, which is kept, and the simulation carries on from it with the configured kernels
+void Frame::OnBenchmarkKernels(wxCommandEvent &WXUNUSED(event))
+{
+  const int benchmarkSteps = 256;
+  this->Stop();
+  this->clModel->ReadToInitialState(this->initialState->initialPositions, this->initialState->initialVelocities);
+  this->initialState->initialJulianDate = this->clModel->julianDate + (this->clModel->time) * 1 / (60 * 60 * 24);
+  this->initialState->initialNumParticles = this->numParticles;
+
+  bool specializeKernels = this->clModel->specializeKernels;
+  wxString accelerationKernelName = *this->clModel->accelerationKernelName;
+  wxString subgroupKernelName = (accelerationKernelName.StartsWith(wxT("newtonian")) ? wxT("newtonian") : wxT("relativistic")) + wxString(wxT("Subgroup"));
+  int numRuns = this->clModel->HasSubgroups() && !accelerationKernelName.EndsWith(wxT("Tree")) ? 3 : 2;
+  double msPerStep[3] = {0.0, 0.0, 0.0};
+  bool ok = true;
+  for (int run = 0; run < numRuns && ok; run++)
+  {
+    this->clModel->specializeKernels = run == 1;
+    *this->clModel->accelerationKernelName = run == 2 ? subgroupKernelName : accelerationKernelName;
+    this->ResetAll();
+    try
+    {
+      msPerStep[run] = this->clModel->BenchmarkSteps(benchmarkSteps);
+    }
+    catch (int e)
+    {
+      wxLogError(wxT("Kernel benchmark failed %d"), e);
+      ok = false;
+    }
+  }
+
+  this->clModel->specializeKernels = specializeKernels;
+  *this->clModel->accelerationKernelName = accelerationKernelName;
+  this->ResetAll();
+  if (ok)
+  {
+    wxString message = wxString::Format(wxT("%s and %s, %d bodies, %d with mass, over %d steps\nGeneric kernels: %.3f ms per step\nSpecialised kernels: %.3f ms per step (%.2fx)"),
+                                        *this->clModel->adamsBashforthKernelName, accelerationKernelName, this->numParticles, this->numGrav, benchmarkSteps,
+                                        msPerStep[0], msPerStep[1], msPerStep[1] > 0.0 ? msPerStep[0] / msPerStep[1] : 0.0);
+    if (numRuns > 2)
+    {
+      message += wxString::Format(wxT("\n%s: %.3f ms per step (%.2fx)"), subgroupKernelName, msPerStep[2], msPerStep[2] > 0.0 ? msPerStep[0] / msPerStep[2] : 0.0);
+    }
+    wxLogMessage(wxT("%s"), message);
+  }
+}
+
+// Runs each summation of the bodies with mass for the same steps from the current state and reports the time it took and how far
+// its positions end up from the compensated sums, so compensation is only paid for where it changes the results.
+// The state is kept and the simulation carries on from it with the configured summation
+void Frame::OnSummationMatrix(wxCommandEvent &WXUNUSED(event))
+{
+  const int matrixSteps = 256;
+  this->Stop();
+  this->clModel->ReadToInitialState(this->initialState->initialPositions, this->initialState->initialVelocities);
+  this->initialState->initialJulianDate = this->clModel->julianDate + (this->clModel->time) * 1 / (60 * 60 * 24);
+  this->initialState->initialNumParticles = this->numParticles;
+
+  int summation = this->clModel->summation;
+  double times[CLModel::numSummations];
+  int numCompared = this->numParticles;
+  cl_double4 *positions = new cl_double4[CLModel::numSummations * this->numParticles];
+  for (int candidate = CLModel::summationPlain; candidate < CLModel::numSummations; candidate++)
+  {
+    this->clModel->summation = candidate;
+    times[candidate] = this->TimeKernelConfiguration(matrixSteps, positions + candidate * this->numParticles);
+    numCompared = this->clModel->GetNumParticles() < numCompared ? this->clModel->GetNumParticles() : numCompared;
+  }
+
+  this->clModel->summation = summation;
+  this->ResetAll();
+
+  wxString message = wxString::Format(wxT("%s, %d bodies, %d with mass, over %d steps"), *this->clModel->accelerationKernelName, this->numParticles, this->numGrav, matrixSteps);
+  const cl_double4 *reference = positions + CLModel::summationKahan * this->numParticles;
+  for (int candidate = CLModel::summationPlain; candidate < CLModel::numSummations; candidate++)
+  {
+    if (times[candidate] < 0.0 || times[CLModel::summationKahan] < 0.0)
+    {
+      message += wxString::Format(wxT("\n%s: failed"), CLModel::SummationName(candidate));
+      continue;
+    }
+
+    const cl_double4 *candidatePositions = positions + candidate * this->numParticles;
+    double maxDifference = 0.0;
+    for (int body = 0; body < numCompared; body++)
+    {
+      for (int axis = 0; axis < 3; axis++)
+      {
+        double difference = fabs(candidatePositions[body].s[axis] - reference[body].s[axis]);
+        maxDifference = difference > maxDifference ? difference : maxDifference;
+      }
+    }
+    message += wxString::Format(wxT("\n%s: %.3f ms per thousand body steps, %.3g Gm from Kahan"), CLModel::SummationName(candidate), times[candidate], maxDifference);
+  }
+  delete[] positions;
+  wxLogMessage(wxT("%s"), message);
+}
+
+// Reports how far the Barnes-Hut tree or pruned perturber accelerations are from the direct sum at the current positions
+void Frame::OnAccelerationErrors(wxCommandEvent &WXUNUSED(event))
+{
+  this->Stop();
+  double maxError;
+  double rmsError;
+  if (!this->clModel->AccelerationErrorStatistics(&maxError, &rmsError))
+  {
+    wxLogMessage(wxT("Choose a Barnes-Hut tree from the Gravity menu or set PerturberTolerance first. The comparison isn't available while streaming"));
+    return;
+  }
+
+  double skippedFraction;
+  double maxErrorBound;
+  if (this->clModel->PerturberStatistics(&skippedFraction, &maxErrorBound))
+  {
+    wxLogMessage(wxT("Perturbers pruned at tolerance %g, refreshed every %d steps, %d bodies, %d with mass\n%.1f%% of the interactions skipped, bound %.3g of the Sun's pull\n")
+                     wxT("Relative acceleration error: %.3g rms, %.3g max"),
+                 this->clModel->perturberTolerance, this->clModel->perturberRefreshSteps, this->numParticles, this->numGrav, 100.0 * skippedFraction, maxErrorBound,
+                 rmsError, maxError);
+    return;
+  }
+
+  wxLogMessage(wxT("Barnes-Hut tree with opening angle %g, %d bodies, %d with mass\nRelative acceleration error: %.3g rms, %.3g max"),
+               this->clModel->treeOpeningAngle, this->numParticles, this->numGrav, rmsError, maxError);
+}
+
+// Logs a digest of the current positions and velocities. Deterministic runs of the same steps from the same state
+// give the same digest on every device, so comparing the logs of two devices checks them against each other
+void Frame::OnStateDigest(wxCommandEvent &WXUNUSED(event))
+{
+  this->Stop();
+  cl_ulong digest;
+  if (!this->clModel->StateDigest(&digest))
+  {
+    return;
+  }
+
+  wxLogMessage(this->StateDigestMessage(digest));
+}
+
+wxString Frame::StateDigestMessage(cl_ulong digest)
+{
+  return wxString::Format(wxT("%s%s, step %d, %d bodies, state digest %016llx"), *this->clModel->deviceName, this->clModel->deterministic ? wxT(" deterministic") : wxT(""),
+                          this->clModel->step, this->clModel->GetNumParticles(), (unsigned long long)digest);
+}
+
+// The -digest command line run, from OnGLContextReady. The steps are the same ExecuteKernels calls as the benchmarks, without the display,
+// and the digest goes to standard output so compare_digests.sh can check devices against each other
+bool Frame::PrintStateDigest(int numSteps)
+{
+  if (!this->clModelOk)
+  {
+    wxLogError(wxT("OpenCL is needed for a state digest"));
+    return false;
+  }
+
+  cl_ulong digest;
+  try
+  {
+    while (this->clModel->step < numSteps)
+    {
+      this->clModel->ExecuteKernels();
+    }
+    if (!this->clModel->StateDigest(&digest))
+    {
+      return false;
+    }
+  }
+  catch (int e)
+  {
+    wxLogError(wxT("State digest run failed %d"), e);
+    return false;
+  }
+
+  wxPrintf(wxT("%s\n"), this->StateDigestMessage(digest));
+  fflush(stdout);
+  return true;
+}
+
 void Frame::OnReset(wxCommandEvent &WXUNUSED(event))
 {
   this->numParticles = this->numParticles > this->initialState->initialNumParticles ? this->initialState->initialNumParticles : this->numParticles;
@@ -710,56 +1416,63 @@ void Frame::OnSetDeltaTime(wxCommandEvent &event)
 {
   this->Stop();
   int id = event.GetId();
+  double newDelT;
   switch (id)
   {
   case ID_SETDELTAT1:
-    this->clModel->delT = 1 * 60.0f;
+    newDelT = 1 * 60.0f;
     break;
   case ID_SETDELTAT5:
-    this->clModel->delT = 5 * 60.0f;
+    newDelT = 5 * 60.0f;
     break;
   case ID_SETDELTAT15:
-    this->clModel->delT = 15 * 60.0f;
+    newDelT = 15 * 60.0f;
     break;
   case ID_SETDELTATHR:
-    this->clModel->delT = 1 * 60 * 60.0f;
+    newDelT = 1 * 60 * 60.0f;
     break;
   case ID_SETDELTATFOURHR:
-    this->clModel->delT = 4 * 60 * 60.0f;
+    newDelT = 4 * 60 * 60.0f;
     break;
   case ID_SETDELTATDAY:
-    this->clModel->delT = 24 * 60 * 60.0f;
+    newDelT = 24 * 60 * 60.0f;
     break;
   case ID_SETDELTAT12HR:
-    this->clModel->delT = 12 * 60 * 60.0f;
+    newDelT = 12 * 60 * 60.0f;
     break;
   case ID_SETDELTATMINUS1:
-    this->clModel->delT = -1 * 60.0f;
+    newDelT = -1 * 60.0f;
     break;
   case ID_SETDELTATMINUS5:
-    this->clModel->delT = -5 * 60.0f;
+    newDelT = -5 * 60.0f;
     break;
   case ID_SETDELTATMINUS15:
-    this->clModel->delT = -15 * 60.0f;
+    newDelT = -15 * 60.0f;
     break;
   case ID_SETDELTATMINUSHR:
-    this->clModel->delT = -60 * 60.0f;
+    newDelT = -60 * 60.0f;
     break;
   case ID_SETDELTATMINUSFOURHR:
-    this->clModel->delT = -4 * 60 * 60.0f;
+    newDelT = -4 * 60 * 60.0f;
     break;
   case ID_SETDELTATMINUS12HR:
-    this->clModel->delT = -12 * 60 * 60.0f;
+    newDelT = -12 * 60 * 60.0f;
     break;
   case ID_SETDELTATMINUSDAY:
-    this->clModel->delT = -24 * 60 * 60.0f;
+    newDelT = -24 * 60 * 60.0f;
     break;
   default:
-    this->clModel->delT = 4 * 60 * 60.0f;
+    newDelT = 4 * 60 * 60.0f;
     break;
   }
-  this->clModel->step = 0;
-  this->clModel->SetKernelArgumentsAndGroupSize();
+
+  // Without a history to keep the startup steps are run again at the new step
+  if (!this->clModel->ChangeDeltaTime(newDelT))
+  {
+    this->clModel->delT = newDelT;
+    this->clModel->step = 0;
+    this->clModel->SetKernelArgumentsAndGroupSize();
+  }
 }
 
 // sets the body to center the display on
@@ -920,6 +1633,18 @@ void Frame::UpdateMenuItems()
       menuItem = menuBar->FindItem(ID_SETGRAV512);
       menuItem->Check(true);
       break;
+    case 1024:
+      menuItem = menuBar->FindItem(ID_SETGRAV1024);
+      menuItem->Check(true);
+      break;
+    case 2048:
+      menuItem = menuBar->FindItem(ID_SETGRAV2048);
+      menuItem->Check(true);
+      break;
+    case 4096:
+      menuItem = menuBar->FindItem(ID_SETGRAV4096);
+      menuItem->Check(true);
+      break;
     default:
       menuItem = menuBar->FindItem(ID_SETGRAVMAX);
       menuItem->Check(true);
@@ -1036,6 +1761,24 @@ void Frame::UpdateMenuItems()
     menuItem = menuBar->FindItem(ID_LOGENCOUNTERS);
     menuItem->Check(this->checkForEncounters);
 
+    menuItem = menuBar->FindItem(ID_CHECKPOINTS);
+    menuItem->Check(this->checkpoint->IsOpen());
+
+    menuItem = menuBar->FindItem(ID_ARCHIVE);
+    menuItem->Check(this->archive->IsOpen());
+
+    menuItem = menuBar->FindItem(ID_EPHEMERIS);
+    menuItem->Check(this->ephemeris->IsOpen());
+
+    menuItem = menuBar->FindItem(ID_KEPLERFASTFORWARD);
+    menuItem->Check(this->keplerFastForward);
+
+    menuItem = menuBar->FindItem(ID_JPLEPHEMERIS);
+    menuItem->Check(this->jplEphemeris->IsOpen());
+
+    menuItem = menuBar->FindItem(ID_HELIOCENTRIC);
+    menuItem->Check(this->clModel->heliocentric);
+
     menuItem = menuBar->FindItem(ID_SETCENTER0);
     menuItem->SetItemLabel(this->initialState->physicalProperties[0].Name);
     menuItem = menuBar->FindItem(ID_SETCENTER1);
@@ -1089,6 +1832,29 @@ void Frame::OnImportSlf(wxCommandEvent &WXUNUSED(event))
   }
 }
 
+// Replaces the asteroids with those in an MPCORB orbital element catalog, keeping the bodies with mass
+void Frame::OnImportMpcOrb(wxCommandEvent &WXUNUSED(event))
+{
+  this->Stop();
+  if (!this->clModelOk)
+  {
+    wxLogError(wxT("OpenCL is needed to convert the orbital elements"));
+    return;
+  }
+
+  wxLogDebug(wxT("Importing MPCORB catalog"));
+  wxFileDialog fileDialog(this, wxT("Choose MPCORB catalog to Import"), wxT(""), wxT(""), wxT("*.DAT;*.dat;*.txt"), wxFD_OPEN | wxFD_FILE_MUST_EXIST);
+  if (fileDialog.ShowModal() == wxID_OK)
+  {
+    if (this->initialState->ImportMPCORB(fileDialog.GetPath(), this->clModel))
+    {
+      this->numParticles = this->initialState->initialNumParticles > this->clModel->maxNumParticles ? this->clModel->maxNumParticles : this->initialState->initialNumParticles;
+      this->numGrav = this->initialState->initialNumGrav > this->clModel->maxNumGrav ? this->clModel->maxNumGrav : this->initialState->initialNumGrav;
+      this->ResetAll();
+    }
+  }
+}
+
 void Frame::ResetAll()
 {
   bool die = false;
@@ -1099,18 +1865,12 @@ void Frame::ResetAll()
   this->Stop();
   try
   {
-    this->clModel->CleanUpCL();
-    this->glCanvas->CleanUpGL();
-    this->glCanvas->CreateOpenGlContext(this->numParticles, this->numGrav);
-    this->ChooseDevice(this->config);
-    this->clModel->CreateBufferObjects(this->glCanvas->getVbo(), this->numParticles, this->numGrav);
-    this->clModel->CompileProgramAndCreateKernels();
-    this->clModel->SetInitalState(this->initialState->initialPositions, this->initialState->initialVelocities);
-    this->glCanvas->SetColours(this->initialState->initialColorData);
-    this->clModel->julianDate = this->initialState->initialJulianDate;
-    this->clModel->time = 0.0f;
+    this->RebuildModel();
     this->UpdateStatusBar(0);
-    this->clModel->SetKernelArgumentsAndGroupSize();
+    if (this->jplEphemeris->IsOpen() && !this->MapDrivenBodies())
+    {
+      this->jplEphemeris->Close();
+    }
     this->clModel->UpdateDisplay();
     this->Refresh(false);
     this->UpdateMenuItems();
@@ -1127,6 +1887,22 @@ void Frame::ResetAll()
   }
 }
 
+// Recreates the OpenCL model and the display buffers from the initial state
+void Frame::RebuildModel()
+{
+  this->clModel->CleanUpCL();
+  this->glCanvas->CleanUpGL();
+  this->glCanvas->CreateOpenGlContext(this->numParticles, this->numGrav);
+  this->ChooseDevice(this->config);
+  this->clModel->CreateBufferObjects(this->glCanvas->getVbo(), this->numParticles, this->numGrav);
+  this->clModel->CompileProgramAndCreateKernels();
+  this->clModel->SetInitalState(this->initialState->initialPositions, this->initialState->initialVelocities);
+  this->glCanvas->SetColours(this->initialState->initialColorData);
+  this->clModel->julianDate = this->initialState->initialJulianDate;
+  this->clModel->time = 0.0f;
+  this->clModel->SetKernelArgumentsAndGroupSize();
+}
+
 // set the number of bodies (particles)
 void Frame::OnSetNum(wxCommandEvent &event)
 {
@@ -1198,8 +1974,17 @@ void Frame::OnSetGrav(wxCommandEvent &event)
   case ID_SETGRAV512:
     this->numGrav = 512;
     break;
+  case ID_SETGRAV1024:
+    this->numGrav = 1024;
+    break;
+  case ID_SETGRAV2048:
+    this->numGrav = 2048;
+    break;
+  case ID_SETGRAV4096:
+    this->numGrav = 4096;
+    break;
   case ID_SETGRAVMAX:
-    this->numGrav = this->clModel->maxNumGrav;
+    this->numGrav = this->clModel->maxConstantNumGrav;
     break;
   default:
     this->numGrav = 16;
@@ -1221,37 +2006,14 @@ void Frame::OnBlending(wxCommandEvent &event)
 // Sets the Integrator used to compute new positions and velocities
 void Frame::OnSetIntegrator(wxCommandEvent &event)
 {
-  switch (event.GetId())
-  {
-  case ID_SETADAMS4:
-    this->clModel->adamsBashforthKernelName = new wxString("adamsBashforth4");
-    this->clModel->adamsMoultonKernelName = new wxString("adamsMoulton3");
-    break;
-  case ID_SETADAMS8:
-    this->clModel->adamsBashforthKernelName = new wxString("adamsBashforth8");
-    this->clModel->adamsMoultonKernelName = new wxString("adamsMoulton7");
-    break;
-  case ID_SETADAMS10:
-    this->clModel->adamsBashforthKernelName = new wxString("adamsBashforth10");
-    this->clModel->adamsMoultonKernelName = new wxString("adamsMoulton9");
-    break;
-  case ID_SETADAMS11:
-    this->clModel->adamsBashforthKernelName = new wxString("adamsBashforth11");
-    this->clModel->adamsMoultonKernelName = new wxString("adamsMoulton10");
-    break;
-  case ID_SETADAMS12:
-    this->clModel->adamsBashforthKernelName = new wxString("adamsBashforth12");
-    this->clModel->adamsMoultonKernelName = new wxString("adamsMoulton11");
-    break;
-  case ID_SETADAMS16:
-    this->clModel->adamsBashforthKernelName = new wxString("adamsBashforth16");
-    this->clModel->adamsMoultonKernelName = new wxString("adamsMoulton15");
-    break;
-  default:
-    this->clModel->adamsBashforthKernelName = new wxString("adamsBashforth11");
-    this->clModel->adamsMoultonKernelName = new wxString("adamsMoulton10");
-    break;
-  }
+  this->clModel->SetAdamsOrder(event.GetId() - ID_SETADAMS2 + CLModel::minAdamsOrder);
+  this->ResetAll();
+}
+
+// Sets how the acceleration kernels add up the bodies with mass, which takes a rebuild
+void Frame::OnSetSummation(wxCommandEvent &event)
+{
+  this->clModel->summation = event.GetId() - ID_SETSUMMATION0;
   this->ResetAll();
 }
 
@@ -1263,12 +2025,27 @@ void Frame::OnSetAcceleration(wxCommandEvent &event)
   case ID_SETNEWTONIAN:
     this->clModel->accelerationKernelName = new wxString("newtonian");
     break;
+  case ID_SETNEWTONIANL:
+    this->clModel->accelerationKernelName = new wxString("newtonianLocal");
+    break;
   case ID_SETRELATIVISTIC:
     this->clModel->accelerationKernelName = new wxString("relativistic");
     break;
   case ID_SETRELATIVISTICL:
     this->clModel->accelerationKernelName = new wxString("relativisticLocal");
     break;
+  case ID_SETNEWTONIANTREE:
+    this->clModel->accelerationKernelName = new wxString("newtonianTree");
+    break;
+  case ID_SETRELATIVISTICTREE:
+    this->clModel->accelerationKernelName = new wxString("relativisticTree");
+    break;
+  case ID_SETNEWTONIANSUBGROUP:
+    this->clModel->accelerationKernelName = new wxString("newtonianSubgroup");
+    break;
+  case ID_SETRELATIVISTICSUBGROUP:
+    this->clModel->accelerationKernelName = new wxString("relativisticSubgroup");
+    break;
   default:
     this->clModel->accelerationKernelName = new wxString("relativistic");
     break;
@@ -1294,8 +2071,10 @@ void Frame::OnClose(wxCloseEvent &event)
 void Frame::OnAbout(wxCommandEvent &WXUNUSED(event))
 {
   wxString message;
-  message.Printf(wxT("Solar System Simulation\n (c) 2013-2025 Michael Simmons\nbody count:%d\nWith Mass:%d\nMax Count Possible:%d\nPredictor %s\nCorrector %s\nPlatform: %s\nDevice: %s\nCL Version: %s\nWeb: https://github.com/moozoo64/openclsolarsystem"),
-                 this->numParticles, this->numGrav, this->clModel->maxNumParticles, this->clModel->adamsBashforthKernelName->c_str(), this->clModel->adamsMoultonKernelName->c_str(), this->clModel->platformName->c_str(), this->clModel->deviceName->c_str(), this->clModel->deviceCLVersion->c_str());
+  message.Printf(wxT("Solar System Simulation\n (c) 2013-2025 Michael Simmons\nbody count:%d\nWith Mass:%d\nMax Count Possible:%d\nPredictor %s\nCorrector %s\nAcceleration %s, %d particles per work-item\nPlatform: %s\nDevice: %s\nCL Version: %s\nProgram cache hits: %d of %d\nWeb: https://github.com/moozoo64/openclsolarsystem"),
+                 this->numParticles, this->numGrav, this->clModel->maxNumParticles, this->clModel->adamsBashforthKernelName->c_str(), this->clModel->adamsMoultonKernelName->c_str(),
+                 this->clModel->accelerationKernelName->c_str(), this->clModel->AccelerationBlock(), this->clModel->platformName->c_str(), this->clModel->deviceName->c_str(), this->clModel->deviceCLVersion->c_str(),
+                 this->clModel->programCacheHits, this->clModel->programCacheHits + this->clModel->programCacheMisses);
   wxMessageBox(message, wxT("About NBody"), wxOK | wxICON_INFORMATION);
 }
 void Frame::OnLogEncounters(wxCommandEvent &event)
@@ -1303,6 +2082,215 @@ void Frame::OnLogEncounters(wxCommandEvent &event)
   this->checkForEncounters = !this->checkForEncounters;
   this->Refresh(true);
 }
+
+// Turns incremental checkpoints on or off.
+// Turning them on starts a new checkpoint file beginning with a full base
+void Frame::OnCheckpoints(wxCommandEvent &event)
+{
+  if (this->checkpoint->IsOpen())
+  {
+    this->checkpoint->Close();
+  }
+  else
+  {
+    wxFileDialog fileDialog(this, wxT("Choose Checkpoint file"), wxT(""), wxT(""), wxT("*.ckp;*.CKP"), wxFD_SAVE | wxFD_OVERWRITE_PROMPT);
+    if (fileDialog.ShowModal() == wxID_OK)
+    {
+      this->checkpoint->Open(fileDialog.GetPath());
+    }
+  }
+  this->UpdateMenuItems();
+}
+
+// Restores the simulation from the last base and following deltas in a checkpoint file
+void Frame::OnRestoreCheckpoint(wxCommandEvent &event)
+{
+  this->Stop();
+  wxFileDialog fileDialog(this, wxT("Choose Checkpoint file"), wxT(""), wxT(""), wxT("*.ckp;*.CKP"), wxFD_OPEN | wxFD_FILE_MUST_EXIST);
+  if (fileDialog.ShowModal() != wxID_OK)
+  {
+    return;
+  }
+
+  CheckpointRecordHeader header;
+  if (!Checkpoint::ReadLastBaseHeader(fileDialog.GetPath(), &header))
+  {
+    return;
+  }
+
+  if (header.numParticles > this->initialState->initialNumParticles)
+  {
+    wxLogError(wxT("Checkpoint has %d bodies but only %d are loaded"), header.numParticles, this->initialState->initialNumParticles);
+    return;
+  }
+
+  // Rebuild the model to match the checkpoint if needed.
+  // The checkpoint then overwrites the whole integrator state
+  this->checkpoint->Close();
+  this->numParticles = header.numParticles;
+  this->numGrav = header.numGrav;
+  this->ResetAll();
+
+  if (Checkpoint::Restore(fileDialog.GetPath(), this->clModel, &header))
+  {
+    this->clModel->UpdateDisplay();
+  }
+  this->UpdateStatusBar(0);
+  this->UpdateMenuItems();
+  this->Refresh(false);
+}
+
+// Starts or stops recording positions to a compressed trajectory archive
+void Frame::OnArchive(wxCommandEvent &event)
+{
+  if (this->archive->IsOpen())
+  {
+    this->archive->Close();
+  }
+  else
+  {
+    wxFileDialog fileDialog(this, wxT("Choose Archive file"), wxT(""), wxT(""), wxT("*.tra;*.TRA"), wxFD_SAVE | wxFD_OVERWRITE_PROMPT);
+    if (fileDialog.ShowModal() == wxID_OK)
+    {
+      this->archive->Create(fileDialog.GetPath(), this->clModel->GetNumParticles(), this->archiveErrorBound);
+    }
+  }
+  this->UpdateMenuItems();
+}
+
+// Starts or stops fitting a Chebyshev ephemeris of every body
+void Frame::OnEphemeris(wxCommandEvent &event)
+{
+  if (this->ephemeris->IsOpen())
+  {
+    this->ephemeris->Close();
+  }
+  else
+  {
+    wxFileDialog fileDialog(this, wxT("Choose Ephemeris file"), wxT(""), wxT(""), wxT("*.eph;*.EPH"), wxFD_SAVE | wxFD_OVERWRITE_PROMPT);
+    if (fileDialog.ShowModal() == wxID_OK)
+    {
+      this->ephemeris->Create(fileDialog.GetPath(), this->clModel->GetNumParticles(), this->ephemerisDegree, this->ephemerisIntervalDays);
+    }
+  }
+  this->UpdateMenuItems();
+}
+
+void Frame::OnKeplerFastForward(wxCommandEvent &event)
+{
+  this->keplerFastForward = !this->keplerFastForward;
+  this->UpdateMenuItems();
+}
+
+// Switches between integrating in the barycentric frame and relative to the Sun. The simulation carries on from the
+// current state, which is read back barycentric, so nothing is lost. Driven bodies are barycentric, so driving stops
+void Frame::OnHeliocentric(wxCommandEvent &WXUNUSED(event))
+{
+  this->Stop();
+  this->clModel->ReadToInitialState(this->initialState->initialPositions, this->initialState->initialVelocities);
+  this->initialState->initialJulianDate = this->clModel->julianDate + (this->clModel->time) * 1 / (60 * 60 * 24);
+  this->initialState->initialNumParticles = this->numParticles;
+  if (this->jplEphemeris->IsOpen())
+  {
+    wxLogMessage(wxT("Stopped driving bodies from the JPL ephemeris"));
+    this->jplEphemeris->Close();
+  }
+  this->clModel->heliocentric = !this->clModel->heliocentric;
+  this->ResetAll();
+}
+
+// Starts or stops driving the bodies with mass from a JPL DE ephemeris
+void Frame::OnJplEphemeris(wxCommandEvent &event)
+{
+  if (this->jplEphemeris->IsOpen())
+  {
+    this->jplEphemeris->Close();
+  }
+  else if (this->clModel->IsStreaming())
+  {
+    wxLogError(wxT("Bodies cannot be driven from an ephemeris while streaming"));
+  }
+  else if (this->clModel->IsHeliocentric())
+  {
+    wxLogError(wxT("Bodies cannot be driven from an ephemeris in the heliocentric frame"));
+  }
+  else
+  {
+    wxFileDialog fileDialog(this, wxT("Choose JPL Ephemeris file"), wxT(""), wxT(""), wxT("*.*"), wxFD_OPEN | wxFD_FILE_MUST_EXIST);
+    if (fileDialog.ShowModal() == wxID_OK && this->jplEphemeris->Open(fileDialog.GetPath()))
+    {
+      try
+      {
+        if (!this->MapDrivenBodies())
+        {
+          throw -1;
+        }
+        double currentJdn = this->clModel->julianDate + (this->clModel->time) * 1 / (60 * 60 * 24);
+        this->DriveBodies(currentJdn, true);
+        this->clModel->UpdateDisplay();
+        this->Refresh(false);
+      }
+      catch (int ex)
+      {
+        this->jplEphemeris->Close();
+      }
+    }
+  }
+  this->UpdateMenuItems();
+}
+
+// Matches the bodies with mass to the ephemeris by name. Those it lacks, such as the larger asteroids, are still integrated
+bool Frame::MapDrivenBodies()
+{
+  this->numDrivenBodies = 0;
+  for (int index = 0; index < this->numGrav && index < this->initialState->initialNumParticles; index++)
+  {
+    int body = JplEphemeris::FindBody(wxString(this->initialState->physicalProperties[index].Name));
+    if (body >= 0 && this->numDrivenBodies < JplEphemeris::NumBodies)
+    {
+      this->drivenBodies[this->numDrivenBodies] = index;
+      this->drivenEphemerisBodies[this->numDrivenBodies] = body;
+      // the ephemeris only gives the motion, keep the GM and relativistic parameter
+      this->drivenPositions[this->numDrivenBodies] = this->initialState->initialPositions[index];
+      this->drivenVelocities[this->numDrivenBodies] = this->initialState->initialVelocities[index];
+      this->numDrivenBodies++;
+    }
+  }
+
+  if (this->numDrivenBodies == 0)
+  {
+    wxLogError(wxT("None of the bodies with mass are in the ephemeris"));
+    return false;
+  }
+
+  wxLogMessage(wxT("Driving %d of %d bodies with mass from DE%d"), this->numDrivenBodies, this->numGrav, this->jplEphemeris->Number());
+  return true;
+}
+
+void Frame::DriveBodies(double julianDate, bool evaluate)
+{
+  for (int driven = 0; driven < this->numDrivenBodies && evaluate; driven++)
+  {
+    double position[3];
+    double velocity[3];
+    if (!this->jplEphemeris->Evaluate(julianDate, this->drivenEphemerisBodies[driven], position, velocity))
+    {
+      wxLogError(wxT("Julian date %f is outside the JPL ephemeris, the bodies with mass are integrated again"), julianDate);
+      this->jplEphemeris->Close();
+      this->UpdateMenuItems();
+      return;
+    }
+
+    for (int component = 0; component < 3; component++)
+    {
+      this->drivenPositions[driven].s[component] = position[component];
+      this->drivenVelocities[driven].s[component] = velocity[component];
+    }
+  }
+
+  this->clModel->SetBodyStates(this->numDrivenBodies, this->drivenBodies, this->drivenPositions, this->drivenVelocities);
+}
+
 void Frame::OnResetColours(wxCommandEvent &event)
 {
   this->initialState->SetDefaultBodyColours();
@@ -1314,7 +2302,34 @@ void Frame::OnGLContextReady(wxCommandEvent &event)
 {
   // Create an openCL model to run the simulation and initialise it
   this->clModel = new CLModel();
+  int streamChunkSize;
+  this->config->Read(wxT("StreamChunkSize"), &streamChunkSize, 0);
+  this->clModel->streamChunkSize = streamChunkSize;
+  wxString defaultProgramCache = wxStandardPaths::Get().GetUserLocalDataDir() + wxFileName::GetPathSeparator() + wxT("programcache");
+  this->config->Read(wxT("ProgramCacheDirectory"), &this->clModel->programCacheDirectory, defaultProgramCache);
+  this->config->Read(wxT("SpecializeKernels"), &this->clModel->specializeKernels, false);
+  this->config->Read(wxT("TreeOpeningAngle"), &this->clModel->treeOpeningAngle, 0.5);
+  this->config->Read(wxT("Summation"), &this->clModel->summation, CLModel::summationDefault);
+  this->config->Read(wxT("CompensatedBodies"), &this->clModel->compensatedBodies, 10);
+  this->config->Read(wxT("PairwiseMassive"), &this->clModel->pairwiseMassive, true);
+  this->config->Read(wxT("PerturberTolerance"), &this->clModel->perturberTolerance, 0.0);
+  this->config->Read(wxT("PerturberRefreshSteps"), &this->clModel->perturberRefreshSteps, 16);
+  this->config->Read(wxT("Heliocentric"), &this->clModel->heliocentric, false);
+  this->config->Read(wxT("FixedPointBits"), &this->clModel->fixedPointBits, 0);
+  this->config->Read(wxT("Deterministic"), &this->clModel->deterministic, false);
+  this->clModel->deterministic = this->clModel->deterministic || this->deterministic;
+  this->config->Read(wxT("StepTolerance"), &this->clModel->stepTolerance, 0.0);
+  this->config->Read(wxT("MinDeltaTime"), &this->clModel->minDeltaTime, 60.0);
+  this->config->Read(wxT("MaxDeltaTime"), &this->clModel->maxDeltaTime, 24 * 60 * 60.0);
   this->ChooseDevice(this->config);
+
+  // Use the settings tuned for this device, choosing it again so it takes the tuned work-group size, or tune it once the model is built
+  bool tuneKernels = this->retuneKernels || !this->LoadKernelTuning();
+  if (!tuneKernels)
+  {
+    this->clModel->CleanUpCL();
+    this->ChooseDevice(this->config);
+  }
   this->clModel->CreateBufferObjects(this->glCanvas->getVbo(), this->numParticles, this->numGrav);
   this->clModel->CompileProgramAndCreateKernels();
   this->glCanvas->SetColours(this->initialState->initialColorData);
@@ -1322,6 +2337,10 @@ void Frame::OnGLContextReady(wxCommandEvent &event)
   this->clModel->julianDate = this->initialState->initialJulianDate;
   this->clModel->time = 0.0f;
   this->clModel->SetKernelArgumentsAndGroupSize();
+  if (tuneKernels)
+  {
+    this->TuneKernels();
+  }
   this->clModel->UpdateDisplay();
   this->clModelOk = true;
 
@@ -1333,8 +2352,34 @@ void Frame::OnGLContextReady(wxCommandEvent &event)
 
   wxMenuBar *menuBar = this->GetMenuBar();
   wxMenuItem *menuItem;
-  menuItem = menuBar->FindItem(ID_SETADAMS11);
+  menuItem = menuBar->FindItem(ID_SETADAMS2 + this->clModel->AdamsOrder() - CLModel::minAdamsOrder);
   menuItem->Check(true);
-  menuItem = menuBar->FindItem(ID_SETRELATIVISTIC);
+  menuItem = menuBar->FindItem(ID_SETSUMMATION0 + this->clModel->summation);
+  if (menuItem != NULL)
+  {
+    menuItem->Check(true);
+  }
+  bool localAcceleration = this->clModel->accelerationKernelName->EndsWith(wxT("Local"));
+  bool treeAcceleration = this->clModel->accelerationKernelName->EndsWith(wxT("Tree"));
+  bool subgroupAcceleration = this->clModel->accelerationKernelName->EndsWith(wxT("Subgroup"));
+  if (this->clModel->accelerationKernelName->StartsWith(wxT("newtonian")))
+  {
+    menuItem = menuBar->FindItem(treeAcceleration ? ID_SETNEWTONIANTREE : localAcceleration ? ID_SETNEWTONIANL : subgroupAcceleration ? ID_SETNEWTONIANSUBGROUP : ID_SETNEWTONIAN);
+  }
+  else
+  {
+    menuItem = menuBar->FindItem(treeAcceleration ? ID_SETRELATIVISTICTREE : localAcceleration ? ID_SETRELATIVISTICL : subgroupAcceleration ? ID_SETRELATIVISTICSUBGROUP : ID_SETRELATIVISTIC);
+  }
   menuItem->Check(true);
+
+  // A -digest run can only step once the model exists, so it runs here and then ends the main loop with its result as the exit code
+  if (this->digestSteps > 0)
+  {
+    bool printed = this->PrintStateDigest(this->digestSteps);
+    wxEventLoopBase *eventLoop = wxEventLoopBase::GetActive();
+    if (eventLoop != NULL)
+    {
+      eventLoop->Exit(printed ? 0 : 1);
+    }
+  }
 }
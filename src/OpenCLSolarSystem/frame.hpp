@@ -28,6 +28,22 @@
 #include "initialstate.hpp"
 #endif
 
+#ifndef CHECKPOINT_HPP
+#include "checkpoint.hpp"
+#endif
+
+#ifndef TRAJECTORYARCHIVE_HPP
+#include "trajectoryarchive.hpp"
+#endif
+
+#ifndef CHEBYSHEVEPHEMERIS_HPP
+#include "chebyshevephemeris.hpp"
+#endif
+
+#ifndef JPLEPHEMERIS_HPP
+#include "jplephemeris.hpp"
+#endif
+
 class Frame : public wxFrame
 {
 public:
@@ -55,10 +71,13 @@ public:
    * @param useLastDevice Use previously selected OpenCL device
    * @param desiredPlatform Preferred OpenCL platform name
    * @param tryForCPUFirst Try CPU before GPU for computation
+   * @param retuneKernels Benchmark the kernel configurations even if the device has been tuned before
+   * @param deterministic Build and run only what gives the same state on every device
+   * @param digestSteps Print the state digest at this step once the model is built and exit, 0 runs normally
    */
   void InitFrame(bool doubleBuffer, bool smooth, bool lighting, bool stereo,
                  int numParticles, int numGrav, bool useLastDevice,
-                 char *desiredPlatform, bool tryForCPUFirst);
+                 char *desiredPlatform, bool tryForCPUFirst, bool retuneKernels, bool deterministic, int digestSteps);
 
 private:
   // OpenGL/OpenCL Components
@@ -71,6 +90,9 @@ private:
   char *desiredPlatform;   /**< Preferred OpenCL platform name */
   bool useLastDevice;      /**< Use previously selected device */
   bool tryForCPUFirst;     /**< Prefer CPU over GPU */
+  bool retuneKernels;      /**< Tune the kernels even if the device has saved settings */
+  bool deterministic;      /**< Run deterministically whatever the configuration says */
+  int digestSteps;         /**< Step a -digest run prints the state digest at before exiting, 0 runs normally */
   bool runOnIdle;          /**< Run simulation during idle time */
   bool checkForEncounters; /**< Check for close encounters between bodies */
 
@@ -81,6 +103,23 @@ private:
   double stopDateJdn;         /**< Julian date to stop simulation */
   double encounterDistance;   /**< Distance threshold for encounters */
   bool goingToDate;           /**< Flag for time-targeted simulation */
+  Checkpoint *checkpoint;     /**< Incremental checkpoint writer */
+  int checkpointInterval;     /**< Steps between checkpoints */
+  TrajectoryArchive *archive; /**< Compressed trajectory archive writer */
+  int archiveInterval;        /**< Steps between archived frames */
+  double archiveErrorBound;   /**< Maximum archived position error in Gm */
+  ChebyshevEphemeris *ephemeris; /**< Chebyshev ephemeris writer */
+  int ephemerisDegree;           /**< Degree of the ephemeris polynomials */
+  double ephemerisIntervalDays;  /**< Days covered by each ephemeris record */
+  bool keplerFastForward;           /**< Go To Date moves distant bodies on Kepler orbits */
+  double keplerFastForwardDistance; /**< Distance from the centre of mass in Gm beyond which bodies are fast forwarded */
+  int twoPhaseSteps;                /**< Steps the bodies with mass run ahead of the test particles, 1 or less runs every stage together */
+  JplEphemeris *jplEphemeris;       /**< External ephemeris driving the bodies with mass, when open */
+  int numDrivenBodies;              /**< Bodies with mass found in the external ephemeris */
+  cl_int drivenBodies[JplEphemeris::NumBodies];        /**< Simulation index of each driven body */
+  int drivenEphemerisBodies[JplEphemeris::NumBodies];  /**< Ephemeris body of each driven body */
+  cl_double4 drivenPositions[JplEphemeris::NumBodies]; /**< Last evaluated positions of the driven bodies */
+  cl_double4 drivenVelocities[JplEphemeris::NumBodies]; /**< Last evaluated velocities of the driven bodies */
 
   // System Components
   wxStopWatch stopWatch; /**< Performance timing */
@@ -94,10 +133,23 @@ private:
   void UpdateStatusBar(wxLongLong timeTaken);
 
   void ResetAll();        /**< Reset simulation to initial state */
+  void RebuildModel();    /**< Recreate the OpenCL model from the initial state, throwing on failure */
   void UpdateMenuItems(); /**< Update menu checkmarks/labels */
   void Start();           /**< Start simulation */
   void Stop();            /**< Stop simulation */
+  void Pause();           /**< Stop stepping, leaving a Kepler fast forward running */
+  void EndFastForward();  /**< Bring any bodies frozen for a Kepler fast forward up to date */
+  void LandOnStopDate();  /**< Display the state exactly at stopDateJdn */
   void DoStep();          /**< Execute one simulation step */
+  int TwoPhaseSteps();    /**< Number of steps the next DoStep can take in two phases */
+  bool MapDrivenBodies(); /**< Find the bodies with mass in the external ephemeris */
+
+  /**
+   * Sets the driven bodies to their external ephemeris state, stopping driving them if that fails
+   * @param julianDate Date to evaluate the ephemeris at
+   * @param evaluate false to rewrite the last evaluated state
+   */
+  void DriveBodies(double julianDate, bool evaluate);
 
   /**
    * Select OpenCL compute device
@@ -105,19 +157,41 @@ private:
    */
   void ChooseDevice(wxConfigBase *config);
 
+  // Kernel autotuning, the best configuration for each device is kept in the config under TuningGroup()
+  wxString TuningGroup();  /**< Config group of the selected device's tuned settings */
+  bool LoadKernelTuning(); /**< Apply the saved settings, false if the device and driver have none */
+  void TuneKernels();      /**< Benchmark the candidate configurations and save the best */
+
+  /**
+   * Rebuilds the model with the current kernel settings and times it
+   * @param numSteps Steps to time after the startup steps
+   * @param positions Receives the positions at the end of the run
+   * @return Milliseconds per step per thousand bodies, or a negative value if the configuration does not run
+   */
+  double TimeKernelConfiguration(int numSteps, cl_double4 *positions);
+
   // Event Handlers
   void OnExit(wxCommandEvent &event);               /**< Handle exit command */
   void OnAbout(wxCommandEvent &event);              /**< Show about dialog */
   void OnStart(wxCommandEvent &event);              /**< Start simulation */
   void OnStop(wxCommandEvent &event);               /**< Stop simulation */
   void OnReset(wxCommandEvent &event);              /**< Reset simulation */
+  void OnGoToDate(wxCommandEvent &event);           /**< Run until a chosen date */
+  void OnBenchmarkKernels(wxCommandEvent &event);   /**< Time the generic and specialised kernels */
+  void OnAccelerationErrors(wxCommandEvent &event); /**< Compare the Barnes-Hut tree or pruned sum with the direct sum */
+  void OnStateDigest(wxCommandEvent &event);        /**< Log a hash of the current state */
+  wxString StateDigestMessage(cl_ulong digest);      /**< Device, step, bodies and digest, as logged and printed */
+  bool PrintStateDigest(int numSteps);               /**< Run to numSteps and print the state digest to standard output */
+  void OnSummationMatrix(wxCommandEvent &event);    /**< Time and compare the summations of the bodies with mass */
   void OnResetColours(wxCommandEvent &event);       /**< Reset body colors */
   void OnSetIntegrator(wxCommandEvent &event);      /**< Change integration method */
+  void OnSetSummation(wxCommandEvent &event);       /**< Change summation of the bodies with mass */
   void OnSetDeltaTime(wxCommandEvent &event);       /**< Change timestep */
   void OnSetNum(wxCommandEvent &event);             /**< Change particle count */
   void OnSetGrav(wxCommandEvent &event);            /**< Change gravity body count */
   void OnSetCenter(wxCommandEvent &event);          /**< Change center body */
   void OnImportSlf(wxCommandEvent &event);          /**< Import Solex file */
+  void OnImportMpcOrb(wxCommandEvent &event);       /**< Import MPCORB orbital element catalog */
   void OnExportSlf(wxCommandEvent &event);          /**< Export Solex file */
   void OnSetAcceleration(wxCommandEvent &event);    /**< Change acceleration calc method */
   void OnSaveInitialState(wxCommandEvent &event);   /**< Save initial conditions */
@@ -125,6 +199,13 @@ private:
   void OnReadToInitialState(wxCommandEvent &event); /**< Set current as initial */
   void OnBlending(wxCommandEvent &event);           /**< Toggle transparency */
   void OnLogEncounters(wxCommandEvent &event);      /**< Toggle encounter logging */
+  void OnCheckpoints(wxCommandEvent &event);        /**< Toggle incremental checkpoints */
+  void OnRestoreCheckpoint(wxCommandEvent &event);  /**< Restore from a checkpoint file */
+  void OnArchive(wxCommandEvent &event);            /**< Toggle trajectory archive recording */
+  void OnEphemeris(wxCommandEvent &event);          /**< Toggle Chebyshev ephemeris generation */
+  void OnKeplerFastForward(wxCommandEvent &event);  /**< Toggle Kepler fast forward for Go To Date */
+  void OnJplEphemeris(wxCommandEvent &event);       /**< Toggle driving the bodies with mass from a JPL ephemeris */
+  void OnHeliocentric(wxCommandEvent &event);       /**< Toggle integrating relative to the Sun */
   void OnTimer(wxTimerEvent &event);                /**< Handle timer updates */
   void OnClose(wxCloseEvent &event);                /**< Handle window close */
   void OnIdle(wxIdleEvent &event);                  /**< Handle idle updates */
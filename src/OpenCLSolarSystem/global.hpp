@@ -41,6 +41,9 @@
 #include <wx/txtstrm.h>
 #include <wx/filedlg.h>
 #include <wx/config.h>
+#include <wx/filename.h>
+#include <wx/stdpaths.h>
+#include <wx/evtloop.h>
 
 #ifdef _WIN32
 #include <GL/wglew.h>
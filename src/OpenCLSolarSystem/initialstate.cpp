@@ -15,6 +15,7 @@
 */
 #include "global.hpp"
 #include "initialstate.hpp"
+#include "mpcorb.hpp"
 
 InitialState::InitialState()
 {
@@ -851,6 +852,256 @@ bool InitialState::ImportSLF( wxString fileName )
 	return true;
 }
 
+// Julian date at 0h, from Meeus. Dates before the 15th of October 1582 are in the Julian calendar
+double InitialState::CalendarDateToJulianDate( int year, int month, int day )
+{
+	if( month < 3 )
+	{
+		month += 12;
+		year -= 1;
+	}
+
+	int b = 0;
+	if( year > 1582 || ( year == 1582 && month > 10 ) || ( year == 1582 && month == 10 && day >= 15 ) )
+	{
+		int a = year / 100;
+		b = 2 - a + a / 4;
+	}
+
+	return floor( 365.25 * ( year + 4716 ) ) + floor( 30.6001 * ( month + 1 ) ) + day + b - 1524.5;
+}
+
+// Orbit type from the MPCORB hexadecimal flags, named as in the slf files written by OrbToSlf so the colours match
+static wxString MpcOrbitType( unsigned long typeCode )
+{
+	if( ( typeCode & 4096 ) != 0 )
+	{
+		return wxT( "NEO!" );
+	}
+	if( ( typeCode & 2048 ) != 0 )
+	{
+		return wxT( "NEO" );
+	}
+	switch( typeCode & 0x3F )
+	{
+	case 2:
+		return wxT( "Aten" );
+	case 3:
+		return wxT( "Apollo" );
+	case 4:
+		return wxT( "Amor" );
+	case 5:
+		return wxT( "QLess1665" );
+	case 6:
+		return wxT( "Hungaria" );
+	case 7:
+		return wxT( "Phocaea" );
+	case 8:
+		return wxT( "Hilda" );
+	case 9:
+		return wxT( "JTrojan" );
+	case 10:
+		return wxT( "Centaur" );
+	case 14:
+		return wxT( "Plutino" );
+	case 15:
+		return wxT( "TNO" );
+	case 16:
+		return wxT( "Cubewano" );
+	case 17:
+		return wxT( "Scattered" );
+	default:
+		return wxEmptyString;
+	}
+}
+
+// Reads an MPCORB.DAT style catalog of orbital elements directly, replacing the separate OrbToSlf and slf import steps.
+// The current bodies with mass (the Sun, planets and any massive asteroids) are kept along with the initial Julian date.
+// Only the text parsing is done here, the elements are converted to state vectors for all the asteroids at once on the device
+bool InitialState::ImportMPCORB( wxString fileName, CLModel *clModel )
+{
+	if( this->initialPositions == NULL || this->initialNumGrav <= 0 || this->initialNumParticles < this->initialNumGrav )
+	{
+		wxLogError( wxT( "Importing an orbital element catalog needs an initial state with the bodies with mass" ) );
+		return false;
+	}
+
+	wxFileInputStream catalogFileInputStream( fileName );
+	if( !catalogFileInputStream.IsOk() || catalogFileInputStream.Eof() )
+	{
+		wxLogError( wxT( "Unable to read %s" ), fileName.c_str() );
+		return false;
+	}
+	wxTextInputStream catalog( catalogFileInputStream );
+
+	// The new bodies are built up in temporaries so the current state is untouched if the import fails.
+	// The bodies with mass are kept
+	const int maxParticles = 2000000;
+	int numKept = this->initialNumGrav;
+	cl_double4 *newPositions = new cl_double4[maxParticles];
+	cl_double4 *newVelocities = new cl_double4[maxParticles];
+	PhysicalProperties *newProperties = new PhysicalProperties[maxParticles];
+
+	int sun = 0;
+	wxString *keptNames = new wxString[numKept];
+	for( int i=0; i< numKept; i++ )
+	{
+		newPositions[i] = this->initialPositions[i];
+		newVelocities[i] = this->initialVelocities[i];
+		newProperties[i] = this->physicalProperties[i];
+		keptNames[i] = wxString( newProperties[i].Name ).BeforeFirst( '-' ).Upper();
+		if( keptNames[i].IsSameAs( wxT( "SUN" ) ) )
+		{
+			sun = i;
+		}
+	}
+
+	wxString message;
+	message.Printf( "Loading %s",fileName.c_str() );
+	wxProgressDialog progressBar( message, wxT( "Loading" ), maxParticles, NULL, wxPD_AUTO_HIDE );
+	progressBar.Update( 0,wxT( "Loading" ) );
+
+	// elementsA is (GM, mean anomaly, semi major axis, eccentricity), elementsB is (inclination, argument of perihelion, node, seconds since the epoch)
+	int maxElements = maxParticles - numKept;
+	cl_double4 *elementsA = new cl_double4[maxElements];
+	cl_double4 *elementsB = new cl_double4[maxElements];
+	const double degreesToRadians = M_PI / 180.0;
+	const double auInGm = 149.597870691;
+
+	int numElements = 0;
+	long lineCount = 0;
+	bool inHeader = true;
+	while( !catalogFileInputStream.Eof() && numElements < maxElements )
+	{
+		wxString line = catalog.ReadLine();
+		lineCount++;
+
+		// The header ends with a row of dashes
+		if( inHeader )
+		{
+			inHeader = !line.StartsWith( wxT( "-----" ) );
+			continue;
+		}
+
+		MpcOrb::Elements elements;
+		MpcOrb::ParseResult result = MpcOrb::ParseLine( line.ToStdString(), &elements );
+		if( result == MpcOrb::BadEpoch )
+		{
+			wxLogDebug( wxT( "Bad epoch %s on line %ld" ), line.Mid( 20, 5 ), lineCount );
+		}
+		else if( result == MpcOrb::BadElements )
+		{
+			wxLogDebug( wxT( "Bad elements on line %ld" ), lineCount );
+		}
+		if( result != MpcOrb::Parsed )
+		{
+			continue;
+		}
+
+		// Skip the asteroids already in as bodies with mass
+		wxString readableName = wxString( elements.readableName ).Upper();
+		bool kept = false;
+		for( int i=0; i< numKept && !kept && !readableName.IsEmpty(); i++ )
+		{
+			kept = keptNames[i].IsSameAs( readableName );
+		}
+		if( kept )
+		{
+			continue;
+		}
+
+		wxString type = MpcOrbitType( elements.typeCode );
+		wxString name = wxString( elements.designation ) + wxT( "-" ) + wxString( elements.uncertainty );
+		if( !type.IsEmpty() )
+		{
+			name += wxT( "-[" ) + type + wxT( "]" );
+		}
+
+		elementsA[numElements].s[0] = 2.83E-09 * 6.67384E-08;
+		elementsA[numElements].s[1] = elements.meanAnomaly * degreesToRadians;
+		elementsA[numElements].s[2] = elements.semiMajorAxis * auInGm;
+		elementsA[numElements].s[3] = elements.eccentricity;
+		elementsB[numElements].s[0] = elements.inclination * degreesToRadians;
+		elementsB[numElements].s[1] = elements.argumentOfPerihelion * degreesToRadians;
+		elementsB[numElements].s[2] = elements.longitudeOfAscendingNode * degreesToRadians;
+		double epoch = CalendarDateToJulianDate( elements.epochYear, elements.epochMonth, elements.epochDay );
+		elementsB[numElements].s[3] = ( this->initialJulianDate - epoch ) * 86400.0;
+
+		int i = numKept + numElements;
+		newProperties[i].Mass = 0.0;
+		newProperties[i].Radius = 0.1 / 1000000;
+		newProperties[i].AbsoluteMagnitude = elements.absoluteMagnitude;
+		newProperties[i].Index = i;
+		for( size_t charIndex =0; charIndex < 32; charIndex++ )
+		{
+			wxChar ch = 0;
+			if( charIndex < name.Len() )
+			{
+				ch = name.GetChar( charIndex );
+			}
+			newProperties[i].Name[charIndex] = ch;
+		}
+		newProperties[i].Name[31] =0;
+		numElements++;
+
+		if( numElements % 10000 == 0 )
+		{
+			message.Printf( "%d",numElements );
+			progressBar.Update( numElements,message );
+		}
+	}
+	delete[] keptNames;
+
+	bool success = true;
+	try
+	{
+		progressBar.Update( numElements,wxT( "Converting to state vectors" ) );
+		clModel->OrbitalToStateVectors( elementsA, elementsB, numElements, newPositions[sun].s[3], newPositions + numKept, newVelocities + numKept );
+	}
+	catch( int ex )
+	{
+		wxLogError( wxT( "Failed to convert the orbital elements to state vectors, keeping the current bodies" ) );
+		success = false;
+	}
+	delete[] elementsA;
+	delete[] elementsB;
+
+	// Only replace the state once the conversion has worked
+	if( success )
+	{
+		this->initialNumParticles = numKept + numElements;
+		this->DeAllocate();
+		this->Allocate();
+
+		for( int i = 0; i < this->initialNumParticles; i++ )
+		{
+			this->initialPositions[i] = newPositions[i];
+			this->initialVelocities[i] = newVelocities[i];
+			this->physicalProperties[i] = newProperties[i];
+		}
+
+		// The elements are heliocentric
+		for( int i = numKept; i < this->initialNumParticles; i++ )
+		{
+			for( int component = 0; component < 3; component++ )
+			{
+				this->initialPositions[i].s[component] += this->initialPositions[sun].s[component];
+				this->initialVelocities[i].s[component] += this->initialVelocities[sun].s[component];
+			}
+			this->physicalProperties[i].RelativisticParameter = this->initialVelocities[i].s[3];
+		}
+
+		wxLogDebug( wxT( "Read %d asteroids from %ld lines" ), numElements, lineCount );
+		this->SetDefaultBodyColours();
+	}
+	delete[] newPositions;
+	delete[] newVelocities;
+	delete[] newProperties;
+
+	progressBar.Close();
+	return success;
+}
+
 // Create a random initial config. This will only happen if there is no initial.bin file to load
 bool InitialState::CreateRandomInitialConfig()
 {
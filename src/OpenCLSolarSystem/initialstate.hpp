@@ -46,6 +46,11 @@ private:
    */
   unsigned long xor128();
 
+  /**
+   * @brief Julian date at 0h of a Gregorian calendar date
+   */
+  static double CalendarDateToJulianDate(int year, int month, int day);
+
 public:
   // Simulation Parameters
   int initialNumParticles; /**< Total number of particles in simulation */
@@ -98,6 +103,16 @@ public:
    */
   bool ImportSLF(wxString fileName);
 
+  /**
+   * @brief Replaces the bodies without mass with the asteroids of an MPCORB format orbital element catalog
+   * The bodies with mass are kept. The elements are moved to the initial Julian date along
+   * Kepler orbits about the Sun and converted to state vectors in bulk on the device
+   * @param fileName Path to the MPCORB.DAT style catalog
+   * @param clModel Model whose kernels do the conversion
+   * @return true if import successful
+   */
+  bool ImportMPCORB(wxString fileName, CLModel *clModel);
+
   /**
    * @brief Exports current state to Solex SLF format
    * @param fileName Target file path
@@ -0,0 +1,274 @@
+/*
+  Copyright 2013-2025 Michael William Simmons
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#include "global.hpp"
+#include "jplephemeris.hpp"
+#include "jplheader.hpp"
+
+JplEphemeris::JplEphemeris()
+{
+  this->file = NULL;
+  this->swapBytes = false;
+  this->numde = 0;
+  this->startJulianDate = 0.0;
+  this->endJulianDate = 0.0;
+  this->intervalDays = 0.0;
+  this->earthMoonRatio = 0.0;
+  this->recordDoubles = 0;
+  this->record = NULL;
+  this->cachedRecord = -1;
+}
+
+JplEphemeris::~JplEphemeris()
+{
+  this->Close();
+}
+
+void JplEphemeris::Swap(void *value, size_t size)
+{
+  JplHeader::Swap(value, size, this->swapBytes);
+}
+
+bool JplEphemeris::Open(wxString fileName)
+{
+  this->Close();
+  this->file = new wxFile();
+  unsigned char header[JPL_HEADER_SIZE];
+  if (!this->file->Open(fileName) || this->file->Read(header, JPL_HEADER_SIZE) != JPL_HEADER_SIZE)
+  {
+    wxLogError(wxT("Unable to open JPL ephemeris %s"), fileName);
+    this->Close();
+    return false;
+  }
+
+  JplHeader::Header parsed;
+  bool valid = JplHeader::Parse(header, &parsed);
+  this->swapBytes = parsed.swapBytes;
+  this->numde = parsed.numde;
+  this->startJulianDate = parsed.startJulianDate;
+  this->endJulianDate = parsed.endJulianDate;
+  this->intervalDays = parsed.intervalDays;
+  this->earthMoonRatio = parsed.earthMoonRatio;
+  for (int body = 0; body < NumBodies; body++)
+  {
+    for (int i = 0; i < 3; i++)
+    {
+      this->pointers[body][i] = parsed.ipt[body][i];
+    }
+  }
+
+  if (!valid)
+  {
+    wxLogError(wxT("%s is not a binary JPL ephemeris"), fileName);
+    this->Close();
+    return false;
+  }
+
+  // Later ephemerides add items whose pointers follow any constant names past 400
+  unsigned char extra[JPL_EXTRA_SIZE];
+  bool haveExtra = this->file->Seek((wxFileOffset)JplHeader::ExtraOffset(parsed)) != wxInvalidOffset && this->file->Read(extra, JPL_EXTRA_SIZE) == JPL_EXTRA_SIZE;
+  int candidates[2];
+  JplHeader::RecordCandidates(parsed, haveExtra ? extra : NULL, candidates);
+
+  this->recordDoubles = 0;
+  for (int candidate = 0; candidate < 2 && this->recordDoubles == 0; candidate++)
+  {
+    double firstDate;
+    if (this->file->Seek((wxFileOffset)2 * candidates[candidate] * sizeof(double)) != wxInvalidOffset && this->file->Read(&firstDate, sizeof(double)) == sizeof(double))
+    {
+      this->Swap(&firstDate, sizeof(double));
+      if (firstDate == this->startJulianDate)
+      {
+        this->recordDoubles = candidates[candidate];
+      }
+    }
+  }
+
+  if (this->recordDoubles == 0)
+  {
+    wxLogError(wxT("Unable to find the records of JPL ephemeris %s"), fileName);
+    this->Close();
+    return false;
+  }
+
+  this->record = new double[this->recordDoubles];
+  this->cachedRecord = -1;
+  wxLogMessage(wxT("Opened DE%d covering Julian dates %.1f to %.1f"), this->numde, this->startJulianDate, this->endJulianDate);
+  return true;
+}
+
+void JplEphemeris::Close()
+{
+  if (this->file != NULL)
+  {
+    this->file->Close();
+    delete this->file;
+    this->file = NULL;
+  }
+  delete[] this->record;
+  this->record = NULL;
+  this->cachedRecord = -1;
+}
+
+bool JplEphemeris::IsOpen()
+{
+  return this->file != NULL;
+}
+
+int JplEphemeris::Number()
+{
+  return this->numde;
+}
+
+double JplEphemeris::StartJulianDate()
+{
+  return this->startJulianDate;
+}
+
+double JplEphemeris::EndJulianDate()
+{
+  return this->endJulianDate;
+}
+
+int JplEphemeris::FindBody(wxString name)
+{
+  static const wxChar *names[NumBodies] = {wxT("MERCURY"), wxT("VENUS"), wxT("EARTH"), wxT("MARS"), wxT("JUPITER"), wxT("SATURN"), wxT("URANUS"), wxT("NEPTUNE"), wxT("PLUTO"), wxT("MOON"), wxT("SUN")};
+  wxString upper = name.BeforeFirst('-').Trim().Upper();
+  for (int body = 0; body < NumBodies; body++)
+  {
+    if (upper.IsSameAs(names[body]))
+    {
+      return body;
+    }
+  }
+  return -1;
+}
+
+// The first two records hold the header and the constants
+bool JplEphemeris::ReadRecord(int index)
+{
+  if (index == this->cachedRecord)
+  {
+    return true;
+  }
+
+  size_t recordSize = this->recordDoubles * sizeof(double);
+  if (this->file->Seek((wxFileOffset)(index + 2) * recordSize) == wxInvalidOffset || this->file->Read(this->record, recordSize) != (ssize_t)recordSize)
+  {
+    this->cachedRecord = -1;
+    return false;
+  }
+
+  for (int i = 0; i < this->recordDoubles; i++)
+  {
+    this->Swap(&this->record[i], sizeof(double));
+  }
+  this->cachedRecord = index;
+  return true;
+}
+
+// State of one item of the pointer table, in km and km/day
+bool JplEphemeris::Interpolate(int item, double julianDate, double *position, double *velocity)
+{
+  if (julianDate < this->startJulianDate || julianDate > this->endJulianDate)
+  {
+    return false;
+  }
+
+  int index = (int)((julianDate - this->startJulianDate) / this->intervalDays);
+  if (julianDate == this->endJulianDate)
+  {
+    index--;
+  }
+
+  if (!this->ReadRecord(index))
+  {
+    return false;
+  }
+
+  // Which sub interval, and where in it from -1 to 1
+  int numCoefficients = this->pointers[item][1];
+  int numSubIntervals = this->pointers[item][2];
+  double subIntervalDays = this->intervalDays / numSubIntervals;
+  double offset = julianDate - this->record[0];
+  int subInterval = (int)(offset / subIntervalDays);
+  subInterval = subInterval < numSubIntervals ? subInterval : numSubIntervals - 1;
+  double x = 2.0 * (offset - subInterval * subIntervalDays) / subIntervalDays - 1.0;
+  const double *coefficients = this->record + this->pointers[item][0] - 1 + subInterval * numCoefficients * 3;
+
+  for (int component = 0; component < 3; component++)
+  {
+    const double *c = coefficients + component * numCoefficients;
+    double t0 = 1.0;
+    double t1 = x;
+    double d0 = 0.0;
+    double d1 = 1.0;
+    double p = c[0] + c[1] * x;
+    double v = c[1];
+    for (int k = 2; k < numCoefficients; k++)
+    {
+      double t2 = 2.0 * x * t1 - t0;
+      double d2 = 2.0 * t1 + 2.0 * x * d1 - d0;
+      p += c[k] * t2;
+      v += c[k] * d2;
+      t0 = t1;
+      t1 = t2;
+      d0 = d1;
+      d1 = d2;
+    }
+    position[component] = p;
+    velocity[component] = v * 2.0 / subIntervalDays;
+  }
+  return true;
+}
+
+bool JplEphemeris::Evaluate(double julianDate, int body, double *position, double *velocity)
+{
+  if (this->file == NULL || body < 0 || body >= NumBodies)
+  {
+    return false;
+  }
+
+  double itemPosition[3];
+  double itemVelocity[3];
+  if (body == Earth || body == Moon)
+  {
+    // The file has the Earth-Moon barycentre and the Moon relative to the Earth
+    double moonPosition[3];
+    double moonVelocity[3];
+    if (!this->Interpolate(Earth, julianDate, itemPosition, itemVelocity) || !this->Interpolate(Moon, julianDate, moonPosition, moonVelocity))
+    {
+      return false;
+    }
+
+    double share = body == Earth ? -1.0 / (1.0 + this->earthMoonRatio) : this->earthMoonRatio / (1.0 + this->earthMoonRatio);
+    for (int component = 0; component < 3; component++)
+    {
+      itemPosition[component] += share * moonPosition[component];
+      itemVelocity[component] += share * moonVelocity[component];
+    }
+  }
+  else if (!this->Interpolate(body, julianDate, itemPosition, itemVelocity))
+  {
+    return false;
+  }
+
+  for (int component = 0; component < 3; component++)
+  {
+    position[component] = itemPosition[component] * 1e-6;
+    velocity[component] = itemVelocity[component] / (60 * 60 * 24);
+  }
+  return true;
+}
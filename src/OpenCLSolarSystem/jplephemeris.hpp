@@ -0,0 +1,92 @@
+/*
+  Copyright 2013-2025 Michael William Simmons
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#ifndef JPLEPHEMERIS_HPP
+#define JPLEPHEMERIS_HPP
+
+/**
+ * @brief Reader for JPL planetary ephemerides in the binary DE format
+ *
+ * Each record covers a fixed number of days and holds Chebyshev coefficients for every body,
+ * split into sub intervals of the record. Positions are barycentric and equatorial (ICRF).
+ * The file stores the Earth-Moon barycentre and the geocentric Moon, Evaluate returns the Earth and Moon instead.
+ * ASCII ephemerides can be converted to binary with JPL's asc2eph.
+ */
+class JplEphemeris
+{
+public:
+  // Bodies in the order of the file's pointer table
+  enum Body
+  {
+    Mercury,
+    Venus,
+    Earth,
+    Mars,
+    Jupiter,
+    Saturn,
+    Uranus,
+    Neptune,
+    Pluto,
+    Moon,
+    Sun,
+    NumBodies
+  };
+
+  JplEphemeris();
+  ~JplEphemeris();
+
+  /**
+   * @brief Opens an ephemeris and reads its header
+   * @param fileName Binary DE file, in either byte order
+   * @return true on success
+   */
+  bool Open(wxString fileName);
+
+  void Close();                /**< Closes the ephemeris */
+  bool IsOpen();               /**< true if an ephemeris is open */
+  int Number();                /**< DE number, e.g. 440 */
+  double StartJulianDate();    /**< First date covered */
+  double EndJulianDate();      /**< Last date covered */
+  static int FindBody(wxString name); /**< Body called name, ignoring case and anything after a '-', -1 if none */
+
+  /**
+   * @brief Evaluates the barycentric state of one body
+   * @param julianDate TDB Julian date, must lie within the ephemeris
+   * @param body Body to evaluate
+   * @param position Receives x, y, z in Gm
+   * @param velocity Receives x, y, z in km/s
+   * @return true on success
+   */
+  bool Evaluate(double julianDate, int body, double *position, double *velocity);
+
+private:
+  wxFile *file;             /**< Open ephemeris or NULL */
+  bool swapBytes;           /**< The file was written with the other byte order */
+  int numde;                /**< DE number */
+  double startJulianDate;   /**< First date covered */
+  double endJulianDate;     /**< Last date covered */
+  double intervalDays;      /**< Days covered by each record */
+  double earthMoonRatio;    /**< Mass of the Earth over that of the Moon */
+  int pointers[NumBodies][3]; /**< Per body, one based first coefficient, coefficients per component and sub intervals */
+  int recordDoubles;        /**< Doubles in each record */
+  double *record;           /**< The record last read */
+  int cachedRecord;         /**< Index of the record last read, -1 if none */
+
+  bool ReadRecord(int index);
+  bool Interpolate(int item, double julianDate, double *position, double *velocity);
+  void Swap(void *value, size_t size);
+};
+
+#endif // JPLEPHEMERIS_HPP
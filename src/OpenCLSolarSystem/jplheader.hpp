@@ -0,0 +1,174 @@
+/*
+  Copyright 2013-2025 Michael William Simmons
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#ifndef JPLHEADER_HPP
+#define JPLHEADER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Offsets into the first record of a binary DE file
+#define JPL_START_OFFSET 2652   // after 3 titles of 84 characters and 400 constant names of 6
+#define JPL_NCON_OFFSET 2676    // number of constants
+#define JPL_EMRAT_OFFSET 2688   // Earth to Moon mass ratio, after the AU
+#define JPL_IPT_OFFSET 2696     // [12][3] pointers, the last for nutations
+#define JPL_NUMDE_OFFSET 2840   // DE number
+#define JPL_LPT_OFFSET 2844     // [3] pointer for librations
+#define JPL_HEADER_SIZE 2856    // followed by any constant names past 400 then pointers for later DE items
+#define JPL_EXTRA_SIZE 24       // [2][3] pointers for the later items
+
+/**
+ * @brief Parser for the header of a binary DE ephemeris
+ *
+ * The record length is not stored, so it is worked out from the pointer table.
+ * Kept apart from JplEphemeris, which reads the file with wxWidgets, so the format can be checked on the host alone.
+ */
+namespace JplHeader
+{
+  /**
+   * @brief What the first record says about the ephemeris, in the file's units
+   */
+  struct Header
+  {
+    bool swapBytes;          /**< The file was written with the other byte order */
+    int numde;               /**< DE number */
+    double startJulianDate;  /**< First date covered */
+    double endJulianDate;    /**< Last date covered */
+    double intervalDays;     /**< Days covered by each record */
+    double earthMoonRatio;   /**< Mass of the Earth over that of the Moon */
+    int ncon;                /**< Number of constants */
+    int ipt[12][3];          /**< Per item, one based first coefficient, coefficients per component and sub intervals */
+    int lpt[3];              /**< The same for librations */
+    int lastCoefficient;     /**< Last coefficient of the items above, the record length if there are no later items */
+  };
+
+  /**
+   * @brief Reverses the bytes of value if swap is true
+   */
+  inline void Swap(void *value, size_t size, bool swap)
+  {
+    if (!swap)
+    {
+      return;
+    }
+
+    unsigned char *bytes = (unsigned char *)value;
+    for (size_t i = 0; i < size / 2; i++)
+    {
+      unsigned char byte = bytes[i];
+      bytes[i] = bytes[size - 1 - i];
+      bytes[size - 1 - i] = byte;
+    }
+  }
+
+  /**
+   * @brief Reads the header from the first JPL_HEADER_SIZE bytes of the file
+   * @return false if it is not a binary DE ephemeris
+   */
+  inline bool Parse(const unsigned char *bytes, Header *header)
+  {
+    // The DE number is small, if it is not the file is in the other byte order
+    int number;
+    memcpy(&number, bytes + JPL_NUMDE_OFFSET, sizeof(int));
+    header->swapBytes = false;
+    if (number <= 0 || number > 10000)
+    {
+      header->swapBytes = true;
+      Swap(&number, sizeof(int), true);
+    }
+    header->numde = number;
+
+    double range[3];
+    memcpy(range, bytes + JPL_START_OFFSET, sizeof(range));
+    memcpy(&header->ncon, bytes + JPL_NCON_OFFSET, sizeof(int));
+    memcpy(&header->earthMoonRatio, bytes + JPL_EMRAT_OFFSET, sizeof(double));
+    memcpy(header->ipt, bytes + JPL_IPT_OFFSET, sizeof(header->ipt));
+    memcpy(header->lpt, bytes + JPL_LPT_OFFSET, sizeof(header->lpt));
+    for (int i = 0; i < 3; i++)
+    {
+      Swap(&range[i], sizeof(double), header->swapBytes);
+      Swap(&header->lpt[i], sizeof(int), header->swapBytes);
+      for (int item = 0; item < 12; item++)
+      {
+        Swap(&header->ipt[item][i], sizeof(int), header->swapBytes);
+      }
+    }
+    Swap(&header->ncon, sizeof(int), header->swapBytes);
+    Swap(&header->earthMoonRatio, sizeof(double), header->swapBytes);
+    header->startJulianDate = range[0];
+    header->endJulianDate = range[1];
+    header->intervalDays = range[2];
+
+    // Record length runs to the last coefficient of the last item. Nutations have two components, everything else three
+    header->lastCoefficient = 0;
+    for (int item = 0; item < 13; item++)
+    {
+      const int *pointer = item < 12 ? header->ipt[item] : header->lpt;
+      int end = pointer[0] - 1 + pointer[1] * pointer[2] * (item == 11 ? 2 : 3);
+      header->lastCoefficient = end > header->lastCoefficient ? end : header->lastCoefficient;
+    }
+
+    return header->numde > 0 && header->numde <= 10000 && header->intervalDays > 0.0 && header->endJulianDate > header->startJulianDate &&
+           header->earthMoonRatio > 0.0 && header->ncon >= 0 && header->lastCoefficient > 2;
+  }
+
+  /**
+   * @brief Where the pointers for items added by later ephemerides are, after any constant names past 400
+   */
+  inline std::int64_t ExtraOffset(const Header &header)
+  {
+    return JPL_HEADER_SIZE + (std::int64_t)(header.ncon > 400 ? header.ncon - 400 : 0) * 6;
+  }
+
+  /**
+   * @brief The two record lengths to try, without and with the later items
+   * @param extraBytes JPL_EXTRA_SIZE bytes read from ExtraOffset, or NULL if the file ends first
+   * @param candidates [2] receives the lengths in doubles
+   *
+   * Only the record length depends on the later items, so the caller confirms it by the first data record starting on the start date.
+   */
+  inline void RecordCandidates(const Header &header, const unsigned char *extraBytes, int *candidates)
+  {
+    int extra[2][3] = {{0, 0, 0}, {0, 0, 0}};
+    if (extraBytes != NULL)
+    {
+      memcpy(extra, extraBytes, sizeof(extra));
+      for (int item = 0; item < 2; item++)
+      {
+        for (int i = 0; i < 3; i++)
+        {
+          Swap(&extra[item][i], sizeof(int), header.swapBytes);
+        }
+      }
+    }
+
+    candidates[0] = header.lastCoefficient;
+    candidates[1] = header.lastCoefficient;
+    for (int item = 0; item < 2; item++)
+    {
+      if (extra[item][0] > 0 && extra[item][1] > 0 && extra[item][2] > 0 && extra[item][1] < 100000 && extra[item][2] < 100000)
+      {
+        std::int64_t end = extra[item][0] - 1 + (std::int64_t)extra[item][1] * extra[item][2] * 3;
+        if (end < 100000)
+        {
+          candidates[1] = (int)end > candidates[1] ? (int)end : candidates[1];
+        }
+      }
+    }
+  }
+} // namespace JplHeader
+
+#endif // JPLHEADER_HPP
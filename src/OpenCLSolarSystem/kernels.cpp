@@ -21,6 +21,100 @@ namespace Kernels
 
 #define KMTOGM 1.0/1000000
 
+// A specialised build defines SPECIALIZED_NUM_GRAV and SPECIALIZED_HISTORY_STRIDE so the loops over the bodies with mass
+// have a constant trip count and the Adams history indexing folds to constant offsets, see CLModel::specializeKernels.
+// Otherwise both come from the kernel arguments
+#ifdef SPECIALIZED_NUM_GRAV
+#define NUM_GRAV SPECIALIZED_NUM_GRAV
+#else
+#define NUM_GRAV numGrav
+#endif
+
+#ifdef SPECIALIZED_HISTORY_STRIDE
+#define HISTORY_STRIDE SPECIALIZED_HISTORY_STRIDE
+#else
+#define HISTORY_STRIDE numParticles
+#endif
+
+// Deterministic builds, defined by the host from CLModel::deterministic. Nothing is contracted into a fused multiply add
+// behind the source's back, and the inverse square root is a correctly rounded square root and divide rather than rsqrt,
+// whose accuracy is up to the vendor, so every device rounds every operation the same way
+#ifdef DETERMINISTIC
+#pragma OPENCL FP_CONTRACT OFF
+#define INV_SQRT(x) (1.0 / sqrt(x))
+#else
+#define INV_SQRT(x) rsqrt(x)
+#endif
+
+// Fixed point positions, defined by the host from CLModel::fixedPointBits. Every position is a whole number of
+// 2^-FIXED_POINT_BITS Gm, which a double holds exactly up to 2^53 units, and every displacement is rounded to the same grid,
+// so a position update is an exact integer addition and gives the same bits in any order on any device
+#ifdef FIXED_POINT_BITS
+#define FIXED_POINT_SCALE ((double)(1L << FIXED_POINT_BITS))
+#define FIXED_POINT(x) (rint((x) * FIXED_POINT_SCALE) / FIXED_POINT_SCALE)
+#else
+#define FIXED_POINT(x) (x)
+#endif
+
+// How the direct sum acceleration kernels add up the pulls of the bodies with mass other than the Sun, defined by the host
+// from CLModel::summation. Each sum is a pair of double4s, the sum and a partial:
+// ACCELERATION_SUM_PLAIN adds in order and leaves the partial at zero.
+// ACCELERATION_SUM_KAHAN keeps the Kahan compensation in the partial.
+// ACCELERATION_SUM_BLOCKED adds SUM_BLOCK_SIZE bodies into the partial then the partial into the sum, so the rounding grows
+// with the block size and the number of blocks rather than with the number of bodies.
+// ACCELERATION_SUM_MAJOR compensates the first COMPENSATED_BODIES bodies, the Sun and planets, and adds the rest, the asteroids, in order.
+// Without a choice the sums are compensated
+#if !defined(ACCELERATION_SUM_PLAIN) && !defined(ACCELERATION_SUM_BLOCKED) && !defined(ACCELERATION_SUM_MAJOR)
+#define ACCELERATION_SUM_KAHAN
+#endif
+
+#ifndef COMPENSATED_BODIES
+#define COMPENSATED_BODIES 10
+#endif
+
+#define SUM_BLOCK_SIZE 32
+
+#define KAHAN_ADD(sum, partial, term) \
+	{ \
+		double4 thisAcc = (term) - (partial); \
+		double4 total = (sum) + thisAcc; \
+		(partial) = (total - (sum)) - thisAcc; \
+		(sum) = total; \
+	}
+
+#if defined(ACCELERATION_SUM_PLAIN)
+#define ACCELERATION_SUM_ADD(sum, partial, term, gravBody) { (sum) += (term); }
+#elif defined(ACCELERATION_SUM_BLOCKED)
+#define ACCELERATION_SUM_ADD(sum, partial, term, gravBody) \
+	{ \
+		(partial) += (term); \
+		if(((gravBody) % SUM_BLOCK_SIZE) == 0) \
+		{ \
+			(sum) += (partial); \
+			(partial) = (double4)(0.0f, 0.0f, 0.0f, 0.0f); \
+		} \
+	}
+#elif defined(ACCELERATION_SUM_MAJOR)
+#define ACCELERATION_SUM_ADD(sum, partial, term, gravBody) \
+	{ \
+		if((gravBody) < COMPENSATED_BODIES) \
+		KAHAN_ADD(sum, partial, term) \
+		else \
+		{ \
+			(sum) += (term); \
+		} \
+	}
+#else
+#define ACCELERATION_SUM_ADD(sum, partial, term, gravBody) KAHAN_ADD(sum, partial, term)
+#endif
+
+// The compensation is left out of the result, the partial of a blocked sum is not
+#ifdef ACCELERATION_SUM_BLOCKED
+#define ACCELERATION_SUM_RESULT(sum, partial) ((sum) + (partial))
+#else
+#define ACCELERATION_SUM_RESULT(sum, partial) (sum)
+#endif
+
 __kernel
 void newtonian( 
 __constant double4* gravPos,
@@ -31,7 +125,8 @@ __global double4* acc)
 { 
 	unsigned int gid = get_global_id(0); 
 	double4 myPos = pos[gid]; 
-	double4 newAcc = (double4)(0.0f, 0.0f, 0.0f, 0.0f);
+	double4 sumAcc = (double4)(0.0f, 0.0f, 0.0f, 0.0f);
+	double4 partial = (double4)(0.0f, 0.0f, 0.0f, 0.0f);
 	double4 r;
 	double distSqr;
 	double invDist;
@@ -42,24 +137,24 @@ __global double4* acc)
 	r = gravPos[0] - myPos;
 	r.w =0.0;
 	distSqr = r.x * r.x + r.y * r.y + r.z * r.z;
-	invDist = rsqrt(distSqr + epsSqr); 
+	invDist = INV_SQRT(distSqr + epsSqr); 
 	invDistCube = invDist * invDist * invDist; 
 	s = gravPos[0].w * invDistCube;
 	double4 accSun= s * r; 
 	
 	//Do the rest
-	for(int gravBody = 1; gravBody < numGrav; gravBody++)
+	for(int gravBody = 1; gravBody < NUM_GRAV; gravBody++)
 	{
 		r = gravPos[gravBody] - myPos;
 		r.w =0.0;
 		distSqr = r.x * r.x + r.y * r.y + r.z * r.z;
-		invDist = rsqrt(distSqr + epsSqr); 
+		invDist = INV_SQRT(distSqr + epsSqr); 
 		invDistCube = invDist * invDist * invDist; 
 		s = gravPos[gravBody].w * invDistCube; 
-		newAcc += s * r; 
+		ACCELERATION_SUM_ADD(sumAcc, partial, s * r, gravBody);
 	}
 	
-	acc[gid] = newAcc + accSun;
+	acc[gid] = ACCELERATION_SUM_RESULT(sumAcc, partial) + accSun;
 }
 
 #define relativisticC1 8.86221439924785E-03
@@ -87,1226 +182,1127 @@ __global double4* acc)
 	r = gravPos[0] - myPos;
 	r.w =0.0;
 	distSqr = r.x * r.x + r.y * r.y + r.z * r.z;
-	invDist = rsqrt(distSqr + epsSqr); 
+	invDist = INV_SQRT(distSqr + epsSqr); 
 	invDistCube = invDist * invDist * invDist; 
 	s = gravPos[0].w * invDistCube;
 	s = s * (1.0 + myVel.w + (relativisticC1*invDist));
 	double4 accSun= s * r;
 	
     //Do the rest
-	double4 compensation = (double4)(0.0f, 0.0f, 0.0f, 0.0f);
-	for(int gravBody = 1; gravBody < numGrav; gravBody++)
+	double4 partial = (double4)(0.0f, 0.0f, 0.0f, 0.0f);
+	for(int gravBody = 1; gravBody < NUM_GRAV; gravBody++)
 	{
 		r = gravPos[gravBody] - myPos;
 		r.w =0.0;
 		distSqr = r.x * r.x + r.y * r.y + r.z * r.z;
-		invDist = rsqrt(distSqr + epsSqr); 
+		invDist = INV_SQRT(distSqr + epsSqr); 
 		invDistCube = invDist * invDist * invDist; 
 		s = gravPos[gravBody].w * invDistCube;
-		
-		double4 thisAcc = (s * r) - compensation;
-		double4 total = sumAcc + thisAcc;
-		compensation = (total - sumAcc ) - thisAcc;
-		sumAcc = total; 
+		ACCELERATION_SUM_ADD(sumAcc, partial, s * r, gravBody);
 	}
 	
-	acc[gid] = sumAcc + accSun;
+	acc[gid] = ACCELERATION_SUM_RESULT(sumAcc, partial) + accSun;
+}
+
+// Compensated add of one pair's contribution to a body's acceleration
+void pairAdd(__global double4* acc, __global double4* compensation, int body, double4 term)
+{
+	double4 thisAcc = term - compensation[body];
+	double4 total = acc[body] + thisAcc;
+	compensation[body] = (total - acc[body]) - thisAcc;
+	acc[body] = total;
 }
 
+// Accelerations of the bodies with mass from each other, each pair computed once and applied to both bodies.
+// A body never sees itself and there is no softening. Run as a single work-group: the pairs are scheduled round robin
+// (the circle method), so the pairs of a round are disjoint and every work-item updates its own two bodies.
+// With relativistic set the Sun's pull carries the correction, as in the relativistic kernel. It runs after the
+// acceleration kernel and overwrites the acceleration of the bodies with mass
 __kernel
-void relativisticLocal( 
+void gravPairs(
+__global const double4* gravPos,
+__global const double4* vel,
+int numGrav,
+int relativistic,
+__global double4* acc,
+__global double4* compensation)
+{
+	int lid = get_local_id(0);
+	int localSize = get_local_size(0);
+	int numSlots = NUM_GRAV + (NUM_GRAV & 1);
+	
+	for(int body = lid; body < NUM_GRAV; body += localSize)
+	{
+		acc[body] = (double4)(0.0f, 0.0f, 0.0f, 0.0f);
+		compensation[body] = (double4)(0.0f, 0.0f, 0.0f, 0.0f);
+	}
+	barrier(CLK_GLOBAL_MEM_FENCE);
+	
+	for(int round = 0; round < numSlots - 1; round++)
+	{
+		for(int pair = lid; pair < numSlots / 2; pair += localSize)
+		{
+			int a = pair == 0 ? round : (round + pair) % (numSlots - 1);
+			int b = pair == 0 ? numSlots - 1 : (round - pair + numSlots - 1) % (numSlots - 1);
+			
+			// an odd number of bodies leaves one of them out of each round
+			if(a < NUM_GRAV && b < NUM_GRAV)
+			{
+				double4 r = gravPos[b] - gravPos[a];
+				r.w =0.0;
+				double distSqr = r.x * r.x + r.y * r.y + r.z * r.z;
+				double invDist = 1.0 / sqrt(distSqr);
+				double invDistCube = invDist * invDist * invDist;
+				double sa = gravPos[b].w * invDistCube;
+				double sb = gravPos[a].w * invDistCube;
+				if(relativistic)
+				{
+					if(b == 0)
+					{
+						sa = sa * (1.0 + vel[a].w + (relativisticC1*invDist));
+					}
+					else if(a == 0)
+					{
+						sb = sb * (1.0 + vel[b].w + (relativisticC1*invDist));
+					}
+				}
+				pairAdd(acc, compensation, a, sa * r);
+				pairAdd(acc, compensation, b, -sb * r);
+			}
+		}
+		barrier(CLK_GLOBAL_MEM_FENCE);
+	}
+}
+
+// The Blocked acceleration kernels compute ACCELERATION_BLOCK particles per work-item, defined by the host when
+// CLModel::particlesPerWorkItem is more than one. Each body with mass is read once and used for every particle of the block.
+// The particles of a work-item are a global size apart, so neighbouring work-items still read neighbouring particles.
+// Only the first numTargets particles are written, the others in the last stride recompute the last particle
+#ifdef ACCELERATION_BLOCK
+__kernel
+void newtonianBlocked( 
 __constant double4* gravPos,
-__global double4* pos,
-__global double4* vel,
+__global double4* pos, 
 int numGrav, 
 double epsSqr, 
 __global double4* acc,
-__local double4* localGravPos) 
+int numTargets) 
 { 
-	uint gid = get_global_id(0);
-	uint lid = get_local_id(0); 
-	double4 myPos = pos[gid];
-	double4 myVel = vel[gid];
-
+	unsigned int gid = get_global_id(0); 
+	unsigned int stride = get_global_size(0);
+	double4 myPos[ACCELERATION_BLOCK];
+	double4 sumAcc[ACCELERATION_BLOCK];
+	double4 partial[ACCELERATION_BLOCK];
+	double4 accSun[ACCELERATION_BLOCK];
 	double4 r;
 	double distSqr;
 	double invDist;
 	double invDistCube;
 	double s;
 	
-	uint blockSize = get_local_size(0);
-	uint numBlocks = 1 + (numGrav/blockSize);
-	double4 newAcc = (double4)(0.0f, 0.0f, 0.0f, 0.0f);
-	double4 accSun = (double4)(0.0f, 0.0f, 0.0f, 0.0f);
-    double4 gravPosN;
-	uint gravPosToLoad;
+	#pragma unroll
+	for(int particle = 0; particle < ACCELERATION_BLOCK; particle++)
+	{
+		myPos[particle] = pos[min(gid + particle * stride, (unsigned int)numTargets - 1)];
+		sumAcc[particle] = (double4)(0.0f, 0.0f, 0.0f, 0.0f);
+		partial[particle] = (double4)(0.0f, 0.0f, 0.0f, 0.0f);
+	}
 	
-	for(uint block = 0; block < numBlocks; block++)
+	// Do the Sun
+	double4 body = gravPos[0];
+	#pragma unroll
+	for(int particle = 0; particle < ACCELERATION_BLOCK; particle++)
 	{
-		gravPosToLoad = block*numBlocks+lid;
-		if(gravPosToLoad < numGrav)
-		{
-			localGravPos[lid] = gravPos[gravPosToLoad];
-		}
-		
-		barrier(CLK_LOCAL_MEM_FENCE);
-		uint start = 0;
-		if(block == 0)
+		r = body - myPos[particle];
+		r.w =0.0;
+		distSqr = r.x * r.x + r.y * r.y + r.z * r.z;
+		invDist = INV_SQRT(distSqr + epsSqr); 
+		invDistCube = invDist * invDist * invDist; 
+		s = body.w * invDistCube;
+		accSun[particle] = s * r;
+	}
+	
+	//Do the rest
+	for(int gravBody = 1; gravBody < NUM_GRAV; gravBody++)
+	{
+		body = gravPos[gravBody];
+		#pragma unroll
+		for(int particle = 0; particle < ACCELERATION_BLOCK; particle++)
 		{
-			// Do the Sun
-			gravPosN =localGravPos[0];
-			r = gravPosN - myPos;
+			r = body - myPos[particle];
 			r.w =0.0;
 			distSqr = r.x * r.x + r.y * r.y + r.z * r.z;
-			invDist = rsqrt(distSqr + epsSqr); 
+			invDist = INV_SQRT(distSqr + epsSqr); 
 			invDistCube = invDist * invDist * invDist; 
-			s = gravPosN.w * invDistCube;
-			s = s * (1.0 + myVel.w + (relativisticC1*invDist));
-			accSun= s * r;
-			start = 1;
+			s = body.w * invDistCube; 
+			ACCELERATION_SUM_ADD(sumAcc[particle], partial[particle], s * r, gravBody);
 		}
-		for( uint gravBody = start ;gravBody < blockSize && (block*numBlocks + gravBody) < numGrav; gravBody++)
+	}
+	
+	#pragma unroll
+	for(int particle = 0; particle < ACCELERATION_BLOCK; particle++)
+	{
+		if(gid + particle * stride < (unsigned int)numTargets)
 		{
-			//Do the rest
-			gravPosN =localGravPos[gravBody];
-			r = gravPosN - myPos;
-			r.w =0.0;
-			distSqr = r.x * r.x + r.y * r.y + r.z * r.z;
-			invDist = rsqrt(distSqr + epsSqr); 
-			invDistCube = invDist * invDist * invDist; 
-			s = gravPosN.w * invDistCube; 
-			newAcc += s * r;
+			acc[gid + particle * stride] = ACCELERATION_SUM_RESULT(sumAcc[particle], partial[particle]) + accSun[particle];
 		}
-	    barrier(CLK_LOCAL_MEM_FENCE);
 	}
-	acc[gid] = newAcc + accSun;
 }
 
 __kernel
-void copyToDisplay(
+void relativisticBlocked( 
 __constant double4* gravPos,
 __global double4* pos,
-__global float4* dispPos,
-int centerBodyIndex) 
+__global double4* vel,
+int numGrav, 
+double epsSqr, 
+__global double4* acc,
+int numTargets) 
 { 
-	double4 dispPosDouble;
-	float4 dispPosFloat;
-	unsigned int gid = get_global_id(0);
-	dispPosDouble = pos[gid] - gravPos[centerBodyIndex];
+	unsigned int gid = get_global_id(0); 
+	unsigned int stride = get_global_size(0);
+	double4 myPos[ACCELERATION_BLOCK];
+	double4 sumAcc[ACCELERATION_BLOCK];
+	double4 partial[ACCELERATION_BLOCK];
+	double4 accSun[ACCELERATION_BLOCK];
+	double4 r;
+	double distSqr;
+	double invDist;
+	double invDistCube;
+	double s;
 	
-	dispPosFloat.x = (float) dispPosDouble.x;
-	dispPosFloat.y = (float) dispPosDouble.y;
-	dispPosFloat.z = (float) dispPosDouble.z;
-	dispPosFloat.w = (float) dispPosDouble.w;
+	// Do the Sun
+	double4 body = gravPos[0];
+	#pragma unroll
+	for(int particle = 0; particle < ACCELERATION_BLOCK; particle++)
+	{
+		unsigned int index = min(gid + particle * stride, (unsigned int)numTargets - 1);
+		myPos[particle] = pos[index];
+		double4 myVel = vel[index];
+		sumAcc[particle] = (double4)(0.0f, 0.0f, 0.0f, 0.0f);
+		partial[particle] = (double4)(0.0f, 0.0f, 0.0f, 0.0f);
+		
+		r = body - myPos[particle];
+		r.w =0.0;
+		distSqr = r.x * r.x + r.y * r.y + r.z * r.z;
+		invDist = INV_SQRT(distSqr + epsSqr); 
+		invDistCube = invDist * invDist * invDist; 
+		s = body.w * invDistCube;
+		s = s * (1.0 + myVel.w + (relativisticC1*invDist));
+		accSun[particle] = s * r;
+	}
 	
-	dispPos[gid] = dispPosFloat;
+	//Do the rest
+	for(int gravBody = 1; gravBody < NUM_GRAV; gravBody++)
+	{
+		body = gravPos[gravBody];
+		#pragma unroll
+		for(int particle = 0; particle < ACCELERATION_BLOCK; particle++)
+		{
+			r = body - myPos[particle];
+			r.w =0.0;
+			distSqr = r.x * r.x + r.y * r.y + r.z * r.z;
+			invDist = INV_SQRT(distSqr + epsSqr); 
+			invDistCube = invDist * invDist * invDist; 
+			s = body.w * invDistCube;
+			ACCELERATION_SUM_ADD(sumAcc[particle], partial[particle], s * r, gravBody);
+		}
+	}
+	
+	#pragma unroll
+	for(int particle = 0; particle < ACCELERATION_BLOCK; particle++)
+	{
+		if(gid + particle * stride < (unsigned int)numTargets)
+		{
+			acc[gid + particle * stride] = ACCELERATION_SUM_RESULT(sumAcc[particle], partial[particle]) + accSun[particle];
+		}
+	}
 }
-
-__kernel void rungeKutta4Startup(
-    __global double4* pos,
-    __global double4* vel,
-    __global double4* acc,
-    double deltaTime,
-    __global double4* newPos,
-    __global double4* newVel,
-    int stage,
-    int step,
-    int numParticles,
-    __global double4* posLast,
-    __global double4* velLast,
-    __global double4* velHistory,
-    __global double4* accHistory,
-    __global double4* k1,
-    __global double4* k2,
-    __global double4* k3,
-    __global double4* k4)
+#endif // ACCELERATION_BLOCK
+
+// The Subgroup acceleration kernels read the bodies with mass from global memory a sub-group at a time: each lane loads
+// one body of the block, a single coalesced read, and the block is then handed to every lane with sub-group broadcasts
+// rather than each lane reading it again. The bodies are summed in the same order as the other kernels.
+// CLModel defines SUBGROUP_BROADCAST from cl_intel_subgroups or cl_khr_subgroups when the device has one of them
+#ifdef SUBGROUP_BROADCAST
+double4 subgroupBody(double4 lanePos, uint gravBody)
 {
-    unsigned int gid = get_global_id(0);
-    double4 position = pos[gid];
-    double4 velocity = vel[gid];
-    double4 acceleration = acc[gid];
-    
-    // Determine which RK4 substep we're on
-    int substep = step & 0x3;  // step % 4
-    long mainStep = step >> 2; // step / 4
-    
-    if(substep == 0) {
-        // First RK4 step - store k1
-        k1[gid] = velocity;          // k1_pos
-        k1[gid + numParticles] = acceleration;  // k1_vel
-        
-        // Calculate intermediate position for next substep
-        double4 pos_mid = position + (deltaTime * 0.5) * velocity * (KMTOGM);
-        newPos[gid] = pos_mid;
-        newVel[gid] = velocity + (deltaTime * 0.5) * acceleration;
-    }
-    else if(substep == 1) {
-        // Second RK4 step - store k2
-        k2[gid] = velocity;          // k2_pos
-        k2[gid + numParticles] = acceleration;  // k2_vel
-        
-        // Calculate intermediate position for next substep
-        double4 pos_mid = position + (deltaTime * 0.5) * velocity * (KMTOGM);
-        newPos[gid] = pos_mid;
-        newVel[gid] = velocity + (deltaTime * 0.5) * acceleration;
-    }
-    else if(substep == 2) {
-        // Third RK4 step - store k3
-        k3[gid] = velocity;          // k3_pos
-        k3[gid + numParticles] = acceleration;  // k3_vel
-        
-        // Calculate final position for last substep
-        double4 pos_end = position + deltaTime * velocity * (KMTOGM);
-        newPos[gid] = pos_end;
-        newVel[gid] = velocity + deltaTime * acceleration;
-    }
-    else {
-        // Fourth RK4 step - calculate final values
-        k4[gid] = velocity;          // k4_pos
-        k4[gid + numParticles] = acceleration;  // k4_vel
-        
-        // Save history for Adams-Bashforth bootstrap
-        velLast[gid] = vel[gid];
-        posLast[gid] = pos[gid];
-        
-        long historyIndex = (mainStep & 0xF) * numParticles + gid;
-        velHistory[historyIndex] = velocity;
-        accHistory[historyIndex] = acceleration;
-        
-        // Calculate final position and velocity using all k values
-        double4 newPosition = pos[gid] + (deltaTime/6.0) * 
-            (k1[gid] + 2.0*k2[gid] + 2.0*k3[gid] + k4[gid]) * (KMTOGM);
-        
-        double4 newVelocity = vel[gid] + (deltaTime/6.0) * 
-            (k1[gid + numParticles] + 2.0*k2[gid + numParticles] + 
-             2.0*k3[gid + numParticles] + k4[gid + numParticles]);
-        
-        // Preserve mass and relativistic parameter
-        newPosition.w = position.w;
-        newVelocity.w = velocity.w;
-        
-        // Store final results
-        newPos[gid] = newPosition;
-        newVel[gid] = newVelocity;
-    }
+	double4 body;
+	body.x = SUBGROUP_BROADCAST(lanePos.x, gravBody);
+	body.y = SUBGROUP_BROADCAST(lanePos.y, gravBody);
+	body.z = SUBGROUP_BROADCAST(lanePos.z, gravBody);
+	body.w = SUBGROUP_BROADCAST(lanePos.w, gravBody);
+	return body;
 }
 
-#define B2C1 1.500000000000000000
-#define B2C2 -0.50000000000000000
-#define M2C1 0.500000000000000000
-#define M2C2 0.500000000000000000
-
-#define B4C1  2.291666666666666666666666666666666666
-#define B4C2 -2.458333333333333333333333333333333333
-#define B4C3  1.541666666666666666666666666666666666
-#define B4C4 -0.375000000000000000000000000000000000
-
-#define M4C1  0.375000000000000000000000000000000000
-#define M4C2  0.791666666666666666666666666666666666
-#define M4C3 -0.208333333333333333333333333333333333
-#define M4C4  0.041666666666666666666666666666666666
-
-#define B8C1   3.589955357142857142857142857142857142
-#define B8C2  -9.525206679894179894179894179894179894
-#define B8C3  18.054538690476190476190476190476190476
-#define B8C4 -22.027752976190476190476190476190476190
-#define B8C5  17.379654431216931216931216931216931216
-#define B8C6  -8.612127976190476190476190476190476190
-#define B8C7   2.445163690476190476190476190476190476
-#define B8C8  -0.304224537037037037037037037037037037
-
-#define M8C1   0.304224537037037037037037037037037037
-#define M8C2   1.156159060846560846560846560846560846
-#define M8C3  -1.006919642857142857142857142857142857
-#define M8C4   1.017964616402116402116402116402116402
-#define M8C5  -0.732035383597883597883597883597883597
-#define M8C6   0.343080357142857142857142857142857142
-#define M8C7  -0.093840939153439153439153439153439153
-#define M8C8   0.011367394179894179894179894179894179
-
-#define B10C1   4.171798804012345679012345679012345679
-#define B10C2 -14.466929701278659611992945326278659611
-#define B10C3  36.641958774250440917107583774250440917
-#define B10C4 -62.646298500881834215167548500881834215
-#define B10C5  74.179320712081128747795414462081128747
-#define B10C6 -61.283642250881834215167548500881834215
-#define B10C7  34.807405202821869488536155202821869488
-#define B10C8 -12.994284611992945326278659611992945326
-#define B10C9   2.877647018298059964726631393298059964
-#define B10C10 -0.286975446428571428571428571428571428
-
-#define M10C1   0.286975446428571428571428571428571428
-#define M10C2   1.302044339726631393298059964726631393
-#define M10C3  -1.553034611992945326278659611992945326
-#define M10C4   2.204905202821869488536155202821869488
-#define M10C5  -2.381454750881834215167548500881834215
-#define M10C6   1.861508212081128747795414462081128747
-#define M10C7  -1.018798500881834215167548500881834215
-#define M10C8   0.370351631393298059964726631393298059
-#define M10C9  -0.080389522707231040564373897707231040
-#define M10C10  0.007892554012345679012345679012345679
-
-#define B11C1    4.451988400456282400726845171289615734
-#define B11C2  -17.268825665718026829137940249051360162
-#define B11C3   49.250490614227593394260060926727593394
-#define B11C4  -96.269050074154240820907487574154240820
-#define B11C5  133.019135965307840307840307840307840307
-#define B11C6 -131.891420554753888087221420554753888087
-#define B11C7   93.647220456048581048581048581048581048
-#define B11C8  -46.617036185265351932018598685265351932
-#define B11C9   15.486178858275212441879108545775212441
-#define B11C10   -3.088871410867938645716423494201271979
-#define B11C11    0.280189596443936721714499492277270055
-
-#define M11C1    0.280189596443936721714499492277270055
-#define M11C2    1.369902839572978461867350756239645128
-#define M11C3   -1.858397861301507134840468173801507134
-#define M11C4    3.019207200978034311367644700978034311
-#define M11C5   -3.806483247655122655122655122655122655
-#define M11C6    3.571542408209074875741542408209074875
-#define M11C7   -2.443826997655122655122655122655122655
-#define M11C8    1.184653629549462882796216129549462882
-#define M11C9   -0.385752772015792849126182459515792849
-#define M11C10    0.075751053858692747581636470525359414
-#define M11C11   -0.006785849984634706856929079151301373
-
-#define B12C1    4.726253940487881460103682325904548126
-#define B12C2  -20.285746606065616482283148949815616482
-#define B12C3   64.335095315965541659986104430548874993
-#define B12C4 -141.522864179368085618085618085618085618
-#define B12C5  223.526764175735529902196568863235529902
-#define B12C6 -258.602100049352653519320185986852653519
-#define B12C7  220.357899950647346480679814013147346480
-#define B12C8 -137.124664395693041526374859708193041526
-#define B12C9   60.739992963489057239057239057239057239
-#define B12C10  -18.173476112605886911442466998022553578
-#define B12C11    3.297110536791526374859708193041526374
-#define B12C12   -0.274265540031599059376837154614932392
-
-#define M12C1    0.274265540031599059376837154614932392
-#define M12C2    1.435067460108692747581636470525359414
-#define M12C3   -2.184220963980078563411896745230078563
-#define M12C4    3.996676509013748597081930415263748597
-#define M12C5   -5.761421863726551226551226551226551226
-#define M12C6    6.308456470709074875741542408209074875
-#define M12C7   -5.180741060155122655122655122655122655
-#define M12C8    3.139592245620891454224787558120891454
-#define M12C9   -1.363222080051507134840468173801507134
-#define M12C10    0.401574156537264176153065041953930842
-#define M12C11   -0.071950470520348992571214793437015659
-#define M12C12    0.005924056412337662337662337662337662
-
-#define B16C1     5.776080028330126933659781984296975478
-#define B16C2   -34.437212290517538206168056256239677756
-#define B16C3   153.295313563544223903709132986028929591
-#define B16C4  -487.624165234214119606673619019298031643
-#define B16C5  1155.966252758585158844886578572645592045
-#define B16C6 -2102.383615302252961827063458456756516721
-#define B16C7  2986.586096092599207006862430142853423276
-#define B16C8 -3345.962146803640596785024695077605130515
-#define B16C9  2964.670665491647888979651545789111926678
-#define B16C10 -2069.993131887207256044750533286688489510
-#define B16C11 1126.751450793321070254905131448341324884
-#define B16C12 -468.674127888398662742109611598147753350
-#define B16C13  143.998829364498292156884529018567819273
-#define B16C14  -30.818758034463882040904748135788700162
-#define B16C15    4.104778844743438324649744402830822583
-#define B16C16   -0.256309496574389152514152514152514152
-
-#define M16C1      0.256309496574389152514152514152514152
-#define M16C2      1.675128083139900493433341757856749038
-#define M16C3     -3.680072701590839904469754557937979454
-#define M16C4      9.761995481886298495783725060621004183
-#define M16C5    -21.140881468825862030916043261722274067
-#define M16C6     36.406371721653340663068396754463773864
-#define M16C7    -49.857166734544628493730125123423183387
-#define M16C8     54.405455281587302244957668238091518514
-#define M16C9    -47.258925891252203927881837934747987658
-#define M16C10    32.490024680635984217746783884350021916
-#define M16C11   -17.466683319498922711417199953355156177
-#define M16C12     7.191569756389252073086949630159506702
-#define M16C13    -2.190844123010405166352035840571995774
-#define M16C14     0.465511282840366748959121093159893865
-#define M16C15    -0.061618445537183739206446437487001860
-#define M16C16     0.003826899553211884423304176390596143
-
 __kernel
-void adamsStartup( 
+void newtonianSubgroup( 
+__global const double4* gravPos,
 __global double4* pos, 
-__global double4* vel,
-__global double4* acc, 
-double deltaTime, 
-__global double4* newPos, 
-__global double4* newVel,
-int stage,
-int step,
-int numParticles,
-__global double4* posLast,
-__global double4* velLast,
-__global double4* velHistory,
-__global double4* accHistory)
-{
-	unsigned int gid = get_global_id(0);
-	double4 position = pos[gid]; 
-	double4 velocity = vel[gid];
-	double4 acceleration = acc[gid];
-	long index;
-	double4 newPosition;
-	double4 newVelocity;
-	double4 sum;
-	double4 f;
+int numGrav, 
+double epsSqr, 
+__global double4* acc) 
+{ 
+	unsigned int gid = get_global_id(0); 
+	double4 myPos = pos[gid]; 
+	double4 sumAcc = (double4)(0.0f, 0.0f, 0.0f, 0.0f);
+	double4 partial = (double4)(0.0f, 0.0f, 0.0f, 0.0f);
+	double4 r;
+	double distSqr;
+	double invDist;
+	double invDistCube;
+	double s;
 	
-	int order = step > 1? (step > 16? 4 : 2) : 1;
+	// Do the Sun
+	r = gravPos[0] - myPos;
+	r.w =0.0;
+	distSqr = r.x * r.x + r.y * r.y + r.z * r.z;
+	invDist = INV_SQRT(distSqr + epsSqr); 
+	invDistCube = invDist * invDist * invDist; 
+	s = gravPos[0].w * invDistCube;
+	double4 accSun= s * r; 
 	
-	if (stage == 1)
+	//Do the rest a sub-group sized block at a time
+	int lane = (int)get_sub_group_local_id();
+	int laneCount = (int)get_sub_group_size();
+	for(int blockStart = 1; blockStart < NUM_GRAV; blockStart += laneCount)
 	{
-		// Adams-Bashford Predictor
-		// acceleration
-		if(order == 1)
-		{
-			f = acceleration;
-			sum = 1.0 * f;
-		}
-		else if (order == 2)
+		int blockCount = min(laneCount, NUM_GRAV - blockStart);
+		double4 lanePos = gravPos[blockStart + min(lane, blockCount - 1)];
+		for(int gravBody = 0; gravBody < blockCount; gravBody++)
 		{
-			f = acceleration;
-			sum = B2C1 * f;
-			
-			index = ((step-1) & 0xF) * numParticles + gid;
-			f = accHistory[index];
-			sum = fma(B2C2,f,sum); //sum += B2C2 * f;
+			double4 body = subgroupBody(lanePos, (uint)gravBody);
+			r = body - myPos;
+			r.w =0.0;
+			distSqr = r.x * r.x + r.y * r.y + r.z * r.z;
+			invDist = INV_SQRT(distSqr + epsSqr); 
+			invDistCube = invDist * invDist * invDist; 
+			s = body.w * invDistCube; 
+			ACCELERATION_SUM_ADD(sumAcc, partial, s * r, blockStart + gravBody);
 		}
-		else
-		{
-			f = acceleration;
-			sum = B4C1 * f;
-			
-			index = ((step-1) & 0xF) * numParticles + gid;
-			f = accHistory[index];
-			sum = fma(B4C2,f,sum); //sum += B4C2 * f;
-			
-			index = ((step-2) & 0xF) * numParticles + gid;
-			f = accHistory[index];
-			sum = fma(B4C3,f,sum); //sum += B4C3 * f;
-
-			index = ((step-3) & 0xF) * numParticles + gid;
-			f = accHistory[index];
-			sum = fma(B4C4,f,sum); //sum += B4C4 * f;
-		}
-		
-		newVelocity = velocity + deltaTime * sum;
-		velLast[gid] = velocity;
+	}
+	
+	acc[gid] = ACCELERATION_SUM_RESULT(sumAcc, partial) + accSun;
+}
 
-		// --------------------------------------------
-		// position
-		if(order == 1)
-		{
-			f = velocity;
-			sum = 1.0 * f;
-		}
-		else if (order == 2)
-		{
-			f = velocity;
-			sum = B2C1 * f;
-			
-			index = ((step-1) & 0xF) * numParticles + gid;
-			f = velHistory[index];
-			sum = fma(B2C2,f,sum); //sum += B2C2 * f;
-		}
-		else
+__kernel
+void relativisticSubgroup( 
+__global const double4* gravPos,
+__global double4* pos,
+__global double4* vel,
+int numGrav, 
+double epsSqr, 
+__global double4* acc) 
+{ 
+	unsigned int gid = get_global_id(0); 
+	double4 myPos = pos[gid];
+	double4 myVel = vel[gid];
+	double4 sumAcc = (double4)(0.0f, 0.0f, 0.0f, 0.0f);
+	double4 r;
+	double distSqr;
+	double invDist;
+	double invDistCube;
+	double s;
+	
+	// Do the Sun
+	r = gravPos[0] - myPos;
+	r.w =0.0;
+	distSqr = r.x * r.x + r.y * r.y + r.z * r.z;
+	invDist = INV_SQRT(distSqr + epsSqr); 
+	invDistCube = invDist * invDist * invDist; 
+	s = gravPos[0].w * invDistCube;
+	s = s * (1.0 + myVel.w + (relativisticC1*invDist));
+	double4 accSun= s * r;
+	
+	//Do the rest a sub-group sized block at a time
+	double4 partial = (double4)(0.0f, 0.0f, 0.0f, 0.0f);
+	int lane = (int)get_sub_group_local_id();
+	int laneCount = (int)get_sub_group_size();
+	for(int blockStart = 1; blockStart < NUM_GRAV; blockStart += laneCount)
+	{
+		int blockCount = min(laneCount, NUM_GRAV - blockStart);
+		double4 lanePos = gravPos[blockStart + min(lane, blockCount - 1)];
+		for(int gravBody = 0; gravBody < blockCount; gravBody++)
 		{
-			f = velocity;
-			sum = B4C1 * f;
-			
-			index = ((step-1) & 0xF) * numParticles + gid;
-			f = velHistory[index];
-			sum = fma(B4C2,f,sum); //sum += B4C2 * f;
-			
-			index = ((step-2) & 0xF) * numParticles + gid;
-			f = velHistory[index];
-			sum = fma(B4C3,f,sum); //sum += B4C3 * f;
-			
-			index = ((step-3) & 0xF) * numParticles + gid;
-			f = velHistory[index];
-			sum = fma(B4C4,f,sum); //sum += B4C4 * f;
+			double4 body = subgroupBody(lanePos, (uint)gravBody);
+			r = body - myPos;
+			r.w =0.0;
+			distSqr = r.x * r.x + r.y * r.y + r.z * r.z;
+			invDist = INV_SQRT(distSqr + epsSqr); 
+			invDistCube = invDist * invDist * invDist; 
+			s = body.w * invDistCube;
+			ACCELERATION_SUM_ADD(sumAcc, partial, s * r, blockStart + gravBody);
 		}
-		
-		newPosition = position + deltaTime * sum * (KMTOGM);
-		posLast[gid] = position;
-		
-		index = ((step) & 0xF) * numParticles + gid;
-		//velocity.w = (double) step;
-		velHistory[index] = velocity;
-		//acceleration.w = (double)step;
-		accHistory[index] = acceleration;
 	}
-	else
+	
+	acc[gid] = ACCELERATION_SUM_RESULT(sumAcc, partial) + accSun;
+}
+#endif // SUBGROUP_BROADCAST
+
+// The Local acceleration kernels stage the bodies with mass through local memory a tile of tileSize bodies at a time,
+// for when there are more of them than fit in constant memory. Each tile is copied by the whole work-group with
+// async_work_group_copy, so tileSize is independent of the work-group size. They give the same sums as the constant memory kernels.
+// CLModel switches to them automatically when numGrav bodies exceed the device's constant buffer
+__kernel
+void newtonianLocal( 
+__global const double4* gravPos,
+__global double4* pos, 
+int numGrav, 
+double epsSqr, 
+__global double4* acc,
+__local double4* gravTile,
+int tileSize) 
+{ 
+	unsigned int gid = get_global_id(0); 
+	double4 myPos = pos[gid]; 
+	double4 sumAcc = (double4)(0.0f, 0.0f, 0.0f, 0.0f);
+	double4 partial = (double4)(0.0f, 0.0f, 0.0f, 0.0f);
+	double4 r;
+	double distSqr;
+	double invDist;
+	double invDistCube;
+	double s;
+	
+	// Do the Sun
+	double4 sunPos = gravPos[0];
+	r = sunPos - myPos;
+	r.w =0.0;
+	distSqr = r.x * r.x + r.y * r.y + r.z * r.z;
+	invDist = INV_SQRT(distSqr + epsSqr); 
+	invDistCube = invDist * invDist * invDist; 
+	s = sunPos.w * invDistCube;
+	double4 accSun= s * r; 
+	
+	//Do the rest a tile at a time
+	for(int tileStart = 1; tileStart < NUM_GRAV; tileStart += tileSize)
 	{
-		// Adams-Moulton corrector
-		// acceleration -> velocity
+		int tileCount = min(tileSize, NUM_GRAV - tileStart);
+		event_t copied = async_work_group_copy(gravTile, gravPos + tileStart, (size_t)tileCount, 0);
+		wait_group_events(1, &copied);
 		
-		if(order == 1)
-		{
-			f = acceleration;
-			sum = 1.0 * f;
-		}
-		else if (order == 2)
-		{
-			f = acceleration;
-			sum = M2C1 * f;
-			
-			index = ((step) & 0xF) * numParticles + gid;
-			f = accHistory[index];
-			sum = fma(M2C2,f,sum); //sum += M2C2 * f;
-		}
-		else
+		for(int gravBody = 0; gravBody < tileCount; gravBody++)
 		{
-			f = acceleration;
-			sum = M4C1 * f;
-			
-			index = ((step) & 0xF) * numParticles + gid;
-			f = accHistory[index];
-			sum = fma(M4C2,f,sum); //sum += M4C2 * f;
-			
-			index = ((step-1) & 0xF) * numParticles + gid;
-			f = accHistory[index];
-			sum = fma(M4C3,f,sum); //sum += M4C3 * f;
-			
-			index = ((step-2) & 0xF) * numParticles + gid;
-			f = accHistory[index];
-			sum = fma(M4C4,f,sum); //sum += M4C4 * f;
+			r = gravTile[gravBody] - myPos;
+			r.w =0.0;
+			distSqr = r.x * r.x + r.y * r.y + r.z * r.z;
+			invDist = INV_SQRT(distSqr + epsSqr); 
+			invDistCube = invDist * invDist * invDist; 
+			s = gravTile[gravBody].w * invDistCube; 
+			ACCELERATION_SUM_ADD(sumAcc, partial, s * r, tileStart + gravBody);
 		}
 		
-		// Store corrected velocity
-		newVelocity = velLast[gid] + deltaTime * sum;
+		// the next copy overwrites the tile
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	
+	acc[gid] = ACCELERATION_SUM_RESULT(sumAcc, partial) + accSun;
+}
+
+__kernel
+void relativisticLocal( 
+__global const double4* gravPos,
+__global double4* pos,
+__global double4* vel,
+int numGrav, 
+double epsSqr, 
+__global double4* acc,
+__local double4* gravTile,
+int tileSize) 
+{ 
+	unsigned int gid = get_global_id(0); 
+	double4 myPos = pos[gid];
+	double4 myVel = vel[gid];
+	double4 sumAcc = (double4)(0.0f, 0.0f, 0.0f, 0.0f);
+	double4 r;
+	double distSqr;
+	double invDist;
+	double invDistCube;
+	double s;
+	
+	// Do the Sun
+	double4 sunPos = gravPos[0];
+	r = sunPos - myPos;
+	r.w =0.0;
+	distSqr = r.x * r.x + r.y * r.y + r.z * r.z;
+	invDist = INV_SQRT(distSqr + epsSqr); 
+	invDistCube = invDist * invDist * invDist; 
+	s = sunPos.w * invDistCube;
+	s = s * (1.0 + myVel.w + (relativisticC1*invDist));
+	double4 accSun= s * r;
+	
+	//Do the rest a tile at a time
+	double4 partial = (double4)(0.0f, 0.0f, 0.0f, 0.0f);
+	for(int tileStart = 1; tileStart < NUM_GRAV; tileStart += tileSize)
+	{
+		int tileCount = min(tileSize, NUM_GRAV - tileStart);
+		event_t copied = async_work_group_copy(gravTile, gravPos + tileStart, (size_t)tileCount, 0);
+		wait_group_events(1, &copied);
 		
-		//------------------------------
-		// velocity -> position
-		if(order == 1)
-		{
-			f = velocity;
-			sum = 1.0 * f;
-		}
-		else if (order == 2)
+		for(int gravBody = 0; gravBody < tileCount; gravBody++)
 		{
-			f = velocity;
-			sum = M2C1 * f;
-			
-			index = ((step) & 0xF) * numParticles + gid;
-			f = velHistory[index];
-			sum = fma(M2C2,f,sum); //sum += M2C2 * f;
-		}
-		else
-		{		
-			f = velocity;
-			sum = M4C1 * f;
-			
-			index = ((step) & 0xF) * numParticles + gid;
-			f = velHistory[index];
-			sum = fma(M4C2,f,sum); //sum += M4C2 * f;
-			
-			index = ((step-1) & 0xF) * numParticles + gid;
-			f = velHistory[index];
-			sum = fma(M4C3,f,sum); //sum += M4C3 * f;
-			
-			index = ((step-2) & 0xF) * numParticles + gid;
-			f = velHistory[index];
-			sum = fma(M4C4,f,sum); //sum += M4C4 * f;
+			r = gravTile[gravBody] - myPos;
+			r.w =0.0;
+			distSqr = r.x * r.x + r.y * r.y + r.z * r.z;
+			invDist = INV_SQRT(distSqr + epsSqr); 
+			invDistCube = invDist * invDist * invDist; 
+			s = gravTile[gravBody].w * invDistCube;
+			ACCELERATION_SUM_ADD(sumAcc, partial, s * r, tileStart + gravBody);
 		}
 		
-		// Store corrected position
-		newPosition = posLast[gid] + deltaTime * sum * (KMTOGM);
+		// the next copy overwrites the tile
+		barrier(CLK_LOCAL_MEM_FENCE);
 	}
 	
-	// Copy across mass and relativistic parameter
-	newPosition.w = position.w;
-	newVelocity.w = velocity.w;
-		
-	newPos[gid] = newPosition;
-	newVel[gid] = newVelocity;
+	acc[gid] = ACCELERATION_SUM_RESULT(sumAcc, partial) + accSun;
 }
 
+// Barnes-Hut tree gravity. Every stage the bodies with mass other than the Sun are sorted by the Morton code of their position
+// in their bounding box, and a binary radix tree is built over the sorted codes (Karras 2012) so every node is built in parallel.
+// Node 0 is the root, nodes 0 to numLeaves - 2 are internal and leaf i of the sorted order is node numLeaves - 1 + i.
+// treeCom holds each node's centre of mass with the total GM in w, treeMin and treeMax the box around its bodies.
+// The Sun is always summed directly, like the other acceleration kernels
+#define TREE_STACK_SIZE 64
+
+// Bounding box of bodies 1 to numGrav - 1 into treeBox[0] and treeBox[1]. Run as a single work-group
 __kernel
-void adamsBashforth12( 
-__global double4* pos, 
-__global double4* vel,
-__global double4* acc, 
-double deltaTime, 
-__global double4* newPos, 
-__global double4* newVel,
-int stage,
-int step,
-int numParticles,
-__global double4* posLast,
-__global double4* velLast,
-__global double4* velHistory,
-__global double4* accHistory)
+void treeBounds(
+__global const double4* gravPos,
+int numGrav,
+__global double4* treeBox,
+__local double4* scratchMin,
+__local double4* scratchMax)
 {
-	unsigned int gid = get_global_id(0);
-	double4 position = pos[gid]; 
-	double4 velocity = vel[gid];
-	double4 acceleration = acc[gid];
-	long index;
-	double4 newPosition;
-	double4 newVelocity;
-	double4 sum;
-	double4 f;
-	
-	// Adams-Bashford Predictor
-	// acceleration
-	f = acceleration;
-	sum = B12C1 * f;
+	unsigned int lid = get_local_id(0);
+	unsigned int localSize = get_local_size(0);
+	double4 boxMin = gravPos[1];
+	double4 boxMax = boxMin;
+	for(int body = 1 + lid; body < NUM_GRAV; body += localSize)
+	{
+		boxMin = fmin(boxMin, gravPos[body]);
+		boxMax = fmax(boxMax, gravPos[body]);
+	}
+	scratchMin[lid] = boxMin;
+	scratchMax[lid] = boxMax;
+	barrier(CLK_LOCAL_MEM_FENCE);
 	
-	index = ((step-1) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B12C2,f,sum); //sum += B12C2 * f;
+	for(unsigned int offset = 1; offset < localSize; offset *= 2)
+	{
+		if((lid % (2 * offset)) == 0 && lid + offset < localSize)
+		{
+			scratchMin[lid] = fmin(scratchMin[lid], scratchMin[lid + offset]);
+			scratchMax[lid] = fmax(scratchMax[lid], scratchMax[lid + offset]);
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
 	
-	index = ((step-2) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B12C3,f,sum); //sum += B12C3 * f;
+	if(lid == 0)
+	{
+		treeBox[0] = scratchMin[0];
+		treeBox[1] = scratchMax[0];
+	}
+}
 
-	index = ((step-3) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B12C4,f,sum); //sum += B12C4 * f;
-	
-	index = ((step-4) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B12C5,f,sum); //sum += B12C5 * f;
-	
-	index = ((step-5) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B12C6,f,sum); //sum += B12C6 * f;
+// Spreads the low 10 bits of v to every third bit
+ulong treeSpread(uint v)
+{
+	ulong x = v & 0x3ff;
+	x = (x | (x << 16)) & 0x30000ff;
+	x = (x | (x << 8)) & 0x300f00f;
+	x = (x | (x << 4)) & 0x30c30c3;
+	x = (x | (x << 2)) & 0x9249249;
+	return x;
+}
+
+// Keys are the 30 bit Morton code above the body index, so they are unique. numKeys is a power of two and the padding sorts last
+__kernel
+void treeMortonKeys(
+__global const double4* gravPos,
+int numGrav,
+__global const double4* treeBox,
+__global ulong* treeKeys,
+int numKeys)
+{
+	int gid = get_global_id(0);
+	if(gid >= numKeys)
+	{
+		return;
+	}
 	
-	index = ((step-6) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B12C7,f,sum); //sum += B12C7 * f;
+	if(gid >= NUM_GRAV - 1)
+	{
+		treeKeys[gid] = ULONG_MAX;
+		return;
+	}
 	
-	index = ((step-7) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B12C8,f,sum); //sum += B12C8 * f;
-	
-	index = ((step-8) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B12C9,f,sum); //sum += B12C9 * f;
-	
-	index = ((step-9) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B12C10,f,sum); //sum += B12C10 * f;
-	
-	index = ((step-10) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B12C11,f,sum); //sum += B12C11 * f;
-	
-	index = ((step-11) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B12C12,f,sum); //sum += B12C12 * f;
-	
-	newVelocity = velocity + deltaTime * sum;
-	velLast[gid] = velocity;
+	int body = gid + 1;
+	double4 boxMin = treeBox[0];
+	double4 extent = treeBox[1] - boxMin;
+	double size = fmax(fmax(extent.x, extent.y), extent.z);
+	double scale = size > 0.0 ? 1023.0 / size : 0.0;
+	double4 cell = (gravPos[body] - boxMin) * scale;
+	ulong morton = (treeSpread((uint)cell.x) << 2) | (treeSpread((uint)cell.y) << 1) | treeSpread((uint)cell.z);
+	treeKeys[gid] = (morton << 32) | (ulong)body;
+}
 
-	// --------------------------------------------
-	// position
-	f = velocity;
-	sum = B12C1 * f;
-	
-	index = ((step-1) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B12C2,f,sum); //sum += B12C2 * f;
-	
-	index = ((step-2) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B12C3,f,sum); //sum += B12C3 * f;
-	
-	index = ((step-3) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B12C4,f,sum); //sum += B12C4 * f;
-	
-	index = ((step-4) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B12C5,f,sum); //sum += B12C5 * f;
-	
-	index = ((step-5) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B12C6,f,sum); //sum += B12C6 * f;
-	
-	index = ((step-6) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B12C7,f,sum); //sum += B12C7 * f;
-	
-	index = ((step-7) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B12C8,f,sum); //sum += B12C8 * f;
-	
-	index = ((step-8) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B12C9,f,sum); //sum += B12C9 * f;
-	
-	index = ((step-9) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B12C10,f,sum); //sum += B12C10 * f;
-	
-	index = ((step-10) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B12C11,f,sum); //sum += B12C11 * f;
-	
-	index = ((step-11) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B12C12,f,sum); //sum += B12C12 * f;
-	
-	newPosition = position + deltaTime * sum * (KMTOGM);
-	posLast[gid] = position;
-	
-	index = ((step) & 0xF) * numParticles + gid;
-	//velocity.w = (double) step;
-	velHistory[index] = velocity;
-	//acceleration.w = (double)step;
-	accHistory[index] = acceleration;
-	
-	// Copy across mass and relativistic parameter
-	newPosition.w = position.w;
-	newVelocity.w = velocity.w;
-		
-	newPos[gid] = newPosition;
-	newVel[gid] = newVelocity;
+// One compare and exchange pass of a bitonic sort of numKeys keys, one work-item per key
+__kernel
+void treeSortStep(
+__global ulong* treeKeys,
+int stage,
+int pass)
+{
+	unsigned int i = get_global_id(0);
+	unsigned int partner = i ^ pass;
+	if(partner > i)
+	{
+		ulong a = treeKeys[i];
+		ulong b = treeKeys[partner];
+		bool ascending = (i & stage) == 0;
+		if((a > b) == ascending)
+		{
+			treeKeys[i] = b;
+			treeKeys[partner] = a;
+		}
+	}
 }
 
+// Length of the common prefix of keys i and j, -1 if j is out of range
+int treeDelta(__global const ulong* treeKeys, int numLeaves, int i, int j)
+{
+	if(j < 0 || j >= numLeaves)
+	{
+		return -1;
+	}
+	return (int)clz(treeKeys[i] ^ treeKeys[j]);
+}
 
+// Finds the range of sorted leaves internal node i covers and where it splits, one work-item per internal node
 __kernel
-void adamsMoulton11( 
-__global double4* pos, 
-__global double4* vel,
-__global double4* acc, 
-double deltaTime, 
-__global double4* newPos, 
-__global double4* newVel,
-int stage,
-int step,
-int numParticles,
-__global double4* posLast,
-__global double4* velLast,
-__global double4* velHistory,
-__global double4* accHistory)
+void treeBuild(
+__global const ulong* treeKeys,
+int numGrav,
+__global int2* treeChildren,
+__global int* treeParents,
+__global int* treeFlags)
 {
-	unsigned int gid = get_global_id(0);
-	double4 position = pos[gid]; 
-	double4 velocity = vel[gid];
-	double4 acceleration = acc[gid];
-	long index;
-	double4 newPosition;
-	double4 newVelocity;
-	double4 sum;
-	double4 f;
-	
-	// Adams-Moulton corrector
-	// acceleration -> velocity
-	
-	f = acceleration;
-	sum = M12C1 * f;
-	
-	index = ((step) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M12C2,f,sum); //sum += M12C2 * f;
-	
-	index = ((step-1) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M12C3,f,sum); //sum += M12C3 * f;
-	
-	index = ((step-2) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M12C4,f,sum); //sum += M12C4 * f;
-	
-	index = ((step-3) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M12C5,f,sum); //sum += M12C5 * f;
-	
-	index = ((step-4) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M12C6,f,sum); //sum += M12C6 * f;
-	
-	index = ((step-5) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M12C7,f,sum); //sum += M12C7 * f;
-	
-	index = ((step-6) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M12C8,f,sum); //sum += M12C8 * f;
-	
-	index = ((step-7) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M12C9,f,sum); //sum += M12C9 * f;
-	
-	index = ((step-8) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M12C10,f,sum); //sum += M12C10 * f;
-	
-	index = ((step-9) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M12C11,f,sum); //sum += M12C11 * f;
-	
-	index = ((step-10) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M12C12,f,sum); //sum += M12C12 * f;
-	
-	// Store corrected velocity
-	newVelocity = velLast[gid] + deltaTime * sum;
-	
-	//------------------------------
-	// velocity -> position
-	f = velocity;
-	sum = M12C1 * f;
-	
-	index = ((step) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M12C2,f,sum); //sum += M12C2 * f;
-	
-	index = ((step-1) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M12C3,f,sum); //sum += M12C3 * f;
-	
-	index = ((step-2) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M12C4,f,sum); //sum += M12C4 * f;
+	int i = get_global_id(0);
+	int numLeaves = NUM_GRAV - 1;
+	if(i >= numLeaves - 1)
+	{
+		return;
+	}
 	
-	index = ((step-3) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M12C5,f,sum); //sum += M12C5 * f;
+	// The range extends towards the neighbour sharing the longer prefix
+	int d = treeDelta(treeKeys, numLeaves, i, i + 1) > treeDelta(treeKeys, numLeaves, i, i - 1) ? 1 : -1;
+	int deltaMin = treeDelta(treeKeys, numLeaves, i, i - d);
+	int lengthMax = 2;
+	while(treeDelta(treeKeys, numLeaves, i, i + lengthMax * d) > deltaMin)
+	{
+		lengthMax *= 2;
+	}
 	
-	index = ((step-4) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M12C6,f,sum); //sum += M12C6 * f;
+	int length = 0;
+	for(int t = lengthMax / 2; t >= 1; t /= 2)
+	{
+		if(treeDelta(treeKeys, numLeaves, i, i + (length + t) * d) > deltaMin)
+		{
+			length += t;
+		}
+	}
+	int j = i + length * d;
 	
-	index = ((step-5) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M12C7,f,sum); //sum += M12C7 * f;
+	// The split is where the prefix of the whole range ends
+	int deltaNode = treeDelta(treeKeys, numLeaves, i, j);
+	int split = 0;
+	int t = length;
+	do
+	{
+		t = (t + 1) / 2;
+		if(treeDelta(treeKeys, numLeaves, i, i + (split + t) * d) > deltaNode)
+		{
+			split += t;
+		}
+	} while(t > 1);
+	int gamma = i + split * d + min(d, 0);
+	
+	int left = min(i, j) == gamma ? numLeaves - 1 + gamma : gamma;
+	int right = max(i, j) == gamma + 1 ? numLeaves + gamma : gamma + 1;
+	treeChildren[i] = (int2)(left, right);
+	treeParents[left] = i;
+	treeParents[right] = i;
+	treeFlags[i] = 0;
+}
+
+// Fills in the leaves then works up the tree. The second child to finish sums its parent, so every node is summed
+// once both its children are, without waiting on other work-groups
+__kernel
+void treeSummarise(
+__global const double4* gravPos,
+int numGrav,
+__global const ulong* treeKeys,
+__global const int2* treeChildren,
+__global const int* treeParents,
+__global volatile int* treeFlags,
+__global volatile double4* treeCom,
+__global volatile double4* treeMin,
+__global volatile double4* treeMax)
+{
+	int leaf = get_global_id(0);
+	int numLeaves = NUM_GRAV - 1;
+	if(leaf >= numLeaves)
+	{
+		return;
+	}
 	
-	index = ((step-6) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M12C8,f,sum); //sum += M12C8 * f;
+	int node = numLeaves - 1 + leaf;
+	double4 body = gravPos[(int)(treeKeys[leaf] & 0xFFFFFFFF)];
+	treeCom[node] = body;
+	treeMin[node] = body;
+	treeMax[node] = body;
 	
-	index = ((step-7) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M12C9,f,sum); //sum += M12C9 * f;
+	while(node != 0)
+	{
+		mem_fence(CLK_GLOBAL_MEM_FENCE);
+		node = treeParents[node];
+		if(atomic_inc(&treeFlags[node]) == 0)
+		{
+			return;
+		}
+		
+		int2 children = treeChildren[node];
+		double4 left = treeCom[children.x];
+		double4 right = treeCom[children.y];
+		double mass = left.w + right.w;
+		double4 com = mass > 0.0 ? (left * left.w + right * right.w) / mass : 0.5 * (left + right);
+		com.w = mass;
+		treeCom[node] = com;
+		treeMin[node] = fmin(treeMin[children.x], treeMin[children.y]);
+		treeMax[node] = fmax(treeMax[children.x], treeMax[children.y]);
+	}
+}
+
+// Sum over the tree at myPos. A leaf, or a node whose box is smaller than the opening angle seen from myPos, acts as a point mass
+double4 treeAcceleration(
+double4 myPos,
+int numLeaves,
+double epsSqr,
+double thetaSqr,
+__global const int2* treeChildren,
+__global const double4* treeCom,
+__global const double4* treeMin,
+__global const double4* treeMax)
+{
+	double4 sumAcc = (double4)(0.0f, 0.0f, 0.0f, 0.0f);
+	double4 r;
+	double distSqr;
+	double invDist;
+	double invDistCube;
 	
-	index = ((step-8) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M12C10,f,sum); //sum += M12C10 * f;
+	// The tree is at most 63 levels deep, the keys being 62 bits
+	int stack[TREE_STACK_SIZE];
+	int top = 0;
+	stack[top++] = 0;
+	while(top > 0)
+	{
+		int node = stack[--top];
+		double4 com = treeCom[node];
+		r = com - myPos;
+		r.w =0.0;
+		distSqr = r.x * r.x + r.y * r.y + r.z * r.z;
+		double4 extent = treeMax[node] - treeMin[node];
+		double size = fmax(fmax(extent.x, extent.y), extent.z);
+		if(node >= numLeaves - 1 || size * size < thetaSqr * distSqr)
+		{
+			invDist = INV_SQRT(distSqr + epsSqr); 
+			invDistCube = invDist * invDist * invDist; 
+			sumAcc += (com.w * invDistCube) * r;
+		}
+		else
+		{
+			int2 children = treeChildren[node];
+			stack[top++] = children.y;
+			stack[top++] = children.x;
+		}
+	}
+	return sumAcc;
+}
+
+__kernel
+void newtonianTree( 
+__global const double4* gravPos,
+__global double4* pos, 
+int numGrav, 
+double epsSqr, 
+__global double4* acc,
+__global const int2* treeChildren,
+__global const double4* treeCom,
+__global const double4* treeMin,
+__global const double4* treeMax,
+double thetaSqr) 
+{ 
+	unsigned int gid = get_global_id(0); 
+	double4 myPos = pos[gid]; 
 	
-	index = ((step-9) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M12C11,f,sum); //sum += M12C11 * f;
+	// Do the Sun
+	double4 r = gravPos[0] - myPos;
+	r.w =0.0;
+	double distSqr = r.x * r.x + r.y * r.y + r.z * r.z;
+	double invDist = INV_SQRT(distSqr + epsSqr); 
+	double invDistCube = invDist * invDist * invDist; 
+	double s = gravPos[0].w * invDistCube;
+	double4 accSun= s * r; 
 	
-	index = ((step-10) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M12C12,f,sum); //sum += M12C12 * f;
+	//Do the rest
+	acc[gid] = treeAcceleration(myPos, NUM_GRAV - 1, epsSqr, thetaSqr, treeChildren, treeCom, treeMin, treeMax) + accSun;
+}
+
+__kernel
+void relativisticTree( 
+__global const double4* gravPos,
+__global double4* pos,
+__global double4* vel,
+int numGrav, 
+double epsSqr, 
+__global double4* acc,
+__global const int2* treeChildren,
+__global const double4* treeCom,
+__global const double4* treeMin,
+__global const double4* treeMax,
+double thetaSqr) 
+{ 
+	unsigned int gid = get_global_id(0); 
+	double4 myPos = pos[gid];
+	double4 myVel = vel[gid];
 	
-	// Store corrected position
-	newPosition = posLast[gid] + deltaTime * sum * (KMTOGM);
+	// Do the Sun
+	double4 r = gravPos[0] - myPos;
+	r.w =0.0;
+	double distSqr = r.x * r.x + r.y * r.y + r.z * r.z;
+	double invDist = INV_SQRT(distSqr + epsSqr); 
+	double invDistCube = invDist * invDist * invDist; 
+	double s = gravPos[0].w * invDistCube;
+	s = s * (1.0 + myVel.w + (relativisticC1*invDist));
+	double4 accSun= s * r;
 	
-	// Copy across mass and relativistic parameter
-	newPosition.w = position.w;
-	newVelocity.w = velocity.w;
-		
-	newPos[gid] = newPosition;
-	newVel[gid] = newVelocity;
+	//Do the rest
+	acc[gid] = treeAcceleration(myPos, NUM_GRAV - 1, epsSqr, thetaSqr, treeChildren, treeCom, treeMin, treeMax) + accSun;
 }
 
+// Perturber pruning. perturberMask decides for every particle which bodies with mass are worth summing over the next few steps:
+// a body is skipped when the most it could pull, at the closest it could come, is under tolerance times the least the Sun could pull.
+// The distances are bounded by twice the relative speed over horizon seconds, from the state when the mask is built, so the mask
+// holds until CLModel rebuilds it every perturberRefreshSteps steps. Bit b of word w of a particle's mask is body w * 32 + b,
+// the words are numParticles apart. The Sun is always summed, so its bit is never read.
+// stats[0] counts the skipped bodies and stats[1] holds the largest sum of skipped bounds relative to the Sun's pull, as float bits
 __kernel
-void adamsBashforth11( 
-__global double4* pos, 
-__global double4* vel,
-__global double4* acc, 
-double deltaTime, 
-__global double4* newPos, 
-__global double4* newVel,
-int stage,
-int step,
+void perturberMask(
+__global const double4* pos,
+__global const double4* vel,
+int numGrav,
+double horizon,
+double tolerance,
+__global uint* mask,
 int numParticles,
-__global double4* posLast,
-__global double4* velLast,
-__global double4* velHistory,
-__global double4* accHistory)
+__global uint* stats)
 {
 	unsigned int gid = get_global_id(0);
-	double4 position = pos[gid]; 
-	double4 velocity = vel[gid];
-	double4 acceleration = acc[gid];
-	long index;
-	double4 newPosition;
-	double4 newVelocity;
-	double4 sum;
-	double4 f;
-	
-	// Adams-Bashford Predictor
-	// acceleration
-	f = acceleration;
-	sum = B11C1 * f;
-	
-	index = ((step-1) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B11C2,f,sum); //sum += B11C2 * f;
+	double4 myPos = pos[gid];
+	double4 myVel = vel[gid];
+	double reach = 2.0 * horizon * KMTOGM;
+	
+	// The Sun's pull at the furthest the particle gets from it
+	double4 r = pos[0] - myPos;
+	double4 v = vel[0] - myVel;
+	r.w = 0.0;
+	v.w = 0.0;
+	double sunDist = length(r) + reach * length(v);
+	double sunAcc = pos[0].w / (sunDist * sunDist);
+	double threshold = tolerance * sunAcc;
+	
+	uint skipped = 0;
+	double skippedAcc = 0.0;
+	int numWords = (NUM_GRAV + 31) / 32;
+	for(int word = 0; word < numWords; word++)
+	{
+		uint bits = 0;
+		for(int bit = 0; bit < 32; bit++)
+		{
+			int gravBody = word * 32 + bit;
+			if(gravBody == 0 || gravBody >= NUM_GRAV)
+			{
+				continue;
+			}
+			
+			r = pos[gravBody] - myPos;
+			v = vel[gravBody] - myVel;
+			r.w = 0.0;
+			v.w = 0.0;
+			double closest = length(r) - reach * length(v);
+			double bound = closest > 0.0 ? pos[gravBody].w / (closest * closest) : INFINITY;
+			if(bound < threshold)
+			{
+				skipped++;
+				skippedAcc += bound;
+			}
+			else
+			{
+				bits |= 1u << bit;
+			}
+		}
+		mask[word * numParticles + gid] = bits;
+	}
 	
-	index = ((step-2) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B11C3,f,sum); //sum += B11C3 * f;
+	atomic_add(&stats[0], skipped);
+	atomic_max(&stats[1], as_uint((float)(skippedAcc / sunAcc)));
+}
 
-	index = ((step-3) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B11C4,f,sum); //sum += B11C4 * f;
-	
-	index = ((step-4) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B11C5,f,sum); //sum += B11C5 * f;
-	
-	index = ((step-5) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B11C6,f,sum); //sum += B11C6 * f;
-	
-	index = ((step-6) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B11C7,f,sum); //sum += B11C7 * f;
-	
-	index = ((step-7) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B11C8,f,sum); //sum += B11C8 * f;
-	
-	index = ((step-8) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B11C9,f,sum); //sum += B11C9 * f;
+// The Pruned acceleration kernels sum the Sun and the bodies with mass set in the particle's perturberMask.
+// They read the bodies with mass from global memory, so take any number of them
+__kernel
+void newtonianPruned( 
+__global const double4* gravPos,
+__global double4* pos, 
+int numGrav, 
+double epsSqr, 
+__global double4* acc,
+__global const uint* mask,
+int maskStride) 
+{ 
+	unsigned int gid = get_global_id(0); 
+	double4 myPos = pos[gid]; 
+	double4 sumAcc = (double4)(0.0f, 0.0f, 0.0f, 0.0f);
+	double4 partial = (double4)(0.0f, 0.0f, 0.0f, 0.0f);
+	double4 r;
+	double distSqr;
+	double invDist;
+	double invDistCube;
+	double s;
 	
-	index = ((step-9) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B11C10,f,sum); //sum += B11C10 * f;
+	// Do the Sun
+	r = gravPos[0] - myPos;
+	r.w =0.0;
+	distSqr = r.x * r.x + r.y * r.y + r.z * r.z;
+	invDist = INV_SQRT(distSqr + epsSqr); 
+	invDistCube = invDist * invDist * invDist; 
+	s = gravPos[0].w * invDistCube;
+	double4 accSun= s * r; 
 	
-	index = ((step-10) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B11C11,f,sum); //sum += B11C11 * f;
+	//Do the rest that are in the mask, lowest set bit first
+	int numWords = (NUM_GRAV + 31) / 32;
+	for(int word = 0; word < numWords; word++)
+	{
+		uint bits = mask[word * maskStride + gid];
+		while(bits != 0)
+		{
+			int gravBody = word * 32 + 31 - (int)clz(bits & (0u - bits));
+			bits &= bits - 1;
+			r = gravPos[gravBody] - myPos;
+			r.w =0.0;
+			distSqr = r.x * r.x + r.y * r.y + r.z * r.z;
+			invDist = INV_SQRT(distSqr + epsSqr); 
+			invDistCube = invDist * invDist * invDist; 
+			s = gravPos[gravBody].w * invDistCube; 
+			ACCELERATION_SUM_ADD(sumAcc, partial, s * r, gravBody);
+		}
+	}
 	
-	newVelocity = velocity + deltaTime * sum;
-	velLast[gid] = velocity;
+	acc[gid] = ACCELERATION_SUM_RESULT(sumAcc, partial) + accSun;
+}
 
-	// --------------------------------------------
-	// position
-	f = velocity;
-	sum = B11C1 * f;
-	
-	index = ((step-1) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B11C2,f,sum); //sum += B11C2 * f;
-	
-	index = ((step-2) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B11C3,f,sum); //sum += B11C3 * f;
-	
-	index = ((step-3) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B11C4,f,sum); //sum += B11C4 * f;
-	
-	index = ((step-4) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B11C5,f,sum); //sum += B11C5 * f;
-	
-	index = ((step-5) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B11C6,f,sum); //sum += B11C6 * f;
-	
-	index = ((step-6) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B11C7,f,sum); //sum += B11C7 * f;
-	
-	index = ((step-7) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B11C8,f,sum); //sum += B11C8 * f;
-	
-	index = ((step-8) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B11C9,f,sum); //sum += B11C9 * f;
+__kernel
+void relativisticPruned( 
+__global const double4* gravPos,
+__global double4* pos,
+__global double4* vel,
+int numGrav, 
+double epsSqr, 
+__global double4* acc,
+__global const uint* mask,
+int maskStride) 
+{ 
+	unsigned int gid = get_global_id(0); 
+	double4 myPos = pos[gid];
+	double4 myVel = vel[gid];
+	double4 sumAcc = (double4)(0.0f, 0.0f, 0.0f, 0.0f);
+	double4 r;
+	double distSqr;
+	double invDist;
+	double invDistCube;
+	double s;
 	
-	index = ((step-9) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B11C10,f,sum); //sum += B11C10 * f;
+	// Do the Sun
+	r = gravPos[0] - myPos;
+	r.w =0.0;
+	distSqr = r.x * r.x + r.y * r.y + r.z * r.z;
+	invDist = INV_SQRT(distSqr + epsSqr); 
+	invDistCube = invDist * invDist * invDist; 
+	s = gravPos[0].w * invDistCube;
+	s = s * (1.0 + myVel.w + (relativisticC1*invDist));
+	double4 accSun= s * r;
 	
-	index = ((step-10) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B11C11,f,sum); //sum += B11C11 * f;
+	//Do the rest that are in the mask, lowest set bit first
+	double4 partial = (double4)(0.0f, 0.0f, 0.0f, 0.0f);
+	int numWords = (NUM_GRAV + 31) / 32;
+	for(int word = 0; word < numWords; word++)
+	{
+		uint bits = mask[word * maskStride + gid];
+		while(bits != 0)
+		{
+			int gravBody = word * 32 + 31 - (int)clz(bits & (0u - bits));
+			bits &= bits - 1;
+			r = gravPos[gravBody] - myPos;
+			r.w =0.0;
+			distSqr = r.x * r.x + r.y * r.y + r.z * r.z;
+			invDist = INV_SQRT(distSqr + epsSqr); 
+			invDistCube = invDist * invDist * invDist; 
+			s = gravPos[gravBody].w * invDistCube;
+			ACCELERATION_SUM_ADD(sumAcc, partial, s * r, gravBody);
+		}
+	}
 	
-	newPosition = position + deltaTime * sum * (KMTOGM);
-	posLast[gid] = position;
+	acc[gid] = ACCELERATION_SUM_RESULT(sumAcc, partial) + accSun;
+}
+
+__kernel
+void copyToDisplay(
+__global const double4* gravPos,
+__global double4* pos,
+__global float4* dispPos,
+int centerBodyIndex) 
+{ 
+	double4 dispPosDouble;
+	float4 dispPosFloat;
+	unsigned int gid = get_global_id(0);
+	dispPosDouble = pos[gid] - gravPos[centerBodyIndex];
 	
-	index = ((step) & 0xF) * numParticles + gid;
-	//velocity.w = (double) step;
-	velHistory[index] = velocity;
-	//acceleration.w = (double)step;
-	accHistory[index] = acceleration;
+	dispPosFloat.x = (float) dispPosDouble.x;
+	dispPosFloat.y = (float) dispPosDouble.y;
+	dispPosFloat.z = (float) dispPosDouble.z;
+	dispPosFloat.w = (float) dispPosDouble.w;
 	
-	// Copy across mass and relativistic parameter
-	newPosition.w = position.w;
-	newVelocity.w = velocity.w;
-		
-	newPos[gid] = newPosition;
-	newVel[gid] = newVelocity;
+	dispPos[gid] = dispPosFloat;
 }
 
+// copyToDisplay for out-of-core streaming, where pos holds just the chunk of particles starting at firstParticle
 __kernel
-void adamsMoulton10( 
-__global double4* pos, 
-__global double4* vel,
-__global double4* acc, 
-double deltaTime, 
-__global double4* newPos, 
-__global double4* newVel,
-int stage,
-int step,
-int numParticles,
-__global double4* posLast,
-__global double4* velLast,
-__global double4* velHistory,
-__global double4* accHistory)
+void copyChunkToDisplay(
+__global const double4* gravPos,
+__global double4* pos,
+__global float4* dispPos,
+int centerBodyIndex,
+int firstParticle)
 {
 	unsigned int gid = get_global_id(0);
-	double4 position = pos[gid]; 
-	double4 velocity = vel[gid];
-	double4 acceleration = acc[gid];
-	long index;
-	double4 newPosition;
-	double4 newVelocity;
-	double4 sum;
-	double4 f;
-	
-	// Adams-Moulton corrector
-	// acceleration -> velocity
-	
-	f = acceleration;
-	sum = M11C1 * f;
-	
-	index = ((step) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M11C2,f,sum); //sum += M11C2 * f;
-	
-	index = ((step-1) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M11C3,f,sum); //sum += M11C3 * f;
-	
-	index = ((step-2) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M11C4,f,sum); //sum += M11C4 * f;
-	
-	index = ((step-3) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M11C5,f,sum); //sum += M11C5 * f;
-	
-	index = ((step-4) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M11C6,f,sum); //sum += M11C6 * f;
-	
-	index = ((step-5) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M11C7,f,sum); //sum += M11C7 * f;
-	
-	index = ((step-6) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M11C8,f,sum); //sum += M11C8 * f;
-	
-	index = ((step-7) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M11C9,f,sum); //sum += M11C9 * f;
-	
-	index = ((step-8) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M11C10,f,sum); //sum += M11C10 * f;
-	
-	index = ((step-9) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M11C11,f,sum); //sum += M11C11 * f;
-	
-	// Store corrected velocity
-	newVelocity = velLast[gid] + deltaTime * sum;
-	
-	//------------------------------
-	// velocity -> position
-	f = velocity;
-	sum = M11C1 * f;
-	
-	index = ((step) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M11C2,f,sum); //sum += M11C2 * f;
-	
-	index = ((step-1) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M11C3,f,sum); //sum += M11C3 * f;
-	
-	index = ((step-2) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M11C4,f,sum); //sum += M11C4 * f;
-	
-	index = ((step-3) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M11C5,f,sum); //sum += M11C5 * f;
-	
-	index = ((step-4) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M11C6,f,sum); //sum += M11C6 * f;
-	
-	index = ((step-5) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M11C7,f,sum); //sum += M11C7 * f;
-	
-	index = ((step-6) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M11C8,f,sum); //sum += M11C8 * f;
-	
-	index = ((step-7) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M11C9,f,sum); //sum += M11C9 * f;
-	
-	index = ((step-8) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M11C10,f,sum); //sum += M11C10 * f;
-	
-	index = ((step-9) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M11C11,f,sum); //sum += M11C11 * f;
-	
-	// Store corrected position
-	newPosition = posLast[gid] + deltaTime * sum * (KMTOGM);
-	
-	// Copy across mass and relativistic parameter
-	newPosition.w = position.w;
-	newVelocity.w = velocity.w;
-		
-	newPos[gid] = newPosition;
-	newVel[gid] = newVelocity;
+	double4 dispPosDouble = pos[gid] - gravPos[centerBodyIndex];
+	dispPos[firstParticle + gid] = (float4)((float)dispPosDouble.x, (float)dispPosDouble.y, (float)dispPosDouble.z, (float)dispPosDouble.w);
+}
+
+__kernel void rungeKutta4Startup(
+    __global double4* pos,
+    __global double4* vel,
+    __global double4* acc,
+    double deltaTime,
+    __global double4* newPos,
+    __global double4* newVel,
+    int stage,
+    int step,
+    int numParticles,
+    __global double4* posLast,
+    __global double4* velLast,
+    __global double4* velHistory,
+    __global double4* accHistory,
+    __global double4* k1,
+    __global double4* k2,
+    __global double4* k3,
+    __global double4* k4)
+{
+    unsigned int gid = get_global_id(0);
+    double4 position = pos[gid];
+    double4 velocity = vel[gid];
+    double4 acceleration = acc[gid];
+    
+    // Determine which RK4 substep we're on
+    int substep = step & 0x3;  // step % 4
+    long mainStep = step >> 2; // step / 4
+    
+    if(substep == 0) {
+        // First RK4 step - store k1
+        k1[gid] = velocity;          // k1_pos
+        k1[gid + numParticles] = acceleration;  // k1_vel
+        
+        // Calculate intermediate position for next substep
+        double4 pos_mid = position + FIXED_POINT((deltaTime * 0.5) * velocity * (KMTOGM));
+        newPos[gid] = pos_mid;
+        newVel[gid] = velocity + (deltaTime * 0.5) * acceleration;
+    }
+    else if(substep == 1) {
+        // Second RK4 step - store k2
+        k2[gid] = velocity;          // k2_pos
+        k2[gid + numParticles] = acceleration;  // k2_vel
+        
+        // Calculate intermediate position for next substep
+        double4 pos_mid = position + FIXED_POINT((deltaTime * 0.5) * velocity * (KMTOGM));
+        newPos[gid] = pos_mid;
+        newVel[gid] = velocity + (deltaTime * 0.5) * acceleration;
+    }
+    else if(substep == 2) {
+        // Third RK4 step - store k3
+        k3[gid] = velocity;          // k3_pos
+        k3[gid + numParticles] = acceleration;  // k3_vel
+        
+        // Calculate final position for last substep
+        double4 pos_end = position + FIXED_POINT(deltaTime * velocity * (KMTOGM));
+        newPos[gid] = pos_end;
+        newVel[gid] = velocity + deltaTime * acceleration;
+    }
+    else {
+        // Fourth RK4 step - calculate final values
+        k4[gid] = velocity;          // k4_pos
+        k4[gid + numParticles] = acceleration;  // k4_vel
+        
+        // Save history for Adams-Bashforth bootstrap
+        velLast[gid] = vel[gid];
+        posLast[gid] = pos[gid];
+        
+        long historyIndex = (mainStep & 0xF) * numParticles + gid;
+        velHistory[historyIndex] = velocity;
+        accHistory[historyIndex] = acceleration;
+        
+        // Calculate final position and velocity using all k values
+        double4 newPosition = pos[gid] + FIXED_POINT((deltaTime/6.0) * 
+            (k1[gid] + 2.0*k2[gid] + 2.0*k3[gid] + k4[gid]) * (KMTOGM));
+        
+        double4 newVelocity = vel[gid] + (deltaTime/6.0) * 
+            (k1[gid + numParticles] + 2.0*k2[gid + numParticles] + 
+             2.0*k3[gid + numParticles] + k4[gid + numParticles]);
+        
+        // Preserve mass and relativistic parameter
+        newPosition.w = position.w;
+        newVelocity.w = velocity.w;
+        
+        // Store final results
+        newPos[gid] = newPosition;
+        newVel[gid] = newVelocity;
+    }
 }
 
-__kernel
-void adamsBashforth10( 
-__global double4* pos, 
-__global double4* vel,
-__global double4* acc, 
-double deltaTime, 
-__global double4* newPos, 
-__global double4* newVel,
-int stage,
-int step,
-int numParticles,
-__global double4* posLast,
-__global double4* velLast,
-__global double4* velHistory,
-__global double4* accHistory)
-{
-	unsigned int gid = get_global_id(0);
-	double4 position = pos[gid]; 
-	double4 velocity = vel[gid];
-	double4 acceleration = acc[gid];
-	long index;
-	double4 newPosition;
-	double4 newVelocity;
-	double4 sum;
-	double4 f;
-	
-	// Adams-Bashford Predictor
-	// acceleration
-	f = acceleration;
-	sum = B10C1 * f;
-	
-	index = ((step-1) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B10C2,f,sum); //sum += B10C2 * f;
-	
-	index = ((step-2) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B10C3,f,sum); //sum += B10C3 * f;
+#define B2C1 1.500000000000000000
+#define B2C2 -0.50000000000000000
+#define M2C1 0.500000000000000000
+#define M2C2 0.500000000000000000
 
-	index = ((step-3) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B10C4,f,sum); //sum += B10C4 * f;
-	
-	index = ((step-4) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B10C5,f,sum); //sum += B10C5 * f;
-	
-	index = ((step-5) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B10C6,f,sum); //sum += B10C6 * f;
-	
-	index = ((step-6) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B10C7,f,sum); //sum += B10C7 * f;
-	
-	index = ((step-7) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B10C8,f,sum); //sum += B10C8 * f;
-	
-	index = ((step-8) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B10C9,f,sum); //sum += B10C9 * f;
-	
-	index = ((step-9) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B10C10,f,sum); //sum += B10C10 * f;
-	
-	newVelocity = velocity + deltaTime * sum;
-	velLast[gid] = velocity;
+#define B4C1  2.291666666666666666666666666666666666
+#define B4C2 -2.458333333333333333333333333333333333
+#define B4C3  1.541666666666666666666666666666666666
+#define B4C4 -0.375000000000000000000000000000000000
 
-	// --------------------------------------------
-	// position
-	f = velocity;
-	sum = B10C1 * f;
-	
-	index = ((step-1) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B10C2,f,sum); //sum += B10C2 * f;
-	
-	index = ((step-2) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B10C3,f,sum); //sum += B10C3 * f;
-	
-	index = ((step-3) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B10C4,f,sum); //sum += B10C4 * f;
-	
-	index = ((step-4) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B10C5,f,sum); //sum += B10C5 * f;
-	
-	index = ((step-5) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B10C6,f,sum); //sum += B10C6 * f;
-	
-	index = ((step-6) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B10C7,f,sum); //sum += B10C7 * f;
-	
-	index = ((step-7) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B10C8,f,sum); //sum += B10C8 * f;
-	
-	index = ((step-8) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B10C9,f,sum);  //sum += B10C9 * f;
-	
-	index = ((step-9) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B10C10,f,sum); //sum += B10C10 * f;
-	
-	newPosition = position + deltaTime * sum * (KMTOGM);
-	posLast[gid] = position;
-	
-	index = ((step) & 0xF) * numParticles + gid;
-	//velocity.w = (double) step;
-	velHistory[index] = velocity;
-	//acceleration.w = (double)step;
-	accHistory[index] = acceleration;
-	
-	// Copy across mass and relativistic parameter
-	newPosition.w = position.w;
-	newVelocity.w = velocity.w;
-		
-	newPos[gid] = newPosition;
-	newVel[gid] = newVelocity;
-}
+#define M4C1  0.375000000000000000000000000000000000
+#define M4C2  0.791666666666666666666666666666666666
+#define M4C3 -0.208333333333333333333333333333333333
+#define M4C4  0.041666666666666666666666666666666666
 
 __kernel
-void adamsMoulton9( 
+void adamsStartup( 
 __global double4* pos, 
 __global double4* vel,
 __global double4* acc, 
@@ -1331,94 +1327,167 @@ __global double4* accHistory)
 	double4 sum;
 	double4 f;
 	
-	// Adams-Moulton corrector
-	// acceleration -> velocity
-	
-	f = acceleration;
-	sum = M10C1 * f;
-	
-	index = ((step) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M10C2,f,sum); //sum += M10C2 * f;
-	
-	index = ((step-1) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M10C3,f,sum); //sum += M10C3 * f;
-	
-	index = ((step-2) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M10C4,f,sum); //sum += M10C4 * f;
-	
-	index = ((step-3) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M10C5,f,sum); //sum += M10C5 * f;
-	
-	index = ((step-4) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M10C6,f,sum); //sum += M10C6 * f;
-	
-	index = ((step-5) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M10C7,f,sum); //sum += M10C7 * f;
-	
-	index = ((step-6) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M10C8,f,sum); //sum += M10C8 * f;
-	
-	index = ((step-7) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M10C9,f,sum); //sum += M10C9 * f;
-	
-	index = ((step-8) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M10C10,f,sum); //sum += M10C10 * f;
-	
-	// Store corrected velocity
-	newVelocity = velLast[gid] + deltaTime * sum;
-	
-	//------------------------------
-	// velocity -> position
-	f = velocity;
-	sum = M10C1 * f;
-	
-	index = ((step) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M10C2,f,sum); //sum += M10C2 * f;
-	
-	index = ((step-1) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M10C3,f,sum); //sum += M10C3 * f;
-	
-	index = ((step-2) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M10C4,f,sum); //sum += M10C4 * f;
-	
-	index = ((step-3) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M10C5,f,sum); //sum += M10C5 * f;
-	
-	index = ((step-4) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M10C6,f,sum); //sum += M10C6 * f;
-	
-	index = ((step-5) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M10C7,f,sum); //sum += M10C7 * f;
-	
-	index = ((step-6) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M10C8,f,sum); //sum += M10C8 * f;
-	
-	index = ((step-7) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M10C9,f,sum); //sum += M10C9 * f;
-	
-	index = ((step-8) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M10C10,f,sum); //sum += M10C10 * f;
+	int order = step > 1? (step > 16? 4 : 2) : 1;
 	
-	// Store corrected position
-	newPosition = posLast[gid] + deltaTime * sum * (KMTOGM);
+	if (stage == 1)
+	{
+		// Adams-Bashford Predictor
+		// acceleration
+		if(order == 1)
+		{
+			f = acceleration;
+			sum = 1.0 * f;
+		}
+		else if (order == 2)
+		{
+			f = acceleration;
+			sum = B2C1 * f;
+			
+			index = ((step-1) & 0xF) * HISTORY_STRIDE + gid;
+			f = accHistory[index];
+			sum = fma(B2C2,f,sum); //sum += B2C2 * f;
+		}
+		else
+		{
+			f = acceleration;
+			sum = B4C1 * f;
+			
+			index = ((step-1) & 0xF) * HISTORY_STRIDE + gid;
+			f = accHistory[index];
+			sum = fma(B4C2,f,sum); //sum += B4C2 * f;
+			
+			index = ((step-2) & 0xF) * HISTORY_STRIDE + gid;
+			f = accHistory[index];
+			sum = fma(B4C3,f,sum); //sum += B4C3 * f;
+
+			index = ((step-3) & 0xF) * HISTORY_STRIDE + gid;
+			f = accHistory[index];
+			sum = fma(B4C4,f,sum); //sum += B4C4 * f;
+		}
+		
+		newVelocity = velocity + deltaTime * sum;
+		velLast[gid] = velocity;
+
+		// --------------------------------------------
+		// position
+		if(order == 1)
+		{
+			f = velocity;
+			sum = 1.0 * f;
+		}
+		else if (order == 2)
+		{
+			f = velocity;
+			sum = B2C1 * f;
+			
+			index = ((step-1) & 0xF) * HISTORY_STRIDE + gid;
+			f = velHistory[index];
+			sum = fma(B2C2,f,sum); //sum += B2C2 * f;
+		}
+		else
+		{
+			f = velocity;
+			sum = B4C1 * f;
+			
+			index = ((step-1) & 0xF) * HISTORY_STRIDE + gid;
+			f = velHistory[index];
+			sum = fma(B4C2,f,sum); //sum += B4C2 * f;
+			
+			index = ((step-2) & 0xF) * HISTORY_STRIDE + gid;
+			f = velHistory[index];
+			sum = fma(B4C3,f,sum); //sum += B4C3 * f;
+			
+			index = ((step-3) & 0xF) * HISTORY_STRIDE + gid;
+			f = velHistory[index];
+			sum = fma(B4C4,f,sum); //sum += B4C4 * f;
+		}
+		
+		newPosition = position + FIXED_POINT(deltaTime * sum * (KMTOGM));
+		posLast[gid] = position;
+		
+		index = ((step) & 0xF) * HISTORY_STRIDE + gid;
+		//velocity.w = (double) step;
+		velHistory[index] = velocity;
+		//acceleration.w = (double)step;
+		accHistory[index] = acceleration;
+	}
+	else
+	{
+		// Adams-Moulton corrector
+		// acceleration -> velocity
+		
+		if(order == 1)
+		{
+			f = acceleration;
+			sum = 1.0 * f;
+		}
+		else if (order == 2)
+		{
+			f = acceleration;
+			sum = M2C1 * f;
+			
+			index = ((step) & 0xF) * HISTORY_STRIDE + gid;
+			f = accHistory[index];
+			sum = fma(M2C2,f,sum); //sum += M2C2 * f;
+		}
+		else
+		{
+			f = acceleration;
+			sum = M4C1 * f;
+			
+			index = ((step) & 0xF) * HISTORY_STRIDE + gid;
+			f = accHistory[index];
+			sum = fma(M4C2,f,sum); //sum += M4C2 * f;
+			
+			index = ((step-1) & 0xF) * HISTORY_STRIDE + gid;
+			f = accHistory[index];
+			sum = fma(M4C3,f,sum); //sum += M4C3 * f;
+			
+			index = ((step-2) & 0xF) * HISTORY_STRIDE + gid;
+			f = accHistory[index];
+			sum = fma(M4C4,f,sum); //sum += M4C4 * f;
+		}
+		
+		// Store corrected velocity
+		newVelocity = velLast[gid] + deltaTime * sum;
+		
+		//------------------------------
+		// velocity -> position
+		if(order == 1)
+		{
+			f = velocity;
+			sum = 1.0 * f;
+		}
+		else if (order == 2)
+		{
+			f = velocity;
+			sum = M2C1 * f;
+			
+			index = ((step) & 0xF) * HISTORY_STRIDE + gid;
+			f = velHistory[index];
+			sum = fma(M2C2,f,sum); //sum += M2C2 * f;
+		}
+		else
+		{		
+			f = velocity;
+			sum = M4C1 * f;
+			
+			index = ((step) & 0xF) * HISTORY_STRIDE + gid;
+			f = velHistory[index];
+			sum = fma(M4C2,f,sum); //sum += M4C2 * f;
+			
+			index = ((step-1) & 0xF) * HISTORY_STRIDE + gid;
+			f = velHistory[index];
+			sum = fma(M4C3,f,sum); //sum += M4C3 * f;
+			
+			index = ((step-2) & 0xF) * HISTORY_STRIDE + gid;
+			f = velHistory[index];
+			sum = fma(M4C4,f,sum); //sum += M4C4 * f;
+		}
+		
+		// Store corrected position
+		newPosition = posLast[gid] + FIXED_POINT(deltaTime * sum * (KMTOGM));
+	}
 	
 	// Copy across mass and relativistic parameter
 	newPosition.w = position.w;
@@ -1428,8 +1497,17 @@ __global double4* accHistory)
 	newVel[gid] = newVelocity;
 }
 
+// Adams-Bashforth predictor and Adams-Moulton corrector of any order from 2 to 16, generated from this one template.
+// The host defines ADAMS_ORDER and ADAMS_MOULTON_ORDER (one less, the naming the integrator menu has always used) and the
+// adamsBashforthCoefficients and adamsMoultonCoefficients tables, newest node first, see CLModel::AdamsProgramSource.
+// Both methods use ADAMS_ORDER nodes, so the 16 element history ring limits the order to 16.
+// The trip counts are constants, so the loops unroll into the same chain of fmas the hand written kernels had.
+#define ADAMS_KERNEL_NAME(name, order) name##order
+#define ADAMS_KERNEL(name, order) ADAMS_KERNEL_NAME(name, order)
+
+#ifdef ADAMS_ORDER
 __kernel
-void adamsBashforth8( 
+void ADAMS_KERNEL(adamsBashforth, ADAMS_ORDER)( 
 __global double4* pos, 
 __global double4* vel,
 __global double4* acc, 
@@ -1452,86 +1530,34 @@ __global double4* accHistory)
 	double4 newPosition;
 	double4 newVelocity;
 	double4 sum;
-	double4 f;
 	
 	// Adams-Bashford Predictor
 	// acceleration
-	f = acceleration;
-	sum = B8C1 * f;
-	
-	index = ((step-1) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B8C2,f,sum); //sum += B8C2 * f;
-	
-	index = ((step-2) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B8C3,f,sum); //sum += B8C3 * f;
-
-	index = ((step-3) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B8C4,f,sum); //sum += B8C4 * f;
-	
-	index = ((step-4) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B8C5,f,sum); //sum += B8C5 * f;
-	
-	index = ((step-5) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B8C6,f,sum); //sum += B8C6 * f;
-	
-	index = ((step-6) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B8C7,f,sum); //sum += B8C7 * f;
-	
-	index = ((step-7) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B8C8,f,sum); //sum += B8C8 * f;
+	sum = adamsBashforthCoefficients[0] * acceleration;
+	for(int j = 1; j < ADAMS_ORDER; j++)
+	{
+		index = ((step-j) & 0xF) * HISTORY_STRIDE + gid;
+		sum = fma(adamsBashforthCoefficients[j], accHistory[index], sum);
+	}
 	
 	newVelocity = velocity + deltaTime * sum;
 	velLast[gid] = velocity;
 
 	// --------------------------------------------
 	// position
-	f = velocity;
-	sum = B8C1 * f;
-	
-	index = ((step-1) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B8C2,f,sum); //sum += B8C2 * f;
-	
-	index = ((step-2) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B8C3,f,sum); //sum += B8C3 * f;
-	
-	index = ((step-3) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B8C4,f,sum); //sum += B8C4 * f;
-	
-	index = ((step-4) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B8C5,f,sum); //sum += B8C5 * f;
-	
-	index = ((step-5) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B8C6,f,sum); //sum += B8C6 * f;
-	
-	index = ((step-6) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B8C7,f,sum); //sum += B8C7 * f;
-	
-	index = ((step-7) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B8C8,f,sum); //sum += B8C8 * f;
+	sum = adamsBashforthCoefficients[0] * velocity;
+	for(int j = 1; j < ADAMS_ORDER; j++)
+	{
+		index = ((step-j) & 0xF) * HISTORY_STRIDE + gid;
+		sum = fma(adamsBashforthCoefficients[j], velHistory[index], sum);
+	}
 	
-	newPosition = position + deltaTime * sum * (KMTOGM);
+	newPosition = position + FIXED_POINT(deltaTime * sum * (KMTOGM));
 	posLast[gid] = position;
 	
-	index = ((step) & 0xF) * numParticles + gid;
-	//velocity.w = (double) step;
+	index = ((step) & 0xF) * HISTORY_STRIDE + gid;
 	velHistory[index] = velocity;
-	//acceleration.w = (double)step;
 	accHistory[index] = acceleration;
-
 	
 	// Copy across mass and relativistic parameter
 	newPosition.w = position.w;
@@ -1540,20 +1566,22 @@ __global double4* accHistory)
 	newPos[gid] = newPosition;
 	newVel[gid] = newVelocity;
 }
-__kernel void adamsMoulton7( 
-	__global double4* pos, 
-	__global double4* vel,
-	__global double4* acc, 
-	double deltaTime, 
-	__global double4* newPos, 
-	__global double4* newVel,
-	int stage,
-	int step,
-	int numParticles,
-	__global double4* posLast,
-	__global double4* velLast,
-	__global double4* velHistory,
-	__global double4* accHistory)
+
+__kernel
+void ADAMS_KERNEL(adamsMoulton, ADAMS_MOULTON_ORDER)( 
+__global double4* pos, 
+__global double4* vel,
+__global double4* acc, 
+double deltaTime, 
+__global double4* newPos, 
+__global double4* newVel,
+int stage,
+int step,
+int numParticles,
+__global double4* posLast,
+__global double4* velLast,
+__global double4* velHistory,
+__global double4* accHistory)
 {
 	unsigned int gid = get_global_id(0);
 	double4 position = pos[gid]; 
@@ -1563,81 +1591,30 @@ __kernel void adamsMoulton7(
 	double4 newPosition;
 	double4 newVelocity;
 	double4 sum;
-	double4 f;
-		
+	
 	// Adams-Moulton corrector
 	// acceleration -> velocity
-	
-	f = acceleration;
-	sum = M8C1 * f;
-	
-	index = ((step) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M8C2,f,sum); //sum += M8C2 * f;
-	
-	index = ((step-1) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M8C3,f,sum); //sum += M8C3 * f;
-	
-	index = ((step-2) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M8C4,f,sum); //sum += M8C4 * f;
-	
-	index = ((step-3) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M8C5,f,sum); //sum += M8C5 * f;
-	
-	index = ((step-4) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M8C6,f,sum); //sum += M8C6 * f;
-	
-	index = ((step-5) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M8C7,f,sum); //sum += M8C7 * f;
-	
-	index = ((step-6) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M8C8,f,sum); //sum += M8C8 * f;
+	sum = adamsMoultonCoefficients[0] * acceleration;
+	for(int j = 1; j < ADAMS_ORDER; j++)
+	{
+		index = ((step-j+1) & 0xF) * HISTORY_STRIDE + gid;
+		sum = fma(adamsMoultonCoefficients[j], accHistory[index], sum);
+	}
 	
 	// Store corrected velocity
 	newVelocity = velLast[gid] + deltaTime * sum;
 	
 	//------------------------------
 	// velocity -> position
-	f = velocity;
-	sum = M8C1 * f;
-	
-	index = ((step) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M8C2,f,sum); //sum += M8C2 * f;
-	
-	index = ((step-1) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M8C3,f,sum); //sum += M8C3 * f;
-	
-	index = ((step-2) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M8C4,f,sum); //sum += M8C4 * f;
-	
-	index = ((step-3) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M8C5,f,sum); //sum += M8C5 * f;
-	
-	index = ((step-4) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M8C6,f,sum); //sum += M8C6 * f;
-	
-	index = ((step-5) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M8C7,f,sum); //sum += M8C7 * f;
-	
-	index = ((step-6) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M8C8,f,sum); //sum += M8C8 * f;
+	sum = adamsMoultonCoefficients[0] * velocity;
+	for(int j = 1; j < ADAMS_ORDER; j++)
+	{
+		index = ((step-j+1) & 0xF) * HISTORY_STRIDE + gid;
+		sum = fma(adamsMoultonCoefficients[j], velHistory[index], sum);
+	}
 	
 	// Store corrected position
-	newPosition = posLast[gid] + deltaTime * sum * (KMTOGM);
-
+	newPosition = posLast[gid] + FIXED_POINT(deltaTime * sum * (KMTOGM));
 	
 	// Copy across mass and relativistic parameter
 	newPosition.w = position.w;
@@ -1646,508 +1623,874 @@ __kernel void adamsMoulton7(
 	newPos[gid] = newPosition;
 	newVel[gid] = newVelocity;
 }
+#endif // ADAMS_ORDER
 
+// Used by incremental checkpoints.
+// XORs each 64 bit word of a state buffer against the copy taken at the previous checkpoint.
+// Doubles that have changed only in their low mantissa bits come out with their high bytes zero,
+// which the host then packs away before writing to disk.
+// The reference is only advanced once the host has the record safely written.
 __kernel
-void adamsBashforth4( 
-__global double4* pos, 
-__global double4* vel,
-__global double4* acc, 
-double deltaTime, 
-__global double4* newPos, 
-__global double4* newVel,
-int stage,
+void checkpointDelta(
+__global const ulong* state,
+__global const ulong* reference,
+ulong referenceOffset,
+__global ulong* delta)
+{
+	size_t gid = get_global_id(0);
+	delta[gid] = state[gid] ^ reference[referenceOffset + gid];
+}
+
+// Used by the trajectory archive.
+// Positions are quantised onto a grid of spacing quantum (twice the error bound) so that the
+// prediction from previous frames is done in exact integer arithmetic and the CPU decoder reproduces it bit for bit.
+// Each work item encodes a block of ARCHIVE_BLOCK_SIZE bodies. The first word of a block holds the bit widths
+// used for x, y and z. The zigzag encoded residuals follow, packed least significant bit first.
+#define ARCHIVE_BLOCK_SIZE 32
+#define ARCHIVE_BLOCK_WORDS (1 + 3 * ARCHIVE_BLOCK_SIZE)
+
+long4 archivePredict(long4 q1, long4 q2, long4 q3, int predictionOrder)
+{
+	switch(predictionOrder)
+	{
+		case 0:
+			return (long4)(0, 0, 0, 0);
+		case 1:
+			return q1;
+		case 2:
+			return 2 * q1 - q2;
+		default:
+			return 3 * (q1 - q2) + q3;
+	}
+}
+
+ulong archiveZigzag(long value)
+{
+	return (ulong)((value << 1) ^ (value >> 63));
+}
+
+int archiveWidth(ulong value)
+{
+	return 64 - (int)clz(value);
+}
+
+__kernel
+void archiveEncode(
+__global const double4* pos,
+__global const long4* quantised1,
+__global const long4* quantised2,
+__global long4* quantised3,
+double quantum,
+int predictionOrder,
+int numParticles,
+__global ulong* blocks,
+__global uint* blockWords)
+{
+	unsigned int block = get_global_id(0);
+	int first = block * ARCHIVE_BLOCK_SIZE;
+	int last = min(first + ARCHIVE_BLOCK_SIZE, numParticles);
+	double invQuantum = 1.0 / quantum;
+	int widthX = 0;
+	int widthY = 0;
+	int widthZ = 0;
+	
+	// First pass finds how many bits are needed
+	for(int i = first; i < last; i++)
+	{
+		double4 position = pos[i];
+		long4 q = (long4)((long)rint(position.x * invQuantum), (long)rint(position.y * invQuantum), (long)rint(position.z * invQuantum), 0);
+		long4 r = q - archivePredict(quantised1[i], quantised2[i], quantised3[i], predictionOrder);
+		widthX = max(widthX, archiveWidth(archiveZigzag(r.x)));
+		widthY = max(widthY, archiveWidth(archiveZigzag(r.y)));
+		widthZ = max(widthZ, archiveWidth(archiveZigzag(r.z)));
+	}
+	
+	// Second pass packs the residuals and keeps the quantised positions for predicting the next frame
+	__global ulong* out = blocks + (size_t)block * ARCHIVE_BLOCK_WORDS;
+	out[0] = (ulong)widthX | ((ulong)widthY << 8) | ((ulong)widthZ << 16);
+	uint word = 1;
+	ulong current = 0;
+	int used = 0;
+	for(int i = first; i < last; i++)
+	{
+		double4 position = pos[i];
+		long4 q = (long4)((long)rint(position.x * invQuantum), (long)rint(position.y * invQuantum), (long)rint(position.z * invQuantum), 0);
+		long4 r = q - archivePredict(quantised1[i], quantised2[i], quantised3[i], predictionOrder);
+		quantised3[i] = q;
+		
+		for(int axis = 0; axis < 3; axis++)
+		{
+			ulong value = archiveZigzag(axis == 0 ? r.x : (axis == 1 ? r.y : r.z));
+			int width = axis == 0 ? widthX : (axis == 1 ? widthY : widthZ);
+			if(width == 0)
+			{
+				continue;
+			}
+			
+			current |= value << used;
+			if(used + width >= 64)
+			{
+				out[word++] = current;
+				current = used == 0 ? 0 : value >> (64 - used);
+				used = used + width - 64;
+			}
+			else
+			{
+				used += width;
+			}
+		}
+	}
+	
+	if(used > 0)
+	{
+		out[word++] = current;
+	}
+	blockWords[block] = word;
+}
+
+// Used to generate Chebyshev ephemerides.
+// Adds the current positions times T_k(x), k = 0..degree, to the running sums for the interval being fitted.
+// x is the sample time mapped onto [-1,1]. The first sample of an interval overwrites the sums.
+__kernel
+void chebyshevAccumulate(
+__global const double4* pos,
+__global double4* sums,
+int numParticles,
+int degree,
+double x,
+int firstSample)
+{
+	unsigned int gid = get_global_id(0);
+	double4 position = pos[gid];
+	position.w = 0.0;
+	
+	double tPrevious = 1.0;
+	double t = x;
+	double tNext;
+	for(int k = 0; k <= degree; k++)
+	{
+		double tk = k == 0 ? 1.0 : t;
+		size_t index = (size_t)k * numParticles + gid;
+		if(firstSample)
+		{
+			sums[index] = tk * position;
+		}
+		else
+		{
+			sums[index] += tk * position;
+		}
+		
+		if(k > 0)
+		{
+			tNext = 2.0 * x * t - tPrevious;
+			tPrevious = t;
+			t = tNext;
+		}
+	}
+}
+
+// Turns the sums into least squares Chebyshev coefficients.
+// gramInverse is the inverse of the (degree+1) square matrix sum_j T_k(x_j) T_l(x_j), the same for every body.
+__kernel
+void chebyshevSolve(
+__global const double4* sums,
+__global const double* gramInverse,
+int numParticles,
+int degree,
+__global double4* coefficients)
+{
+	unsigned int gid = get_global_id(0);
+	for(int k = 0; k <= degree; k++)
+	{
+		double4 c = (double4)(0.0, 0.0, 0.0, 0.0);
+		for(int l = 0; l <= degree; l++)
+		{
+			c += gramInverse[k * (degree + 1) + l] * sums[(size_t)l * numParticles + gid];
+		}
+		coefficients[(size_t)k * numParticles + gid] = c;
+	}
+}
+
+// Dense output. Evaluates the state at fraction of the way through the step just completed,
+// by integrating the Adams-Moulton interpolating polynomial through the acceleration (velocity) history
+// from posLast and velLast. weights are the integrals of the Lagrange basis polynomials from 0 to fraction,
+// for the nodes 1, 0, -1 ... -10 steps. At fraction 1 they are the 12th order Adams-Moulton coefficients.
+// Nothing used by the integrator is written.
+__kernel
+void denseOutput(
+__global const double4* pos,
+__global const double4* vel,
+__global const double4* acc,
+__global const double4* posLast,
+__global const double4* velLast,
+__global const double4* velHistory,
+__global const double4* accHistory,
+__global const double* weights,
+double deltaTime,
 int step,
 int numParticles,
+__global double4* outPos,
+__global double4* outVel)
+{
+	unsigned int gid = get_global_id(0);
+	double4 accSum = weights[0] * acc[gid];
+	double4 velSum = weights[0] * vel[gid];
+	long index;
+	
+	for(int j = 1; j < 12; j++)
+	{
+		index = ((step - j + 1) & 0xF) * numParticles + gid;
+		accSum = fma(weights[j], accHistory[index], accSum);
+		velSum = fma(weights[j], velHistory[index], velSum);
+	}
+	
+	double4 newPosition = posLast[gid] + deltaTime * velSum * (KMTOGM);
+	double4 newVelocity = velLast[gid] + deltaTime * accSum;
+	newPosition.w = pos[gid].w;
+	newVelocity.w = vel[gid].w;
+	outPos[gid] = newPosition;
+	outVel[gid] = newVelocity;
+}
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Solves Kepler's equation m = e - e sin(E) for the eccentric anomaly by bisection
+double KeplerSolver(double m,double e)
+{
+		double pi = M_PI;
+		double sign = m >0 ? 1.0 :-1.0;
+		m = fabs(m) / (2 * pi);
+		m = (m - floor(m)) * 2 * pi * sign;
+		sign = 1.0;
+		if (m > pi)
+		{
+			sign = -1;
+			m = 2 * pi - m;
+		}
+
+		double e0 = pi / 2;
+		double d = pi / 4;
+		for (int j = 0; j < 64; j++)
+		{
+			double m1 = e0 - e * sin(e0);
+
+			e0 = m > m1 ? e0 + d : e0 - d;
+			d = d / 2;
+		}
+
+		return e0 * sign;
+}
+
+// Used by the Kepler fast forward.
+// Mass weighted centre of the bodies with mass in one slot of a position, velocity or acceleration buffer.
+// masses holds the GM of each body in .w, the total is returned in .w
+double4 gravCentre(__global const double4* buffer, __global const double4* masses, long offset, int numGrav)
+{
+	double4 centre = (double4)(0.0, 0.0, 0.0, 0.0);
+	double total = 0.0;
+	for(int gravBody = 0; gravBody < numGrav; gravBody++)
+	{
+		double gm = masses[gravBody].w;
+		centre = fma(gm, buffer[offset + gravBody], centre);
+		total += gm;
+	}
+	centre = centre / total;
+	centre.w = total;
+	return centre;
+}
+
+// Position in Gm and velocity in Gm/s on the Kepler orbit through r0, v0 elapsed seconds later.
+// Works from the perifocal unit vectors rather than angular elements, the orbit must be bound
+void keplerState(double4 r0, double4 v0, double mu, double elapsed, double4* r, double4* v)
+{
+	double radius0 = length(r0);
+	double4 h = cross(r0, v0);
+	double4 eccentricityVector = cross(v0, h) / mu - r0 / radius0;
+	double eccentricity = length(eccentricityVector);
+	double semiMajorAxis = 1.0 / (2.0 / radius0 - dot(v0, v0) / mu);
+	double4 p;
+	double meanAnomaly;
+	if(eccentricity > 1e-12)
+	{
+		p = eccentricityVector / eccentricity;
+		double eccentricAnomaly = atan2(dot(r0, v0) / sqrt(mu * semiMajorAxis), 1.0 - radius0 / semiMajorAxis);
+		meanAnomaly = eccentricAnomaly - eccentricity * sin(eccentricAnomaly);
+	}
+	else
+	{
+		p = r0 / radius0;
+		meanAnomaly = 0.0;
+	}
+	double4 q = cross(h, p) / length(h);
+	
+	meanAnomaly += sqrt(mu / (semiMajorAxis * semiMajorAxis * semiMajorAxis)) * elapsed;
+	double eccentricAnomaly = KeplerSolver(meanAnomaly, eccentricity);
+	double cosE = cos(eccentricAnomaly);
+	double sinE = sin(eccentricAnomaly);
+	double b = semiMajorAxis * sqrt(1.0 - eccentricity * eccentricity);
+	double s = sqrt(mu * semiMajorAxis) / (semiMajorAxis * (1.0 - eccentricity * cosE));
+	*r = semiMajorAxis * (cosE - eccentricity) * p + b * sinE * q;
+	*v = -s * sinE * p + s * sqrt(1.0 - eccentricity * eccentricity) * cosE * q;
+}
+
+// Kepler fast forward. Moves distant test particles from where they were elapsed seconds ago, startPos and startVel,
+// along Kepler orbits about the centre of mass of the bodies with mass, ignoring planetary perturbations.
+// The Adams history for the last 15 steps is filled in from the same orbits so the integrator can carry on with them.
+// Runs over the particles from firstParticle on.
+__kernel
+void keplerFastForward(
+__global double4* pos,
+__global double4* vel,
+__global double4* acc,
 __global double4* posLast,
 __global double4* velLast,
 __global double4* velHistory,
-__global double4* accHistory)
+__global double4* accHistory,
+__global const double4* startPos,
+__global const double4* startVel,
+double4 startCentrePos,
+double4 startCentreVel,
+double elapsed,
+double deltaTime,
+int step,
+int numGrav,
+int numParticles,
+int firstParticle)
+{
+	unsigned int sid = get_global_id(0);
+	unsigned int gid = firstParticle + sid;
+	double mu = startCentrePos.w * (KMTOGM);
+	double4 r0 = startPos[sid] - startCentrePos;
+	double4 v0 = (startVel[sid] - startCentreVel) * (KMTOGM);
+	double mass = pos[gid].w;
+	double relativisticParam = vel[gid].w;
+	double4 r;
+	double4 v;
+	double4 result;
+	long index;
+	r0.w = 0.0;
+	v0.w = 0.0;
+	
+	// Current state and acceleration, accelerations in km/s^2 are -GM r / |r|^3 with r in Gm
+	keplerState(r0, v0, mu, elapsed, &r, &v);
+	result = gravCentre(vel, pos, 0, numGrav) + v / (KMTOGM);
+	result.w = relativisticParam;
+	vel[gid] = result;
+	result = gravCentre(acc, pos, 0, numGrav) - startCentrePos.w * r / (length(r) * dot(r, r));
+	result.w = 0.0;
+	acc[gid] = result;
+	result = FIXED_POINT(gravCentre(pos, pos, 0, numGrav) + r);
+	result.w = mass;
+	pos[gid] = result;
+	
+	// State at the previous step
+	keplerState(r0, v0, mu, elapsed - deltaTime, &r, &v);
+	double4 previous = FIXED_POINT(gravCentre(posLast, pos, 0, numGrav) + r);
+	previous.w = mass;
+	posLast[gid] = previous;
+	previous = gravCentre(velLast, pos, 0, numGrav) + v / (KMTOGM);
+	previous.w = relativisticParam;
+	velLast[gid] = previous;
+	
+	for(int j = 1; j < 16; j++)
+	{
+		index = ((step - j) & 0xF) * numParticles;
+		keplerState(r0, v0, mu, elapsed - j * deltaTime, &r, &v);
+		previous = gravCentre(velHistory, pos, index, numGrav) + v / (KMTOGM);
+		previous.w = relativisticParam;
+		velHistory[index + gid] = previous;
+		previous = gravCentre(accHistory, pos, index, numGrav) - startCentrePos.w * r / (length(r) * dot(r, r));
+		previous.w = 0.0;
+		accHistory[index + gid] = previous;
+	}
+}
+
+#define SPEED_OF_LIGHT 299792458.0
+#define COS_OBLIQUITY_OF_THE_ECLIPTIC 0.91748214228886027
+#define SIN_OBLIQUITY_OF_THE_ECLIPTIC 0.39777697090334874
+
+// Converts heliocentric ecliptic orbital elements to state vectors relative to the centre body in equatorial co-ordinates.
+// elementsA is (GM, mean anomaly at the element epoch, semi major axis in Gm, eccentricity)
+// elementsB is (inclination, argument of perihelion, longitude of the ascending node, seconds since the element epoch)
+// Angles are in radians. centreMass is the GM of the centre body, the mean motion comes from the sum of the two
+// so the orbits match the centre body of the simulation.
+// Positions are in Gm with the GM in w, velocities in km/s with the relativistic parameter in w.
+__kernel
+void orbitalToStateVectors(
+__global const double4* elementsA,
+__global const double4* elementsB,
+double centreMass,
+__global double4* newPos,
+__global double4* newVel,
+int numElements
+)
+{
+	unsigned int gid = get_global_id(0);
+	if(gid >= numElements)
+	{
+		return;
+	}
+
+	double mass = elementsA[gid].x;
+	double meanAnomaly = elementsA[gid].y;
+	double semiMajorAxis = elementsA[gid].z;
+	double eccentricity = elementsA[gid].w;
+	double inclination = elementsB[gid].x;
+	double argumentOfPerihelion = elementsB[gid].y;
+	double longitudeOfAscendingNode = elementsB[gid].z;
+	double elapsed = elementsB[gid].w;
+
+	// GM in w gives accelerations in km/s^2 from distances in Gm, work in Gm and Gm/s
+	double u = (centreMass + mass) * (KMTOGM);
+	double meanMotion = sqrt(u / (semiMajorAxis * semiMajorAxis * semiMajorAxis));
+	meanAnomaly = meanAnomaly + elapsed * meanMotion;
+
+	double eccentricAnomaly = KeplerSolver(meanAnomaly, eccentricity);
+	double radius = semiMajorAxis * (1 - eccentricity * cos(eccentricAnomaly));
+
+	// with x in the direction of perihelion, z perpendicular to the plane of the orbit
+	double ox = semiMajorAxis * (cos(eccentricAnomaly) - eccentricity);
+	double oy = semiMajorAxis * sqrt(1 - eccentricity * eccentricity) * sin(eccentricAnomaly);
+
+	double p = sqrt(u * semiMajorAxis) / radius;
+	double ovx = -p * sin(eccentricAnomaly);
+	double ovy = p * sqrt(1 - eccentricity * eccentricity) * cos(eccentricAnomaly);
+
+	// rotate to ecliptic co-ordinates
+	double cosArg = cos(argumentOfPerihelion);
+	double sinArg = sin(argumentOfPerihelion);
+	double cosLong = cos(longitudeOfAscendingNode);
+	double sinLong = sin(longitudeOfAscendingNode);
+	double cosInc = cos(inclination);
+	double sinInc = sin(inclination);
+
+	double x = ox * (cosArg * cosLong - sinArg * cosInc * sinLong) - oy * (sinArg * cosLong + cosArg * cosInc * sinLong);
+	double y = ox * (cosArg * sinLong + sinArg * cosInc * cosLong) + oy * (cosArg * cosInc * cosLong - sinArg * sinLong);
+	double z = ox * (sinArg * sinInc) + oy * (cosArg * sinInc);
+
+	double vx = ovx * (cosArg * cosLong - sinArg * cosInc * sinLong) - ovy * (sinArg * cosLong + cosArg * cosInc * sinLong);
+	double vy = ovx * (cosArg * sinLong + sinArg * cosInc * cosLong) + ovy * (cosArg * cosInc * cosLong - sinArg * sinLong);
+	double vz = ovx * (sinArg * sinInc) + ovy * (cosArg * sinInc);
+
+	// rotate to equatorial co-ordinates
+	double4 position;
+	position.x = x;
+	position.y = y * (COS_OBLIQUITY_OF_THE_ECLIPTIC) - z * (SIN_OBLIQUITY_OF_THE_ECLIPTIC);
+	position.z = y * (SIN_OBLIQUITY_OF_THE_ECLIPTIC) + z * (COS_OBLIQUITY_OF_THE_ECLIPTIC);
+	position.w = mass;
+
+	// -9 G M / (c^2 a) with G M in m^3/s^2 and a in m
+	double4 velocity;
+	velocity.x = vx / (KMTOGM);
+	velocity.y = (vy * (COS_OBLIQUITY_OF_THE_ECLIPTIC) - vz * (SIN_OBLIQUITY_OF_THE_ECLIPTIC)) / (KMTOGM);
+	velocity.z = (vy * (SIN_OBLIQUITY_OF_THE_ECLIPTIC) + vz * (COS_OBLIQUITY_OF_THE_ECLIPTIC)) / (KMTOGM);
+	velocity.w = -9.0 * centreMass * 1.0e12 / (SPEED_OF_LIGHT * SPEED_OF_LIGHT * semiMajorAxis);
+
+	newPos[gid] = position;
+	newVel[gid] = velocity;
+}
+
+// Acceleration of one test particle from the bodies with mass, as the newtonian or relativistic direct sum kernels compute it,
+// with the same summation
+double4 testParticleAcc(__global const double4* gravPos, double4 myPos, double4 myVel, int numGrav, double epsSqr, int relativistic)
+{
+	double4 r;
+	double distSqr;
+	double invDist;
+	double invDistCube;
+	double s;
+
+	// Do the Sun
+	r = gravPos[0] - myPos;
+	r.w = 0.0;
+	distSqr = r.x * r.x + r.y * r.y + r.z * r.z;
+	invDist = INV_SQRT(distSqr + epsSqr);
+	invDistCube = invDist * invDist * invDist;
+	s = gravPos[0].w * invDistCube;
+	if(relativistic)
+	{
+		s = s * (1.0 + myVel.w + (relativisticC1*invDist));
+	}
+	double4 accSun = s * r;
+
+	// Do the rest
+	double4 sumAcc = (double4)(0.0f, 0.0f, 0.0f, 0.0f);
+	double4 partial = (double4)(0.0f, 0.0f, 0.0f, 0.0f);
+	for(int gravBody = 1; gravBody < numGrav; gravBody++)
+	{
+		r = gravPos[gravBody] - myPos;
+		r.w = 0.0;
+		distSqr = r.x * r.x + r.y * r.y + r.z * r.z;
+		invDist = INV_SQRT(distSqr + epsSqr);
+		invDistCube = invDist * invDist * invDist;
+		s = gravPos[gravBody].w * invDistCube;
+		ACCELERATION_SUM_ADD(sumAcc, partial, s * r, gravBody);
+	}
+
+	return ACCELERATION_SUM_RESULT(sumAcc, partial) + accSun;
+}
+
+// Heliocentric integration. Every particle, and the Sun, is integrated relative to the Sun, which stays at the origin at rest.
+// The heliocentric acceleration of a particle is its acceleration less the Sun's, so less the indirect term, the pull
+// of the other bodies with mass on the Sun. One work item sums it, compensated and unsoftened like gravPairs
+__kernel
+void heliocentricIndirect(
+__global const double4* gravPos,
+int numGrav,
+__global double4* indirect)
+{
+	if(get_global_id(0) != 0)
+	{
+		return;
+	}
+
+	double4 sumAcc = (double4)(0.0, 0.0, 0.0, 0.0);
+	double4 partial = (double4)(0.0, 0.0, 0.0, 0.0);
+	for(int gravBody = 1; gravBody < numGrav; gravBody++)
+	{
+		double4 r = gravPos[gravBody] - gravPos[0];
+		double distSqr = r.x * r.x + r.y * r.y + r.z * r.z;
+		double invDist = 1.0 / sqrt(distSqr);
+		double s = gravPos[gravBody].w * invDist * invDist * invDist;
+		KAHAN_ADD(sumAcc, partial, s * r);
+	}
+	sumAcc.w = 0.0;
+	indirect[0] = sumAcc;
+}
+
+// Takes the indirect term off the accelerations of the particles, the Sun's own is zero in its frame
+__kernel
+void addIndirect(
+__global double4* acc,
+__global const double4* indirect)
 {
 	unsigned int gid = get_global_id(0);
-	double4 position = pos[gid]; 
-	double4 velocity = vel[gid];
 	double4 acceleration = acc[gid];
-	long index;
-	double4 newPosition;
-	double4 newVelocity;
-	double4 sum;
-	double4 f;
-	
-	// Adams-Bashford Predictor
-	// acceleration
-	f = acceleration;
-	sum = B4C1 * f;
-	
-	index = ((step-1) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B4C2,f,sum); //sum += B4C2 * f;
-	
-	index = ((step-2) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B4C3,f,sum); //sum += B4C3 * f;
+	double4 term = gid == 0 ? acceleration : indirect[0];
+	acceleration.xyz -= term.xyz;
+	acc[gid] = acceleration;
+}
+
+// Offset between the barycentric and heliocentric frames. Going to the heliocentric frame it is the state of the Sun,
+// coming back it is the heliocentric state of the centre of mass. offset is the position then the velocity, w is zero.
+// The position is kept on the fixed point grid so shifted positions stay on it
+__kernel
+void frameOffset(
+__global const double4* pos,
+__global const double4* vel,
+int numGrav,
+int toHeliocentric,
+__global double4* offset)
+{
+	if(get_global_id(0) != 0)
+	{
+		return;
+	}
+
+	double4 positionOffset = toHeliocentric ? pos[0] : gravCentre(pos, pos, 0, numGrav);
+	double4 velocityOffset = toHeliocentric ? vel[0] : gravCentre(vel, pos, 0, numGrav);
+	positionOffset = FIXED_POINT(positionOffset);
+	positionOffset.w = 0.0;
+	velocityOffset.w = 0.0;
+	offset[0] = positionOffset;
+	offset[1] = velocityOffset;
+}
+
+// Moves the particles into the other frame by the offset frameOffset found, keeping the GM and relativistic parameter in w.
+// framePos and frameVel can be pos and vel
+__kernel
+void frameShift(
+__global const double4* pos,
+__global const double4* vel,
+__global const double4* offset,
+__global double4* framePos,
+__global double4* frameVel,
+int numParticles)
+{
+	unsigned int gid = get_global_id(0);
+	if(gid >= numParticles)
+	{
+		return;
+	}
 
-	index = ((step-3) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B4C4,f,sum); //sum += B4C4 * f;
-	
-	newVelocity = velocity + deltaTime * sum;
-	velLast[gid] = velocity;
+	framePos[gid] = pos[gid] - offset[0];
+	frameVel[gid] = vel[gid] - offset[1];
+}
 
-	// --------------------------------------------
-	// position
+// Rounds the loaded positions onto the fixed point grid, keeping the GM in w
+__kernel
+void fixedPointPositions(
+__global double4* pos,
+int numParticles)
+{
+	unsigned int gid = get_global_id(0);
+	if(gid >= numParticles)
+	{
+		return;
+	}
 
-	f = velocity;
-	sum = B4C1 * f;
-	
-	index = ((step-1) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B4C2,f,sum); //sum += B4C2 * f;
-	
-	index = ((step-2) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B4C3,f,sum); //sum += B4C3 * f;
-	
-	index = ((step-3) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B4C4,f,sum); //sum += B4C4 * f;
-	
-	newPosition = position + deltaTime * sum * (KMTOGM);
-	posLast[gid] = position;
-	
-	index = ((step) & 0xF) * numParticles + gid;
-	//velocity.w = (double) step;
-	velHistory[index] = velocity;
-	//acceleration.w = (double)step;
-	accHistory[index] = acceleration;
-	
-	// Copy across mass and relativistic parameter
-	newPosition.w = position.w;
-	newVelocity.w = velocity.w;
-		
-	newPos[gid] = newPosition;
-	newVel[gid] = newVelocity;
+	double4 position = pos[gid];
+	double gm = position.w;
+	position = FIXED_POINT(position);
+	position.w = gm;
+	pos[gid] = position;
 }
 
+// Adaptive step size. The difference between the Adams-Moulton corrected and the Adams-Bashforth predicted position
+// estimates the local error of the step for nothing. Runs as a single work-group after the corrector, before the
+// corrected positions are copied over the predicted ones. Each particle's difference is taken relative to its distance
+// from the Sun, and errors gets the largest and the root mean square over the particles. The largest is the same
+// whatever the work-group size
 __kernel
-void adamsMoulton3( 
-__global double4* pos, 
-__global double4* vel,
-__global double4* acc, 
-double deltaTime, 
-__global double4* newPos, 
-__global double4* newVel,
-int stage,
-int step,
+void stepError(
+__global const double4* predictedPos,
+__global const double4* correctedPos,
 int numParticles,
-__global double4* posLast,
-__global double4* velLast,
-__global double4* velHistory,
-__global double4* accHistory)
+__local double* localMax,
+__local double* localSum,
+__global double* errors)
 {
-	unsigned int gid = get_global_id(0);
-	double4 position = pos[gid]; 
-	double4 velocity = vel[gid];
-	double4 acceleration = acc[gid];
-	long index;
-	double4 newPosition;
-	double4 newVelocity;
-	double4 sum;
-	double4 f;
-	
-	// Adams-Moulton corrector
-	// acceleration -> velocity
-	f = acceleration;
-	sum = M4C1 * f;
-	
-	index = ((step) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M4C2,f,sum); //sum += M4C2 * f;
-	
-	index = ((step-1) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M4C3,f,sum); //sum += M4C3 * f;
-	
-	index = ((step-2) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M4C4,f,sum); //sum += M4C4 * f;
-	
-	// Store corrected velocity
-	newVelocity = velLast[gid] + deltaTime * sum;
-	
-	//------------------------------
-	// velocity -> position
-	f = velocity;
-	sum = M4C1 * f;
-	
-	index = ((step) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M4C2,f,sum); //sum += M4C2 * f;
-	
-	index = ((step-1) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M4C3,f,sum); //sum += M4C3 * f;
-	
-	index = ((step-2) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M4C4,f,sum); //sum += M4C4 * f;
-	
-	// Store corrected position
-	newPosition = posLast[gid] + deltaTime * sum * (KMTOGM);
-	
-	// Copy across mass and relativistic parameter
-	newPosition.w = position.w;
-	newVelocity.w = velocity.w;
-		
-	newPos[gid] = newPosition;
-	newVel[gid] = newVelocity;
+	int lid = get_local_id(0);
+	int localSize = get_local_size(0);
+	double4 sun = correctedPos[0];
+	double maxError = 0.0;
+	double sumSqr = 0.0;
+	for(int gid = lid + 1; gid < numParticles; gid += localSize)
+	{
+		double4 d = correctedPos[gid] - predictedPos[gid];
+		double4 r = correctedPos[gid] - sun;
+		double distSqr = r.x * r.x + r.y * r.y + r.z * r.z;
+		if(distSqr > 0.0)
+		{
+			double errorSqr = (d.x * d.x + d.y * d.y + d.z * d.z) / distSqr;
+			maxError = fmax(maxError, sqrt(errorSqr));
+			sumSqr += errorSqr;
+		}
+	}
+	localMax[lid] = maxError;
+	localSum[lid] = sumSqr;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if(lid == 0)
+	{
+		for(int item = 1; item < localSize; item++)
+		{
+			maxError = fmax(maxError, localMax[item]);
+			sumSqr += localSum[item];
+		}
+		errors[0] = maxError;
+		errors[1] = numParticles > 1 ? sqrt(sumSqr / (numParticles - 1)) : 0.0;
+	}
+}
+
+// The Adams history of one particle as a function of x, the number of old steps back, through the RESCALE_NODES nodes around x
+#define RESCALE_NODES 8
+double4 historyAt(double4* nodes, double x)
+{
+	int first = clamp((int)floor(x) - RESCALE_NODES / 2 + 1, 0, 16 - RESCALE_NODES);
+	double4 sum = (double4)(0.0, 0.0, 0.0, 0.0);
+	for(int a = first; a < first + RESCALE_NODES; a++)
+	{
+		double weight = 1.0;
+		for(int b = first; b < first + RESCALE_NODES; b++)
+		{
+			if(b != a)
+			{
+				weight *= (x - b) / (a - b);
+			}
+		}
+		sum += weight * nodes[a];
+	}
+	return sum;
 }
 
+// Changes the spacing of the Adams history from the old step to ratio times it. Node m of the history, slot step - m
+// and the current velocity and acceleration for m = 0, is at m old steps back. Slot step - j becomes the
+// value at ratio * j old steps back, interpolated through the RESCALE_NODES nodes around it. Slots that would be past
+// the oldest node are left alone, the predictor doesn't reach them before they are overwritten.
+// A negative ratio reverses time, which needs the history ahead of the current state. So the particle is moved back to the
+// oldest node, its position found by integrating the velocity history with 4 point Gauss-Legendre on each old step,
+// and the nodes are taken in the other order, before rescaling by -ratio, which is at most 1.
+// Runs once acc holds the acceleration at pos
 __kernel
-void adamsBashforth16( 
-__global double4* pos, 
+void rescaleHistory(
+__global double4* pos,
 __global double4* vel,
-__global double4* acc, 
-double deltaTime, 
-__global double4* newPos, 
-__global double4* newVel,
-int stage,
-int step,
-int numParticles,
-__global double4* posLast,
-__global double4* velLast,
+__global double4* acc,
 __global double4* velHistory,
-__global double4* accHistory)
+__global double4* accHistory,
+int numParticles,
+int step,
+double deltaTime,
+double ratio)
 {
 	unsigned int gid = get_global_id(0);
-	double4 position = pos[gid]; 
-	double4 velocity = vel[gid];
-	double4 acceleration = acc[gid];
-	long index;
-	double4 newPosition;
-	double4 newVelocity;
-	double4 sum;
-	double4 f;
-	
-	// Adams-Bashford Predictor
-	// acceleration
-	f = acceleration;
-	sum = B16C1 * f;
-	
-	index = ((step-1) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B16C2,f,sum); //sum += B16C2 * f;
-	
-	index = ((step-2) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B16C3,f,sum); //sum += B16C3 * f;
+	if(gid >= numParticles)
+	{
+		return;
+	}
 
-	index = ((step-3) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B16C4,f,sum); //sum += B16C4 * f;
-	
-	index = ((step-4) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B16C5,f,sum); //sum += B16C5 * f;
-	
-	index = ((step-5) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B16C6,f,sum); //sum += B16C6 * f;
-	
-	index = ((step-6) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B16C7,f,sum); //sum += B16C7 * f;
-	
-	index = ((step-7) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B16C8,f,sum); //sum += B16C8 * f;
-	
-	index = ((step-8) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B16C9,f,sum); //sum += B16C9 * f;
-	
-	index = ((step-9) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B16C10,f,sum); //sum += B16C10 * f;
-	
-	index = ((step-10) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B16C11,f,sum); //sum += B16C11 * f;
-	
-	index = ((step-11) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B16C12,f,sum); //sum += B16C12 * f;
+	double4 velNodes[16];
+	double4 accNodes[16];
+	velNodes[0] = vel[gid];
+	accNodes[0] = acc[gid];
+	for(int m = 1; m < 16; m++)
+	{
+		long index = ((step-m) & 0xF) * HISTORY_STRIDE + gid;
+		velNodes[m] = velHistory[index];
+		accNodes[m] = accHistory[index];
+	}
 
-	index = ((step-12) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B16C13,f,sum); //sum += B16C13 * f;
-	
-	index = ((step-13) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B16C14,f,sum); //sum += B16C14 * f;
-	
-	index = ((step-14) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B16C15,f,sum); //sum += B16C15 * f;
+	if(ratio < 0.0)
+	{
+		const double gaussNodes[4] = {-0.8611363115940526, -0.3399810435848563, 0.3399810435848563, 0.8611363115940526};
+		const double gaussWeights[4] = {0.3478548451374538, 0.6521451548625461, 0.6521451548625461, 0.3478548451374538};
+		double4 integral = (double4)(0.0, 0.0, 0.0, 0.0);
+		for(int k = 0; k < 15; k++)
+		{
+			for(int g = 0; g < 4; g++)
+			{
+				integral += 0.5 * gaussWeights[g] * historyAt(velNodes, k + 0.5 + 0.5 * gaussNodes[g]);
+			}
+		}
 
-    index = ((step-15) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(B16C16,f,sum); //sum += B16C16 * f;
+		double4 position = pos[gid];
+		double gm = position.w;
+		position -= FIXED_POINT(deltaTime * integral * (KMTOGM));
+		position.w = gm;
+		pos[gid] = position;
 
-	newVelocity = velocity + deltaTime * sum;
-	velLast[gid] = velocity;
+		for(int m = 0; m < 8; m++)
+		{
+			double4 swap = velNodes[m];
+			velNodes[m] = velNodes[15 - m];
+			velNodes[15 - m] = swap;
+			swap = accNodes[m];
+			accNodes[m] = accNodes[15 - m];
+			accNodes[15 - m] = swap;
+		}
+		vel[gid] = velNodes[0];
+		acc[gid] = accNodes[0];
+		ratio = -ratio;
+	}
 
-	// --------------------------------------------
-	// position
-	f = velocity;
-	sum = B16C1 * f;
-	
-	index = ((step-1) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B16C2,f,sum); //sum += B16C2 * f;
-	
-	index = ((step-2) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B16C3,f,sum); //sum += B16C3 * f;
-	
-	index = ((step-3) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B16C4,f,sum); //sum += B16C4 * f;
-	
-	index = ((step-4) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B16C5,f,sum); //sum += B16C5 * f;
-	
-	index = ((step-5) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B16C6,f,sum); //sum += B16C6 * f;
-	
-	index = ((step-6) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B16C7,f,sum); //sum += B16C7 * f;
-	
-	index = ((step-7) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B16C8,f,sum); //sum += B16C8 * f;
-	
-	index = ((step-8) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B16C9,f,sum); //sum += B16C9 * f;
-	
-	index = ((step-9) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B16C10,f,sum); //sum += B16C10 * f;
-	
-	index = ((step-10) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B16C11,f,sum); //sum += B16C11 * f;
-	
-	index = ((step-11) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B16C12,f,sum); //sum += B16C12 * f;
-	
-	index = ((step-12) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B16C13,f,sum); //sum += B16C13 * f;
-	
-	index = ((step-13) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B16C14,f,sum); //sum += B16C14 * f;
-	
-	index = ((step-14) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B16C15,f,sum); //sum += B16C15 * f;
+	for(int j = 1; j < 16; j++)
+	{
+		double x = ratio * j;
+		if(x > 15.0)
+		{
+			break;
+		}
 
-	index = ((step-15) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(B16C16,f,sum); //sum += B16C16 * f;
-	
-	newPosition = position + deltaTime * sum * (KMTOGM);
-	posLast[gid] = position;
-	
-	index = ((step) & 0xF) * numParticles + gid;
-	//velocity.w = (double) step;
-	velHistory[index] = velocity;
-	//acceleration.w = (double)step;
-	accHistory[index] = acceleration;
-	
-	// Copy across mass and relativistic parameter
-	newPosition.w = position.w;
-	newVelocity.w = velocity.w;
-		
-	newPos[gid] = newPosition;
-	newVel[gid] = newVelocity;
+		long index = ((step-j) & 0xF) * HISTORY_STRIDE + gid;
+		double4 velocity = historyAt(velNodes, x);
+		double4 acceleration = historyAt(accNodes, x);
+		velocity.w = velNodes[j].w;
+		acceleration.w = accNodes[j].w;
+		velHistory[index] = velocity;
+		accHistory[index] = acceleration;
+	}
 }
 
-
+// Second phase of two-phase integration.
+// The bodies with mass have already been integrated numSteps steps, and gravEphemeris holds their positions
+// at every stage, [2 * numSteps][numGrav], the start of the step followed by the predicted positions.
+// Each work item advances one test particle all numSteps steps with the same Adams predictor corrector
+// the stage kernels use, keeping its history rings in private memory, so the particle state is read and written once.
+// coefficients holds the order Adams-Bashforth weights, newest first, followed by the order Adams-Moulton weights.
 __kernel
-void adamsMoulton15( 
-__global double4* pos, 
-__global double4* vel,
-__global double4* acc, 
-double deltaTime, 
-__global double4* newPos, 
-__global double4* newVel,
-int stage,
+void twoPhaseTestParticles(
+__global const double4* gravEphemeris,
+int numGrav,
+double epsSqr,
+int relativistic,
+__constant double* coefficients,
+int order,
+double deltaTime,
 int step,
+int numSteps,
 int numParticles,
+int firstParticle,
+__global double4* pos,
+__global double4* vel,
+__global double4* acc,
 __global double4* posLast,
 __global double4* velLast,
 __global double4* velHistory,
 __global double4* accHistory)
 {
-	unsigned int gid = get_global_id(0);
-	double4 position = pos[gid]; 
+	unsigned int gid = firstParticle + get_global_id(0);
+	double4 velRing[16];
+	double4 accRing[16];
+	double4 position = pos[gid];
 	double4 velocity = vel[gid];
+	double4 lastPosition = posLast[gid];
+	double4 lastVelocity = velLast[gid];
 	double4 acceleration = acc[gid];
-	long index;
-	double4 newPosition;
-	double4 newVelocity;
-	double4 sum;
-	double4 f;
-	
-	// Adams-Moulton corrector
-	// acceleration -> velocity
-	
-	f = acceleration;
-	sum = M16C1 * f;
-	
-	index = ((step) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M16C2,f,sum); //sum += M16C2 * f;
-	
-	index = ((step-1) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M16C3,f,sum); //sum += M16C3 * f;
-	
-	index = ((step-2) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M16C4,f,sum); //sum += M16C4 * f;
-	
-	index = ((step-3) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M16C5,f,sum); //sum += M16C5 * f;
-	
-	index = ((step-4) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M16C6,f,sum); //sum += M16C6 * f;
-	
-	index = ((step-5) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M16C7,f,sum); //sum += M16C7 * f;
-	
-	index = ((step-6) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M16C8,f,sum); //sum += M16C8 * f;
-	
-	index = ((step-7) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M16C9,f,sum); //sum += M16C9 * f;
-	
-	index = ((step-8) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M16C10,f,sum); //sum += M16C10 * f;
-	
-	index = ((step-9) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M16C11,f,sum); //sum += M16C11 * f;
-	
-	index = ((step-10) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M16C12,f,sum); //sum += M16C12 * f;
-
-	index = ((step-11) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M16C13,f,sum); //sum += M16C13 * f;
-	
-	index = ((step-12) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M16C14,f,sum); //sum += M16C14 * f;
-	
-	index = ((step-13) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M16C15,f,sum); //sum += M16C15 * f;
-	
-	index = ((step-14) & 0xF) * numParticles + gid;
-	f = accHistory[index];
-	sum = fma(M16C16,f,sum); //sum += M16C16 * f;
-
-	// Store corrected velocity
-	newVelocity = velLast[gid] + deltaTime * sum;
-	
-	//------------------------------
-	// velocity -> position
-	f = velocity;
-	sum = M16C1 * f;
-	
-	index = ((step) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M16C2,f,sum); //sum += M16C2 * f;
-	
-	index = ((step-1) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M16C3,f,sum); //sum += M16C3 * f;
-	
-	index = ((step-2) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M16C4,f,sum); //sum += M16C4 * f;
-	
-	index = ((step-3) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M16C5,f,sum); //sum += M16C5 * f;
+	double4 velSum;
+	double4 accSum;
+	double4 predictedPos;
+	double4 predictedVel;
+	int n;
 	
-	index = ((step-4) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M16C6,f,sum); //sum += M16C6 * f;
-	
-	index = ((step-5) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M16C7,f,sum); //sum += M16C7 * f;
-	
-	index = ((step-6) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M16C8,f,sum); //sum += M16C8 * f;
-	
-	index = ((step-7) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M16C9,f,sum); //sum += M16C9 * f;
-	
-	index = ((step-8) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M16C10,f,sum); //sum += M16C10 * f;
-	
-	index = ((step-9) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M16C11,f,sum); //sum += M16C11 * f;
-	
-	index = ((step-10) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M16C12,f,sum); //sum += M16C12 * f;
-
-	index = ((step-11) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M16C13,f,sum); //sum += M16C13 * f;
-	
-	index = ((step-12) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M16C14,f,sum); //sum += M16C14 * f;
-	
-	index = ((step-13) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M16C15,f,sum); //sum += M16C15 * f;
-	
-	index = ((step-14) & 0xF) * numParticles + gid;
-	f = velHistory[index];
-	sum = fma(M16C16,f,sum); //sum += M16C16 * f;
-
-	// Store corrected position
-	newPosition = posLast[gid] + deltaTime * sum * (KMTOGM);
+	for(int slot = 0; slot < 16; slot++)
+	{
+		velRing[slot] = velHistory[slot * numParticles + gid];
+		accRing[slot] = accHistory[slot * numParticles + gid];
+	}
 	
-	// Copy across mass and relativistic parameter
-	newPosition.w = position.w;
-	newVelocity.w = velocity.w;
+	for(int s = 0; s < numSteps; s++)
+	{
+		n = step + s;
 		
-	newPos[gid] = newPosition;
-	newVel[gid] = newVelocity;
+		// Adams-Bashforth predictor, from the acceleration at the start of the step
+		acceleration = testParticleAcc(gravEphemeris + (2 * s) * numGrav, position, velocity, numGrav, epsSqr, relativistic);
+		accSum = coefficients[0] * acceleration;
+		velSum = coefficients[0] * velocity;
+		for(int j = 1; j < order; j++)
+		{
+			accSum = fma(coefficients[j], accRing[(n - j) & 0xF], accSum);
+			velSum = fma(coefficients[j], velRing[(n - j) & 0xF], velSum);
+		}
+		
+		predictedVel = velocity + deltaTime * accSum;
+		predictedPos = position + FIXED_POINT(deltaTime * velSum * (KMTOGM));
+		predictedVel.w = velocity.w;
+		predictedPos.w = position.w;
+		
+		lastPosition = position;
+		lastVelocity = velocity;
+		velRing[n & 0xF] = velocity;
+		accRing[n & 0xF] = acceleration;
+		
+		// Adams-Moulton corrector, from the acceleration at the predicted position
+		acceleration = testParticleAcc(gravEphemeris + (2 * s + 1) * numGrav, predictedPos, predictedVel, numGrav, epsSqr, relativistic);
+		accSum = coefficients[16] * acceleration;
+		velSum = coefficients[16] * predictedVel;
+		for(int j = 1; j < order; j++)
+		{
+			accSum = fma(coefficients[16 + j], accRing[(n - j + 1) & 0xF], accSum);
+			velSum = fma(coefficients[16 + j], velRing[(n - j + 1) & 0xF], velSum);
+		}
+		
+		velocity = lastVelocity + deltaTime * accSum;
+		position = lastPosition + FIXED_POINT(deltaTime * velSum * (KMTOGM));
+		velocity.w = lastVelocity.w;
+		position.w = lastPosition.w;
+	}
+	
+	pos[gid] = position;
+	vel[gid] = velocity;
+	acc[gid] = acceleration;
+	posLast[gid] = lastPosition;
+	velLast[gid] = lastVelocity;
+	for(int slot = 0; slot < 16; slot++)
+	{
+		velHistory[slot * numParticles + gid] = velRing[slot];
+		accHistory[slot * numParticles + gid] = accRing[slot];
+	}
 }
 
 )";
@@ -0,0 +1,188 @@
+/*
+  Copyright 2013-2025 Michael William Simmons
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#ifndef MPCORB_HPP
+#define MPCORB_HPP
+
+#include <cstdlib>
+#include <locale>
+#include <sstream>
+#include <string>
+
+/**
+ * @brief Column parser for one line of an MPCORB.DAT style catalog of orbital elements
+ *
+ * Columns follow the Minor Planet Center's export format, counted from 1 in its documentation and from 0 here.
+ * Kept apart from InitialState::ImportMPCORB, which needs the device, so the format can be checked on the host alone.
+ */
+namespace MpcOrb
+{
+  /**
+   * @brief Elements of one catalog line, in the catalog's units, degrees and AU
+   */
+  struct Elements
+  {
+    char uncertainty;                /**< Uncertainty parameter, '0' to '9' */
+    int epochYear;                   /**< Epoch, unpacked from the packed form */
+    int epochMonth;                  /**< 1 to 12 */
+    int epochDay;                    /**< 1 to 31 */
+    double absoluteMagnitude;        /**< H, 20 when the catalog has none */
+    double meanAnomaly;              /**< Degrees at the epoch */
+    double argumentOfPerihelion;     /**< Degrees */
+    double longitudeOfAscendingNode; /**< Degrees */
+    double inclination;              /**< Degrees */
+    double eccentricity;             /**< Below 1 */
+    double semiMajorAxis;            /**< AU */
+    unsigned long typeCode;          /**< Hexadecimal orbit type flags, 0 when absent */
+    std::string designation;         /**< Readable designation without spaces, such as (1)Ceres, or the packed one if that is empty */
+    std::string readableName;        /**< Name part of the readable designation without spaces, as OrbToSlf names bodies */
+  };
+
+  enum ParseResult
+  {
+    Parsed,      /**< elements is filled in */
+    Skipped,     /**< Too short or not well enough determined */
+    BadEpoch,    /**< The packed epoch can't be read */
+    BadElements, /**< One of the orbital elements can't be read */
+    Unbound      /**< Eccentricity 1 or more, or a semi major axis that isn't positive */
+  };
+
+  /**
+   * @brief The columns from start, at most length of them, empty past the end of the line
+   */
+  inline std::string Column(const std::string &line, size_t start, size_t length)
+  {
+    return start < line.size() ? line.substr(start, length) : std::string();
+  }
+
+  /**
+   * @brief The text with the spaces at either end removed, or every space if all is true
+   */
+  inline std::string Strip(const std::string &text, bool all)
+  {
+    std::string stripped;
+    size_t first = text.find_first_not_of(' ');
+    size_t last = text.find_last_not_of(' ');
+    if (first == std::string::npos)
+    {
+      return stripped;
+    }
+
+    for (size_t i = first; i <= last; i++)
+    {
+      if (!all || text[i] != ' ')
+      {
+        stripped += text[i];
+      }
+    }
+    return stripped;
+  }
+
+  /**
+   * @brief Reads a number filling a field apart from surrounding spaces, always with a '.' decimal point
+   */
+  inline bool ReadDouble(const std::string &field, double *value)
+  {
+    std::istringstream stream(field);
+    stream.imbue(std::locale::classic());
+    stream >> *value;
+    if (stream.fail())
+    {
+      return false;
+    }
+
+    stream >> std::ws;
+    return stream.eof();
+  }
+
+  /**
+   * @brief Reads an unsigned whole number filling a field apart from surrounding spaces
+   */
+  inline bool ReadUnsigned(const std::string &field, int base, unsigned long *value)
+  {
+    std::string number = Strip(field, false);
+    if (number.empty() || number[0] == '-' || number[0] == '+')
+    {
+      return false;
+    }
+
+    char *end = NULL;
+    *value = strtoul(number.c_str(), &end, base);
+    return *end == '\0';
+  }
+
+  /**
+   * @brief Parses one line that follows the header's row of dashes
+   */
+  inline ParseResult ParseLine(const std::string &line, Elements *elements)
+  {
+    if (line.size() < 106)
+    {
+      return Skipped;
+    }
+
+    // Only take reasonably well determined orbits
+    elements->uncertainty = line[105];
+    if (elements->uncertainty < '0' || elements->uncertainty > '9')
+    {
+      return Skipped;
+    }
+
+    // Packed epoch, century letter I J K, two digit year, then month and day as 1-9 A-V
+    std::string epoch = Column(line, 20, 5);
+    unsigned long year;
+    if (epoch.size() < 5 || epoch[0] < 'I' || epoch[0] > 'K' || !ReadUnsigned(epoch.substr(1, 2), 10, &year))
+    {
+      return BadEpoch;
+    }
+    elements->epochYear = (int)year + 1800 + (epoch[0] - 'I') * 100;
+    elements->epochMonth = epoch[3] <= '9' ? epoch[3] - '0' : epoch[3] - 'A' + 10;
+    elements->epochDay = epoch[4] <= '9' ? epoch[4] - '0' : epoch[4] - 'A' + 10;
+
+    if (!ReadDouble(Column(line, 8, 5), &elements->absoluteMagnitude))
+    {
+      elements->absoluteMagnitude = 20.0;
+    }
+
+    if (!ReadDouble(Column(line, 26, 9), &elements->meanAnomaly) || !ReadDouble(Column(line, 37, 9), &elements->argumentOfPerihelion) ||
+        !ReadDouble(Column(line, 48, 9), &elements->longitudeOfAscendingNode) || !ReadDouble(Column(line, 59, 9), &elements->inclination) ||
+        !ReadDouble(Column(line, 70, 9), &elements->eccentricity) || !ReadDouble(Column(line, 92, 11), &elements->semiMajorAxis))
+    {
+      return BadElements;
+    }
+
+    if (elements->eccentricity >= 1.0 || elements->semiMajorAxis <= 0.0)
+    {
+      return Unbound;
+    }
+
+    if (line.size() < 165 || !ReadUnsigned(Column(line, 161, 4), 16, &elements->typeCode))
+    {
+      elements->typeCode = 0;
+    }
+
+    // Readable designation in columns 167-194, such as (1) Ceres or 2001 AB123, the date of the last observation follows it.
+    // The name is columns 176-194, as OrbToSlf reads it
+    elements->designation = Strip(Column(line, 166, 28), true);
+    if (elements->designation.empty())
+    {
+      elements->designation = Strip(Column(line, 0, 7), false);
+    }
+    elements->readableName = Strip(Column(line, 175, 19), true);
+    return Parsed;
+  }
+} // namespace MpcOrb
+
+#endif // MPCORB_HPP
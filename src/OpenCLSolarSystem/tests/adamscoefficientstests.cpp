@@ -0,0 +1,124 @@
+/*
+  Copyright 2013-2025 Michael William Simmons
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#include "hostcheck.hpp"
+#include "adamscoefficients.hpp"
+
+using AdamsCoefficients::Integer;
+using AdamsCoefficients::maxOrder;
+using AdamsCoefficients::minOrder;
+using AdamsCoefficients::table;
+
+// Checks one method against published weights over a common denominator, both exactly and as the table holds them
+static void CheckMethod(int order, int newestNode, const long long *numerators, long long denominator)
+{
+  const double *row = newestNode == 0 ? table.bashforth[order] : table.moulton[order];
+  for (int node = 0; node < order; node++)
+  {
+    AdamsCoefficients::Rational expected = AdamsCoefficients::Reduce(numerators[node], denominator);
+    AdamsCoefficients::Rational weight = AdamsCoefficients::Weight(order, newestNode, node);
+    CHECK(weight.numerator == expected.numerator && weight.denominator == expected.denominator);
+    CHECK_NEAR(row[node], (double)numerators[node] / (double)denominator, 1e-15 * fabs((double)numerators[node] / (double)denominator));
+  }
+}
+
+// Low orders from the standard tables
+static void PublishedWeights()
+{
+  const long long bashforth2[] = {3, -1};
+  const long long bashforth3[] = {23, -16, 5};
+  const long long bashforth4[] = {55, -59, 37, -9};
+  const long long bashforth5[] = {1901, -2774, 2616, -1274, 251};
+  const long long bashforth6[] = {4277, -7923, 9982, -7298, 2877, -475};
+  CheckMethod(2, 0, bashforth2, 2);
+  CheckMethod(3, 0, bashforth3, 12);
+  CheckMethod(4, 0, bashforth4, 24);
+  CheckMethod(5, 0, bashforth5, 720);
+  CheckMethod(6, 0, bashforth6, 1440);
+
+  // The corrector's nodes run from the point being corrected back
+  const long long moulton2[] = {1, 1};
+  const long long moulton3[] = {5, 8, -1};
+  const long long moulton4[] = {9, 19, -5, 1};
+  const long long moulton5[] = {251, 646, -264, 106, -19};
+  const long long moulton6[] = {475, 1427, -798, 482, -173, 27};
+  CheckMethod(2, 1, moulton2, 2);
+  CheckMethod(3, 1, moulton3, 12);
+  CheckMethod(4, 1, moulton4, 24);
+  CheckMethod(5, 1, moulton5, 720);
+  CheckMethod(6, 1, moulton6, 1440);
+}
+
+// An order k method integrates every polynomial of degree below k exactly, so sum of w(node) (newestNode - node)^n is 1/(n + 1).
+// Checked in integers up to order 12, past which the powers would overflow
+static void ExactForPolynomials()
+{
+  for (int order = minOrder; order <= 12; order++)
+  {
+    for (int newestNode = 0; newestNode < 2; newestNode++)
+    {
+      AdamsCoefficients::Weights weights = AdamsCoefficients::MethodWeights(order, newestNode);
+      for (int n = 0; n < order; n++)
+      {
+        Integer sum = 0;
+        for (int node = 0; node < order; node++)
+        {
+          Integer power = 1;
+          for (int i = 0; i < n; i++)
+          {
+            power *= newestNode - node;
+          }
+          sum += weights.numerator[node] * power;
+        }
+        CHECK(sum * (n + 1) == weights.denominator);
+      }
+    }
+  }
+}
+
+// Every row the kernels use is the rounded exact weight, sums to one, and is zero past its order
+static void EveryOrder()
+{
+  for (int order = minOrder; order <= maxOrder; order++)
+  {
+    for (int newestNode = 0; newestNode < 2; newestNode++)
+    {
+      const double *row = newestNode == 0 ? table.bashforth[order] : table.moulton[order];
+      double sum = 0.0;
+      double magnitude = 0.0;
+      for (int node = 0; node < maxOrder; node++)
+      {
+        if (node >= order)
+        {
+          CHECK(row[node] == 0.0);
+          continue;
+        }
+
+        CHECK(row[node] == AdamsCoefficients::ToDouble(AdamsCoefficients::Weight(order, newestNode, node)));
+        sum += row[node];
+        magnitude += fabs(row[node]);
+      }
+      CHECK_NEAR(sum, 1.0, 4e-16 * order * magnitude);
+    }
+  }
+}
+
+int main()
+{
+  PublishedWeights();
+  ExactForPolynomials();
+  EveryOrder();
+  return HostCheck::Result();
+}
@@ -0,0 +1,215 @@
+/*
+  Copyright 2013-2025 Michael William Simmons
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#include "hostcheck.hpp"
+#include "archivecodec.hpp"
+
+#include <vector>
+
+// Must match ARCHIVE_BLOCK_SIZE and ARCHIVE_BLOCK_WORDS in the kernels, and CLModel
+static const int blockSize = 32;
+static const int blockWords = 1 + 3 * blockSize;
+
+static std::uint64_t Zigzag(std::int64_t value)
+{
+  return (std::uint64_t)((std::uint64_t)value << 1) ^ (std::uint64_t)(value >> 63);
+}
+
+static int Width(std::uint64_t value)
+{
+  int width = 0;
+  while (width < 64 && (value >> width) != 0)
+  {
+    width++;
+  }
+  return width;
+}
+
+// The archiveEncode kernel's packing of one block, from positions already quantised.
+// history is laid out as the decoder keeps it and is moved on a frame
+static std::uint32_t EncodeBlock(const std::int64_t *quantised, int numBodies, int predictionOrder, std::int64_t *history, std::uint64_t *out)
+{
+  std::vector<std::uint64_t> values((size_t)numBodies * 3);
+  int widths[3] = {0, 0, 0};
+  for (int body = 0; body < numBodies; body++)
+  {
+    std::int64_t *q = history + (size_t)body * 9;
+    for (int axis = 0; axis < 3; axis++)
+    {
+      std::int64_t frames[3] = {q[axis], q[3 + axis], q[6 + axis]};
+      std::uint64_t value = Zigzag(quantised[body * 3 + axis] - ArchiveCodec::Predict(frames, predictionOrder));
+      values[body * 3 + axis] = value;
+      widths[axis] = Width(value) > widths[axis] ? Width(value) : widths[axis];
+      q[6 + axis] = q[3 + axis];
+      q[3 + axis] = q[axis];
+      q[axis] = quantised[body * 3 + axis];
+    }
+  }
+
+  out[0] = (std::uint64_t)widths[0] | ((std::uint64_t)widths[1] << 8) | ((std::uint64_t)widths[2] << 16);
+  std::uint32_t word = 1;
+  std::uint64_t current = 0;
+  int used = 0;
+  for (int i = 0; i < numBodies * 3; i++)
+  {
+    std::uint64_t value = values[i];
+    int width = widths[i % 3];
+    if (width == 0)
+    {
+      continue;
+    }
+
+    current |= value << used;
+    if (used + width >= 64)
+    {
+      out[word++] = current;
+      current = used == 0 ? 0 : value >> (64 - used);
+      used = used + width - 64;
+    }
+    else
+    {
+      used += width;
+    }
+  }
+
+  if (used > 0)
+  {
+    out[word++] = current;
+  }
+  return word;
+}
+
+// Bodies on circular orbits archived with a keyframe every 16 frames and decoded back, every coordinate within half the quantum
+static void OrbitRoundTrip()
+{
+  const int numBodies = 70;
+  const int numBlocks = (numBodies + blockSize - 1) / blockSize;
+  const int numFrames = 40;
+  const int keyframeInterval = 16;
+  const double quantum = 2e-6;
+  std::vector<std::int64_t> encoderHistory((size_t)numBodies * 9, 0);
+  std::vector<std::int64_t> decoderHistory((size_t)numBodies * 9, 0);
+  std::vector<std::uint64_t> blocks((size_t)numBlocks * blockWords);
+  int framesSinceKeyframe = 0;
+  for (int frame = 0; frame < numFrames; frame++)
+  {
+    int predictionOrder = 0;
+    if (frame > 0 && framesSinceKeyframe < keyframeInterval)
+    {
+      predictionOrder = framesSinceKeyframe + 1 < 3 ? framesSinceKeyframe + 1 : 3;
+    }
+
+    std::vector<double> positions((size_t)numBodies * 3);
+    std::vector<std::int64_t> quantised((size_t)numBodies * 3);
+    for (int body = 0; body < numBodies; body++)
+    {
+      double radius = 50.0 + 30.0 * body;
+      double angle = 0.01 * frame * (1.0 + body % 7) + body;
+      positions[body * 3] = radius * cos(angle);
+      positions[body * 3 + 1] = radius * sin(angle);
+      positions[body * 3 + 2] = 0.01 * radius * sin(2.0 * angle);
+      for (int axis = 0; axis < 3; axis++)
+      {
+        quantised[body * 3 + axis] = (std::int64_t)rint(positions[body * 3 + axis] / quantum);
+      }
+    }
+
+    for (int block = 0; block < numBlocks; block++)
+    {
+      int first = block * blockSize;
+      int count = first + blockSize < numBodies ? blockSize : numBodies - first;
+      std::uint64_t *out = blocks.data() + (size_t)block * blockWords;
+      std::uint32_t words = EncodeBlock(quantised.data() + first * 3, count, predictionOrder, encoderHistory.data() + (size_t)first * 9, out);
+      CHECK(words <= (std::uint32_t)blockWords);
+      if (predictionOrder == 3)
+      {
+        CHECK(words < (std::uint32_t)blockWords / 2);
+      }
+
+      bool decoded = true;
+      try
+      {
+        ArchiveCodec::DecodeBlock(out, words, count, predictionOrder, decoderHistory.data() + (size_t)first * 9);
+      }
+      catch (int)
+      {
+        decoded = false;
+      }
+      CHECK(decoded);
+    }
+
+    for (int body = 0; body < numBodies; body++)
+    {
+      for (int axis = 0; axis < 3; axis++)
+      {
+        CHECK_NEAR(decoderHistory[(size_t)body * 9 + axis] * quantum, positions[body * 3 + axis], 0.5 * quantum * (1.0 + 1e-9));
+      }
+    }
+    framesSinceKeyframe = predictionOrder == 0 ? 0 : framesSinceKeyframe + 1;
+  }
+}
+
+// Residuals needing all 64 bits straddle words and still come back exactly
+static void FullWidthResiduals()
+{
+  const int numBodies = 5;
+  std::int64_t quantised[numBodies * 3];
+  for (int i = 0; i < numBodies * 3; i++)
+  {
+    quantised[i] = (i % 2 ? -1 : 1) * (((std::int64_t)1 << 62) + i * 12345);
+  }
+
+  std::vector<std::int64_t> encoderHistory(numBodies * 9, 0);
+  std::vector<std::int64_t> decoderHistory(numBodies * 9, 0);
+  std::uint64_t out[blockWords];
+  std::uint32_t words = EncodeBlock(quantised, numBodies, 0, encoderHistory.data(), out);
+  CHECK((out[0] & 0xFF) == 64);
+  ArchiveCodec::DecodeBlock(out, words, numBodies, 0, decoderHistory.data());
+  for (int i = 0; i < numBodies * 3; i++)
+  {
+    CHECK(decoderHistory[(i / 3) * 9 + i % 3] == quantised[i]);
+  }
+}
+
+// A block cut short, or empty, throws rather than reading past its words
+static void TruncatedBlock()
+{
+  std::int64_t quantised[6] = {1000, -2000, 3000, 4000, -5000, 6000};
+  std::vector<std::int64_t> history(18, 0);
+  std::uint64_t out[blockWords];
+  std::uint32_t words = EncodeBlock(quantised, 2, 0, history.data(), out);
+  for (std::uint32_t cut = 0; cut < words; cut++)
+  {
+    std::vector<std::int64_t> decoderHistory(18, 0);
+    bool threw = false;
+    try
+    {
+      ArchiveCodec::DecodeBlock(out, cut, 2, 0, decoderHistory.data());
+    }
+    catch (int)
+    {
+      threw = true;
+    }
+    CHECK(threw);
+  }
+}
+
+int main()
+{
+  OrbitRoundTrip();
+  FullWidthResiduals();
+  TruncatedBlock();
+  return HostCheck::Result();
+}
@@ -0,0 +1,127 @@
+/*
+  Copyright 2013-2025 Michael William Simmons
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#include "hostcheck.hpp"
+#include "checkpointcodec.hpp"
+
+#include <cstring>
+#include <random>
+#include <vector>
+
+// Words that XOR to zero take no bytes, the rest as many as their highest non zero byte
+static void EncodedLengths()
+{
+  std::uint64_t words[5] = {0, 0xFF, 0x100, 0x8000000000000000ull, 0x0102030405060708ull};
+  unsigned char out[64];
+  size_t size = CheckpointCodec::EncodeWords(words, 5, out);
+  CHECK(size == 3 + 0 + 1 + 2 + 8 + 8);
+  CHECK(size <= CheckpointCodec::EncodedSizeBound(5));
+  CHECK(out[0] == 0x10);
+  CHECK(out[2] == 0x82);
+
+  std::uint64_t zeros[7] = {};
+  CHECK(CheckpointCodec::EncodeWords(zeros, 7, out) == 4);
+}
+
+// A base and a chain of deltas, written as Checkpoint::Write does and replayed as Checkpoint::Restore does, in two sections
+static void RecordRoundTrip()
+{
+  const size_t sectionWords[2] = {36, 61};
+  const size_t numWords = sectionWords[0] + sectionWords[1];
+  std::mt19937_64 random(20250101);
+  std::vector<double> state(numWords);
+  for (size_t i = 0; i < numWords; i++)
+  {
+    state[i] = std::uniform_real_distribution<double>(-1e4, 1e4)(random);
+  }
+
+  std::vector<std::vector<unsigned char>> records;
+  std::vector<std::uint64_t> reference(numWords, 0);
+  std::vector<double> expected;
+  for (int record = 0; record < 8; record++)
+  {
+    // Small changes to a double leave its high bytes alone, which is what the deltas rely on
+    if (record > 0)
+    {
+      for (size_t i = 0; i < numWords; i += 1 + record % 3)
+      {
+        state[i] += 1e-9 * state[i] * record;
+      }
+    }
+
+    std::vector<std::uint64_t> words(numWords);
+    memcpy(words.data(), state.data(), numWords * sizeof(std::uint64_t));
+    std::vector<std::uint64_t> delta(numWords);
+    for (size_t i = 0; i < numWords; i++)
+    {
+      delta[i] = words[i] ^ reference[i];
+    }
+
+    std::vector<unsigned char> encoded(CheckpointCodec::EncodedSizeBound(sectionWords[0]) + CheckpointCodec::EncodedSizeBound(sectionWords[1]));
+    size_t size = CheckpointCodec::EncodeWords(delta.data(), sectionWords[0], encoded.data());
+    size += CheckpointCodec::EncodeWords(delta.data() + sectionWords[0], sectionWords[1], encoded.data() + size);
+    encoded.resize(size);
+    if (record > 0)
+    {
+      CHECK(size < numWords * sizeof(std::uint64_t));
+    }
+    records.push_back(encoded);
+    reference = words;
+    expected = state;
+  }
+
+  std::vector<std::uint64_t> restored(numWords, 0);
+  for (const std::vector<unsigned char> &record : records)
+  {
+    size_t inIndex = 0;
+    size_t wordIndex = 0;
+    for (int section = 0; section < 2; section++)
+    {
+      size_t used = 0;
+      CHECK(CheckpointCodec::XorDecodedWords(record.data() + inIndex, record.size() - inIndex, restored.data() + wordIndex, sectionWords[section], &used));
+      inIndex += used;
+      wordIndex += sectionWords[section];
+    }
+    CHECK(inIndex == record.size());
+  }
+  CHECK(memcmp(restored.data(), expected.data(), numWords * sizeof(std::uint64_t)) == 0);
+}
+
+// A record cut short or with a byte count over 8 is rejected rather than read past
+static void MalformedRecords()
+{
+  std::uint64_t words[4] = {0x1122334455667788ull, 0x99, 0, 0xABCD};
+  unsigned char out[64];
+  size_t size = CheckpointCodec::EncodeWords(words, 4, out);
+  std::uint64_t decoded[4] = {};
+  size_t used = 0;
+  for (size_t cut = 0; cut < size; cut++)
+  {
+    CHECK(!CheckpointCodec::XorDecodedWords(out, cut, decoded, 4, &used));
+  }
+  CHECK(CheckpointCodec::XorDecodedWords(out, size, decoded, 4, &used));
+  CHECK(used == size);
+
+  unsigned char badLength[] = {0x09, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+  CHECK(!CheckpointCodec::XorDecodedWords(badLength, sizeof(badLength), decoded, 2, &used));
+}
+
+int main()
+{
+  EncodedLengths();
+  RecordRoundTrip();
+  MalformedRecords();
+  return HostCheck::Result();
+}
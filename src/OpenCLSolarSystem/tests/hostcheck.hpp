@@ -0,0 +1,63 @@
+/*
+  Copyright 2013-2025 Michael William Simmons
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#ifndef HOSTCHECK_HPP
+#define HOSTCHECK_HPP
+
+#include <cmath>
+#include <cstdio>
+
+/**
+ * @brief Minimal checks for the host side tests, which build without wxWidgets or OpenCL
+ *
+ * A failed check is reported with its file and line and the test carries on, so one run shows every failure.
+ * Each test's main returns HostCheck::Result(), which ctest takes as the outcome.
+ */
+namespace HostCheck
+{
+  inline int failures = 0;
+
+  inline void Check(bool passed, const char *condition, const char *file, int line)
+  {
+    if (!passed)
+    {
+      fprintf(stderr, "%s:%d: check failed: %s\n", file, line, condition);
+      failures++;
+    }
+  }
+
+  inline void CheckNear(double actual, double expected, double tolerance, const char *expression, const char *file, int line)
+  {
+    if (!(fabs(actual - expected) <= tolerance))
+    {
+      fprintf(stderr, "%s:%d: check failed: %s is %.17g, expected %.17g within %g\n", file, line, expression, actual, expected, tolerance);
+      failures++;
+    }
+  }
+
+  inline int Result()
+  {
+    if (failures > 0)
+    {
+      fprintf(stderr, "%d checks failed\n", failures);
+    }
+    return failures > 0 ? 1 : 0;
+  }
+} // namespace HostCheck
+
+#define CHECK(condition) HostCheck::Check((condition), #condition, __FILE__, __LINE__)
+#define CHECK_NEAR(actual, expected, tolerance) HostCheck::CheckNear((actual), (expected), (tolerance), #actual, __FILE__, __LINE__)
+
+#endif // HOSTCHECK_HPP
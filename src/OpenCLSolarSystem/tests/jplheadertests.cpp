@@ -0,0 +1,194 @@
+/*
+  Copyright 2013-2025 Michael William Simmons
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#include "hostcheck.hpp"
+#include "jplheader.hpp"
+
+#include <vector>
+
+// Pointer table shared by DE405 and DE430, Mercury to the Sun, then nutations and librations
+static const int pointerTable[13][3] = {{3, 14, 4},  {171, 10, 2}, {231, 13, 2}, {309, 11, 1}, {342, 8, 1},  {366, 7, 1}, {387, 6, 1},
+                                        {405, 6, 1}, {423, 6, 1},  {441, 13, 8}, {753, 11, 2}, {819, 10, 4}, {899, 10, 4}};
+
+// Writes value at offset in the given byte order
+template <typename T> static void Put(std::vector<unsigned char> &bytes, size_t offset, T value, bool swap)
+{
+  JplHeader::Swap(&value, sizeof(T), swap);
+  memcpy(bytes.data() + offset, &value, sizeof(T));
+}
+
+// The start of a binary DE file, through the pointers of any later items
+static std::vector<unsigned char> File(int numde, int ncon, const int extra[2][3], bool swap)
+{
+  std::vector<unsigned char> bytes(JPL_HEADER_SIZE + (ncon > 400 ? ncon - 400 : 0) * 6 + JPL_EXTRA_SIZE, ' ');
+  Put(bytes, JPL_START_OFFSET, 2305424.5, swap);
+  Put(bytes, JPL_START_OFFSET + 8, 2525008.5, swap);
+  Put(bytes, JPL_START_OFFSET + 16, 32.0, swap);
+  Put(bytes, JPL_NCON_OFFSET, ncon, swap);
+  Put(bytes, JPL_EMRAT_OFFSET - 8, 149597870.7, swap);
+  Put(bytes, JPL_EMRAT_OFFSET, 81.30056907419062, swap);
+  for (int item = 0; item < 12; item++)
+  {
+    for (int i = 0; i < 3; i++)
+    {
+      Put(bytes, JPL_IPT_OFFSET + (item * 3 + i) * sizeof(int), pointerTable[item][i], swap);
+    }
+  }
+  Put(bytes, JPL_NUMDE_OFFSET, numde, swap);
+  for (int i = 0; i < 3; i++)
+  {
+    Put(bytes, JPL_LPT_OFFSET + i * sizeof(int), pointerTable[12][i], swap);
+  }
+
+  size_t extraOffset = bytes.size() - JPL_EXTRA_SIZE;
+  for (int item = 0; item < 2; item++)
+  {
+    for (int i = 0; i < 3; i++)
+    {
+      Put(bytes, extraOffset + (item * 3 + i) * sizeof(int), extra[item][i], swap);
+    }
+  }
+  return bytes;
+}
+
+static void CheckParsed(const JplHeader::Header &header, int numde, int ncon)
+{
+  CHECK(header.numde == numde);
+  CHECK(header.ncon == ncon);
+  CHECK_NEAR(header.startJulianDate, 2305424.5, 0.0);
+  CHECK_NEAR(header.endJulianDate, 2525008.5, 0.0);
+  CHECK_NEAR(header.intervalDays, 32.0, 0.0);
+  CHECK_NEAR(header.earthMoonRatio, 81.30056907419062, 0.0);
+  for (int item = 0; item < 12; item++)
+  {
+    for (int i = 0; i < 3; i++)
+    {
+      CHECK(header.ipt[item][i] == pointerTable[item][i]);
+    }
+  }
+  for (int i = 0; i < 3; i++)
+  {
+    CHECK(header.lpt[i] == pointerTable[12][i]);
+  }
+
+  // Librations end the record, 899 - 1 + 10 * 4 * 3
+  CHECK(header.lastCoefficient == 1018);
+}
+
+// Fewer than 400 constants and no later items, in both byte orders
+static void De405()
+{
+  const int none[2][3] = {{0, 0, 0}, {0, 0, 0}};
+  for (int swap = 0; swap < 2; swap++)
+  {
+    std::vector<unsigned char> bytes = File(405, 156, none, swap == 1);
+    JplHeader::Header header;
+    CHECK(JplHeader::Parse(bytes.data(), &header));
+    CHECK(header.swapBytes == (swap == 1));
+    CheckParsed(header, 405, 156);
+    CHECK(JplHeader::ExtraOffset(header) == JPL_HEADER_SIZE);
+
+    int candidates[2];
+    JplHeader::RecordCandidates(header, bytes.data() + JplHeader::ExtraOffset(header), candidates);
+    CHECK(candidates[0] == 1018 && candidates[1] == 1018);
+  }
+}
+
+// More than 400 constants push the later items' pointers back, and they lengthen the second candidate
+static void LaterItems()
+{
+  const int extra[2][3] = {{1019, 10, 8}, {1259, 13, 1}};
+  for (int swap = 0; swap < 2; swap++)
+  {
+    std::vector<unsigned char> bytes = File(430, 572, extra, swap == 1);
+    JplHeader::Header header;
+    CHECK(JplHeader::Parse(bytes.data(), &header));
+    CHECK(header.swapBytes == (swap == 1));
+    CheckParsed(header, 430, 572);
+    CHECK(JplHeader::ExtraOffset(header) == JPL_HEADER_SIZE + 172 * 6);
+
+    int candidates[2];
+    JplHeader::RecordCandidates(header, bytes.data() + JplHeader::ExtraOffset(header), candidates);
+    CHECK(candidates[0] == 1018);
+    CHECK(candidates[1] == 1258 + 13 * 3);
+
+    // A file too short to hold them has only the one length
+    JplHeader::RecordCandidates(header, NULL, candidates);
+    CHECK(candidates[0] == 1018 && candidates[1] == 1018);
+  }
+}
+
+// Without librations the record ends at the nutations, which have two components, 819 - 1 + 10 * 4 * 2
+static void NoLibrations()
+{
+  const int none[2][3] = {{0, 0, 0}, {0, 0, 0}};
+  std::vector<unsigned char> bytes = File(200, 100, none, true);
+  for (int i = 0; i < 3; i++)
+  {
+    Put(bytes, JPL_LPT_OFFSET + i * sizeof(int), 0, true);
+  }
+
+  JplHeader::Header header;
+  CHECK(JplHeader::Parse(bytes.data(), &header));
+  CHECK(header.lastCoefficient == 898);
+}
+
+// Text where the later pointers would be, or implausible sizes, are not taken as items
+static void ImplausibleLaterItems()
+{
+  const int extra[2][3] = {{0x20202020, 0x20202020, 0x20202020}, {1019, 100000, 1}};
+  std::vector<unsigned char> bytes = File(440, 645, extra, false);
+  JplHeader::Header header;
+  CHECK(JplHeader::Parse(bytes.data(), &header));
+  int candidates[2];
+  JplHeader::RecordCandidates(header, bytes.data() + JplHeader::ExtraOffset(header), candidates);
+  CHECK(candidates[1] == 1018);
+}
+
+// Headers that aren't from an ephemeris are refused
+static void NotAnEphemeris()
+{
+  const int none[2][3] = {{0, 0, 0}, {0, 0, 0}};
+  JplHeader::Header header;
+  std::vector<unsigned char> bytes(JPL_HEADER_SIZE, 0);
+  CHECK(!JplHeader::Parse(bytes.data(), &header));
+
+  bytes = File(405, 156, none, false);
+  Put(bytes, JPL_START_OFFSET + 16, 0.0, false);
+  CHECK(!JplHeader::Parse(bytes.data(), &header));
+
+  bytes = File(405, 156, none, false);
+  Put(bytes, JPL_START_OFFSET + 8, 2305424.5, false);
+  CHECK(!JplHeader::Parse(bytes.data(), &header));
+
+  bytes = File(405, 156, none, false);
+  Put(bytes, JPL_EMRAT_OFFSET, -1.0, false);
+  CHECK(!JplHeader::Parse(bytes.data(), &header));
+
+  // Swapped, a DE number over 10000 stays out of range
+  bytes = File(405, 156, none, false);
+  Put(bytes, JPL_NUMDE_OFFSET, 20000, false);
+  CHECK(!JplHeader::Parse(bytes.data(), &header));
+}
+
+int main()
+{
+  De405();
+  LaterItems();
+  NoLibrations();
+  ImplausibleLaterItems();
+  NotAnEphemeris();
+  return HostCheck::Result();
+}
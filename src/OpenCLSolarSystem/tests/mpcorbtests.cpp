@@ -0,0 +1,116 @@
+/*
+  Copyright 2013-2025 Michael William Simmons
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#include "hostcheck.hpp"
+#include "mpcorb.hpp"
+
+// Writes text into line at a column counted from 0, padding with spaces
+static void Put(std::string &line, size_t column, const std::string &text)
+{
+  if (line.size() < column + text.size())
+  {
+    line.resize(column + text.size(), ' ');
+  }
+  line.replace(column, text.size(), text);
+}
+
+// A catalog line laid out as the Minor Planet Center exports it, the readable designation's number right aligned before the name
+static std::string CatalogLine(const std::string &epoch, const std::string &meanAnomaly, const std::string &eccentricity, char uncertainty,
+                               const std::string &readableDesignation)
+{
+  std::string line;
+  Put(line, 0, "00001");
+  Put(line, 8, " 3.34");
+  Put(line, 14, " 0.15");
+  Put(line, 20, epoch);
+  Put(line, 26, meanAnomaly);
+  Put(line, 37, " 73.27343");
+  Put(line, 48, " 80.25221");
+  Put(line, 59, " 10.58780");
+  Put(line, 70, eccentricity);
+  Put(line, 80, " 0.21424651");
+  Put(line, 92, "  2.7660512");
+  Put(line, 105, std::string(1, uncertainty));
+  Put(line, 107, "MPO940186  7330 125 1801-2025 0.80 M-v 30k MPCLINUX");
+  Put(line, 161, "0803");
+  Put(line, 166, readableDesignation);
+  Put(line, 194, "20250218");
+  return line;
+}
+
+static void NumberedAsteroid()
+{
+  MpcOrb::Elements elements;
+  std::string line = CatalogLine("K2555", "188.70269", "0.0794013", '0', "     (1) Ceres");
+  CHECK(MpcOrb::ParseLine(line, &elements) == MpcOrb::Parsed);
+  CHECK(elements.uncertainty == '0');
+  CHECK(elements.epochYear == 2025 && elements.epochMonth == 5 && elements.epochDay == 5);
+  CHECK_NEAR(elements.absoluteMagnitude, 3.34, 1e-12);
+  CHECK_NEAR(elements.meanAnomaly, 188.70269, 1e-12);
+  CHECK_NEAR(elements.argumentOfPerihelion, 73.27343, 1e-12);
+  CHECK_NEAR(elements.longitudeOfAscendingNode, 80.25221, 1e-12);
+  CHECK_NEAR(elements.inclination, 10.58780, 1e-12);
+  CHECK_NEAR(elements.eccentricity, 0.0794013, 1e-12);
+  CHECK_NEAR(elements.semiMajorAxis, 2.7660512, 1e-12);
+  CHECK(elements.typeCode == 0x803);
+
+  // The date of the last observation after the designation is not part of it
+  CHECK(elements.designation == "(1)Ceres");
+  CHECK(elements.readableName == "Ceres");
+}
+
+static void ProvisionalDesignation()
+{
+  MpcOrb::Elements elements;
+  std::string line = CatalogLine("J99AV", " 12.5", "0.25", '9', "         2001 AB123");
+  CHECK(MpcOrb::ParseLine(line, &elements) == MpcOrb::Parsed);
+  CHECK(elements.epochYear == 1999 && elements.epochMonth == 10 && elements.epochDay == 31);
+  CHECK(elements.designation == "2001AB123");
+  CHECK(elements.readableName == "2001AB123");
+
+  // Without a readable designation the packed one is used
+  line = CatalogLine("K2555", "188.70269", "0.0794013", '0', "");
+  line.resize(166);
+  CHECK(MpcOrb::ParseLine(line, &elements) == MpcOrb::Parsed);
+  CHECK(elements.designation == "00001");
+  CHECK(elements.readableName.empty());
+}
+
+static void RejectedLines()
+{
+  MpcOrb::Elements elements;
+  CHECK(MpcOrb::ParseLine(CatalogLine("K2555", "188.70269", "0.0794013", 'E', "(1) Ceres"), &elements) == MpcOrb::Skipped);
+  CHECK(MpcOrb::ParseLine(CatalogLine("K2555", "188.70269", "0.0794013", '0', "(1) Ceres").substr(0, 100), &elements) == MpcOrb::Skipped);
+  CHECK(MpcOrb::ParseLine(CatalogLine("X2555", "188.70269", "0.0794013", '0', "(1) Ceres"), &elements) == MpcOrb::BadEpoch);
+  CHECK(MpcOrb::ParseLine(CatalogLine("K2555", "", "0.0794013", '0', "(1) Ceres"), &elements) == MpcOrb::BadElements);
+  CHECK(MpcOrb::ParseLine(CatalogLine("K2555", "188.7O269", "0.0794013", '0', "(1) Ceres"), &elements) == MpcOrb::BadElements);
+  CHECK(MpcOrb::ParseLine(CatalogLine("K2555", "188.70269", "1.2000000", '0', "(1) Ceres"), &elements) == MpcOrb::Unbound);
+
+  // A missing magnitude or type code falls back rather than rejecting the line
+  std::string line = CatalogLine("K2555", "188.70269", "0.0794013", '0', "     (1) Ceres");
+  Put(line, 8, "     ");
+  Put(line, 161, "    ");
+  CHECK(MpcOrb::ParseLine(line, &elements) == MpcOrb::Parsed);
+  CHECK_NEAR(elements.absoluteMagnitude, 20.0, 0.0);
+  CHECK(elements.typeCode == 0);
+}
+
+int main()
+{
+  NumberedAsteroid();
+  ProvisionalDesignation();
+  RejectedLines();
+  return HostCheck::Result();
+}
@@ -0,0 +1,452 @@
+/*
+  Copyright 2013-2025 Michael William Simmons
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#include "global.hpp"
+#include "trajectoryarchive.hpp"
+#include "archivecodec.hpp"
+
+TrajectoryArchive::TrajectoryArchive()
+{
+  this->file = NULL;
+  this->writing = false;
+  this->header.numParticles = 0;
+  this->header.blockSize = CLModel::archiveBlockSize;
+  this->header.quantum = 0.0;
+  this->framesSinceKeyframe = 0;
+  this->bytesWritten = 0;
+  this->keyframeInterval = 64;
+  this->verifyFrames = false;
+  this->blocks = NULL;
+  this->blockWords = NULL;
+  this->blockOffsets = NULL;
+  this->numFrames = 0;
+  this->frameCapacity = 0;
+  this->frameOffsets = NULL;
+  this->frameDates = NULL;
+  this->frameOrders = NULL;
+}
+
+TrajectoryArchive::~TrajectoryArchive()
+{
+  this->Close();
+}
+
+void TrajectoryArchive::DeAllocate()
+{
+  delete[] this->blocks;
+  this->blocks = NULL;
+  delete[] this->blockWords;
+  this->blockWords = NULL;
+  delete[] this->blockOffsets;
+  this->blockOffsets = NULL;
+  delete[] this->frameOffsets;
+  this->frameOffsets = NULL;
+  delete[] this->frameDates;
+  this->frameDates = NULL;
+  delete[] this->frameOrders;
+  this->frameOrders = NULL;
+  this->numFrames = 0;
+  this->frameCapacity = 0;
+}
+
+// Appends a frame to the index, doubling its size when it is full
+void TrajectoryArchive::AddToIndex(wxFileOffset offset, double julianDate, int predictionOrder)
+{
+  if (this->numFrames == this->frameCapacity)
+  {
+    int capacity = this->frameCapacity > 0 ? 2 * this->frameCapacity : 64;
+    wxFileOffset *offsets = new wxFileOffset[capacity];
+    double *dates = new double[capacity];
+    int *orders = new int[capacity];
+    if (this->numFrames > 0)
+    {
+      memcpy(offsets, this->frameOffsets, this->numFrames * sizeof(wxFileOffset));
+      memcpy(dates, this->frameDates, this->numFrames * sizeof(double));
+      memcpy(orders, this->frameOrders, this->numFrames * sizeof(int));
+    }
+    delete[] this->frameOffsets;
+    delete[] this->frameDates;
+    delete[] this->frameOrders;
+    this->frameOffsets = offsets;
+    this->frameDates = dates;
+    this->frameOrders = orders;
+    this->frameCapacity = capacity;
+  }
+
+  this->frameOffsets[this->numFrames] = offset;
+  this->frameDates[this->numFrames] = julianDate;
+  this->frameOrders[this->numFrames] = predictionOrder;
+  this->numFrames++;
+}
+
+bool TrajectoryArchive::Create(wxString fileName, int numParticles, double errorBound)
+{
+  this->Close();
+  if (errorBound <= 0.0)
+  {
+    wxLogError(wxT("Archive error bound must be positive"));
+    return false;
+  }
+
+  // Reopened for reading as well, so frames can be decoded to verify them as they are written
+  this->file = new wxFile();
+  if (!this->file->Create(fileName, true) || !this->file->Close() || !this->file->Open(fileName, wxFile::read_write))
+  {
+    wxLogError(wxT("Unable to create archive %s"), fileName);
+    delete this->file;
+    this->file = NULL;
+    return false;
+  }
+
+  this->writing = true;
+  this->header.numParticles = numParticles;
+  this->header.blockSize = CLModel::archiveBlockSize;
+  this->header.quantum = 2.0 * errorBound;
+  if (this->file->Write(&this->header, sizeof(this->header)) != sizeof(this->header))
+  {
+    wxLogError(wxT("Unable to write the header of archive %s"), fileName);
+    this->Close();
+    return false;
+  }
+  this->bytesWritten = sizeof(this->header);
+  this->framesSinceKeyframe = 0;
+  this->numFrames = 0;
+
+  int numBlocks = (numParticles + CLModel::archiveBlockSize - 1) / CLModel::archiveBlockSize;
+  this->blocks = new cl_ulong[(size_t)numBlocks * CLModel::archiveBlockWords];
+  this->blockWords = new cl_uint[numBlocks];
+  this->blockOffsets = new cl_uint[numBlocks + 1];
+  return true;
+}
+
+bool TrajectoryArchive::WriteFrame(CLModel *clModel)
+{
+  if (this->file == NULL || !this->writing)
+  {
+    return false;
+  }
+
+  if (clModel->GetNumParticles() != this->header.numParticles)
+  {
+    wxLogError(wxT("Archive has %d bodies but the simulation has %d"), this->header.numParticles, clModel->GetNumParticles());
+    return false;
+  }
+
+  bool success = false;
+  try
+  {
+    ArchiveFrameHeader frameHeader;
+    cl_int predictionOrder = 0;
+    if (this->numFrames > 0 && this->framesSinceKeyframe < this->keyframeInterval)
+    {
+      predictionOrder = this->framesSinceKeyframe + 1 < 3 ? this->framesSinceKeyframe + 1 : 3;
+    }
+
+    frameHeader.predictionOrder = clModel->ArchiveEncode(this->header.quantum, predictionOrder, this->blocks, this->blockWords);
+    frameHeader.julianDate = clModel->julianDate + clModel->time / (60 * 60 * 24);
+    frameHeader.numBlocks = clModel->ArchiveNumBlocks();
+
+    // Squeeze out the unused words at the end of each block
+    cl_uint offset = 0;
+    for (int block = 0; block < frameHeader.numBlocks; block++)
+    {
+      this->blockOffsets[block] = offset;
+      if (offset != (cl_uint)block * CLModel::archiveBlockWords)
+      {
+        memmove(this->blocks + offset, this->blocks + (size_t)block * CLModel::archiveBlockWords, this->blockWords[block] * sizeof(cl_ulong));
+      }
+      offset += this->blockWords[block];
+    }
+    this->blockOffsets[frameHeader.numBlocks] = offset;
+    frameHeader.numWords = offset;
+
+    size_t offsetsSize = (frameHeader.numBlocks + 1) * sizeof(cl_uint);
+    size_t wordsSize = offset * sizeof(cl_ulong);
+    wxFileOffset framePosition = this->file->Tell();
+    if (framePosition == wxInvalidOffset || this->file->Write(&frameHeader, sizeof(frameHeader)) != sizeof(frameHeader) || this->file->Write(this->blockOffsets, offsetsSize) != offsetsSize || this->file->Write(this->blocks, wordsSize) != wordsSize)
+    {
+      wxLogError(wxT("TrajectoryArchive::WriteFrame write failed"));
+      throw -1;
+    }
+
+    this->bytesWritten += sizeof(frameHeader) + offsetsSize + wordsSize;
+    this->framesSinceKeyframe = frameHeader.predictionOrder == 0 ? 0 : this->framesSinceKeyframe + 1;
+    this->AddToIndex(framePosition, frameHeader.julianDate, frameHeader.predictionOrder);
+    wxLogDebug(wxT("Archived frame %d order %d %lu bytes"), this->numFrames, frameHeader.predictionOrder, (unsigned long)(sizeof(frameHeader) + offsetsSize + wordsSize));
+    success = true;
+  }
+  catch (int ex)
+  {
+    wxLogError(wxT("TrajectoryArchive::WriteFrame failed %d"), ex);
+    success = false;
+  }
+
+  if (success && this->verifyFrames)
+  {
+    success = this->VerifyFrame(clModel);
+  }
+
+  return success;
+}
+
+// Decodes the frame just written back from the file, from the nearest keyframe as any reader would,
+// and checks every coordinate is within the error bound, half the quantum, of the positions that were encoded
+bool TrajectoryArchive::VerifyFrame(CLModel *clModel)
+{
+  int numParticles = this->header.numParticles;
+  cl_double4 *decoded = new cl_double4[numParticles];
+  cl_double4 *positions = new cl_double4[numParticles];
+  cl_double4 *velocities = new cl_double4[numParticles];
+  bool success = false;
+  double worstError = 0.0;
+  int worstBody = 0;
+
+  if (this->ReadPositions(this->numFrames - 1, 0, numParticles, decoded))
+  {
+    try
+    {
+      clModel->ReadToInitialState(positions, velocities);
+      success = true;
+      for (int body = 0; body < numParticles; body++)
+      {
+        for (int axis = 0; axis < 3; axis++)
+        {
+          double error = fabs(decoded[body].s[axis] - positions[body].s[axis]);
+          double tolerance = 0.5 * this->header.quantum + 1e-15 * fabs(positions[body].s[axis]);
+          if (error > worstError)
+          {
+            worstError = error;
+            worstBody = body;
+          }
+          success = success && error <= tolerance;
+        }
+      }
+    }
+    catch (int)
+    {
+      success = false;
+    }
+  }
+
+  if (!success)
+  {
+    wxLogError(wxT("Archive frame %d doesn't decode to the positions encoded, %g Gm out at body %d with a bound of %g Gm"), this->numFrames, worstError, worstBody,
+               0.5 * this->header.quantum);
+  }
+
+  delete[] decoded;
+  delete[] positions;
+  delete[] velocities;
+  return success;
+}
+
+bool TrajectoryArchive::Open(wxString fileName)
+{
+  this->Close();
+  this->file = new wxFile();
+  if (!this->file->Open(fileName) || this->file->Read(&this->header, sizeof(this->header)) != sizeof(this->header) || this->header.blockSize != CLModel::archiveBlockSize)
+  {
+    wxLogError(wxT("Unable to open archive %s"), fileName);
+    delete this->file;
+    this->file = NULL;
+    return false;
+  }
+  this->writing = false;
+
+  // Index the frames
+  wxFileOffset length = this->file->Length();
+  wxFileOffset position = sizeof(this->header);
+  ArchiveFrameHeader frameHeader;
+  this->file->Seek(position);
+  while (this->file->Read(&frameHeader, sizeof(frameHeader)) == sizeof(frameHeader))
+  {
+    wxFileOffset next = position + sizeof(frameHeader) + (frameHeader.numBlocks + 1) * sizeof(cl_uint) + frameHeader.numWords * sizeof(cl_ulong);
+    if (next > length)
+    {
+      break;
+    }
+
+    this->AddToIndex(position, frameHeader.julianDate, frameHeader.predictionOrder);
+    position = next;
+    this->file->Seek(position);
+  }
+
+  return true;
+}
+
+void TrajectoryArchive::Close()
+{
+  if (this->file != NULL)
+  {
+    if (this->writing && this->numFrames > 0)
+    {
+      double rawBytes = (double)this->numFrames * this->header.numParticles * 3 * sizeof(cl_double);
+      wxLogMessage(wxT("Archived %d frames in %llu bytes, %.1f%% of raw positions"), this->numFrames, (unsigned long long)this->bytesWritten, 100.0 * this->bytesWritten / rawBytes);
+    }
+    this->file->Close();
+    delete this->file;
+    this->file = NULL;
+  }
+  this->writing = false;
+  this->DeAllocate();
+}
+
+bool TrajectoryArchive::IsOpen()
+{
+  return this->file != NULL;
+}
+
+int TrajectoryArchive::NumFrames()
+{
+  return this->numFrames;
+}
+
+int TrajectoryArchive::NumParticles()
+{
+  return this->header.numParticles;
+}
+
+double TrajectoryArchive::FrameJulianDate(int frame)
+{
+  return this->frameDates[frame];
+}
+
+// Binary search of the frame index.
+// Works for archives recorded running backwards in time as well
+int TrajectoryArchive::FindFrame(double julianDate)
+{
+  if (this->numFrames == 0)
+  {
+    return -1;
+  }
+
+  bool forwards = this->frameDates[this->numFrames - 1] >= this->frameDates[0];
+  int low = 0;
+  int high = this->numFrames - 1;
+  int found = -1;
+  while (low <= high)
+  {
+    int middle = (low + high) / 2;
+    bool atOrBefore = forwards ? this->frameDates[middle] <= julianDate : this->frameDates[middle] >= julianDate;
+    if (atOrBefore)
+    {
+      found = middle;
+      low = middle + 1;
+    }
+    else
+    {
+      high = middle - 1;
+    }
+  }
+  return found;
+}
+
+bool TrajectoryArchive::ReadPositions(int frame, int firstBody, int numBodies, cl_double4 *positions)
+{
+  if (this->file == NULL || frame < 0 || frame >= this->numFrames || firstBody < 0 || numBodies <= 0 || firstBody + numBodies > this->header.numParticles)
+  {
+    return false;
+  }
+
+  // Go back to the keyframe
+  int keyframe = frame;
+  while (keyframe > 0 && this->frameOrders[keyframe] != 0)
+  {
+    keyframe--;
+  }
+
+  int firstBlock = firstBody / CLModel::archiveBlockSize;
+  int lastBlock = (firstBody + numBodies - 1) / CLModel::archiveBlockSize;
+  int numBlocks = lastBlock - firstBlock + 1;
+  int firstInRange = firstBlock * CLModel::archiveBlockSize;
+  int numInRange = numBlocks * CLModel::archiveBlockSize;
+
+  // Quantised positions of the last three decoded frames for the bodies in range, newest first
+  cl_long *history = new cl_long[(size_t)3 * numInRange * 3]();
+  cl_uint *offsets = new cl_uint[numBlocks + 1];
+  cl_ulong *words = NULL;
+  cl_ulong wordsCapacity = 0;
+  bool success = true;
+
+  try
+  {
+    for (int current = keyframe; current <= frame; current++)
+    {
+      ArchiveFrameHeader frameHeader;
+      this->file->Seek(this->frameOffsets[current]);
+      if (this->file->Read(&frameHeader, sizeof(frameHeader)) != (ssize_t)sizeof(frameHeader) || frameHeader.numBlocks < firstBlock + numBlocks)
+      {
+        throw -1;
+      }
+
+      // Only read the offsets and words for the blocks wanted
+      wxFileOffset offsetsPosition = this->frameOffsets[current] + sizeof(frameHeader);
+      this->file->Seek(offsetsPosition + firstBlock * sizeof(cl_uint));
+      if (this->file->Read(offsets, (numBlocks + 1) * sizeof(cl_uint)) != (ssize_t)((numBlocks + 1) * sizeof(cl_uint)))
+      {
+        throw -1;
+      }
+
+      cl_ulong numWords = offsets[numBlocks] - offsets[0];
+      if (numWords > wordsCapacity)
+      {
+        delete[] words;
+        wordsCapacity = numWords;
+        words = new cl_ulong[wordsCapacity];
+      }
+
+      wxFileOffset wordsPosition = offsetsPosition + (frameHeader.numBlocks + 1) * sizeof(cl_uint);
+      this->file->Seek(wordsPosition + offsets[0] * sizeof(cl_ulong));
+      if (this->file->Read(words, numWords * sizeof(cl_ulong)) != (ssize_t)(numWords * sizeof(cl_ulong)))
+      {
+        throw -1;
+      }
+
+      for (int block = 0; block < numBlocks; block++)
+      {
+        int blockFirst = (firstBlock + block) * CLModel::archiveBlockSize;
+        int blockLast = blockFirst + CLModel::archiveBlockSize < this->header.numParticles ? blockFirst + CLModel::archiveBlockSize : this->header.numParticles;
+        ArchiveCodec::DecodeBlock((const std::uint64_t *)words + (offsets[block] - offsets[0]), offsets[block + 1] - offsets[block], blockLast - blockFirst,
+                                  frameHeader.predictionOrder, (std::int64_t *)history + (size_t)(blockFirst - firstInRange) * 9);
+      }
+    }
+
+    for (int body = 0; body < numBodies; body++)
+    {
+      cl_long *q = history + (size_t)(firstBody + body - firstInRange) * 9;
+      positions[body].s[0] = q[0] * this->header.quantum;
+      positions[body].s[1] = q[1] * this->header.quantum;
+      positions[body].s[2] = q[2] * this->header.quantum;
+      positions[body].s[3] = 0.0;
+    }
+  }
+  catch (int ex)
+  {
+    wxLogError(wxT("TrajectoryArchive::ReadPositions archive is corrupt at frame %d"), frame);
+    success = false;
+  }
+
+  // Frames being written carry on at the end
+  if (this->writing && this->file->SeekEnd() == wxInvalidOffset)
+  {
+    wxLogError(wxT("TrajectoryArchive::ReadPositions failed to return to the end of the archive"));
+    success = false;
+  }
+
+  delete[] words;
+  delete[] offsets;
+  delete[] history;
+  return success;
+}
@@ -0,0 +1,130 @@
+/*
+  Copyright 2013-2025 Michael William Simmons
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#ifndef TRAJECTORYARCHIVE_HPP
+#define TRAJECTORYARCHIVE_HPP
+
+#ifndef CLMODEL_H
+#include "clmodel.hpp"
+#endif // #ifndef CLMODEL_H
+
+/**
+ * @brief Header at the start of a trajectory archive file
+ */
+struct ArchiveFileHeader
+{
+  cl_int numParticles; /**< Number of bodies in every frame */
+  cl_int blockSize;    /**< Bodies per independently decodable block */
+  cl_double quantum;   /**< Grid spacing in Gm, twice the error bound */
+};
+
+/**
+ * @brief Header in front of every frame
+ * It is followed by numBlocks + 1 cl_uint word offsets and then numWords cl_ulong words of packed residuals
+ */
+struct ArchiveFrameHeader
+{
+  cl_double julianDate;   /**< Julian date of the snapshot */
+  cl_int predictionOrder; /**< Number of previous frames extrapolated from, 0 for a keyframe */
+  cl_int numBlocks;       /**< Number of blocks of bodies */
+  cl_ulong numWords;      /**< Number of packed words */
+};
+
+/**
+ * @brief Compressed archive of position snapshots
+ *
+ * Positions are quantised onto a grid of spacing twice the error bound.
+ * Each frame stores the difference between the quantised position and an extrapolation
+ * of up to three earlier frames, zigzag encoded and bit packed in blocks of bodies, on the device.
+ * For bodies on smooth orbits these residuals need only a few bits.
+ *
+ * Frames are indexed by time, and per block offsets let a range of bodies be decoded
+ * without touching the rest. Decoding starts from the nearest keyframe at or before the requested frame.
+ */
+class TrajectoryArchive
+{
+public:
+  TrajectoryArchive();
+  ~TrajectoryArchive();
+
+  /**
+   * @brief Creates a new archive for writing
+   * @param fileName File to create, it is overwritten if it exists
+   * @param numParticles Number of bodies per frame
+   * @param errorBound Maximum position error in Gm
+   * @return true on success
+   */
+  bool Create(wxString fileName, int numParticles, double errorBound);
+
+  /**
+   * @brief Encodes the current positions and appends them as a frame
+   * @param clModel Model to encode, must have the same number of bodies as the archive
+   * @return true on success
+   */
+  bool WriteFrame(CLModel *clModel);
+
+  /**
+   * @brief Opens an existing archive and builds the frame index
+   * @param fileName Archive to read
+   * @return true on success
+   */
+  bool Open(wxString fileName);
+
+  void Close();  /**< Closes the archive, logging the compression achieved if writing */
+  bool IsOpen(); /**< true if an archive is open */
+
+  int NumFrames();                   /**< Number of frames in an archive opened for reading */
+  int NumParticles();                /**< Number of bodies in each frame */
+  double FrameJulianDate(int frame); /**< Julian date of a frame */
+  int FindFrame(double julianDate);  /**< Last frame at or before julianDate, -1 if none */
+
+  /**
+   * @brief Decodes the positions of a range of bodies, from an archive being read or written
+   * @param frame Frame index
+   * @param firstBody First body to return
+   * @param numBodies Number of bodies to return
+   * @param positions Receives numBodies positions in Gm, w is set to 0
+   * @return true on success
+   */
+  bool ReadPositions(int frame, int firstBody, int numBodies, cl_double4 *positions);
+
+  int keyframeInterval; /**< Frames between keyframes */
+  bool verifyFrames;    /**< Decodes each frame after writing it and checks it against the positions encoded */
+
+private:
+  wxFile *file;             /**< Open archive or NULL */
+  bool writing;             /**< Open for writing rather than reading */
+  ArchiveFileHeader header; /**< Header of the open archive */
+  int framesSinceKeyframe;  /**< Frames written since the last keyframe */
+  cl_ulong bytesWritten;    /**< Bytes written, for the compression ratio */
+
+  // Writing buffers
+  cl_ulong *blocks;      /**< [numBlocks][archiveBlockWords] encoded blocks read back from the device */
+  cl_uint *blockWords;   /**< [numBlocks] words used by each block */
+  cl_uint *blockOffsets; /**< [numBlocks + 1] word offsets of each block in the frame */
+
+  // Frame index, kept as frames are written too so they can be verified
+  int numFrames;              /**< Number of frames */
+  int frameCapacity;          /**< Frames the index has room for */
+  wxFileOffset *frameOffsets; /**< [numFrames] file offset of each frame header */
+  double *frameDates;         /**< [numFrames] Julian date of each frame */
+  int *frameOrders;           /**< [numFrames] prediction order of each frame */
+
+  void DeAllocate();
+  void AddToIndex(wxFileOffset offset, double julianDate, int predictionOrder);
+  bool VerifyFrame(CLModel *clModel);
+};
+
+#endif // TRAJECTORYARCHIVE_HPP